@@ -0,0 +1,353 @@
+/*
+ * Hot-path microbenchmarks: value decoding for every data type and format, the scheduler's due
+ * block selection, OPC UA node updates, history updates and reads, and logging. Every case runs a
+ * fixed number of iterations several times and reports the median time, its spread and the heap
+ * allocations per call as JSON.
+ */
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "logger.h"
+#include "opcua_server.h"
+#include "register_cache.h"
+#include "sma_format.h"
+
+#define BENCH_RUNS        5  // Timed runs per case; the median is reported
+#define BENCH_MAX_RESULTS 128
+
+/*
+ * @brief The result of one benchmark case.
+ */
+typedef struct {
+  char     name[64];
+  long     iterations;   // Per run
+  double   ns_per_op;    // Median over the runs
+  double   ns_spread;    // Spread of the inner runs relative to the median, the noise of the measurement
+  double   allocs_per_op;
+  unsigned items;        // Work items per call (tags scanned), 1 for single operations
+} bench_result_t;
+
+typedef void (*bench_fn_t)(void* context, long iteration);
+
+static bench_result_t   results[BENCH_MAX_RESULTS];
+static int              num_results = 0;
+static double           scale       = 1.0;  // Multiplies all iteration counts
+static _Atomic uint64_t allocations = 0;
+
+// Counts heap allocations of the whole process, including open62541's, by wrapping glibc's allocator
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+extern void  __libc_free(void* ptr);
+
+void* malloc(size_t size) {
+  atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+  return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+  atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+  return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+  atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+  return __libc_realloc(ptr, size);
+}
+
+void free(void* ptr) {
+  __libc_free(ptr);
+}
+
+static int64_t monotonic_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int compare_double(const void* a, const void* b) {
+  double x = *(const double*) a, y = *(const double*) b;
+  return (x > y) - (x < y);
+}
+
+// Runs fn iterations times per run, after one untimed warm-up run
+static void run_case(const char* name, long iterations, unsigned items, bench_fn_t fn, void* context) {
+  iterations = (long) (iterations * scale) > 0 ? (long) (iterations * scale) : 1;
+  double   ns[BENCH_RUNS];
+  uint64_t allocs = 0;
+  for (int run = -1; run < BENCH_RUNS; run++) {
+    uint64_t allocs_start = atomic_load_explicit(&allocations, memory_order_relaxed);
+    int64_t  start        = monotonic_ns();
+    for (long i = 0; i < iterations; i++) {
+      fn(context, i);
+    }
+    int64_t end = monotonic_ns();
+    if (run >= 0) {
+      ns[run] = (double) (end - start) / (double) iterations;
+      allocs += atomic_load_explicit(&allocations, memory_order_relaxed) - allocs_start;
+    }
+  }
+  qsort(ns, BENCH_RUNS, sizeof(double), compare_double);
+
+  if (num_results < BENCH_MAX_RESULTS) {
+    bench_result_t* result = &results[num_results++];
+    snprintf(result->name, sizeof(result->name), "%s", name);
+    result->iterations    = iterations;
+    result->ns_per_op     = ns[BENCH_RUNS / 2];
+    result->ns_spread     = ns[BENCH_RUNS / 2] > 0 ? (ns[BENCH_RUNS - 2] - ns[1]) / ns[BENCH_RUNS / 2] : 0;
+    result->allocs_per_op = (double) allocs / (double) (iterations * BENCH_RUNS);
+    result->items         = items;
+    fprintf(stderr, "%-40s %12.1f ns/op %8.2f allocs/op\n", name, result->ns_per_op, result->allocs_per_op);
+  }
+}
+
+// --- Decoding ---
+
+/*
+ * @brief A mapping to decode and registers holding a valid (non-NaN) value for it.
+ */
+typedef struct {
+  modbus_reg_mapping_t mapping;
+  uint16_t             regs[4];
+} decode_case_t;
+
+static void bench_decode(void* context, long iteration) {
+  decode_case_t* c = (decode_case_t*) context;
+  UA_Variant     value;
+  c->regs[3]       = (uint16_t) iteration;  // Keep the compiler from hoisting the decode
+  if (process_modbus_value_formatted(c->regs, &c->mapping, &value)) {
+    UA_Variant_clear(&value);
+  }
+}
+
+static void run_decode_cases(void) {
+  static const char*          data_types[] = {"U16", "S16", "U32", "S32", "U64"};
+  static const char*          formats[]    = {"FIX0", "FIX2", "ENUM", "FW", "DT", "TM", "Duration", "TEMP", "RAW"};
+  static enum_value_mapping_t enum_values[] = {{307, "Ok"}, {35, "Fault"}, {455, "Warning"}};
+  for (size_t t = 0; t < sizeof(data_types) / sizeof(data_types[0]); t++) {
+    for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+      decode_case_t c = {{"Bench", 30000, "bench", (char*) data_types[t], (char*) formats[f], 1.0f, 1000, 4, enum_values, 3},
+                         {0x0001, 0x0133, 0x0000, 0x0000}};
+      char          name[64];
+      snprintf(name, sizeof(name), "decode/%s/%s", data_types[t], formats[f]);
+      run_case(name, 200000, 1, bench_decode, &c);
+    }
+  }
+}
+
+// --- Scheduling ---
+
+/*
+ * @brief A read plan and the simulated clock driving it.
+ */
+typedef struct {
+  const modbus_opcua_config_t* config;
+  register_cache_t*            cache;
+  int*                         due_blocks;
+  int64_t                      now_ms;
+} schedule_case_t;
+
+static void bench_schedule(void* context, long iteration) {
+  schedule_case_t* c = (schedule_case_t*) context;
+  c->now_ms += 10;  // One acquisition cycle
+  int num_due  = register_cache_collect_due(c->cache, c->now_ms, c->due_blocks);
+  for (int d = 0; d < num_due; d++) {
+    register_cache_finish_block(c->cache, c->config, c->due_blocks[d], c->now_ms);
+  }
+}
+
+// Builds a config of num_tags U16 mappings with a mix of poll intervals; each gets its own block
+static modbus_opcua_config_t* make_tag_config(int num_tags) {
+  static const int       intervals[] = {1000, 2000, 5000, 10000, 60000};
+  modbus_opcua_config_t* config      = calloc(1, sizeof(modbus_opcua_config_t));
+  config->num_mappings               = num_tags;
+  config->mappings                   = calloc((size_t) num_tags, sizeof(modbus_reg_mapping_t));
+  for (int m = 0; m < num_tags; m++) {
+    char node_id[32];
+    snprintf(node_id, sizeof(node_id), "bench.tag_%d", m);
+    // Adjacent ranges are only coalesced with device capabilities; fc 3 and 4 double the address space
+    config->mappings[m] = (modbus_reg_mapping_t) {strdup(node_id), m % 65536, strdup(node_id), "U16", "FIX0", 1.0f,
+                                                  intervals[m % 5], m < 65536 ? 4 : 3, NULL, 0};
+  }
+  return config;
+}
+
+static void free_tag_config(modbus_opcua_config_t* config) {
+  for (int m = 0; m < config->num_mappings; m++) {
+    free(config->mappings[m].name);
+    free(config->mappings[m].opcua_node_id);
+  }
+  free(config->mappings);
+  free(config);
+}
+
+static void run_schedule_cases(void) {
+  static const int sizes[] = {10000, 50000, 100000};
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    modbus_opcua_config_t* config = make_tag_config(sizes[s]);
+    schedule_case_t        c      = {config, register_cache_create(config, NULL), NULL, 0};
+    if (!c.cache) {
+      fprintf(stderr, "bench_decode: cannot build the read plan for %d tags\n", sizes[s]);
+      free_tag_config(config);
+      continue;
+    }
+    c.due_blocks = calloc((size_t) c.cache->num_blocks, sizeof(int));
+    char name[64];
+    snprintf(name, sizeof(name), "schedule/collect_due/%d", sizes[s]);
+    run_case(name, 2000, (unsigned) c.cache->num_blocks, bench_schedule, &c);
+    free(c.due_blocks);
+    register_cache_free(c.cache);
+    free_tag_config(config);
+  }
+}
+
+// --- OPC UA node updates ---
+
+/*
+ * @brief A server with nodes for the mappings of config.
+ */
+typedef struct {
+  UA_Server*             server;
+  modbus_opcua_config_t* config;
+} node_case_t;
+
+static void bench_node_update(void* context, long iteration) {
+  node_case_t* c     = (node_case_t*) context;
+  UA_Float     value = (UA_Float) iteration;
+  UA_Variant   variant;
+  UA_Variant_setScalar(&variant, &value, &UA_TYPES[UA_TYPES_FLOAT]);
+  update_opcua_node_value_typed(c->server, &c->config->mappings[iteration % c->config->num_mappings], &variant);
+}
+
+static void run_node_cases(void) {
+  node_case_t c = {NULL, make_tag_config(1000)};
+  c.server      = opcua_server_init(c.config);  // Never started, so no port is opened
+  add_opcua_nodes(c.server, c.config);
+  run_case("opcua/update_node_value_typed", 50000, 1, bench_node_update, &c);
+  UA_Server_delete(c.server);
+  free_tag_config(c.config);
+}
+
+// --- History ---
+
+#define BENCH_HISTORY_NODES   10
+#define BENCH_HISTORY_ENTRIES 1000
+
+static void bench_history_update(void* context, long iteration) {
+  node_case_t* c     = (node_case_t*) context;
+  UA_Float     value = (UA_Float) iteration;
+  UA_Variant   variant;
+  UA_Variant_setScalar(&variant, &value, &UA_TYPES[UA_TYPES_FLOAT]);
+  opcua_update_history(c->server, (size_t) (iteration % BENCH_HISTORY_NODES), &variant);
+}
+
+static void bench_history_read(void* context, long iteration) {
+  node_case_t*              c       = (node_case_t*) context;
+  UA_NodeId                 node_id = UA_NODEID_STRING(1, c->config->mappings[iteration % BENCH_HISTORY_NODES].opcua_node_id);
+  UA_ReadRawModifiedDetails details;
+  UA_ReadRawModifiedDetails_init(&details);
+  details.startTime = 1;  // Set, and before every stored value
+  details.endTime   = UA_DateTime_now() + UA_DATETIME_SEC * 3600;
+  UA_HistoryData result;
+  UA_HistoryData_init(&result);
+  readHistoryData(c->server, NULL, NULL, &node_id, true, NULL, UA_TIMESTAMPSTORETURN_SOURCE, &details, NULL, NULL, &result);
+  UA_HistoryData_clear(&result);
+}
+
+static void run_history_cases(void) {
+  node_case_t c = {NULL, make_tag_config(BENCH_HISTORY_NODES)};
+  c.server      = opcua_server_init(c.config);
+  add_opcua_nodes(c.server, c.config);
+  opcua_init_history(BENCH_HISTORY_NODES);
+  for (int m = 0; m < BENCH_HISTORY_NODES; m++) {
+    opcua_add_history_node(c.server, (size_t) m, UA_NODEID_STRING(1, c.config->mappings[m].opcua_node_id), BENCH_HISTORY_ENTRIES);
+  }
+  // Updates run on full buffers, so each one replaces the oldest value; reads return every stored value
+  for (long i = 0; i < BENCH_HISTORY_NODES * BENCH_HISTORY_ENTRIES; i++) {
+    bench_history_update(&c, i);
+  }
+  run_case("history/update", 200000, 1, bench_history_update, &c);
+  run_case("history/read/1000", 2000, BENCH_HISTORY_ENTRIES, bench_history_read, &c);
+  opcua_cleanup_history();
+  UA_Server_delete(c.server);
+  free_tag_config(c.config);
+}
+
+// --- Logging ---
+
+static void bench_log(void* context, long iteration) {
+  log_message(*(log_level_t*) context, "Read '%s': %f (Poll Rate: %dms)", "Bench", (double) iteration, 1000);
+}
+
+static void run_log_cases(void) {
+  // The logger writes to /dev/null at INFO level
+  log_level_t enabled = LOG_LEVEL_INFO, disabled = LOG_LEVEL_DEBUG;
+  logger_set_level(LOG_LEVEL_INFO);
+  run_case("log/enabled", 100000, 1, bench_log, &enabled);
+  run_case("log/disabled", 10000000, 1, bench_log, &disabled);
+  logger_set_level(LOG_LEVEL_ERROR);
+}
+
+static void write_json(FILE* out) {
+  fprintf(out, "{\n  \"benchmark\": \"decode\",\n  \"runs\": %d,\n  \"results\": [\n", BENCH_RUNS);
+  for (int r = 0; r < num_results; r++) {
+    const bench_result_t* result = &results[r];
+    fprintf(out,
+            "    {\"name\": \"%s\", \"iterations\": %ld, \"ns_per_op\": %.2f, \"ns_spread\": %.4f, \"allocs_per_op\": %.3f, \"items_per_op\": %u}%s\n",
+            result->name, result->iterations, result->ns_per_op, result->ns_spread, result->allocs_per_op, result->items,
+            r + 1 < num_results ? "," : "");
+  }
+  fprintf(out, "  ]\n}\n");
+}
+
+int main(int argc, char* argv[]) {
+  const char* output = "bench_decode.json";
+  const char* filter = NULL;
+  int         opt;
+  while ((opt = getopt(argc, argv, "o:f:s:h")) != -1) {
+    switch (opt) {
+      case 'o': output = optarg; break;
+      case 'f': filter = optarg; break;
+      case 's': scale = atof(optarg); break;
+      default:
+        fprintf(stderr,
+                "Usage: %s [-o result.json] [-f decode|schedule|opcua|history|log] [-s iteration_scale]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+  // Production-like: warnings (e.g. for the RAW format) are filtered out except in the log cases
+  if (logger_init("/dev/null", LOG_LEVEL_ERROR) != 0) {
+    return EXIT_FAILURE;
+  }
+
+  if (!filter || strcmp(filter, "decode") == 0) {
+    run_decode_cases();
+  }
+  if (!filter || strcmp(filter, "schedule") == 0) {
+    run_schedule_cases();
+  }
+  if (!filter || strcmp(filter, "opcua") == 0) {
+    run_node_cases();
+  }
+  if (!filter || strcmp(filter, "history") == 0) {
+    run_history_cases();
+  }
+  if (!filter || strcmp(filter, "log") == 0) {
+    run_log_cases();
+  }
+
+  FILE* out = fopen(output, "w");
+  if (!out) {
+    perror("bench_decode: cannot write the results");
+    return EXIT_FAILURE;
+  }
+  write_json(out);
+  fclose(out);
+  logger_close();
+  return EXIT_SUCCESS;
+}
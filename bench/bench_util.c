@@ -0,0 +1,150 @@
+#define _GNU_SOURCE  // CPU affinity
+#include "bench_util.h"
+
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "open62541/client_config_default.h"
+#include "open62541/client_highlevel.h"
+
+int64_t bench_monotonic_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+double bench_process_cpu_sec(pid_t pid) {
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%d/stat", (int) pid);
+  FILE* f = fopen(path, "r");
+  if (!f) {
+    return 0.0;
+  }
+  char   line[1024];
+  double cpu = 0.0;
+  if (fgets(line, sizeof(line), f)) {
+    // Fields 14 and 15 (utime, stime) follow the command name, which may contain spaces
+    const char*        p     = strrchr(line, ')');
+    unsigned long long utime = 0, stime = 0;
+    if (p && sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &utime, &stime) == 2) {
+      cpu = (double) (utime + stime) / (double) sysconf(_SC_CLK_TCK);
+    }
+  }
+  fclose(f);
+  return cpu;
+}
+
+uint64_t bench_process_rss(pid_t pid) {
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%d/statm", (int) pid);
+  FILE* f = fopen(path, "r");
+  if (!f) {
+    return 0;
+  }
+  unsigned long long size = 0, resident = 0;
+  int                fields = fscanf(f, "%llu %llu", &size, &resident);
+  fclose(f);
+  return fields == 2 ? (uint64_t) resident * (uint64_t) sysconf(_SC_PAGESIZE) : 0;
+}
+
+int bench_pin_cpus(int first, int count) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int c = first; c < first + count && c < CPU_SETSIZE; c++) {
+    CPU_SET(c, &set);
+  }
+  return sched_setaffinity(0, sizeof(set), &set);
+}
+
+int bench_write_gateway_config(const char* path, const bench_gateway_t* gateway, const modbus_opcua_config_t* config) {
+  FILE* f = fopen(path, "w");
+  if (!f) {
+    return -1;
+  }
+  fprintf(f, "modbus:\n  ip: \"127.0.0.1\"\n  port: %d\n  slave_id: %d\n  timeout_sec: %d\n", gateway->modbus_port, config->modbus_slave_id,
+          gateway->modbus_timeout_sec);
+  fprintf(f, "opcua:\n  port: %d\n", gateway->opcua_port);
+  if (gateway->history_entries > 0) {
+    fprintf(f, "  history_entries: %d\n", gateway->history_entries);
+  }
+  fprintf(f, "logging:\n  file: \"%s\"\n  level: 1\n", gateway->log_file);
+  if (gateway->metrics_port > 0) {
+    fprintf(f, "metrics:\n  enabled: true\n  bind_address: \"127.0.0.1\"\n  port: %d\n", gateway->metrics_port);
+  }
+  fprintf(f, "cache_dir: \"%s\"\n", gateway->cache_dir);
+  fprintf(f, "mappings:\n");
+  for (int m = 0; m < config->num_mappings; m++) {
+    const modbus_reg_mapping_t* mapping = &config->mappings[m];
+    fprintf(f, "  - name: \"%s\"\n    modbus_address: %d\n    opcua_node_id: \"%s\"\n    data_type: \"%s\"\n    format: \"%s\"\n",
+            mapping->name, mapping->modbus_address, mapping->opcua_node_id, mapping->data_type, mapping->format);
+    fprintf(f, "    poll_interval_ms: %d\n", mapping->poll_interval_ms);
+  }
+  return fclose(f) == 0 ? 0 : -1;
+}
+
+pid_t bench_start_gateway(const char* gateway, const char* config_path, const char* output_path, int cpus) {
+  pid_t pid = fork();
+  if (pid == 0) {
+    if (cpus > 0) {
+      bench_pin_cpus(0, cpus);
+    }
+    // open62541 logs to stdout; keep it out of the benchmark's output
+    int fd = open(output_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+      dup2(fd, STDOUT_FILENO);
+      dup2(fd, STDERR_FILENO);
+      close(fd);
+    }
+    execl(gateway, gateway, config_path, (char*) NULL);
+    _exit(127);
+  }
+  return pid;
+}
+
+UA_Client* bench_start_subscriber(const char* program, int opcua_port, const bench_subscription_t* subscription,
+                                  const modbus_opcua_config_t* config) {
+  char url[64];
+  snprintf(url, sizeof(url), "opc.tcp://127.0.0.1:%d", opcua_port);
+  UA_Client* client = UA_Client_new();
+  UA_ClientConfig_setDefault(UA_Client_getConfig(client));
+
+  int64_t deadline_us = bench_monotonic_us() + BENCH_CONNECT_WAIT_MS * 1000LL;
+  while (UA_Client_connect(client, url) != UA_STATUSCODE_GOOD) {
+    if (bench_monotonic_us() > deadline_us) {
+      fprintf(stderr, "%s: the gateway does not accept OPC UA connections on %s\n", program, url);
+      UA_Client_delete(client);
+      return NULL;
+    }
+    usleep(200000);
+  }
+
+  UA_CreateSubscriptionRequest request = UA_CreateSubscriptionRequest_default();
+  request.requestedPublishingInterval  = subscription->publishing_interval_ms;
+  UA_CreateSubscriptionResponse response = UA_Client_Subscriptions_create(client, request, NULL, NULL, NULL);
+  if (response.responseHeader.serviceResult != UA_STATUSCODE_GOOD) {
+    fprintf(stderr, "%s: subscription on %s failed: %s\n", program, url, UA_StatusCode_name(response.responseHeader.serviceResult));
+    UA_Client_delete(client);
+    return NULL;
+  }
+  for (int m = 0; m < config->num_mappings; m++) {
+    UA_MonitoredItemCreateRequest item = UA_MonitoredItemCreateRequest_default(UA_NODEID_STRING(1, config->mappings[m].opcua_node_id));
+    item.requestedParameters.samplingInterval = subscription->sampling_interval_ms;
+    void* context = subscription->contexts ? (char*) subscription->contexts + (size_t) m * subscription->context_size : NULL;
+    UA_MonitoredItemCreateResult result = UA_Client_MonitoredItems_createDataChange(
+        client, response.subscriptionId, UA_TIMESTAMPSTORETURN_NEITHER, item, context, subscription->on_change, NULL);
+    if (result.statusCode != UA_STATUSCODE_GOOD) {
+      fprintf(stderr, "%s: monitoring %s on %s failed: %s\n", program, config->mappings[m].opcua_node_id, url,
+              UA_StatusCode_name(result.statusCode));
+      if (subscription->all_required) {
+        UA_Client_delete(client);
+        return NULL;
+      }
+    }
+  }
+  return client;
+}
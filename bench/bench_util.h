@@ -0,0 +1,103 @@
+#ifndef BENCH_UTIL_H
+#define BENCH_UTIL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "config.h"
+#include "open62541/client_subscriptions.h"
+
+// How long a gateway may take until its OPC UA server accepts
+#define BENCH_CONNECT_WAIT_MS 15000
+
+/*
+ * @brief Settings of a gateway started by a benchmark; the mappings come from a configuration.
+ */
+typedef struct {
+  int         modbus_port;
+  int         modbus_timeout_sec;
+  int         opcua_port;
+  int         history_entries;  // 0 for no history
+  int         metrics_port;     // 0 for no metrics endpoint
+  const char* log_file;
+  const char* cache_dir;
+} bench_gateway_t;
+
+/*
+ * @brief A subscription on every mapping of a gateway.
+ */
+typedef struct {
+  double                                   publishing_interval_ms;
+  double                                   sampling_interval_ms;
+  UA_Client_DataChangeNotificationCallback on_change;
+  void*                                    contexts;      // One MonitoredItem context per mapping, or NULL
+  size_t                                   context_size;  // Size of one context
+  bool                                     all_required;  // Fail if any MonitoredItem cannot be created
+} bench_subscription_t;
+
+/**
+ * @brief Returns the monotonic clock in microseconds.
+ */
+int64_t bench_monotonic_us(void);
+
+/**
+ * @brief Returns the user plus system CPU time of a process in seconds, 0 if it is gone.
+ *
+ * @param pid The process.
+ */
+double bench_process_cpu_sec(pid_t pid);
+
+/**
+ * @brief Returns the resident set size of a process in bytes, 0 if it is gone.
+ *
+ * @param pid The process.
+ */
+uint64_t bench_process_rss(pid_t pid);
+
+/**
+ * @brief Restricts the calling thread, and the threads and processes it starts later, to CPUs
+ * first .. first + count - 1.
+ *
+ * @param first The first CPU.
+ * @param count The number of CPUs.
+ * @return 0 on success, -1 on failure.
+ */
+int bench_pin_cpus(int first, int count);
+
+/**
+ * @brief Writes the configuration of a gateway for the mappings of a configuration, which the
+ * simulator serves as well.
+ *
+ * @param path The file to write.
+ * @param gateway The gateway settings.
+ * @param config The configuration holding the slave ID and the mappings.
+ * @return 0 on success, -1 on failure.
+ */
+int bench_write_gateway_config(const char* path, const bench_gateway_t* gateway, const modbus_opcua_config_t* config);
+
+/**
+ * @brief Starts a gateway process with its output redirected to a file.
+ *
+ * @param gateway The gateway executable.
+ * @param config_path The configuration to run it with.
+ * @param output_path Receives the gateway's stdout and stderr.
+ * @param cpus Run the gateway on the first 'cpus' CPUs, 0 for no pinning.
+ * @return The process ID, or -1 if fork failed.
+ */
+pid_t bench_start_gateway(const char* gateway, const char* config_path, const char* output_path, int cpus);
+
+/**
+ * @brief Connects to a gateway, retrying for BENCH_CONNECT_WAIT_MS while it starts up, and
+ * subscribes to all its mappings. Errors are reported on stderr, prefixed with the program name.
+ *
+ * @param program The benchmark's name for error messages.
+ * @param opcua_port The gateway's OPC UA port.
+ * @param subscription The subscription to create.
+ * @param config The configuration holding the mappings.
+ * @return The connected client, or NULL on failure.
+ */
+UA_Client* bench_start_subscriber(const char* program, int opcua_port, const bench_subscription_t* subscription,
+                                  const modbus_opcua_config_t* config);
+
+#endif  // BENCH_UTIL_H
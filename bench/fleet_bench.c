@@ -0,0 +1,305 @@
+/*
+ * End-to-end fleet benchmark: N simulated inverters with M tags each, one gateway process per
+ * inverter and K OPC UA subscribers per gateway. Reports the staleness of the notified values
+ * (simulated register change to client notification), gateway CPU and RSS and the Modbus request
+ * rate as JSON, so builds and configurations can be compared.
+ */
+#include <errno.h>
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "bench_util.h"
+#include "config.h"
+#include "histogram.h"
+#include "logger.h"
+#include "open62541/client_config_default.h"
+#include "open62541/client_highlevel.h"
+#include "open62541/client_subscriptions.h"
+#include "sma_simulator.h"
+
+#define BENCH_FIRST_ADDRESS   31000  // Tags are S32 values from here on, two registers apart
+
+/*
+ * @brief Benchmark parameters.
+ */
+typedef struct {
+  int         num_inverters;
+  int         tags_per_inverter;
+  int         subscribers;        // Per gateway
+  int         duration_sec;       // Measured period, after the warm-up
+  int         warmup_sec;
+  int         poll_interval_ms;
+  int         update_interval_ms;  // Of the simulated values
+  int         sampling_interval_ms;
+  int         publishing_interval_ms;
+  int         modbus_base_port;
+  int         opcua_base_port;
+  int         latency_us;
+  int         cpus;               // Gateways run on the first 'cpus' CPUs, the benchmark on the others; 0 for no pinning
+  const char* gateway;
+  const char* output;
+} bench_options_t;
+
+/*
+ * @brief One monitored tag; the context of its MonitoredItem.
+ */
+typedef struct {
+  int inverter;
+  int address;
+} bench_tag_t;
+
+static sma_sim_t*          sim;
+static latency_histogram_t staleness;
+static bool                measuring     = false;
+static uint64_t            notifications = 0;
+static uint64_t            unmatched     = 0;  // Values no longer among the simulator's recent changes
+
+static void on_data_change(UA_Client* client, UA_UInt32 sub_id, void* sub_context, UA_UInt32 mon_id, void* mon_context,
+                           UA_DataValue* value) {
+  int64_t            now_us = bench_monotonic_us();
+  const bench_tag_t* tag    = (const bench_tag_t*) mon_context;
+  if (!measuring || !value->hasValue || !UA_Variant_hasScalarType(&value->value, &UA_TYPES[UA_TYPES_FLOAT])) {
+    return;
+  }
+  notifications++;
+  // FIX0 values are published as floats equal to the raw register value
+  int64_t raw       = (int64_t) lroundf(*(UA_Float*) value->value.data);
+  int64_t change_us = sma_sim_change_time_us(sim, tag->inverter, tag->address, (uint64_t) (uint32_t) raw);
+  if (change_us < 0) {
+    unmatched++;
+    return;
+  }
+  histogram_record(&staleness, now_us - change_us);
+}
+
+// Runs all clients for a while; each iteration of a client is non-blocking
+static void run_clients(UA_Client** clients, int num_clients, int64_t until_us) {
+  while (bench_monotonic_us() < until_us) {
+    for (int c = 0; c < num_clients; c++) {
+      if (clients[c]) {
+        UA_Client_run_iterate(clients[c], 0);
+      }
+    }
+    usleep(500);  // Bounds the measurement error of the notification time
+  }
+}
+
+static void usage(const char* program) {
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  -n <count>  inverters, one gateway process each (default 10)\n"
+          "  -m <count>  tags per inverter (default 20)\n"
+          "  -k <count>  OPC UA subscribers per gateway (default 1)\n"
+          "  -t <sec>    measured duration (default 60)\n"
+          "  -w <sec>    warm-up before measuring (default 5)\n"
+          "  -i <ms>     poll interval of the tags (default 1000)\n"
+          "  -u <ms>     update interval of the simulated values (default 1000)\n"
+          "  -s <ms>     sampling interval of the MonitoredItems (default 100)\n"
+          "  -r <ms>     publishing interval of the subscriptions (default 100)\n"
+          "  -l <us>     simulated Modbus response latency (default 0)\n"
+          "  -c <count>  run the gateways on this many CPUs and the simulator and clients on the rest (default 0, no pinning)\n"
+          "  -p <port>   Modbus port of the first inverter (default 15020)\n"
+          "  -P <port>   OPC UA port of the first gateway (default 14840)\n"
+          "  -g <path>   gateway executable (default ./modbus_opcua_gateway)\n"
+          "  -o <path>   JSON result file (default fleet_bench.json)\n",
+          program);
+}
+
+int main(int argc, char* argv[]) {
+  bench_options_t options = {10, 20, 1, 60, 5, 1000, 1000, 100, 100, 15020, 14840, 0, 0, "./modbus_opcua_gateway", "fleet_bench.json"};
+  int             opt;
+  while ((opt = getopt(argc, argv, "n:m:k:t:w:i:u:s:r:l:c:p:P:g:o:h")) != -1) {
+    switch (opt) {
+      case 'n': options.num_inverters = atoi(optarg); break;
+      case 'm': options.tags_per_inverter = atoi(optarg); break;
+      case 'k': options.subscribers = atoi(optarg); break;
+      case 't': options.duration_sec = atoi(optarg); break;
+      case 'w': options.warmup_sec = atoi(optarg); break;
+      case 'i': options.poll_interval_ms = atoi(optarg); break;
+      case 'u': options.update_interval_ms = atoi(optarg); break;
+      case 's': options.sampling_interval_ms = atoi(optarg); break;
+      case 'r': options.publishing_interval_ms = atoi(optarg); break;
+      case 'l': options.latency_us = atoi(optarg); break;
+      case 'c': options.cpus = atoi(optarg); break;
+      case 'p': options.modbus_base_port = atoi(optarg); break;
+      case 'P': options.opcua_base_port = atoi(optarg); break;
+      case 'g': options.gateway = optarg; break;
+      case 'o': options.output = optarg; break;
+      default: usage(argv[0]); return EXIT_FAILURE;
+    }
+  }
+  if (options.num_inverters <= 0 || options.tags_per_inverter <= 0 || options.tags_per_inverter > 8000 || options.subscribers < 0 ||
+      options.duration_sec <= 0 || options.cpus < 0) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  int online_cpus = (int) sysconf(_SC_NPROCESSORS_ONLN);
+  if (options.cpus > online_cpus) {
+    fprintf(stderr, "fleet_bench: -c %d exceeds the %d online CPUs\n", options.cpus, online_cpus);
+    return EXIT_FAILURE;
+  }
+  // Keep the simulator and the clients (started from here) off the gateways' CPUs when there are CPUs left
+  if (options.cpus > 0 && options.cpus < online_cpus) {
+    bench_pin_cpus(options.cpus, online_cpus - options.cpus);
+  }
+  logger_init(NULL, LOG_LEVEL_WARN);
+  histogram_init(&staleness);
+
+  // Voltage-like tags never drop to zero at night, so every update changes them
+  modbus_opcua_config_t config = {0};
+  config.modbus_slave_id       = 3;
+  config.num_mappings          = options.tags_per_inverter;
+  config.mappings              = calloc((size_t) config.num_mappings, sizeof(modbus_reg_mapping_t));
+  for (int m = 0; m < config.num_mappings; m++) {
+    char name[64], node_id[64];
+    snprintf(name, sizeof(name), "Bench Voltage %d", m);
+    snprintf(node_id, sizeof(node_id), "bench.tag_%d", m);
+    config.mappings[m] = (modbus_reg_mapping_t) {strdup(name), BENCH_FIRST_ADDRESS + 2 * m, strdup(node_id), "S32", "FIX0", 1.0f,
+                                                 options.poll_interval_ms, 4, NULL, 0};
+  }
+
+  sma_sim_options_t sim_options;
+  sma_sim_default_options(&sim_options);
+  sim_options.num_inverters      = options.num_inverters;
+  sim_options.base_port          = options.modbus_base_port;
+  sim_options.slave_id           = config.modbus_slave_id;
+  sim_options.latency_us         = options.latency_us;
+  sim_options.update_interval_ms = options.update_interval_ms;
+  sim                            = sma_sim_start(&config, &sim_options);
+  if (!sim) {
+    return EXIT_FAILURE;
+  }
+
+  char dir[] = "/tmp/fleet_bench.XXXXXX";
+  if (!mkdtemp(dir)) {
+    fprintf(stderr, "fleet_bench: mkdtemp failed: %s\n", strerror(errno));
+    return EXIT_FAILURE;
+  }
+  pid_t* pids = calloc((size_t) options.num_inverters, sizeof(pid_t));
+  for (int i = 0; i < options.num_inverters; i++) {
+    char config_path[256], output_path[256];
+    snprintf(config_path, sizeof(config_path), "%s/gateway_%d.yaml", dir, i);
+    snprintf(output_path, sizeof(output_path), "%s/gateway_%d.out", dir, i);
+    char log_path[256];
+    snprintf(log_path, sizeof(log_path), "%s/gateway_%d.log", dir, i);
+    bench_gateway_t gateway = {options.modbus_base_port + i, 5, options.opcua_base_port + i, 0, 0, log_path, dir};
+    if (bench_write_gateway_config(config_path, &gateway, &config) != 0) {
+      fprintf(stderr, "fleet_bench: cannot write %s\n", config_path);
+      return EXIT_FAILURE;
+    }
+    pids[i] = bench_start_gateway(options.gateway, config_path, output_path, options.cpus);
+  }
+
+  int          num_clients = options.num_inverters * options.subscribers;
+  UA_Client**  clients     = calloc((size_t) (num_clients > 0 ? num_clients : 1), sizeof(UA_Client*));
+  bench_tag_t* tags        = calloc((size_t) options.num_inverters * (size_t) config.num_mappings, sizeof(bench_tag_t));
+  int          failed      = 0;
+  bench_subscription_t subscription = {options.publishing_interval_ms, options.sampling_interval_ms, on_data_change, NULL,
+                                       sizeof(bench_tag_t), false};
+  for (int i = 0; i < options.num_inverters; i++) {
+    subscription.contexts = &tags[i * config.num_mappings];
+    for (int m = 0; m < config.num_mappings; m++) {
+      tags[i * config.num_mappings + m] = (bench_tag_t) {i, config.mappings[m].modbus_address};
+    }
+    for (int k = 0; k < options.subscribers; k++) {
+      clients[i * options.subscribers + k] = bench_start_subscriber("fleet_bench", options.opcua_base_port + i, &subscription, &config);
+      failed += clients[i * options.subscribers + k] == NULL;
+    }
+  }
+
+  run_clients(clients, num_clients, bench_monotonic_us() + options.warmup_sec * 1000000LL);
+
+  // Measured period
+  sma_sim_stats_t sim_start, sim_end;
+  double          cpu_start = 0.0, cpu_end = 0.0;
+  uint64_t        rss_peak  = 0;
+  sma_sim_get_stats(sim, &sim_start);
+  for (int i = 0; i < options.num_inverters; i++) {
+    cpu_start += bench_process_cpu_sec(pids[i]);
+  }
+  int64_t start_us = bench_monotonic_us();
+  measuring        = true;
+  for (int sec = 0; sec < options.duration_sec; sec++) {
+    run_clients(clients, num_clients, start_us + (sec + 1) * 1000000LL);
+    uint64_t rss = 0;
+    for (int i = 0; i < options.num_inverters; i++) {
+      rss += bench_process_rss(pids[i]);
+    }
+    rss_peak = rss > rss_peak ? rss : rss_peak;
+  }
+  measuring        = false;
+  double   elapsed = (double) (bench_monotonic_us() - start_us) / 1e6;
+  uint64_t rss_end = 0;
+  sma_sim_get_stats(sim, &sim_end);
+  for (int i = 0; i < options.num_inverters; i++) {
+    cpu_end += bench_process_cpu_sec(pids[i]);
+    rss_end += bench_process_rss(pids[i]);
+  }
+
+  for (int c = 0; c < num_clients; c++) {
+    if (clients[c]) {
+      UA_Client_disconnect(clients[c]);
+      UA_Client_delete(clients[c]);
+    }
+  }
+  for (int i = 0; i < options.num_inverters; i++) {
+    kill(pids[i], SIGTERM);
+  }
+  int exited_badly = 0;
+  for (int i = 0; i < options.num_inverters; i++) {
+    int status = 0;
+    waitpid(pids[i], &status, 0);
+    exited_badly += !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+  }
+  sma_sim_stop(sim);
+  for (int m = 0; m < config.num_mappings; m++) {
+    free(config.mappings[m].name);
+    free(config.mappings[m].opcua_node_id);
+  }
+  free(config.mappings);
+  free(clients);
+  free(tags);
+  free(pids);
+
+  // CPU per tag/s: gateway CPU seconds per second, divided by the configured tag reads per second
+  double tag_rate = (double) options.num_inverters * options.tags_per_inverter * 1000.0 / options.poll_interval_ms;
+  double cpu_sec  = cpu_end - cpu_start;
+  FILE*  out      = fopen(options.output, "w");
+  if (!out) {
+    fprintf(stderr, "fleet_bench: cannot write %s: %s\n", options.output, strerror(errno));
+    return EXIT_FAILURE;
+  }
+  fprintf(out, "{\n  \"benchmark\": \"fleet\",\n");
+  fprintf(out,
+          "  \"parameters\": {\"inverters\": %d, \"tags_per_inverter\": %d, \"subscribers_per_gateway\": %d, \"duration_sec\": %d, "
+          "\"poll_interval_ms\": %d, \"update_interval_ms\": %d, \"sampling_interval_ms\": %d, \"publishing_interval_ms\": %d, "
+          "\"modbus_latency_us\": %d, \"gateway_cpus\": %d},\n",
+          options.num_inverters, options.tags_per_inverter, options.subscribers, options.duration_sec, options.poll_interval_ms,
+          options.update_interval_ms, options.sampling_interval_ms, options.publishing_interval_ms, options.latency_us, options.cpus);
+  fprintf(out, "  \"staleness_ms\": {\"count\": %llu, \"mean\": %.3f, \"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"p999\": %.3f, \"max\": %.3f},\n",
+          (unsigned long long) histogram_count(&staleness), histogram_mean(&staleness) / 1000.0,
+          histogram_percentile(&staleness, 50.0) / 1000.0, histogram_percentile(&staleness, 90.0) / 1000.0,
+          histogram_percentile(&staleness, 99.0) / 1000.0, histogram_percentile(&staleness, 99.9) / 1000.0,
+          histogram_max(&staleness) / 1000.0);
+  fprintf(out, "  \"notifications_per_sec\": %.1f,\n  \"unmatched_notifications\": %llu,\n", notifications / elapsed,
+          (unsigned long long) unmatched);
+  fprintf(out, "  \"modbus_requests_per_sec\": %.1f,\n  \"modbus_exceptions\": %llu,\n", (sim_end.requests - sim_start.requests) / elapsed,
+          (unsigned long long) (sim_end.exceptions - sim_start.exceptions));
+  fprintf(out, "  \"tag_reads_per_sec\": %.1f,\n  \"gateway_cpu_percent\": %.2f,\n  \"gateway_cpu_us_per_tag\": %.3f,\n", tag_rate,
+          100.0 * cpu_sec / elapsed, 1e6 * cpu_sec / (tag_rate * elapsed));
+  fprintf(out, "  \"gateway_rss_bytes\": {\"end\": %llu, \"peak\": %llu, \"per_gateway\": %llu},\n", (unsigned long long) rss_end,
+          (unsigned long long) rss_peak, (unsigned long long) (rss_end / (uint64_t) options.num_inverters));
+  fprintf(out, "  \"failed_subscribers\": %d,\n  \"failed_gateways\": %d\n}\n", failed, exited_badly);
+  fclose(out);
+
+  fprintf(stderr, "fleet_bench: staleness p50 %.1f ms, p99 %.1f ms; %.0f Modbus req/s; gateway CPU %.1f us/tag; results in %s (logs in %s)\n",
+          histogram_percentile(&staleness, 50.0) / 1000.0, histogram_percentile(&staleness, 99.0) / 1000.0,
+          (sim_end.requests - sim_start.requests) / elapsed, 1e6 * cpu_sec / (tag_rate * elapsed), options.output, dir);
+  logger_close();
+  return failed || exited_badly ? EXIT_FAILURE : EXIT_SUCCESS;
+}
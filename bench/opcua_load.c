@@ -0,0 +1,355 @@
+/*
+ * OPC UA client load generator: opens many sessions against a running gateway, creates
+ * MonitoredItems on the configured tags and issues a mix of Read, Browse and HistoryRead requests.
+ * The client count is ramped up in stages; every stage reports notification latency and service
+ * response times, so the stage at which the gateway's server loop saturates stands out.
+ */
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config_parser.h"
+#include "histogram.h"
+#include "logger.h"
+#include "open62541/client_config_default.h"
+#include "open62541/client_highlevel.h"
+#include "open62541/client_subscriptions.h"
+
+#define LOAD_MAX_STAGES 64
+#define LOAD_SETUP      LOAD_MAX_STAGES  // Collects what happens while clients join between two stages
+
+typedef enum { LOAD_READ, LOAD_BROWSE, LOAD_HISTORY_READ, LOAD_SERVICE_COUNT } load_service_t;
+
+static const char* service_names[LOAD_SERVICE_COUNT] = {"read", "browse", "history_read"};
+
+/*
+ * @brief Load generator parameters.
+ */
+typedef struct {
+  const char* url;
+  const char* username;
+  const char* password;
+  int         max_clients;
+  int         step;                       // Clients added per stage
+  int         stage_sec;
+  int         items_per_client;           // MonitoredItems per session
+  int         sampling_interval_ms;
+  int         publishing_interval_ms;
+  double      rates[LOAD_SERVICE_COUNT];  // Requests per second and client
+  int         saturation_ms;              // p99 above which a stage counts as saturated
+  const char* output;
+} load_options_t;
+
+/*
+ * @brief Measurements of one stage, shared by all client threads.
+ */
+typedef struct {
+  int                 clients;
+  latency_histogram_t notification_latency;
+  latency_histogram_t service_latency[LOAD_SERVICE_COUNT];
+  _Atomic uint64_t    notifications;
+  _Atomic uint64_t    service_errors[LOAD_SERVICE_COUNT];
+} load_stage_t;
+
+/*
+ * @brief One client session and its thread.
+ */
+typedef struct {
+  int        index;
+  UA_Client* client;
+  pthread_t  thread;
+  bool       started;
+} load_client_t;
+
+static load_options_t         options;
+static modbus_opcua_config_t* config;
+static load_stage_t           stages[LOAD_MAX_STAGES + 1];
+static atomic_int             current_stage = LOAD_SETUP;
+static atomic_bool            stop          = false;
+
+static int64_t monotonic_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static load_stage_t* stage(void) {
+  return &stages[atomic_load(&current_stage)];
+}
+
+// Latency from the gateway's write (source timestamp) to the notification; both run on the same clock
+static void on_data_change(UA_Client* client, UA_UInt32 sub_id, void* sub_context, UA_UInt32 mon_id, void* mon_context,
+                           UA_DataValue* value) {
+  if (!value->hasSourceTimestamp) {
+    return;
+  }
+  load_stage_t* s = stage();
+  atomic_fetch_add_explicit(&s->notifications, 1, memory_order_relaxed);
+  histogram_record(&s->notification_latency, (UA_DateTime_now() - value->sourceTimestamp) / UA_DATETIME_USEC);
+}
+
+static UA_Boolean on_history_data(UA_Client* client, const UA_NodeId* node_id, UA_Boolean more_data, const UA_ExtensionObject* data,
+                                  void* context) {
+  return false;  // The first page is enough to time the service
+}
+
+static UA_NodeId tag_node(long n) {
+  return UA_NODEID_STRING(1, config->mappings[n % config->num_mappings].opcua_node_id);
+}
+
+static UA_StatusCode issue_request(UA_Client* client, load_service_t service, long n) {
+  UA_NodeId node_id = tag_node(n);
+  switch (service) {
+    case LOAD_READ: {
+      UA_Variant value;
+      UA_Variant_init(&value);
+      UA_StatusCode rc = UA_Client_readValueAttribute(client, node_id, &value);
+      UA_Variant_clear(&value);
+      return rc;
+    }
+    case LOAD_BROWSE: {
+      UA_BrowseRequest request;
+      UA_BrowseRequest_init(&request);
+      request.nodesToBrowse               = UA_BrowseDescription_new();
+      request.nodesToBrowseSize           = 1;
+      request.nodesToBrowse[0].nodeId     = UA_NODEID_NUMERIC(0, UA_NS0ID_OBJECTSFOLDER);
+      request.nodesToBrowse[0].resultMask = UA_BROWSERESULTMASK_ALL;
+      UA_BrowseResponse response          = UA_Client_Service_browse(client, request);
+      UA_StatusCode     rc                = response.responseHeader.serviceResult;
+      UA_BrowseResponse_clear(&response);
+      UA_BrowseRequest_clear(&request);
+      return rc;
+    }
+    case LOAD_HISTORY_READ: {
+      UA_DateTime now = UA_DateTime_now();
+      return UA_Client_HistoryRead_raw(client, &node_id, on_history_data, now - 60 * UA_DATETIME_SEC, now, UA_STRING_NULL, false, 100,
+                                       UA_TIMESTAMPSTORETURN_BOTH, NULL);
+    }
+    default:
+      return UA_STATUSCODE_BADINTERNALERROR;
+  }
+}
+
+static UA_Client* connect_client(int index) {
+  UA_Client* client = UA_Client_new();
+  UA_ClientConfig_setDefault(UA_Client_getConfig(client));
+  UA_StatusCode rc = options.username ? UA_Client_connectUsername(client, options.url, options.username, options.password)
+                                      : UA_Client_connect(client, options.url);
+  if (rc != UA_STATUSCODE_GOOD) {
+    fprintf(stderr, "opcua_load: client %d cannot connect to %s: %s\n", index, options.url, UA_StatusCode_name(rc));
+    UA_Client_delete(client);
+    return NULL;
+  }
+
+  UA_CreateSubscriptionRequest request = UA_CreateSubscriptionRequest_default();
+  request.requestedPublishingInterval  = options.publishing_interval_ms;
+  UA_CreateSubscriptionResponse response = UA_Client_Subscriptions_create(client, request, NULL, NULL, NULL);
+  if (response.responseHeader.serviceResult != UA_STATUSCODE_GOOD) {
+    fprintf(stderr, "opcua_load: client %d cannot create a subscription: %s\n", index,
+            UA_StatusCode_name(response.responseHeader.serviceResult));
+    return client;  // Still usable for the request mix
+  }
+  for (int i = 0; i < options.items_per_client; i++) {
+    UA_MonitoredItemCreateRequest item = UA_MonitoredItemCreateRequest_default(tag_node(index + i));
+    item.requestedParameters.samplingInterval = options.sampling_interval_ms;
+    UA_Client_MonitoredItems_createDataChange(client, response.subscriptionId, UA_TIMESTAMPSTORETURN_BOTH, item, NULL, on_data_change,
+                                              NULL);
+  }
+  return client;
+}
+
+// Serves the subscription and issues the request mix at the configured rates
+static void* client_main(void* arg) {
+  load_client_t* c = (load_client_t*) arg;
+  int64_t        next_us[LOAD_SERVICE_COUNT];
+  int64_t        period_us[LOAD_SERVICE_COUNT];
+  long           n = c->index;
+  for (int s = 0; s < LOAD_SERVICE_COUNT; s++) {
+    period_us[s] = options.rates[s] > 0.0 ? (int64_t) (1e6 / options.rates[s]) : 0;
+    // Spread the clients' requests over the period instead of sending them in bursts
+    next_us[s] = monotonic_us() + (period_us[s] ? (int64_t) (c->index * 7919) % period_us[s] : 0);
+  }
+
+  while (!atomic_load(&stop)) {
+    UA_Client_run_iterate(c->client, 5);
+    for (int s = 0; s < LOAD_SERVICE_COUNT; s++) {
+      int64_t now_us = monotonic_us();
+      if (!period_us[s] || now_us < next_us[s]) {
+        continue;
+      }
+      next_us[s] += period_us[s];
+      if (next_us[s] < now_us) {
+        next_us[s] = now_us + period_us[s];  // Behind schedule: the gateway is saturated, do not pile up
+      }
+      UA_StatusCode rc         = issue_request(c->client, (load_service_t) s, n++);
+      int64_t       elapsed_us = monotonic_us() - now_us;
+      load_stage_t* st         = stage();
+      histogram_record(&st->service_latency[s], elapsed_us);
+      if (rc != UA_STATUSCODE_GOOD) {
+        atomic_fetch_add_explicit(&st->service_errors[s], 1, memory_order_relaxed);
+      }
+    }
+  }
+  return NULL;
+}
+
+static void write_stage_json(FILE* out, const load_stage_t* s, int stage_sec, bool last) {
+  fprintf(out, "    {\"clients\": %d, \"monitored_items\": %d, \"notifications_per_sec\": %.1f,\n", s->clients,
+          s->clients * options.items_per_client, (double) atomic_load(&s->notifications) / stage_sec);
+  fprintf(out, "     \"notification_latency_ms\": {\"count\": %llu, \"p50\": %.3f, \"p99\": %.3f, \"max\": %.3f}",
+          (unsigned long long) histogram_count(&s->notification_latency), histogram_percentile(&s->notification_latency, 50.0) / 1000.0,
+          histogram_percentile(&s->notification_latency, 99.0) / 1000.0, histogram_max(&s->notification_latency) / 1000.0);
+  for (int v = 0; v < LOAD_SERVICE_COUNT; v++) {
+    const latency_histogram_t* h = &s->service_latency[v];
+    fprintf(out, ",\n     \"%s_ms\": {\"count\": %llu, \"errors\": %llu, \"p50\": %.3f, \"p99\": %.3f, \"max\": %.3f}", service_names[v],
+            (unsigned long long) histogram_count(h), (unsigned long long) atomic_load(&s->service_errors[v]),
+            histogram_percentile(h, 50.0) / 1000.0, histogram_percentile(h, 99.0) / 1000.0, histogram_max(h) / 1000.0);
+  }
+  fprintf(out, "}%s\n", last ? "" : ",");
+}
+
+// A stage is saturated when notifications or any service exceed the p99 limit
+static bool stage_saturated(const load_stage_t* s) {
+  uint64_t limit_us = (uint64_t) options.saturation_ms * 1000;
+  bool     over     = histogram_percentile(&s->notification_latency, 99.0) > limit_us;
+  for (int v = 0; v < LOAD_SERVICE_COUNT; v++) {
+    over |= histogram_percentile(&s->service_latency[v], 99.0) > limit_us;
+  }
+  return over;
+}
+
+static void usage(const char* program) {
+  fprintf(stderr,
+          "Usage: %s [options] <path_to_config.yaml>\n"
+          "  -u <url>       server URL (default opc.tcp://127.0.0.1:4840)\n"
+          "  -U <user>      user name, -W <password> its password\n"
+          "  -c <count>     clients (sessions) in the last stage (default 10)\n"
+          "  -S <count>     clients added per stage (default: all at once)\n"
+          "  -t <sec>       duration of a stage (default 30)\n"
+          "  -m <count>     MonitoredItems per client (default 100)\n"
+          "  -s <ms>        sampling interval (default 250)\n"
+          "  -r <ms>        publishing interval (default 500)\n"
+          "  -R <rate>      Reads per second and client (default 1)\n"
+          "  -B <rate>      Browses per second and client (default 0.2)\n"
+          "  -H <rate>      HistoryReads per second and client (default 0.1)\n"
+          "  -L <ms>        p99 limit that marks a stage as saturated (default 100)\n"
+          "  -o <path>      JSON result file (default opcua_load.json)\n"
+          "The configuration provides the node IDs of the tags.\n",
+          program);
+}
+
+int main(int argc, char* argv[]) {
+  options = (load_options_t) {"opc.tcp://127.0.0.1:4840", NULL, NULL, 10, 0, 30, 100, 250, 500, {1.0, 0.2, 0.1}, 100, "opcua_load.json"};
+  int opt;
+  while ((opt = getopt(argc, argv, "u:U:W:c:S:t:m:s:r:R:B:H:L:o:h")) != -1) {
+    switch (opt) {
+      case 'u': options.url = optarg; break;
+      case 'U': options.username = optarg; break;
+      case 'W': options.password = optarg; break;
+      case 'c': options.max_clients = atoi(optarg); break;
+      case 'S': options.step = atoi(optarg); break;
+      case 't': options.stage_sec = atoi(optarg); break;
+      case 'm': options.items_per_client = atoi(optarg); break;
+      case 's': options.sampling_interval_ms = atoi(optarg); break;
+      case 'r': options.publishing_interval_ms = atoi(optarg); break;
+      case 'R': options.rates[LOAD_READ] = atof(optarg); break;
+      case 'B': options.rates[LOAD_BROWSE] = atof(optarg); break;
+      case 'H': options.rates[LOAD_HISTORY_READ] = atof(optarg); break;
+      case 'L': options.saturation_ms = atoi(optarg); break;
+      case 'o': options.output = optarg; break;
+      default: usage(argv[0]); return EXIT_FAILURE;
+    }
+  }
+  if (optind != argc - 1 || options.max_clients <= 0 || options.stage_sec <= 0) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  if (options.step <= 0 || options.step > options.max_clients) {
+    options.step = options.max_clients;
+  }
+  if (options.username && !options.password) {
+    options.password = "";
+  }
+  config = load_config_from_yaml(argv[optind]);
+  if (!config || config->num_mappings == 0) {
+    fprintf(stderr, "opcua_load: no mappings in %s\n", argv[optind]);
+    return EXIT_FAILURE;
+  }
+  logger_init(NULL, LOG_LEVEL_WARN);
+
+  load_client_t* clients    = calloc((size_t) options.max_clients, sizeof(load_client_t));
+  int            num_stages = 0;
+  int            saturated  = -1;
+  for (int count = options.step; num_stages < LOAD_MAX_STAGES; count += options.step) {
+    count = count > options.max_clients ? options.max_clients : count;
+    // Measurements taken while clients join are not part of any stage
+    atomic_store(&current_stage, LOAD_SETUP);
+    for (int c = 0; c < count; c++) {
+      if (!clients[c].started) {
+        clients[c].index   = c;
+        clients[c].client  = connect_client(c);
+        clients[c].started = clients[c].client && pthread_create(&clients[c].thread, NULL, client_main, &clients[c]) == 0;
+      }
+    }
+    int connected = 0;
+    for (int c = 0; c < count; c++) {
+      connected += clients[c].started;
+    }
+    stages[num_stages].clients = connected;
+    atomic_store(&current_stage, num_stages);
+    sleep((unsigned) options.stage_sec);
+
+    load_stage_t* s = &stages[num_stages++];
+    fprintf(stderr, "opcua_load: %d clients: notification p99 %.1f ms, read p99 %.1f ms, %.0f notifications/s\n", s->clients,
+            histogram_percentile(&s->notification_latency, 99.0) / 1000.0, histogram_percentile(&s->service_latency[LOAD_READ], 99.0) / 1000.0,
+            (double) atomic_load(&s->notifications) / options.stage_sec);
+    if (saturated < 0 && stage_saturated(s)) {
+      saturated = num_stages - 1;
+    }
+    if (count == options.max_clients) {
+      break;
+    }
+  }
+
+  atomic_store(&stop, true);
+  for (int c = 0; c < options.max_clients; c++) {
+    if (clients[c].started) {
+      pthread_join(clients[c].thread, NULL);
+    }
+    if (clients[c].client) {
+      UA_Client_disconnect(clients[c].client);
+      UA_Client_delete(clients[c].client);
+    }
+  }
+  free(clients);
+
+  FILE* out = fopen(options.output, "w");
+  if (!out) {
+    perror("opcua_load: cannot write the results");
+    return EXIT_FAILURE;
+  }
+  fprintf(out, "{\n  \"benchmark\": \"opcua_load\",\n  \"url\": \"%s\",\n", options.url);
+  fprintf(out,
+          "  \"parameters\": {\"items_per_client\": %d, \"sampling_interval_ms\": %d, \"publishing_interval_ms\": %d, "
+          "\"read_rate\": %.2f, \"browse_rate\": %.2f, \"history_read_rate\": %.2f, \"stage_sec\": %d, \"saturation_ms\": %d},\n",
+          options.items_per_client, options.sampling_interval_ms, options.publishing_interval_ms, options.rates[LOAD_READ],
+          options.rates[LOAD_BROWSE], options.rates[LOAD_HISTORY_READ], options.stage_sec, options.saturation_ms);
+  if (saturated >= 0) {
+    fprintf(out, "  \"saturation_clients\": %d,\n", stages[saturated].clients);
+  } else {
+    fprintf(out, "  \"saturation_clients\": null,\n");
+  }
+  fprintf(out, "  \"stages\": [\n");
+  for (int s = 0; s < num_stages; s++) {
+    write_stage_json(out, &stages[s], options.stage_sec, s + 1 == num_stages);
+  }
+  fprintf(out, "  ]\n}\n");
+  fclose(out);
+  free_config(config);
+  logger_close();
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,405 @@
+/*
+ * Compares benchmark results against stored baselines. The JSON of a result and of the baseline
+ * with the same file name are flattened into numeric values ("results[decode/U16/FIX0].ns_per_op",
+ * "staleness_ms.p99", ...); values whose direction is known (times, latencies, allocations, CPU,
+ * memory, rates, failures) fail the check when they got worse by more than their threshold. Times
+ * measured with a noise estimate get a threshold of at least three times that noise. A result
+ * without a baseline fails the check as well, unless missing baselines are explicitly allowed.
+ */
+#include <errno.h>
+#include <libgen.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define CHECK_KEY_MAX   192
+#define CHECK_NOISE_MUL 3.0  // Multiple of the measured noise a time may move without failing
+
+/*
+ * @brief One flattened numeric value of a benchmark result.
+ */
+typedef struct {
+  char   key[CHECK_KEY_MAX];
+  double value;
+} metric_t;
+
+/*
+ * @brief All numeric values of one result file.
+ */
+typedef struct {
+  metric_t* items;
+  int       count;
+  int       capacity;
+} metric_set_t;
+
+/*
+ * @brief How a value is judged. The first rule whose suffix ends the key applies; values
+ * without a rule are informational (parameters, counts) and never compared.
+ */
+typedef struct {
+  const char* suffix;
+  int         direction;  // 1: higher is better, -1: lower is better
+  double      threshold;  // Relative change tolerated
+  double      tolerance;  // Absolute change tolerated, for values near zero
+} metric_rule_t;
+
+static const metric_rule_t rules[] = {
+    {".ns_per_op", -1, 0.10, 2.0},          // bench_decode, ns
+    {".allocs_per_op", -1, 0.0, 0.01},      // Deterministic, any new allocation is a regression
+    {".errors", -1, 0.0, 0.0},              // opcua_load service errors
+    {"failed_subscribers", -1, 0.0, 0.0},   // fleet_bench
+    {"failed_gateways", -1, 0.0, 0.0},
+    {"saturation_clients", 1, 0.0, 0.0},    // opcua_load
+    {".p50", -1, 0.25, 1.0},                // Latency percentiles, ms
+    {".p99", -1, 0.25, 2.0},
+    {"gateway_cpu_us_per_tag", -1, 0.20, 0.5},
+    {"gateway_cpu_percent", -1, 0.20, 1.0},
+    {"gateway_rss_bytes.per_gateway", -1, 0.10, 1024.0 * 1024.0},
+    {".recovery_ms", -1, 0.25, 500.0},      // resilience_bench, ms
+    {".max_gap_ms", -1, 0.25, 500.0},
+    {"_cpu_percent", -1, 0.20, 1.0},
+    {"_per_sec", 1, 0.10, 1.0},             // Throughput
+};
+
+static double threshold_scale = 1.0;
+static bool   verbose         = false;
+
+// --- Flattening JSON parser, just enough for the benchmark output ---
+
+/*
+ * @brief Parser state over a whole file held in memory.
+ */
+typedef struct {
+  const char*   p;
+  metric_set_t* set;
+  bool          error;
+} parser_t;
+
+static void add_metric(metric_set_t* set, const char* key, double value) {
+  if (set->count == set->capacity) {
+    int       capacity = set->capacity ? set->capacity * 2 : 256;
+    metric_t* items    = realloc(set->items, (size_t) capacity * sizeof(metric_t));
+    if (!items) {
+      return;
+    }
+    set->items    = items;
+    set->capacity = capacity;
+  }
+  snprintf(set->items[set->count].key, CHECK_KEY_MAX, "%s", key);
+  set->items[set->count++].value = value;
+}
+
+static const metric_t* find_metric(const metric_set_t* set, const char* key) {
+  for (int i = 0; i < set->count; i++) {
+    if (strcmp(set->items[i].key, key) == 0) {
+      return &set->items[i];
+    }
+  }
+  return NULL;
+}
+
+static void skip_space(parser_t* ps) {
+  while (*ps->p == ' ' || *ps->p == '\t' || *ps->p == '\n' || *ps->p == '\r') {
+    ps->p++;
+  }
+}
+
+// Reads a string into out (truncated to size), the escaped character is taken literally
+static bool parse_string(parser_t* ps, char* out, size_t size) {
+  if (*ps->p != '"') {
+    return false;
+  }
+  size_t length = 0;
+  for (ps->p++; *ps->p && *ps->p != '"'; ps->p++) {
+    if (*ps->p == '\\' && ps->p[1]) {
+      ps->p++;
+    }
+    if (length + 1 < size) {
+      out[length++] = *ps->p;
+    }
+  }
+  out[length] = '\0';
+  if (*ps->p != '"') {
+    return false;
+  }
+  ps->p++;
+  return true;
+}
+
+static void parse_value(parser_t* ps, const char* path);
+
+// Array elements are keyed by their "name" member if it comes first, by their index otherwise
+static void parse_object(parser_t* ps, const char* path, int index) {
+  char prefix[CHECK_KEY_MAX];
+  if (index < 0) {
+    snprintf(prefix, sizeof(prefix), "%s", path);
+  } else {
+    snprintf(prefix, sizeof(prefix), "%s[%d]", path, index);
+  }
+
+  ps->p++;  // '{'
+  skip_space(ps);
+  if (*ps->p == '}') {
+    ps->p++;
+    return;
+  }
+  for (bool first = true; !ps->error; first = false) {
+    char key[64];
+    skip_space(ps);
+    if (!parse_string(ps, key, sizeof(key))) {
+      ps->error = true;
+      return;
+    }
+    skip_space(ps);
+    if (*ps->p++ != ':') {
+      ps->error = true;
+      return;
+    }
+    skip_space(ps);
+
+    if (first && index >= 0 && strcmp(key, "name") == 0 && *ps->p == '"') {
+      char name[CHECK_KEY_MAX / 2];
+      if (!parse_string(ps, name, sizeof(name))) {
+        ps->error = true;
+        return;
+      }
+      snprintf(prefix, sizeof(prefix), "%s[%s]", path, name);
+    } else {
+      char child[CHECK_KEY_MAX];
+      snprintf(child, sizeof(child), "%s%s%s", prefix, prefix[0] ? "." : "", key);
+      parse_value(ps, child);
+    }
+
+    skip_space(ps);
+    if (*ps->p == ',') {
+      ps->p++;
+    } else if (*ps->p == '}') {
+      ps->p++;
+      return;
+    } else {
+      ps->error = true;
+    }
+  }
+}
+
+static void parse_array(parser_t* ps, const char* path) {
+  ps->p++;  // '['
+  skip_space(ps);
+  if (*ps->p == ']') {
+    ps->p++;
+    return;
+  }
+  for (int index = 0; !ps->error; index++) {
+    skip_space(ps);
+    if (*ps->p == '{') {
+      parse_object(ps, path, index);
+    } else {
+      char child[CHECK_KEY_MAX];
+      snprintf(child, sizeof(child), "%s[%d]", path, index);
+      parse_value(ps, child);
+    }
+    skip_space(ps);
+    if (*ps->p == ',') {
+      ps->p++;
+    } else if (*ps->p == ']') {
+      ps->p++;
+      return;
+    } else {
+      ps->error = true;
+    }
+  }
+}
+
+static void parse_value(parser_t* ps, const char* path) {
+  skip_space(ps);
+  if (*ps->p == '{') {
+    parse_object(ps, path, -1);
+  } else if (*ps->p == '[') {
+    parse_array(ps, path);
+  } else if (*ps->p == '"') {
+    char ignored[CHECK_KEY_MAX];
+    ps->error = !parse_string(ps, ignored, sizeof(ignored));
+  } else if (strncmp(ps->p, "true", 4) == 0 || strncmp(ps->p, "null", 4) == 0) {
+    ps->p += 4;
+  } else if (strncmp(ps->p, "false", 5) == 0) {
+    ps->p += 5;
+  } else {
+    char*  end;
+    double value = strtod(ps->p, &end);
+    if (end == ps->p) {
+      ps->error = true;
+      return;
+    }
+    ps->p = end;
+    add_metric(ps->set, path, value);
+  }
+}
+
+// Returns 0 on success, -1 if the file is missing (errno is set) or not valid JSON
+static int load_metrics(const char* path, metric_set_t* set) {
+  FILE* file = fopen(path, "rb");
+  if (!file) {
+    return -1;
+  }
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  rewind(file);
+  char* text = size >= 0 ? malloc((size_t) size + 1) : NULL;
+  if (!text || fread(text, 1, (size_t) size, file) != (size_t) size) {
+    free(text);
+    fclose(file);
+    errno = EIO;
+    return -1;
+  }
+  fclose(file);
+  text[size] = '\0';
+
+  parser_t ps = {text, set, false};
+  parse_value(&ps, "");
+  free(text);
+  if (ps.error) {
+    errno = EINVAL;
+    return -1;
+  }
+  return 0;
+}
+
+// --- Comparison ---
+
+static const metric_rule_t* find_rule(const char* key) {
+  size_t key_length = strlen(key);
+  for (size_t r = 0; r < sizeof(rules) / sizeof(rules[0]); r++) {
+    size_t suffix_length = strlen(rules[r].suffix);
+    if (key_length >= suffix_length && strcmp(key + key_length - suffix_length, rules[r].suffix) == 0) {
+      return &rules[r];
+    }
+  }
+  return NULL;
+}
+
+// The noise of a ns_per_op value is its sibling ns_spread, measured alongside it
+static double noise_of(const metric_set_t* set, const char* key) {
+  char   spread_key[CHECK_KEY_MAX];
+  size_t length = strlen(key) - strlen("ns_per_op");
+  snprintf(spread_key, sizeof(spread_key), "%.*sns_spread", (int) length, key);
+  const metric_t* spread = find_metric(set, spread_key);
+  return spread ? spread->value : 0;
+}
+
+// Compares one result file with its baseline; returns the number of regressions
+static int compare(const char* name, const metric_set_t* baseline, const metric_set_t* result) {
+  int compared = 0, regressions = 0, improvements = 0, missing = 0;
+  for (int i = 0; i < baseline->count; i++) {
+    const metric_t*      base = &baseline->items[i];
+    const metric_rule_t* rule = find_rule(base->key);
+    if (!rule) {
+      continue;
+    }
+    const metric_t* current = find_metric(result, base->key);
+    if (!current) {
+      printf("  missing    %-56s %14.3f -> (not measured)\n", base->key, base->value);
+      missing++;
+      continue;
+    }
+    compared++;
+
+    double threshold = rule->threshold * threshold_scale;
+    if (strcmp(rule->suffix, ".ns_per_op") == 0) {
+      double noise = fmax(noise_of(baseline, base->key), noise_of(result, base->key));
+      threshold    = fmax(threshold, CHECK_NOISE_MUL * noise);
+    }
+    double change    = current->value - base->value;
+    double relative  = base->value != 0 ? change / fabs(base->value) : (change != 0 ? INFINITY : 0);
+    double worse     = -rule->direction * change;  // Positive when the value got worse
+    double allowed   = fmax(threshold * fabs(base->value), rule->tolerance);
+    bool   regressed = worse > allowed;
+    bool   improved  = -worse > allowed;
+    if (regressed) {
+      regressions++;
+    } else if (improved) {
+      improvements++;
+    }
+    if (regressed || improved || verbose) {
+      printf("  %-10s %-56s %14.3f -> %14.3f  (%+.1f%%, limit %.1f%%)\n", regressed ? "REGRESSED" : improved ? "improved" : "ok", base->key,
+             base->value, current->value, 100.0 * relative, 100.0 * threshold);
+    }
+  }
+  printf("%s: %d values compared, %d regressed, %d improved, %d missing\n", name, compared, regressions, improvements, missing);
+  return regressions;
+}
+
+int main(int argc, char* argv[]) {
+  const char* baseline_dir  = "bench/baselines";
+  bool        allow_missing = false;
+  int         opt;
+  while ((opt = getopt(argc, argv, "b:s:avh")) != -1) {
+    switch (opt) {
+      case 'b': baseline_dir = optarg; break;
+      case 's': threshold_scale = atof(optarg); break;
+      case 'a': allow_missing = true; break;
+      case 'v': verbose = true; break;
+      default:
+        fprintf(stderr,
+                "Usage: %s [-b baseline_dir] [-s threshold_scale] [-a] [-v] result.json...\n"
+                "Each result is compared with the baseline of the same file name. A result without\n"
+                "a baseline fails the check unless -a allows missing baselines.\n",
+                argv[0]);
+        return 2;
+    }
+  }
+  if (optind >= argc) {
+    fprintf(stderr, "perf_check: no result files given\n");
+    return 2;
+  }
+
+  int regressions = 0, checked = 0, unchecked = 0;
+  for (int f = optind; f < argc; f++) {
+    char  result_path[1024], baseline_path[1024];
+    snprintf(result_path, sizeof(result_path), "%s", argv[f]);
+    char* name = basename(result_path);
+    snprintf(baseline_path, sizeof(baseline_path), "%s/%s", baseline_dir, name);
+
+    metric_set_t baseline = {0}, result = {0};
+    if (load_metrics(argv[f], &result) != 0) {
+      fprintf(stderr, "perf_check: cannot read result %s: %s\n", argv[f], strerror(errno));
+      return 2;
+    }
+    if (load_metrics(baseline_path, &baseline) != 0) {
+      if (errno == ENOENT) {
+        printf("%s: no baseline at %s, %s (record one with the perf-baseline target)\n", name, baseline_path,
+               allow_missing ? "skipped" : "FAILED");
+        unchecked++;
+      } else {
+        fprintf(stderr, "perf_check: cannot read baseline %s: %s\n", baseline_path, strerror(errno));
+        return 2;
+      }
+    } else {
+      regressions += compare(name, &baseline, &result);
+      checked++;
+    }
+    free(baseline.items);
+    free(result.items);
+  }
+
+  if (regressions > 0) {
+    printf("perf_check: FAILED, %d regressions against the baselines in %s\n", regressions, baseline_dir);
+    return 1;
+  }
+  if (unchecked > 0 && !allow_missing) {
+    printf("perf_check: FAILED, %d of %d results have no baseline in %s\n", unchecked, argc - optind, baseline_dir);
+    return 1;
+  }
+  if (checked == 0) {
+    printf("perf_check: nothing checked, none of the %d results has a baseline in %s\n", argc - optind, baseline_dir);
+    return 0;
+  }
+  if (unchecked > 0) {
+    printf("perf_check: passed for %d results, %d without a baseline not checked\n", checked, unchecked);
+    return 0;
+  }
+  printf("perf_check: passed, %d results within their thresholds\n", checked);
+  return 0;
+}
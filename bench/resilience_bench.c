@@ -0,0 +1,355 @@
+/*
+ * Resilience benchmark: one gateway reads a simulated inverter through fault_proxy, which injects
+ * latency, stalls, half-open connections, slow reads, connection resets and refused reconnects in
+ * turn. For every scenario it measures how long the gateway takes to publish fresh values for all
+ * tags once the fault is cleared, the longest gap in the published data, the reconnect attempts
+ * and the gateway CPU while the fault lasts and while recovering.
+ */
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "bench_util.h"
+#include "config.h"
+#include "fault_proxy.h"
+#include "logger.h"
+#include "open62541/client_config_default.h"
+#include "open62541/client_highlevel.h"
+#include "open62541/client_subscriptions.h"
+#include "sma_simulator.h"
+
+#define BENCH_FIRST_ADDRESS   31000  // Tags are S32 values from here on, two registers apart
+#define BENCH_HEALTHY_WAIT_MS 60000  // How long a scenario waits for all tags to be fresh before starting
+
+/*
+ * @brief Benchmark parameters.
+ */
+typedef struct {
+  int         tags;
+  int         poll_interval_ms;
+  int         fault_sec;           // How long each fault lasts
+  int         recovery_sec;        // How long the gateway may take to recover before the scenario fails
+  int         modbus_timeout_sec;  // Of the gateway
+  int         modbus_port;         // The simulator; the proxy listens on the next port
+  int         opcua_port;
+  const char* gateway;
+  const char* output;
+  const char* only;                // Run only this scenario
+} bench_options_t;
+
+/*
+ * @brief A fault and how it is applied.
+ */
+typedef struct {
+  const char*          name;
+  fault_proxy_faults_t faults;
+  bool                 reset_at_start;     // Reset the open connection, so the gateway has to reconnect into the fault
+  int                  reset_interval_ms;  // Keep resetting connections this often, 0 for never
+} scenario_t;
+
+static const scenario_t scenarios[] = {
+    {"baseline", {0}, false, 0},
+    {"latency_200ms", {.latency_us = 200000, .jitter_us = 100000}, false, 0},
+    {"stall", {.stall = true}, false, 0},
+    {"half_open", {.half_open = true}, false, 0},
+    {"slow_reads", {.slow_read_bytes_per_sec = 200}, false, 0},
+    {"reset_storm", {0}, true, 500},
+    {"refused_reconnect", {.refuse = true}, true, 0},
+};
+
+#define NUM_SCENARIOS ((int) (sizeof(scenarios) / sizeof(scenarios[0])))
+
+/*
+ * @brief Publication history of one tag during a scenario; the context of its MonitoredItem.
+ */
+typedef struct {
+  int64_t last_us;       // Last notification
+  int64_t max_gap_us;    // Longest time without a notification since the scenario started
+  int64_t recovered_us;  // First notification after the fault was cleared, 0 until then
+} bench_tag_t;
+
+/*
+ * @brief Measurements of one scenario.
+ */
+typedef struct {
+  bool     ran;
+  bool     recovered;
+  double   recovery_ms;       // From clearing the fault until every tag was published again
+  double   max_gap_ms;        // Longest publication gap of any tag
+  double   mean_gap_ms;       // Longest publication gap, averaged over the tags
+  double   fault_cpu_percent;
+  double   recovery_cpu_percent;
+  uint64_t connection_attempts;
+  uint64_t refused;
+  uint64_t resets;
+} scenario_result_t;
+
+static bench_tag_t* tags;
+static int          num_tags;
+static int64_t      clear_us = 0;  // When the fault was cleared, 0 while it lasts
+
+static void on_data_change(UA_Client* client, UA_UInt32 sub_id, void* sub_context, UA_UInt32 mon_id, void* mon_context,
+                           UA_DataValue* value) {
+  int64_t      now_us = bench_monotonic_us();
+  bench_tag_t* tag    = (bench_tag_t*) mon_context;
+  if (!value->hasValue) {
+    return;
+  }
+  tag->max_gap_us = now_us - tag->last_us > tag->max_gap_us ? now_us - tag->last_us : tag->max_gap_us;
+  tag->last_us    = now_us;
+  if (clear_us != 0 && tag->recovered_us == 0) {
+    tag->recovered_us = now_us;
+  }
+}
+
+static void run_client(UA_Client* client, int64_t until_us) {
+  while (bench_monotonic_us() < until_us) {
+    UA_Client_run_iterate(client, 0);
+    usleep(1000);
+  }
+}
+
+// Waits until every tag was published within the last three poll intervals
+static bool wait_healthy(UA_Client* client, const bench_options_t* options) {
+  int64_t deadline_us = bench_monotonic_us() + BENCH_HEALTHY_WAIT_MS * 1000LL;
+  while (bench_monotonic_us() < deadline_us) {
+    run_client(client, bench_monotonic_us() + options->poll_interval_ms * 1000LL);
+    int64_t oldest_us = bench_monotonic_us() - 3LL * options->poll_interval_ms * 1000;
+    int     stale     = 0;
+    for (int m = 0; m < num_tags; m++) {
+      stale += tags[m].last_us < oldest_us;
+    }
+    if (stale == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void run_scenario(const scenario_t* scenario, UA_Client* client, fault_proxy_t* proxy, pid_t gateway,
+                         const bench_options_t* options, scenario_result_t* result) {
+  memset(result, 0, sizeof(*result));
+  result->ran = true;
+  if (!wait_healthy(client, options)) {
+    fprintf(stderr, "resilience_bench: %s: the gateway did not publish all tags before the fault\n", scenario->name);
+    return;
+  }
+
+  fault_proxy_stats_t stats_start, stats_end;
+  fault_proxy_get_stats(proxy, &stats_start);
+  int64_t start_us = bench_monotonic_us();
+  for (int m = 0; m < num_tags; m++) {
+    tags[m] = (bench_tag_t) {start_us, 0, 0};
+  }
+  clear_us = 0;
+
+  // Fault period
+  double cpu_start = bench_process_cpu_sec(gateway);
+  fault_proxy_set_faults(proxy, &scenario->faults);
+  if (scenario->reset_at_start) {
+    fault_proxy_reset_connections(proxy);
+  }
+  int64_t end_us = start_us + options->fault_sec * 1000000LL;
+  for (int64_t now_us = start_us; now_us < end_us; now_us = bench_monotonic_us()) {
+    int64_t step_us = scenario->reset_interval_ms > 0 ? scenario->reset_interval_ms * 1000LL : end_us - now_us;
+    run_client(client, now_us + step_us < end_us ? now_us + step_us : end_us);
+    if (scenario->reset_interval_ms > 0) {
+      fault_proxy_reset_connections(proxy);
+    }
+  }
+  double cpu_fault = bench_process_cpu_sec(gateway);
+
+  // Recovery period
+  fault_proxy_faults_t none = {0};
+  fault_proxy_set_faults(proxy, &none);
+  clear_us             = bench_monotonic_us();
+  int64_t deadline_us  = clear_us + options->recovery_sec * 1000000LL;
+  int     num_recovered = 0;
+  while (num_recovered < num_tags && bench_monotonic_us() < deadline_us) {
+    run_client(client, bench_monotonic_us() + 10000);
+    num_recovered = 0;
+    for (int m = 0; m < num_tags; m++) {
+      num_recovered += tags[m].recovered_us != 0;
+    }
+  }
+  int64_t recovered_us = bench_monotonic_us();
+  double  cpu_end      = bench_process_cpu_sec(gateway);
+  fault_proxy_get_stats(proxy, &stats_end);
+
+  int64_t latest_us = clear_us, gap_sum_us = 0, max_gap_us = 0;
+  for (int m = 0; m < num_tags; m++) {
+    // A tag that was not published again is still in its gap
+    int64_t gap_us = tags[m].recovered_us ? tags[m].max_gap_us : recovered_us - tags[m].last_us;
+    gap_us         = gap_us > tags[m].max_gap_us ? gap_us : tags[m].max_gap_us;
+    gap_sum_us    += gap_us;
+    max_gap_us     = gap_us > max_gap_us ? gap_us : max_gap_us;
+    latest_us      = tags[m].recovered_us > latest_us ? tags[m].recovered_us : latest_us;
+  }
+  result->recovered            = num_recovered == num_tags;
+  result->recovery_ms          = (double) ((result->recovered ? latest_us : recovered_us) - clear_us) / 1000.0;
+  result->max_gap_ms           = (double) max_gap_us / 1000.0;
+  result->mean_gap_ms          = (double) gap_sum_us / num_tags / 1000.0;
+  result->fault_cpu_percent    = 100.0 * (cpu_fault - cpu_start) / options->fault_sec;
+  result->recovery_cpu_percent = recovered_us > clear_us ? 100.0 * (cpu_end - cpu_fault) / ((double) (recovered_us - clear_us) / 1e6) : 0.0;
+  result->connection_attempts  = stats_end.accepted - stats_start.accepted;
+  result->refused              = stats_end.refused - stats_start.refused;
+  result->resets               = stats_end.resets - stats_start.resets;
+
+  fprintf(stderr, "%-18s %-9s %12.0f %12.0f %12.2f %12.2f %9llu\n", scenario->name, result->recovered ? "yes" : "NO", result->recovery_ms,
+          result->max_gap_ms, result->fault_cpu_percent, result->recovery_cpu_percent, (unsigned long long) result->connection_attempts);
+}
+
+static void usage(const char* program) {
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  -m <count>  tags (default 20)\n"
+          "  -i <ms>     poll interval of the tags (default 1000)\n"
+          "  -f <sec>    duration of each fault (default 15)\n"
+          "  -R <sec>    time allowed to recover before a scenario fails (default 60)\n"
+          "  -T <sec>    Modbus timeout of the gateway (default 2)\n"
+          "  -p <port>   Modbus port of the simulator, the proxy listens on the next one (default 16020)\n"
+          "  -P <port>   OPC UA port of the gateway (default 16840)\n"
+          "  -S <name>   run only this scenario\n"
+          "  -g <path>   gateway executable (default ./modbus_opcua_gateway)\n"
+          "  -o <path>   JSON result file (default resilience_bench.json)\n"
+          "Scenarios:",
+          program);
+  for (int s = 0; s < NUM_SCENARIOS; s++) {
+    fprintf(stderr, " %s", scenarios[s].name);
+  }
+  fprintf(stderr, "\n");
+}
+
+int main(int argc, char* argv[]) {
+  bench_options_t options = {20, 1000, 15, 60, 2, 16020, 16840, "./modbus_opcua_gateway", "resilience_bench.json", NULL};
+  int             opt;
+  while ((opt = getopt(argc, argv, "m:i:f:R:T:p:P:S:g:o:h")) != -1) {
+    switch (opt) {
+      case 'm': options.tags = atoi(optarg); break;
+      case 'i': options.poll_interval_ms = atoi(optarg); break;
+      case 'f': options.fault_sec = atoi(optarg); break;
+      case 'R': options.recovery_sec = atoi(optarg); break;
+      case 'T': options.modbus_timeout_sec = atoi(optarg); break;
+      case 'p': options.modbus_port = atoi(optarg); break;
+      case 'P': options.opcua_port = atoi(optarg); break;
+      case 'S': options.only = optarg; break;
+      case 'g': options.gateway = optarg; break;
+      case 'o': options.output = optarg; break;
+      default: usage(argv[0]); return EXIT_FAILURE;
+    }
+  }
+  if (options.tags <= 0 || options.tags > 8000 || options.poll_interval_ms <= 0 || options.fault_sec <= 0 || options.recovery_sec <= 0) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  logger_init(NULL, LOG_LEVEL_WARN);
+
+  // Voltage-like tags change on every simulator update, so every successful poll is published
+  modbus_opcua_config_t config = {0};
+  config.modbus_slave_id       = 3;
+  config.num_mappings          = options.tags;
+  config.mappings              = calloc((size_t) config.num_mappings, sizeof(modbus_reg_mapping_t));
+  num_tags                     = options.tags;
+  tags                         = calloc((size_t) num_tags, sizeof(bench_tag_t));
+  for (int m = 0; m < config.num_mappings; m++) {
+    char name[64], node_id[64];
+    snprintf(name, sizeof(name), "Bench Voltage %d", m);
+    snprintf(node_id, sizeof(node_id), "bench.tag_%d", m);
+    config.mappings[m] = (modbus_reg_mapping_t) {strdup(name), BENCH_FIRST_ADDRESS + 2 * m, strdup(node_id), "S32", "FIX0", 1.0f,
+                                                 options.poll_interval_ms, 4, NULL, 0};
+  }
+
+  sma_sim_options_t sim_options;
+  sma_sim_default_options(&sim_options);
+  sim_options.base_port          = options.modbus_port;
+  sim_options.slave_id           = config.modbus_slave_id;
+  sim_options.update_interval_ms = options.poll_interval_ms / 2 > 0 ? options.poll_interval_ms / 2 : 1;
+  sma_sim_t*     sim             = sma_sim_start(&config, &sim_options);
+  fault_proxy_t* proxy           = sim ? fault_proxy_start(options.modbus_port + 1, "127.0.0.1", options.modbus_port) : NULL;
+  if (!proxy) {
+    sma_sim_stop(sim);
+    return EXIT_FAILURE;
+  }
+
+  char dir[] = "/tmp/resilience_bench.XXXXXX";
+  char config_path[256], output_path[256];
+  if (!mkdtemp(dir)) {
+    fprintf(stderr, "resilience_bench: mkdtemp failed: %s\n", strerror(errno));
+    return EXIT_FAILURE;
+  }
+  snprintf(config_path, sizeof(config_path), "%s/gateway.yaml", dir);
+  snprintf(output_path, sizeof(output_path), "%s/gateway.out", dir);
+  char log_path[256];
+  snprintf(log_path, sizeof(log_path), "%s/gateway.log", dir);
+  bench_gateway_t gateway_config = {options.modbus_port + 1, options.modbus_timeout_sec, options.opcua_port, 0, 0, log_path, dir};
+  if (bench_write_gateway_config(config_path, &gateway_config, &config) != 0) {
+    fprintf(stderr, "resilience_bench: cannot write %s\n", config_path);
+    return EXIT_FAILURE;
+  }
+  // Sampling and publishing well below the poll interval, so gaps are the gateway's
+  bench_subscription_t subscription = {50, 50, on_data_change, tags, sizeof(bench_tag_t), true};
+  pid_t                gateway      = bench_start_gateway(options.gateway, config_path, output_path, 0);
+  UA_Client*           client       = bench_start_subscriber("resilience_bench", options.opcua_port, &subscription, &config);
+
+  scenario_result_t results[NUM_SCENARIOS];
+  memset(results, 0, sizeof(results));
+  int failed = client == NULL;
+  if (client) {
+    fprintf(stderr, "%-18s %-9s %12s %12s %12s %12s %9s\n", "scenario", "recovered", "recovery ms", "max gap ms", "fault CPU %",
+            "recovery CPU %", "connects");
+    for (int s = 0; s < NUM_SCENARIOS; s++) {
+      if (!options.only || strcmp(options.only, scenarios[s].name) == 0) {
+        run_scenario(&scenarios[s], client, proxy, gateway, &options, &results[s]);
+        failed += !results[s].recovered;
+      }
+    }
+    UA_Client_disconnect(client);
+    UA_Client_delete(client);
+  }
+
+  kill(gateway, SIGTERM);
+  int status = 0;
+  waitpid(gateway, &status, 0);
+  bool exited_badly = !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+  fault_proxy_stop(proxy);
+  sma_sim_stop(sim);
+  for (int m = 0; m < config.num_mappings; m++) {
+    free(config.mappings[m].name);
+    free(config.mappings[m].opcua_node_id);
+  }
+  free(config.mappings);
+  free(tags);
+
+  FILE* out = fopen(options.output, "w");
+  if (!out) {
+    fprintf(stderr, "resilience_bench: cannot write %s: %s\n", options.output, strerror(errno));
+    return EXIT_FAILURE;
+  }
+  fprintf(out, "{\n  \"benchmark\": \"resilience\",\n");
+  fprintf(out, "  \"parameters\": {\"tags\": %d, \"poll_interval_ms\": %d, \"fault_sec\": %d, \"recovery_sec\": %d, \"modbus_timeout_sec\": %d},\n",
+          options.tags, options.poll_interval_ms, options.fault_sec, options.recovery_sec, options.modbus_timeout_sec);
+  fprintf(out, "  \"scenarios\": [");
+  bool first = true;
+  for (int s = 0; s < NUM_SCENARIOS; s++) {
+    const scenario_result_t* r = &results[s];
+    if (!r->ran) {
+      continue;
+    }
+    fprintf(out, "%s\n    {\"name\": \"%s\", \"recovered\": %s, \"recovery_ms\": %.1f, \"max_gap_ms\": %.1f, \"mean_gap_ms\": %.1f,",
+            first ? "" : ",", scenarios[s].name, r->recovered ? "true" : "false", r->recovery_ms, r->max_gap_ms, r->mean_gap_ms);
+    fprintf(out, " \"fault_cpu_percent\": %.2f, \"recovery_cpu_percent\": %.2f, \"connection_attempts\": %llu, \"refused\": %llu, \"resets\": %llu}",
+            r->fault_cpu_percent, r->recovery_cpu_percent, (unsigned long long) r->connection_attempts, (unsigned long long) r->refused,
+            (unsigned long long) r->resets);
+    first = false;
+  }
+  fprintf(out, "\n  ],\n  \"gateway_exited_cleanly\": %s\n}\n", exited_badly ? "false" : "true");
+  fclose(out);
+
+  fprintf(stderr, "resilience_bench: results in %s (gateway log in %s)\n", options.output, dir);
+  logger_close();
+  return failed || exited_badly ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,262 @@
+/*
+ * Scaling benchmark: runs fleet_bench for every combination of device count, tags per device and
+ * gateway CPUs, and reports the throughput, CPU and memory of each point as a table and as CSV
+ * for plotting. The scaling efficiency of a point is its throughput per device relative to the
+ * smallest device count with the same tags and CPUs; where it drops is where adding inverters
+ * stops being linear on that machine.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define SCALE_MAX_VALUES 32  // Per swept parameter
+
+/*
+ * @brief Benchmark parameters.
+ */
+typedef struct {
+  int         devices[SCALE_MAX_VALUES];
+  int         num_devices;
+  int         tags[SCALE_MAX_VALUES];
+  int         num_tags;
+  int         cpus[SCALE_MAX_VALUES];
+  int         num_cpus;
+  int         duration_sec;  // Measured period of every point
+  int         warmup_sec;
+  int         poll_interval_ms;
+  int         subscribers;   // Per gateway
+  double      efficiency;    // Points below this scaling efficiency are flagged
+  const char* fleet_bench;
+  const char* gateway;
+  const char* output;
+} scale_options_t;
+
+/*
+ * @brief Result of one point of the sweep.
+ */
+typedef struct {
+  int    devices;
+  int    tags_per_device;
+  int    cpus;
+  bool   ok;
+  double notifications_per_sec;  // Values published to the subscribers
+  double modbus_requests_per_sec;
+  double cpu_percent;            // Of all gateways together, 100 per busy CPU
+  double cpu_us_per_tag;
+  double rss_bytes;              // Of all gateways together, at the end
+  double rss_per_gateway_bytes;
+  double staleness_p50_ms;
+  double staleness_p99_ms;
+  double efficiency;
+} scale_point_t;
+
+// Parses a comma separated list of positive numbers; returns the count, or -1 if invalid
+static int parse_list(const char* text, int* values) {
+  int count = 0;
+  for (const char* p = text; *p;) {
+    char* end;
+    long  value = strtol(p, &end, 10);
+    if (end == p || value <= 0 || count == SCALE_MAX_VALUES || (*end != ',' && *end != '\0')) {
+      return -1;
+    }
+    values[count++] = (int) value;
+    p               = *end == ',' ? end + 1 : end;
+  }
+  return count;
+}
+
+// Returns the number following the first "key": in a fleet_bench result; keys are unique there
+static double json_number(const char* text, const char* key) {
+  char pattern[64];
+  snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+  const char* p = strstr(text, pattern);
+  return p ? strtod(p + strlen(pattern), NULL) : 0.0;
+}
+
+static char* read_file(const char* path) {
+  FILE* f = fopen(path, "rb");
+  if (!f) {
+    return NULL;
+  }
+  fseek(f, 0, SEEK_END);
+  long  size = ftell(f);
+  char* text = size >= 0 ? malloc((size_t) size + 1) : NULL;
+  rewind(f);
+  if (text && fread(text, 1, (size_t) size, f) == (size_t) size) {
+    text[size] = '\0';
+  } else {
+    free(text);
+    text = NULL;
+  }
+  fclose(f);
+  return text;
+}
+
+// Runs fleet_bench for one point; its output goes to <dir>/<name>.log and its result to <dir>/<name>.json
+static void run_point(const scale_options_t* options, const char* dir, scale_point_t* point) {
+  char name[64], json_path[256], log_path[256];
+  snprintf(name, sizeof(name), "n%d_m%d_c%d", point->devices, point->tags_per_device, point->cpus);
+  snprintf(json_path, sizeof(json_path), "%s/%s.json", dir, name);
+  snprintf(log_path, sizeof(log_path), "%s/%s.log", dir, name);
+
+  char devices[16], tags[16], cpus[16], subscribers[16], duration[16], warmup[16], poll[16];
+  snprintf(devices, sizeof(devices), "%d", point->devices);
+  snprintf(tags, sizeof(tags), "%d", point->tags_per_device);
+  snprintf(cpus, sizeof(cpus), "%d", point->cpus);
+  snprintf(subscribers, sizeof(subscribers), "%d", options->subscribers);
+  snprintf(duration, sizeof(duration), "%d", options->duration_sec);
+  snprintf(warmup, sizeof(warmup), "%d", options->warmup_sec);
+  snprintf(poll, sizeof(poll), "%d", options->poll_interval_ms);
+  // Port ranges far apart, so 1000 devices fit without the Modbus and OPC UA ports overlapping
+  char* argv[] = {(char*) options->fleet_bench, "-n", devices, "-m", tags, "-c", cpus, "-k", subscribers, "-t", duration, "-w", warmup,
+                  "-i", poll, "-u", poll, "-p", "20000", "-P", "30000", "-g", (char*) options->gateway, "-o", json_path, NULL};
+
+  unlink(json_path);
+  pid_t pid = fork();
+  if (pid == 0) {
+    int fd = open(log_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+      dup2(fd, STDOUT_FILENO);
+      dup2(fd, STDERR_FILENO);
+      close(fd);
+    }
+    execv(options->fleet_bench, argv);
+    _exit(127);
+  }
+  int status = 0;
+  if (pid < 0 || waitpid(pid, &status, 0) < 0) {
+    return;
+  }
+
+  // A point with failed subscribers or gateways still has figures worth plotting, but is marked
+  char* text = read_file(json_path);
+  if (!text) {
+    return;
+  }
+  point->ok                      = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+  point->notifications_per_sec   = json_number(text, "notifications_per_sec");
+  point->modbus_requests_per_sec = json_number(text, "modbus_requests_per_sec");
+  point->cpu_percent             = json_number(text, "gateway_cpu_percent");
+  point->cpu_us_per_tag          = json_number(text, "gateway_cpu_us_per_tag");
+  point->rss_bytes               = json_number(text, "end");
+  point->rss_per_gateway_bytes   = json_number(text, "per_gateway");
+  point->staleness_p50_ms        = json_number(text, "p50");
+  point->staleness_p99_ms        = json_number(text, "p99");
+  free(text);
+}
+
+static void usage(const char* program) {
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  -n <list>   device counts, one gateway process each (default 1,10,50,100,250,500,1000)\n"
+          "  -m <list>   tags per device (default 10,40)\n"
+          "  -c <list>   CPUs the gateways run on (default 1,2,4; counts above the online CPUs are skipped)\n"
+          "  -t <sec>    measured duration of every point (default 30)\n"
+          "  -w <sec>    warm-up of every point (default 5)\n"
+          "  -i <ms>     poll interval of the tags (default 1000)\n"
+          "  -k <count>  OPC UA subscribers per gateway (default 1)\n"
+          "  -e <ratio>  flag points whose scaling efficiency is below this (default 0.9)\n"
+          "  -f <path>   fleet_bench executable (default ./fleet_bench)\n"
+          "  -g <path>   gateway executable (default ./modbus_opcua_gateway)\n"
+          "  -o <path>   CSV result file (default scale_bench.csv)\n",
+          program);
+}
+
+int main(int argc, char* argv[]) {
+  scale_options_t options = {{1, 10, 50, 100, 250, 500, 1000}, 7, {10, 40}, 2, {1, 2, 4}, 3, 30, 5, 1000, 1, 0.9,
+                             "./fleet_bench", "./modbus_opcua_gateway", "scale_bench.csv"};
+  int             opt;
+  while ((opt = getopt(argc, argv, "n:m:c:t:w:i:k:e:f:g:o:h")) != -1) {
+    switch (opt) {
+      case 'n': options.num_devices = parse_list(optarg, options.devices); break;
+      case 'm': options.num_tags = parse_list(optarg, options.tags); break;
+      case 'c': options.num_cpus = parse_list(optarg, options.cpus); break;
+      case 't': options.duration_sec = atoi(optarg); break;
+      case 'w': options.warmup_sec = atoi(optarg); break;
+      case 'i': options.poll_interval_ms = atoi(optarg); break;
+      case 'k': options.subscribers = atoi(optarg); break;
+      case 'e': options.efficiency = atof(optarg); break;
+      case 'f': options.fleet_bench = optarg; break;
+      case 'g': options.gateway = optarg; break;
+      case 'o': options.output = optarg; break;
+      default: usage(argv[0]); return EXIT_FAILURE;
+    }
+  }
+  if (options.num_devices <= 0 || options.num_tags <= 0 || options.num_cpus <= 0 || options.duration_sec <= 0 || options.warmup_sec < 0 ||
+      options.poll_interval_ms <= 0 || options.subscribers < 0) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  // fleet_bench holds a listening and a connected socket per device plus the client connections
+  struct rlimit files;
+  if (getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur < files.rlim_max) {
+    files.rlim_cur = files.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &files);
+  }
+
+  char dir[] = "/tmp/scale_bench.XXXXXX";
+  if (!mkdtemp(dir)) {
+    fprintf(stderr, "scale_bench: mkdtemp failed: %s\n", strerror(errno));
+    return EXIT_FAILURE;
+  }
+  FILE* out = fopen(options.output, "w");
+  if (!out) {
+    fprintf(stderr, "scale_bench: cannot write %s: %s\n", options.output, strerror(errno));
+    return EXIT_FAILURE;
+  }
+  fprintf(out, "devices,tags_per_device,cpus,tags,ok,notifications_per_sec,modbus_requests_per_sec,gateway_cpu_percent,"
+               "gateway_cpu_us_per_tag,gateway_rss_bytes,rss_per_gateway_bytes,staleness_p50_ms,staleness_p99_ms,efficiency\n");
+  printf("%8s %6s %5s %8s %14s %12s %8s %10s %12s %10s %10s %10s\n", "devices", "tags", "cpus", "total", "values/s", "requests/s", "CPU %",
+         "us/tag", "RSS MiB", "p50 ms", "p99 ms", "efficiency");
+
+  int online_cpus = (int) sysconf(_SC_NPROCESSORS_ONLN);
+  int flagged     = 0;
+  for (int c = 0; c < options.num_cpus; c++) {
+    if (options.cpus[c] > online_cpus) {
+      fprintf(stderr, "scale_bench: skipping %d CPUs, only %d are online\n", options.cpus[c], online_cpus);
+      continue;
+    }
+    for (int m = 0; m < options.num_tags; m++) {
+      double reference = 0.0;  // Throughput per device of the first point of this series
+      for (int n = 0; n < options.num_devices; n++) {
+        scale_point_t point   = {0};
+        point.devices         = options.devices[n];
+        point.tags_per_device = options.tags[m];
+        point.cpus            = options.cpus[c];
+        run_point(&options, dir, &point);
+        // Without subscribers nothing is published, so the Modbus request rate is the throughput
+        double throughput = options.subscribers > 0 ? point.notifications_per_sec : point.modbus_requests_per_sec;
+        double per_device = throughput / point.devices;
+        if (reference == 0.0) {
+          reference = per_device;
+        }
+        point.efficiency = reference > 0.0 ? per_device / reference : 0.0;
+        bool low         = !point.ok || point.efficiency < options.efficiency;
+        flagged         += low;
+
+        printf("%8d %6d %5d %8d %14.0f %12.0f %8.1f %10.2f %12.1f %10.1f %10.1f %9.2f%s\n", point.devices, point.tags_per_device, point.cpus,
+               point.devices * point.tags_per_device, point.notifications_per_sec, point.modbus_requests_per_sec, point.cpu_percent,
+               point.cpu_us_per_tag, point.rss_bytes / (1024.0 * 1024.0), point.staleness_p50_ms, point.staleness_p99_ms, point.efficiency,
+               !point.ok ? " failed" : low ? " <" : "");
+        fflush(stdout);
+        fprintf(out, "%d,%d,%d,%d,%d,%.1f,%.1f,%.2f,%.3f,%.0f,%.0f,%.3f,%.3f,%.3f\n", point.devices, point.tags_per_device, point.cpus,
+                point.devices * point.tags_per_device, point.ok, point.notifications_per_sec, point.modbus_requests_per_sec,
+                point.cpu_percent, point.cpu_us_per_tag, point.rss_bytes, point.rss_per_gateway_bytes, point.staleness_p50_ms,
+                point.staleness_p99_ms, point.efficiency);
+        fflush(out);
+      }
+    }
+  }
+  fclose(out);
+
+  fprintf(stderr, "scale_bench: %d points below %.2f efficiency or failed; CSV in %s, per-point results in %s\n", flagged, options.efficiency,
+          options.output, dir);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,467 @@
+/*
+ * Soak test: one gateway polls a simulated inverter at an accelerated rate for hours while OPC UA
+ * clients keep connecting, subscribing, reading history and disconnecting. The gateway's RSS,
+ * allocator heap and open file descriptors are sampled throughout; the test fails if any of them
+ * grew by more than its bound between the start and the end of the period after the warm-up.
+ */
+#include <dirent.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "bench_util.h"
+#include "config.h"
+#include "logger.h"
+#include "open62541/client_config_default.h"
+#include "open62541/client_highlevel.h"
+#include "open62541/client_subscriptions.h"
+#include "sma_simulator.h"
+
+#define SOAK_FIRST_ADDRESS   31000        // Tags are S32 values from here on, two registers apart
+#define SOAK_MAX_CLIENTS     64
+#define SOAK_HISTORY_ENTRIES 1000         // History per tag; the ring buffers are full within the warm-up
+#define SOAK_METRICS_MAX     (512 * 1024)  // Largest metrics response read
+
+/*
+ * @brief Benchmark parameters.
+ */
+typedef struct {
+  int         duration_sec;      // Whole run, warm-up included
+  int         warmup_sec;        // Growth before this is not counted
+  int         sample_sec;
+  int         tags;
+  int         poll_interval_ms;
+  int         clients;           // Connected at any time; each is replaced after its lifetime
+  int         client_lifetime_sec;
+  double      rss_bound_mb;      // Allowed growth after the warm-up
+  double      heap_bound_mb;
+  int         fd_bound;
+  int         modbus_port;
+  int         opcua_port;
+  int         metrics_port;
+  const char* gateway;
+  const char* output;
+  const char* samples;           // CSV of all samples, or NULL
+} soak_options_t;
+
+/*
+ * @brief One sample of the gateway's resources.
+ */
+typedef struct {
+  double time_sec;
+  double rss_bytes;
+  double heap_bytes;     // In use, from the allocator; 0 if the gateway does not report it
+  double heap_free_bytes;
+  double fds;
+  double sessions;
+  double history_bytes;
+  double cpu_sec;
+} soak_sample_t;
+
+/*
+ * @brief A churning client and when it is replaced.
+ */
+typedef struct {
+  UA_Client* client;
+  int64_t    expires_us;
+} soak_client_t;
+
+static int process_fds(pid_t pid) {
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%d/fd", (int) pid);
+  DIR* dir = opendir(path);
+  if (!dir) {
+    return 0;
+  }
+  int count = 0;
+  for (struct dirent* entry = readdir(dir); entry; entry = readdir(dir)) {
+    count += entry->d_name[0] != '.';
+  }
+  closedir(dir);
+  return count;
+}
+
+// Fetches the gateway's metrics; returns a malloc'ed text, or NULL if the endpoint does not answer
+static char* scrape_metrics(int port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return NULL;
+  }
+  struct timeval     timeout = {2, 0};
+  struct sockaddr_in addr    = {0};
+  addr.sin_family            = AF_INET;
+  addr.sin_port              = htons((uint16_t) port);
+  addr.sin_addr.s_addr       = htonl(INADDR_LOOPBACK);
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  static const char request[] = "GET /metrics HTTP/1.1\r\nHost: 127.0.0.1\r\nConnection: close\r\n\r\n";
+  char*             text      = malloc(SOAK_METRICS_MAX);
+  size_t            len       = 0;
+  if (!text || connect(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0 || send(fd, request, sizeof(request) - 1, 0) < 0) {
+    free(text);
+    close(fd);
+    return NULL;
+  }
+  for (ssize_t n; len < SOAK_METRICS_MAX - 1 && (n = recv(fd, text + len, SOAK_METRICS_MAX - 1 - len, 0)) > 0;) {
+    len += (size_t) n;
+  }
+  close(fd);
+  text[len] = '\0';
+  return text;
+}
+
+// Returns the value of the first sample line starting with 'series' (name plus labels), or 0
+static double metric_value(const char* text, const char* series) {
+  size_t length = strlen(series);
+  for (const char* line = text; line; line = strchr(line, '\n') ? strchr(line, '\n') + 1 : NULL) {
+    if (strncmp(line, series, length) == 0 && line[length] == ' ') {
+      return strtod(line + length + 1, NULL);
+    }
+  }
+  return 0.0;
+}
+
+static UA_Boolean on_history_data(UA_Client* client, const UA_NodeId* node_id, UA_Boolean more_data, const UA_ExtensionObject* data,
+                                  void* context) {
+  return true;  // Follow the continuation points, so they are released by the server as well
+}
+
+static void on_data_change(UA_Client* client, UA_UInt32 sub_id, void* sub_context, UA_UInt32 mon_id, void* mon_context,
+                           UA_DataValue* value) {
+}
+
+// Connects a client, subscribes to all tags and reads the history of one of them
+static UA_Client* start_client(int serial, const soak_options_t* options, const modbus_opcua_config_t* config) {
+  char url[64];
+  snprintf(url, sizeof(url), "opc.tcp://127.0.0.1:%d", options->opcua_port);
+  UA_Client* client = UA_Client_new();
+  UA_ClientConfig_setDefault(UA_Client_getConfig(client));
+  if (UA_Client_connect(client, url) != UA_STATUSCODE_GOOD) {
+    UA_Client_delete(client);
+    return NULL;
+  }
+
+  UA_CreateSubscriptionRequest  request  = UA_CreateSubscriptionRequest_default();
+  UA_CreateSubscriptionResponse response = UA_Client_Subscriptions_create(client, request, NULL, NULL, NULL);
+  if (response.responseHeader.serviceResult == UA_STATUSCODE_GOOD) {
+    for (int m = 0; m < config->num_mappings; m++) {
+      UA_MonitoredItemCreateRequest item = UA_MonitoredItemCreateRequest_default(UA_NODEID_STRING(1, config->mappings[m].opcua_node_id));
+      UA_Client_MonitoredItems_createDataChange(client, response.subscriptionId, UA_TIMESTAMPSTORETURN_BOTH, item, NULL, on_data_change,
+                                                NULL);
+    }
+  }
+  UA_NodeId   node_id = UA_NODEID_STRING(1, config->mappings[serial % config->num_mappings].opcua_node_id);
+  UA_DateTime now     = UA_DateTime_now();
+  UA_Client_HistoryRead_raw(client, &node_id, on_history_data, now - 60 * UA_DATETIME_SEC, now, UA_STRING_NULL, false, 100,
+                            UA_TIMESTAMPSTORETURN_BOTH, NULL);
+  return client;
+}
+
+static void take_sample(pid_t gateway, const soak_options_t* options, double time_sec, soak_sample_t* sample) {
+  sample->time_sec  = time_sec;
+  sample->rss_bytes = (double) bench_process_rss(gateway);
+  sample->fds       = process_fds(gateway);
+  sample->cpu_sec   = bench_process_cpu_sec(gateway);
+  char* text        = scrape_metrics(options->metrics_port);
+  if (text) {
+    sample->heap_bytes      = metric_value(text, "process_heap_bytes{state=\"in_use\"}");
+    sample->heap_free_bytes = metric_value(text, "process_heap_bytes{state=\"free\"}");
+    sample->sessions        = metric_value(text, "modbus_gateway_opcua_sessions");
+    sample->history_bytes   = metric_value(text, "modbus_gateway_history_bytes");
+    free(text);
+  }
+}
+
+static int compare_doubles(const void* a, const void* b) {
+  double x = *(const double*) a, y = *(const double*) b;
+  return (x > y) - (x < y);
+}
+
+// Median of one field over samples [from, to); the median keeps single spikes from deciding the result
+static double window_median(const soak_sample_t* samples, int from, int to, size_t offset) {
+  double* values = calloc((size_t) (to - from), sizeof(double));
+  if (!values) {
+    return 0.0;
+  }
+  for (int i = from; i < to; i++) {
+    values[i - from] = *(const double*) ((const char*) &samples[i] + offset);
+  }
+  qsort(values, (size_t) (to - from), sizeof(double), compare_doubles);
+  double median = values[(to - from) / 2];
+  free(values);
+  return median;
+}
+
+// Least-squares slope of one field over samples [from, to), per hour
+static double slope_per_hour(const soak_sample_t* samples, int from, int to, size_t offset) {
+  double n = to - from, sum_t = 0.0, sum_v = 0.0, sum_tt = 0.0, sum_tv = 0.0;
+  for (int i = from; i < to; i++) {
+    double t = samples[i].time_sec, v = *(const double*) ((const char*) &samples[i] + offset);
+    sum_t += t;
+    sum_v += v;
+    sum_tt += t * t;
+    sum_tv += t * v;
+  }
+  double denominator = n * sum_tt - sum_t * sum_t;
+  return denominator > 0.0 ? 3600.0 * (n * sum_tv - sum_t * sum_v) / denominator : 0.0;
+}
+
+static void usage(const char* program) {
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  -d <sec>    duration, warm-up included (default 14400)\n"
+          "  -w <sec>    warm-up, growth before it is not counted (default 900)\n"
+          "  -s <sec>    sample interval (default 10)\n"
+          "  -m <count>  tags (default 100)\n"
+          "  -i <ms>     poll interval of the tags (default 50)\n"
+          "  -k <count>  connected OPC UA clients, each replaced after its lifetime (default 4)\n"
+          "  -l <sec>    client lifetime (default 10)\n"
+          "  -r <MiB>    allowed RSS growth after the warm-up (default 8)\n"
+          "  -H <MiB>    allowed heap growth after the warm-up (default 4)\n"
+          "  -F <count>  allowed growth of open file descriptors after the warm-up (default 2)\n"
+          "  -p <port>   Modbus port of the simulator (default 17020)\n"
+          "  -P <port>   OPC UA port of the gateway (default 17840)\n"
+          "  -M <port>   metrics port of the gateway (default 17464)\n"
+          "  -g <path>   gateway executable (default ./modbus_opcua_gateway)\n"
+          "  -o <path>   JSON result file (default soak_bench.json)\n"
+          "  -c <path>   CSV file of all samples\n",
+          program);
+}
+
+int main(int argc, char* argv[]) {
+  soak_options_t options = {14400, 900, 10, 100, 50, 4, 10, 8.0, 4.0, 2, 17020, 17840, 17464, "./modbus_opcua_gateway", "soak_bench.json",
+                            NULL};
+  int            opt;
+  while ((opt = getopt(argc, argv, "d:w:s:m:i:k:l:r:H:F:p:P:M:g:o:c:h")) != -1) {
+    switch (opt) {
+      case 'd': options.duration_sec = atoi(optarg); break;
+      case 'w': options.warmup_sec = atoi(optarg); break;
+      case 's': options.sample_sec = atoi(optarg); break;
+      case 'm': options.tags = atoi(optarg); break;
+      case 'i': options.poll_interval_ms = atoi(optarg); break;
+      case 'k': options.clients = atoi(optarg); break;
+      case 'l': options.client_lifetime_sec = atoi(optarg); break;
+      case 'r': options.rss_bound_mb = atof(optarg); break;
+      case 'H': options.heap_bound_mb = atof(optarg); break;
+      case 'F': options.fd_bound = atoi(optarg); break;
+      case 'p': options.modbus_port = atoi(optarg); break;
+      case 'P': options.opcua_port = atoi(optarg); break;
+      case 'M': options.metrics_port = atoi(optarg); break;
+      case 'g': options.gateway = optarg; break;
+      case 'o': options.output = optarg; break;
+      case 'c': options.samples = optarg; break;
+      default: usage(argv[0]); return EXIT_FAILURE;
+    }
+  }
+  if (options.duration_sec <= 0 || options.warmup_sec < 0 || options.sample_sec <= 0 || options.tags <= 0 || options.tags > 8000 ||
+      options.poll_interval_ms <= 0 || options.clients < 0 || options.clients > SOAK_MAX_CLIENTS || options.client_lifetime_sec <= 0) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  // Growth is judged on the median of the first and the last tenth of the measured samples
+  int max_samples = options.duration_sec / options.sample_sec + 2;
+  if ((options.duration_sec - options.warmup_sec) / options.sample_sec < 20) {
+    fprintf(stderr, "soak_bench: the period after the warm-up must hold at least 20 samples\n");
+    return EXIT_FAILURE;
+  }
+  logger_init(NULL, LOG_LEVEL_WARN);
+
+  // Voltage-like tags change on every simulator update, so every poll is published and appended to the
+  // tag's history; once the ring buffers are full, every poll replaces the oldest entry
+  modbus_opcua_config_t config = {0};
+  config.modbus_slave_id       = 3;
+  config.num_mappings          = options.tags;
+  config.mappings              = calloc((size_t) config.num_mappings, sizeof(modbus_reg_mapping_t));
+  for (int m = 0; m < config.num_mappings; m++) {
+    char name[64], node_id[64];
+    snprintf(name, sizeof(name), "Soak Voltage %d", m);
+    snprintf(node_id, sizeof(node_id), "soak.tag_%d", m);
+    config.mappings[m] = (modbus_reg_mapping_t) {strdup(name), SOAK_FIRST_ADDRESS + 2 * m, strdup(node_id), "S32", "FIX0", 1.0f,
+                                                 options.poll_interval_ms, 4, NULL, 0};
+  }
+
+  sma_sim_options_t sim_options;
+  sma_sim_default_options(&sim_options);
+  sim_options.base_port          = options.modbus_port;
+  sim_options.slave_id           = config.modbus_slave_id;
+  sim_options.update_interval_ms = options.poll_interval_ms;
+  sma_sim_t* sim                 = sma_sim_start(&config, &sim_options);
+  if (!sim) {
+    return EXIT_FAILURE;
+  }
+
+  char dir[] = "/tmp/soak_bench.XXXXXX";
+  char config_path[256], output_path[256];
+  if (!mkdtemp(dir)) {
+    fprintf(stderr, "soak_bench: mkdtemp failed: %s\n", strerror(errno));
+    return EXIT_FAILURE;
+  }
+  snprintf(config_path, sizeof(config_path), "%s/gateway.yaml", dir);
+  snprintf(output_path, sizeof(output_path), "%s/gateway.out", dir);
+  // Metrics and history enabled; the simulator serves the same mappings
+  char log_path[256];
+  snprintf(log_path, sizeof(log_path), "%s/gateway.log", dir);
+  bench_gateway_t gateway_config = {options.modbus_port, 5, options.opcua_port, SOAK_HISTORY_ENTRIES, options.metrics_port, log_path, dir};
+  if (bench_write_gateway_config(config_path, &gateway_config, &config) != 0) {
+    fprintf(stderr, "soak_bench: cannot write %s\n", config_path);
+    return EXIT_FAILURE;
+  }
+  pid_t gateway = bench_start_gateway(options.gateway, config_path, output_path, 0);
+
+  // The first client waits for the gateway to come up
+  soak_client_t clients[SOAK_MAX_CLIENTS] = {{0}};
+  int64_t       start_us                  = bench_monotonic_us();
+  UA_Client*    probe                     = NULL;
+  while (!probe && bench_monotonic_us() - start_us < BENCH_CONNECT_WAIT_MS * 1000LL) {
+    probe = start_client(0, &options, &config);
+    if (!probe) {
+      usleep(200000);
+    }
+  }
+  if (!probe) {
+    fprintf(stderr, "soak_bench: the gateway does not accept OPC UA connections on port %d\n", options.opcua_port);
+    kill(gateway, SIGTERM);
+    waitpid(gateway, NULL, 0);
+    sma_sim_stop(sim);
+    return EXIT_FAILURE;
+  }
+  UA_Client_disconnect(probe);
+  UA_Client_delete(probe);
+
+  soak_sample_t* samples        = calloc((size_t) max_samples, sizeof(soak_sample_t));
+  int            num_samples    = 0;
+  int            failed_clients = 0;
+  uint64_t       sessions       = 0;
+  bool           gateway_died   = false;
+  start_us                      = bench_monotonic_us();
+  int64_t end_us                = start_us + options.duration_sec * 1000000LL;
+  int64_t next_sample_us        = start_us;
+  for (int k = 0; k < options.clients; k++) {
+    // Staggered, so clients come and go one at a time
+    clients[k].expires_us = start_us + (int64_t) options.client_lifetime_sec * 1000000LL * k / options.clients;
+  }
+
+  while (!gateway_died && bench_monotonic_us() < end_us) {
+    int64_t now_us = bench_monotonic_us();
+    for (int k = 0; k < options.clients; k++) {
+      if (now_us >= clients[k].expires_us) {
+        if (clients[k].client) {
+          UA_Client_disconnect(clients[k].client);
+          UA_Client_delete(clients[k].client);
+        }
+        clients[k].client     = start_client((int) sessions, &options, &config);
+        clients[k].expires_us = bench_monotonic_us() + options.client_lifetime_sec * 1000000LL;
+        failed_clients       += clients[k].client == NULL;
+        sessions++;
+      } else if (clients[k].client) {
+        UA_Client_run_iterate(clients[k].client, 0);
+      }
+    }
+
+    if (now_us >= next_sample_us && num_samples < max_samples) {
+      take_sample(gateway, &options, (double) (now_us - start_us) / 1e6, &samples[num_samples]);
+      const soak_sample_t* s = &samples[num_samples++];
+      if ((int) s->time_sec % 60 < options.sample_sec) {
+        fprintf(stderr, "soak_bench: %5.0f min  RSS %8.1f MiB  heap %8.1f MiB  fds %4.0f  sessions %3.0f  history %8.1f MiB\n",
+                s->time_sec / 60.0, s->rss_bytes / 1048576.0, s->heap_bytes / 1048576.0, s->fds, s->sessions, s->history_bytes / 1048576.0);
+      }
+      next_sample_us += options.sample_sec * 1000000LL;
+    }
+    gateway_died = waitpid(gateway, NULL, WNOHANG) == gateway;
+    usleep(1000);
+  }
+
+  for (int k = 0; k < options.clients; k++) {
+    if (clients[k].client) {
+      UA_Client_disconnect(clients[k].client);
+      UA_Client_delete(clients[k].client);
+    }
+  }
+  int status = 0;
+  if (!gateway_died) {
+    kill(gateway, SIGTERM);
+    waitpid(gateway, &status, 0);
+  }
+  bool exited_badly = gateway_died || !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+  sma_sim_stop(sim);
+  for (int m = 0; m < config.num_mappings; m++) {
+    free(config.mappings[m].name);
+    free(config.mappings[m].opcua_node_id);
+  }
+  free(config.mappings);
+
+  if (options.samples) {
+    FILE* csv = fopen(options.samples, "w");
+    if (csv) {
+      fprintf(csv, "time_sec,rss_bytes,heap_bytes,heap_free_bytes,fds,sessions,history_bytes,cpu_sec\n");
+      for (int i = 0; i < num_samples; i++) {
+        const soak_sample_t* s = &samples[i];
+        fprintf(csv, "%.1f,%.0f,%.0f,%.0f,%.0f,%.0f,%.0f,%.2f\n", s->time_sec, s->rss_bytes, s->heap_bytes, s->heap_free_bytes, s->fds,
+                s->sessions, s->history_bytes, s->cpu_sec);
+      }
+      fclose(csv);
+    }
+  }
+
+  // Growth between the first and the last tenth of the samples after the warm-up
+  int first = 0;
+  while (first < num_samples && samples[first].time_sec < options.warmup_sec) {
+    first++;
+  }
+  int    window     = (num_samples - first) / 10 > 3 ? (num_samples - first) / 10 : 3;
+  bool   measured   = num_samples - first >= 2 * window;
+  double rss_growth = 0.0, heap_growth = 0.0, fd_growth = 0.0, rss_slope = 0.0, heap_slope = 0.0;
+  if (measured) {
+    rss_growth  = window_median(samples, num_samples - window, num_samples, offsetof(soak_sample_t, rss_bytes)) -
+                  window_median(samples, first, first + window, offsetof(soak_sample_t, rss_bytes));
+    heap_growth = window_median(samples, num_samples - window, num_samples, offsetof(soak_sample_t, heap_bytes)) -
+                  window_median(samples, first, first + window, offsetof(soak_sample_t, heap_bytes));
+    fd_growth   = window_median(samples, num_samples - window, num_samples, offsetof(soak_sample_t, fds)) -
+                  window_median(samples, first, first + window, offsetof(soak_sample_t, fds));
+    rss_slope   = slope_per_hour(samples, first, num_samples, offsetof(soak_sample_t, rss_bytes));
+    heap_slope  = slope_per_hour(samples, first, num_samples, offsetof(soak_sample_t, heap_bytes));
+  }
+  bool   heap_reported = num_samples > 0 && samples[num_samples - 1].heap_bytes > 0.0;
+  bool   rss_failed    = rss_growth > options.rss_bound_mb * 1048576.0;
+  bool   heap_failed   = heap_growth > options.heap_bound_mb * 1048576.0;
+  bool   fd_failed     = fd_growth > options.fd_bound;
+  bool   failed        = !measured || rss_failed || heap_failed || fd_failed || exited_badly;
+  double run_sec       = num_samples > 0 ? samples[num_samples - 1].time_sec : 0.0;
+  double cpu_percent   = num_samples > 1 && run_sec > samples[0].time_sec
+                             ? 100.0 * (samples[num_samples - 1].cpu_sec - samples[0].cpu_sec) / (run_sec - samples[0].time_sec)
+                             : 0.0;
+  free(samples);
+
+  FILE* out = fopen(options.output, "w");
+  if (!out) {
+    fprintf(stderr, "soak_bench: cannot write %s: %s\n", options.output, strerror(errno));
+    return EXIT_FAILURE;
+  }
+  fprintf(out, "{\n  \"benchmark\": \"soak\",\n");
+  fprintf(out, "  \"parameters\": {\"duration_sec\": %d, \"warmup_sec\": %d, \"tags\": %d, \"poll_interval_ms\": %d, \"clients\": %d, "
+               "\"client_lifetime_sec\": %d},\n",
+          options.duration_sec, options.warmup_sec, options.tags, options.poll_interval_ms, options.clients, options.client_lifetime_sec);
+  fprintf(out, "  \"run_sec\": %.0f,\n  \"sessions\": %llu,\n  \"failed_clients\": %d,\n  \"gateway_cpu_percent\": %.2f,\n", run_sec,
+          (unsigned long long) sessions, failed_clients, cpu_percent);
+  fprintf(out, "  \"growth\": {\"measured\": %s, \"rss_bytes\": %.0f, \"heap_bytes\": %.0f, \"fds\": %.0f, \"rss_bytes_per_hour\": %.0f, "
+               "\"heap_bytes_per_hour\": %.0f},\n",
+          measured ? "true" : "false", rss_growth, heap_growth, fd_growth, rss_slope, heap_slope);
+  fprintf(out, "  \"heap_reported\": %s,\n  \"passed\": %s,\n  \"gateway_exited_cleanly\": %s\n}\n", heap_reported ? "true" : "false",
+          failed ? "false" : "true", exited_badly ? "false" : "true");
+  fclose(out);
+
+  fprintf(stderr, "soak_bench: %s after %.0f s and %llu sessions; growth after warm-up: RSS %.2f MiB%s, heap %.2f MiB%s, fds %+.0f%s%s%s\n",
+          failed ? "FAILED" : "passed", run_sec, (unsigned long long) sessions, rss_growth / 1048576.0, rss_failed ? " (over bound)" : "",
+          heap_growth / 1048576.0, heap_reported ? (heap_failed ? " (over bound)" : "") : " (not reported)", fd_growth,
+          fd_failed ? " (over bound)" : "", !measured ? "; too few samples after the warm-up" : "",
+          exited_badly ? "; the gateway did not exit cleanly" : "");
+  fprintf(stderr, "soak_bench: results in %s (gateway log in %s)\n", options.output, dir);
+  logger_close();
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,49 @@
+#ifndef ADMIN_CONSOLE_H
+#define ADMIN_CONSOLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "device_caps.h"
+#include "register_cache.h"
+
+/*
+ * @brief Acquisition state the console reports on, owned by the main loop.
+ */
+typedef struct {
+  const modbus_opcua_config_t* config;
+  register_cache_t*            reg_cache;   // Current read plan; the console may reschedule its blocks
+  const device_caps_t*         caps;
+  bool                         connected;   // A Modbus connection is open
+  bool                         identified;  // The device was identified on this connection
+  int64_t                      now_ms;      // Time base of the schedule (get_time_ms())
+} admin_view_t;
+
+/**
+ * @brief Starts the admin console on the Unix socket 'admin_socket', if configured.
+ *
+ * Clients connect with e.g. `socat - UNIX-CONNECT:<socket>` and send one command per line
+ * ("help" lists them). A background thread serves a few connections at once; commands that
+ * inspect or change acquisition state are handed to the main loop, which answers them in
+ * admin_console_service() between two cycles.
+ *
+ * @param config A pointer to the application configuration.
+ * @return 0 on success or when disabled, -1 if the console could not be started.
+ */
+int admin_console_start(const modbus_opcua_config_t* config);
+
+/**
+ * @brief Answers a pending console command that needs the acquisition state. Costs one atomic
+ * load when no command is pending; must be called from the main loop.
+ *
+ * @param view The current acquisition state.
+ */
+void admin_console_service(const admin_view_t* view);
+
+/**
+ * @brief Stops the console thread and removes the socket.
+ */
+void admin_console_stop(void);
+
+#endif  // ADMIN_CONSOLE_H
@@ -2,6 +2,7 @@
 #define CONFIG_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 /*
@@ -24,6 +25,7 @@ typedef struct {
   char* format;            // Format: "FIXn", "ENUM", "FW", "DT", "TM", "Duration", "TEMP"
   float scale;             // A scaling factor to apply to the raw value (deprecated, use format)
   int   poll_interval_ms;  // Individual polling interval for this mapping
+  int   function_code;     // Modbus read function: 3 = holding registers, 4 = input registers (default)
   
   // For ENUM format
   enum_value_mapping_t* enum_values;     // Array of enum mappings
@@ -46,6 +48,8 @@ typedef struct {
   // OPC UA server configuration
   char*    opcua_server_url;
   uint16_t opcua_port;
+  int      opcua_slow_request_ms;  // Service requests taking longer are logged with their session, 0 disables
+  int      opcua_history_entries;  // Published values kept per mapping for HistoryRead, 0 disables history
 
   // Security configuration
   char* opcua_username;
@@ -58,9 +62,48 @@ typedef struct {
   // Watchdog configuration
   int watchdog_sec;
 
+  // Interval (seconds) of the INFO memory summary, 0 disables it
+  int memory_summary_sec;
+
+  // Directory for persisted per-device caches (e.g. SunSpec discovery results)
+  char* cache_dir;
+
+  // SunSpec auto-discovery configuration
+  bool sunspec_enabled;
+  int  sunspec_base_address;      // Start of the SunSpec map ("SunS" marker), usually 40000
+  int  sunspec_poll_interval_ms;  // Poll interval for the generated mappings
+
+  // Prometheus/OpenMetrics HTTP listener configuration
+  bool  metrics_enabled;
+  char* metrics_bind_address;  // Defaults to all interfaces when not set
+  int   metrics_port;
+
+  // Modbus wire capture configuration
+  bool  capture_enabled;       // Capture from startup; can be toggled at runtime with SIGUSR1
+  char* capture_file;          // Capture is unavailable when not set
+  int   capture_max_file_mb;   // Size at which the capture file is rotated
+  int   capture_max_files;     // Number of rotated files kept (<file>.1 ... <file>.N)
+
+  // Admin console configuration
+  char* admin_socket;  // Unix socket path of the admin console, disabled when not set
+
+  // Span tracing configuration
+  bool  trace_enabled;
+  char* trace_file;           // Chrome/Perfetto trace JSON, written on SIGUSR2 and at shutdown
+  int   trace_buffer_events;  // Ring buffer capacity; older spans are overwritten
+
+  // Register trace configuration
+  char*  register_trace_record;  // Every successful block read is recorded here, disabled when not set
+  char*  register_trace_replay;  // Replays this trace instead of reading the device, when set
+  double register_trace_speed;   // Replay speed: 1 = real time, 10 = ten times faster, 0 = as fast as possible
+
   // Modbus to OPC UA mappings
   modbus_reg_mapping_t* mappings;
   int                   num_mappings;
+
+  // Size of the single allocation holding this struct, its mappings,
+  // enum tables and (interned, read-only) strings
+  size_t arena_size;
 } modbus_opcua_config_t;
 
 #endif  // CONFIG_H
\ No newline at end of file
@@ -2,6 +2,7 @@
 #define CONFIG_PARSER_H
 
 #include "config.h"
+#include "device_caps.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -12,6 +13,8 @@ extern "C" {
  *
  * This function is implemented in C++ but exposed as a C function.
  * It parses the specified YAML file and populates a modbus_opcua_config_t struct.
+ * The struct, its mappings, enum tables and strings live in a single arena
+ * allocation; identical strings are shared and must be treated as read-only.
  *
  * @param filename The path to the YAML configuration file.
  * @return A pointer to a newly allocated modbus_opcua_config_t struct, or NULL on error.
@@ -20,10 +23,60 @@ modbus_opcua_config_t* load_config_from_yaml(const char* filename);
 
 /**
  * @brief Frees all memory associated with a modbus_opcua_config_t struct.
+ * The whole configuration is released with a single free of its arena.
  * @param config The configuration struct to free.
  */
 void free_config(modbus_opcua_config_t* config);
 
+/**
+ * @brief Loads only the `mappings` list of a YAML file (e.g. a discovery cache).
+ *
+ * @param filename The path to the YAML file.
+ * @return A newly allocated configuration holding just the mappings, or NULL on error.
+ */
+modbus_opcua_config_t* load_mappings_from_yaml(const char* filename);
+
+/**
+ * @brief Writes mappings to a YAML file in the format read by load_mappings_from_yaml().
+ *
+ * @param filename The path of the file to (atomically) replace.
+ * @param mappings The mappings to write.
+ * @param num_mappings The number of mappings.
+ * @return 0 on success, -1 on failure.
+ */
+int save_mappings_to_yaml(const char* filename, const modbus_reg_mapping_t* mappings, int num_mappings);
+
+/**
+ * @brief Builds a new configuration consisting of an existing one plus extra mappings.
+ *
+ * Mappings whose opcua_node_id is already in use are skipped with a warning.
+ * The original configuration is left untouched and must still be freed by the caller.
+ *
+ * @param config The configuration to extend.
+ * @param mappings The mappings to append.
+ * @param num_mappings The number of mappings to append.
+ * @return A newly allocated configuration, or NULL on error.
+ */
+modbus_opcua_config_t* config_append_mappings(const modbus_opcua_config_t* config, const modbus_reg_mapping_t* mappings, int num_mappings);
+
+/**
+ * @brief Loads persisted device capabilities (the limits, not the device identity).
+ *
+ * @param filename The path to the capability cache file.
+ * @param caps The capabilities to fill.
+ * @return 0 on success, -1 if the file is missing or invalid.
+ */
+int load_device_caps_from_yaml(const char* filename, device_caps_t* caps);
+
+/**
+ * @brief Persists device capabilities to a YAML file.
+ *
+ * @param filename The path of the file to (atomically) replace.
+ * @param caps The capabilities to write.
+ * @return 0 on success, -1 on failure.
+ */
+int save_device_caps_to_yaml(const char* filename, const device_caps_t* caps);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,76 @@
+#ifndef CPU_ACCOUNTING_H
+#define CPU_ACCOUNTING_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+/*
+ * @brief Pipeline stages that CPU and wall time are accounted to.
+ */
+typedef enum {
+  PIPELINE_MODBUS_IO,      // Modbus requests, including waiting for the device
+  PIPELINE_DECODE,         // Conversion of cached registers into OPC UA values
+  PIPELINE_NODE_UPDATE,    // Writes into the OPC UA address space
+  PIPELINE_HISTORY,        // Appends to the history ring buffers
+  PIPELINE_LOGGING,        // Formatting and writing log messages
+  PIPELINE_OPCUA_SERVICE,  // OPC UA network and service processing
+  PIPELINE_STAGE_COUNT
+} pipeline_stage_t;
+
+/*
+ * @brief Accumulated time of one stage. Times are exclusive: a stage entered inside another
+ * (e.g. logging during a node update) is not counted twice.
+ */
+typedef struct {
+  _Atomic uint64_t calls;
+  _Atomic uint64_t wall_ns;  // Monotonic clock
+  _Atomic uint64_t cpu_ns;   // Thread CPU clock; the difference to wall_ns is time spent waiting
+} stage_time_t;
+
+/*
+ * @brief Time accounts of all stages, kept globally and per device.
+ */
+typedef struct {
+  stage_time_t stage[PIPELINE_STAGE_COUNT];
+} stage_accounts_t;
+
+// Accounts of all threads and devices
+extern stage_accounts_t cpu_accounts_global;
+
+/**
+ * @brief Returns the display name of a stage, e.g. "ModbusIO".
+ *
+ * @param stage The stage.
+ * @return The name.
+ */
+const char* cpu_accounting_stage_name(pipeline_stage_t stage);
+
+/**
+ * @brief Additionally accounts the calling thread's stages to a device.
+ *
+ * @param device The device accounts, or NULL to account to the global totals only.
+ */
+void cpu_accounting_bind_device(stage_accounts_t* device);
+
+/**
+ * @brief Starts timing a stage on the calling thread. Must be paired with cpu_accounting_leave().
+ *
+ * @param stage The stage entered.
+ */
+void cpu_accounting_enter(pipeline_stage_t stage);
+
+/**
+ * @brief Stops timing the innermost stage of the calling thread and accounts its time.
+ *
+ * @param stage The stage left, which must match the last cpu_accounting_enter().
+ */
+void cpu_accounting_leave(pipeline_stage_t stage);
+
+/**
+ * @brief Returns the CPU time used by the whole process (all threads) so far.
+ *
+ * @return The process CPU time in nanoseconds.
+ */
+uint64_t cpu_accounting_process_cpu_ns(void);
+
+#endif  // CPU_ACCOUNTING_H
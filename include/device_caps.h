@@ -0,0 +1,148 @@
+#ifndef DEVICE_CAPS_H
+#define DEVICE_CAPS_H
+
+#include <modbus/modbus.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "config.h"
+
+// SMA identification registers used as the capability cache key
+#define SMA_REG_SERIAL_NUMBER 30057
+#define SMA_REG_FIRMWARE      30059
+
+#define DEVICE_CAPS_MAX_INVALID_RANGES 64
+
+// Seconds before a range learned from a single exception is re-read to confirm it
+#define DEVICE_CAPS_CONFIRM_DELAY_SEC 60
+
+/*
+ * @brief A range of Modbus registers [start, end) the device rejected with an exception.
+ */
+typedef struct {
+  int    function_code;
+  int    start;
+  int    end;
+  bool   no_coalesce;  // Only the combined read failed: read the parts separately instead of quarantining
+  bool   confirmed;    // Rejected again by a probe (or loaded from the cache); only confirmed ranges are persisted
+  time_t learned_at;   // When the exception was seen, for the confirming probe
+} invalid_range_t;
+
+/*
+ * @brief Probing progress of the background capability revalidation.
+ */
+typedef enum {
+  CAPS_PROBE_FUNCTION_CODES,  // Check that function codes 3 and 4 are accepted
+  CAPS_PROBE_INVALID_RANGES,  // Re-read known invalid ranges, dropping the ones that work again
+  CAPS_PROBE_MAX_REGS,        // Binary search for the largest accepted block read
+  CAPS_PROBE_DONE
+} caps_probe_state_t;
+
+/*
+ * @brief What the gateway knows about a device's Modbus implementation.
+ * Persisted per serial number and firmware version in the cache directory.
+ */
+typedef struct {
+  char serial[32];    // Device serial number, "" if the device could not be identified
+  char firmware[32];  // Firmware version string, "" if unknown
+
+  int  max_regs_per_request;    // Largest block read known to work, 0 if unknown (no coalescing)
+  bool fc3_supported;           // Holding registers can be read
+  bool fc4_supported;           // Input registers can be read
+  int  max_pipelined_requests;  // Requests in flight; the libmodbus transport always uses 1
+
+  invalid_range_t invalid_ranges[DEVICE_CAPS_MAX_INVALID_RANGES];
+  int             num_invalid_ranges;
+
+  // Runtime state (not persisted)
+  bool               validated;    // Limits confirmed for this serial and firmware
+  caps_probe_state_t probe_state;  // Next revalidation step
+  int                probe_index;  // Step-specific cursor
+  int                probe_lo;     // Max regs binary search: largest size known to work
+  int                probe_hi;     // Max regs binary search: largest size still to try
+} device_caps_t;
+
+/**
+ * @brief Resets capabilities to the conservative defaults used for unknown devices.
+ * @param caps The capabilities to reset.
+ */
+void device_caps_init(device_caps_t* caps);
+
+/**
+ * @brief Identifies the connected device and loads its capabilities from the cache.
+ *
+ * An exact serial/firmware match is used as validated. A cache entry of the same serial
+ * with a different firmware is used as a known-good starting point and revalidated in
+ * the background; unknown devices start from defaults and are probed.
+ *
+ * @param caps The capabilities to fill.
+ * @param ctx A connected Modbus context.
+ * @param config A pointer to the application configuration.
+ * @return 1 if the device identity changed (read plan must be rebuilt), 0 otherwise.
+ */
+int device_caps_identify(device_caps_t* caps, modbus_t* ctx, const modbus_opcua_config_t* config);
+
+/**
+ * @brief Records a Modbus exception returned for a block read.
+ *
+ * @param caps The device capabilities.
+ * @param function_code The function code of the failed read.
+ * @param address The first register of the failed read.
+ * @param num_regs The number of registers of the failed read.
+ * @param coalesced Whether the read combined several adjacent register ranges.
+ * @param error The errno value reported by libmodbus.
+ * @return 1 if the capabilities changed (read plan must be rebuilt), 0 otherwise.
+ */
+int device_caps_report_exception(device_caps_t* caps, int function_code, int address, int num_regs, bool coalesced, int error);
+
+/**
+ * @brief Persists the capabilities to `caps_<serial>_<firmware>.yaml` in the configured cache directory.
+ * Invalid ranges that no probe has confirmed yet are left out.
+ *
+ * @param caps The device capabilities.
+ * @param config The gateway configuration providing cache_dir.
+ */
+void device_caps_save(const device_caps_t* caps, const modbus_opcua_config_t* config);
+
+/**
+ * @brief Checks whether a register range may be fetched with a single coalesced read.
+ *
+ * @param caps The device capabilities.
+ * @param function_code The function code used to read the range.
+ * @param start The first register of the range.
+ * @param end One past the last register of the range.
+ * @return true if the range fits the validated request size and spans no failed coalesced read.
+ */
+bool device_caps_may_coalesce(const device_caps_t* caps, int function_code, int start, int end);
+
+/**
+ * @brief Checks whether a register range intersects a known invalid range.
+ *
+ * @param caps The device capabilities.
+ * @param function_code The function code used to read the range.
+ * @param start The first register of the range.
+ * @param end One past the last register of the range.
+ * @return true if the range must not be read.
+ */
+bool device_caps_is_invalid(const device_caps_t* caps, int function_code, int start, int end);
+
+struct register_cache_s;  // register_cache.h includes this header
+
+/**
+ * @brief Runs one revalidation request if the capabilities are not validated yet.
+ *
+ * Called once per main loop iteration so probing is spread over time instead of
+ * delaying acquisition. Results are persisted once all steps are done. Afterwards,
+ * invalid ranges learned from a single exception are re-read once they are
+ * DEVICE_CAPS_CONFIRM_DELAY_SEC old: a range that is rejected again is confirmed and
+ * persisted, one that reads fine was a transient error and is dropped.
+ *
+ * @param caps The device capabilities.
+ * @param ctx A connected Modbus context.
+ * @param cache The current read plan, used to pick probe addresses.
+ * @param config A pointer to the application configuration.
+ * @return 1 if the capabilities changed (read plan must be rebuilt), 0 otherwise.
+ */
+int device_caps_probe_step(device_caps_t* caps, modbus_t* ctx, const struct register_cache_s* cache, const modbus_opcua_config_t* config);
+
+#endif  // DEVICE_CAPS_H
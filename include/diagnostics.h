@@ -0,0 +1,134 @@
+#ifndef DIAGNOSTICS_H
+#define DIAGNOSTICS_H
+
+#include <stdint.h>
+
+#include "config.h"
+#include "cpu_accounting.h"
+#include "histogram.h"
+#include "opcua_server.h"
+
+/*
+ * @brief Timed quantities of the acquisition path.
+ */
+typedef enum {
+  LATENCY_MODBUS_RTT,     // Modbus request/response round trip of a block read
+  LATENCY_DECODE,         // Conversion of cached registers into an OPC UA value
+  LATENCY_NODE_UPDATE,    // Write of the value into the OPC UA address space
+  LATENCY_POLL_LATENESS,  // Actual read time minus the scheduled poll time
+  LATENCY_PUBLISH_AGE,    // Age of the published value when a client reads it
+  LATENCY_STAGE_COUNT
+} latency_stage_t;
+
+/*
+ * @brief Latency histograms of all stages for one mapping or for the device.
+ */
+typedef struct {
+  latency_histogram_t stage[LATENCY_STAGE_COUNT];
+  _Atomic uint64_t    missed_intervals;  // Poll intervals that passed without a read
+} latency_stats_t;
+
+/*
+ * @brief Value exposed by one diagnostics variable node.
+ */
+typedef struct {
+  const latency_histogram_t* hist;        // Histogram to summarise, or NULL to expose the counter
+  const _Atomic uint64_t*    counter;
+  uint64_t (*sample)(int arg);            // Sampled on read instead of the counter when set
+  int                        sample_arg;
+  double                     scale;       // > 0 exposes counter or sample as Double multiplied by it
+  double                     percentile;  // < 0 exposes the sample count, 100 the maximum
+} diag_value_t;
+
+struct diagnostics_s;
+
+/*
+ * @brief Node context of a mapping's value node, used to time client reads.
+ */
+typedef struct {
+  struct diagnostics_s* diag;
+  int                   mapping_index;
+} diag_tag_t;
+
+/*
+ * @brief Gateway health statistics, kept for the device and for every mapping.
+ */
+typedef struct diagnostics_s {
+  latency_stats_t  device;
+  stage_accounts_t device_time;   // CPU and wall time of the device's pipeline stages
+  latency_stats_t* mappings;      // Indexed like config->mappings
+  int              num_mappings;
+  diag_value_t*    values;        // Node contexts of the diagnostics variables
+  int              num_values;
+  diag_tag_t*      tags;          // Node contexts of the mapping value nodes
+} diagnostics_t;
+
+/**
+ * @brief Returns a monotonic timestamp for latency measurements.
+ *
+ * @return The current monotonic time in microseconds.
+ */
+int64_t diagnostics_now_us(void);
+
+/**
+ * @brief Allocates empty statistics for the configured mappings.
+ *
+ * @param config A pointer to the application configuration.
+ * @return A pointer to the diagnostics, or NULL on allocation failure.
+ */
+diagnostics_t* diagnostics_create(const modbus_opcua_config_t* config);
+
+/**
+ * @brief Frees the diagnostics. Must be called after the OPC UA server that exposes them is deleted.
+ *
+ * @param diag The diagnostics to free (may be NULL).
+ */
+void diagnostics_free(diagnostics_t* diag);
+
+/**
+ * @brief Records a device-wide latency sample.
+ *
+ * @param diag The diagnostics.
+ * @param stage The timed stage.
+ * @param micros The duration in microseconds.
+ */
+void diagnostics_record_device(diagnostics_t* diag, latency_stage_t stage, int64_t micros);
+
+/**
+ * @brief Records a latency sample for one mapping.
+ *
+ * @param diag The diagnostics.
+ * @param mapping_index The index of the mapping in config->mappings.
+ * @param stage The timed stage.
+ * @param micros The duration in microseconds.
+ */
+void diagnostics_record_mapping(diagnostics_t* diag, int mapping_index, latency_stage_t stage, int64_t micros);
+
+/**
+ * @brief Records when a mapping was read relative to its schedule.
+ *
+ * @param diag The diagnostics.
+ * @param mapping_index The index of the mapping in config->mappings.
+ * @param scheduled_ms The time (ms) the read was scheduled for, 0 for the first read.
+ * @param actual_ms The time (ms) the read completed.
+ * @param interval_ms The poll interval of the mapping.
+ */
+void diagnostics_record_schedule(diagnostics_t* diag, int mapping_index, int64_t scheduled_ms, int64_t actual_ms, int interval_ms);
+
+/**
+ * @brief Adds the Diagnostics folder to the address space.
+ *
+ * Every stage is exposed as an object with Count, P50, P90, P99 and Max variables (milliseconds),
+ * computed from the histograms when a client reads them, next to a MissedIntervals counter.
+ * Reads of the mapping nodes themselves are hooked to measure the age of the served value.
+ * CPU and wall time per pipeline stage are exposed for the device and for the whole gateway, next to
+ * the latency of the OPC UA services.
+ *
+ * @param server The OPC UA server instance.
+ * @param diag The diagnostics to expose.
+ * @param config A pointer to the application configuration.
+ * @return UA_STATUSCODE_GOOD on success.
+ */
+UA_StatusCode diagnostics_add_nodes(UA_Server* server, diagnostics_t* diag, const modbus_opcua_config_t* config);
+
+#endif  // DIAGNOSTICS_H
@@ -0,0 +1,77 @@
+#ifndef FAULT_PROXY_H
+#define FAULT_PROXY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * @brief Faults applied to the proxied connections. All off (zero) by default; changes apply to
+ * traffic already queued as well.
+ */
+typedef struct {
+  int  latency_us;               // Added to every forwarded chunk, both directions
+  int  jitter_us;                // Uniformly distributed extra latency, 0..jitter_us; chunks keep their order
+  bool stall;                    // Hold all traffic; connections stay open and the data is delivered when cleared
+  bool half_open;                // Drop all traffic silently and never pass a close on, so both peers see a dead but open connection
+  bool refuse;                   // Reset new connections right after accepting them
+  int  slow_read_bytes_per_sec;  // Device responses trickle out at this rate, 0 for unlimited
+} fault_proxy_faults_t;
+
+/*
+ * @brief Counters of a running proxy.
+ */
+typedef struct {
+  uint64_t accepted;           // Connections accepted (connection attempts of the gateway)
+  uint64_t refused;            // Connections reset because of 'refuse' or an unreachable target
+  uint64_t resets;             // Connections reset by fault_proxy_reset_connections()
+  uint64_t bytes_forwarded;
+  uint64_t bytes_dropped;      // Dropped while half open
+  int      active_connections;
+} fault_proxy_stats_t;
+
+typedef struct fault_proxy_s fault_proxy_t;
+
+/**
+ * @brief Starts a loopback TCP proxy that forwards every connection on listen_port to the target,
+ * applying the faults set with fault_proxy_set_faults(). One background thread serves all connections.
+ * For tests and benchmarks only.
+ *
+ * @param listen_port The port to accept connections on (127.0.0.1).
+ * @param target_address The IPv4 address to forward to.
+ * @param target_port The port to forward to.
+ * @return The running proxy, or NULL if it could not be started.
+ */
+fault_proxy_t* fault_proxy_start(int listen_port, const char* target_address, int target_port);
+
+/**
+ * @brief Stops the proxy and closes all its connections.
+ *
+ * @param proxy The proxy (may be NULL).
+ */
+void fault_proxy_stop(fault_proxy_t* proxy);
+
+/**
+ * @brief Replaces the active faults. Safe to call from any thread.
+ *
+ * @param proxy The proxy.
+ * @param faults The faults to apply from now on.
+ */
+void fault_proxy_set_faults(fault_proxy_t* proxy, const fault_proxy_faults_t* faults);
+
+/**
+ * @brief Resets (RST) all open connections on both sides. Safe to call from any thread; takes
+ * effect within a few milliseconds.
+ *
+ * @param proxy The proxy.
+ */
+void fault_proxy_reset_connections(fault_proxy_t* proxy);
+
+/**
+ * @brief Returns the counters of a running proxy. Safe to call from any thread.
+ *
+ * @param proxy The proxy.
+ * @param stats Receives the counters.
+ */
+void fault_proxy_get_stats(fault_proxy_t* proxy, fault_proxy_stats_t* stats);
+
+#endif  // FAULT_PROXY_H
@@ -0,0 +1,92 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+// Log-linear (HDR-style) bucketing: values below HISTOGRAM_SUB_BUCKETS are counted exactly, every
+// further power of two is split into HISTOGRAM_SUB_BUCKETS linear buckets (~6% relative precision).
+#define HISTOGRAM_SUB_BUCKET_BITS 4
+#define HISTOGRAM_SUB_BUCKETS     (1 << HISTOGRAM_SUB_BUCKET_BITS)
+#define HISTOGRAM_MAX_MAGNITUDE   26  // Values up to 2^26 us (~67 s) are tracked, larger ones clamp
+#define HISTOGRAM_NUM_BUCKETS     (HISTOGRAM_SUB_BUCKETS * (HISTOGRAM_MAX_MAGNITUDE - HISTOGRAM_SUB_BUCKET_BITS + 2))
+
+/*
+ * @brief A latency histogram in microseconds.
+ *
+ * Recording only uses relaxed atomic increments, so the acquisition loop never blocks on readers
+ * (OPC UA diagnostics, metrics exporters) that compute percentiles concurrently.
+ */
+typedef struct {
+  _Atomic uint32_t buckets[HISTOGRAM_NUM_BUCKETS];
+  _Atomic uint64_t count;
+  _Atomic uint64_t sum_us;
+  _Atomic uint64_t max_us;
+} latency_histogram_t;
+
+/**
+ * @brief Resets a histogram to zero samples.
+ *
+ * @param hist The histogram to reset.
+ */
+void histogram_init(latency_histogram_t* hist);
+
+/**
+ * @brief Records one sample.
+ *
+ * @param hist The histogram.
+ * @param value_us The sample in microseconds; negative values are recorded as zero.
+ */
+void histogram_record(latency_histogram_t* hist, int64_t value_us);
+
+/**
+ * @brief Computes a percentile of the recorded samples.
+ *
+ * @param hist The histogram.
+ * @param percentile The percentile in the range 0..100.
+ * @return The highest value equivalent to the percentile's bucket in microseconds, or 0 without samples.
+ */
+uint64_t histogram_percentile(const latency_histogram_t* hist, double percentile);
+
+/**
+ * @brief Returns the number of recorded samples.
+ *
+ * @param hist The histogram.
+ * @return The sample count.
+ */
+uint64_t histogram_count(const latency_histogram_t* hist);
+
+/**
+ * @brief Returns the largest recorded sample.
+ *
+ * @param hist The histogram.
+ * @return The maximum in microseconds, or 0 without samples.
+ */
+uint64_t histogram_max(const latency_histogram_t* hist);
+
+/**
+ * @brief Returns the sum of the recorded samples.
+ *
+ * @param hist The histogram.
+ * @return The sum in microseconds.
+ */
+uint64_t histogram_sum(const latency_histogram_t* hist);
+
+/**
+ * @brief Counts the samples at or below a value, for exporting cumulative buckets.
+ *
+ * @param hist The histogram.
+ * @param value_us The bucket bound in microseconds.
+ * @return The number of samples whose bucket lies entirely at or below the bound.
+ */
+uint64_t histogram_count_at_or_below(const latency_histogram_t* hist, uint64_t value_us);
+
+/**
+ * @brief Returns the mean of the recorded samples.
+ *
+ * @param hist The histogram.
+ * @return The mean in microseconds, or 0 without samples.
+ */
+double histogram_mean(const latency_histogram_t* hist);
+
+#endif  // HISTOGRAM_H
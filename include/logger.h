@@ -2,6 +2,7 @@
 #define LOGGER_H
 
 #include <stdarg.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -28,6 +29,27 @@ int logger_init(const char* filename, int level);
  */
 void log_message(log_level_t level, const char* format, ...);
 
+/**
+ * @brief Changes the maximum log level at runtime. Safe to call from any thread.
+ *
+ * @param level The maximum log level to record.
+ */
+void logger_set_level(int level);
+
+/**
+ * @brief Returns the maximum log level currently recorded.
+ *
+ * @return The log level.
+ */
+int logger_get_level(void);
+
+/**
+ * @brief Returns the number of log messages that could not be written (e.g. disk full).
+ *
+ * @return The dropped message count.
+ */
+uint64_t logger_dropped_messages(void);
+
 /**
  * @brief Closes the log file.
  */
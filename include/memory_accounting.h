@@ -0,0 +1,101 @@
+#ifndef MEMORY_ACCOUNTING_H
+#define MEMORY_ACCOUNTING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Estimated heap cost of one node in the open62541 nodestore: node struct, NodeId, names,
+// forward and inverse references and the nodestore entry
+#define MEMORY_NODE_ESTIMATE_BYTES 512
+
+// Estimated cost of one secure channel (send and receive chunk buffers plus channel state)
+// and of one session or MonitoredItem (state plus a one-entry value queue)
+#define MEMORY_CHANNEL_ESTIMATE_BYTES        (2 * 65535 + 4096)
+#define MEMORY_SESSION_ESTIMATE_BYTES        4096
+#define MEMORY_MONITORED_ITEM_ESTIMATE_BYTES 512
+
+/*
+ * @brief Subsystems that memory is accounted to.
+ */
+typedef enum {
+  MEMORY_CONFIG,          // Configuration arena (mappings, enum tables, strings)
+  MEMORY_REGISTER_CACHE,  // Read plan and cached register values
+  MEMORY_ADDRESS_SPACE,   // Gateway nodes in the OPC UA address space (estimated per node)
+  MEMORY_HISTORY,         // Stored historical values
+  MEMORY_LOG_BUFFERS,     // Log stream buffer, trace ring and wire capture ring
+  MEMORY_DIAGNOSTICS,     // Latency histograms and diagnostics node contexts
+  MEMORY_OPCUA_SESSIONS,  // Secure channels, sessions and MonitoredItems (estimated)
+  MEMORY_SUBSYSTEM_COUNT
+} memory_subsystem_t;
+
+/**
+ * @brief Returns the display name of a subsystem, e.g. "AddressSpace".
+ *
+ * @param subsystem The subsystem.
+ * @return The name.
+ */
+const char* memory_subsystem_name(memory_subsystem_t subsystem);
+
+/**
+ * @brief Sets the bytes held by a subsystem.
+ *
+ * @param subsystem The subsystem.
+ * @param bytes The bytes currently held.
+ */
+void memory_account_set(memory_subsystem_t subsystem, uint64_t bytes);
+
+/**
+ * @brief Adjusts the bytes held by a subsystem.
+ *
+ * @param subsystem The subsystem.
+ * @param delta The bytes allocated (positive) or released (negative).
+ */
+void memory_account_add(memory_subsystem_t subsystem, int64_t delta);
+
+/**
+ * @brief Returns the bytes held by a subsystem. History and OPC UA sessions are derived from the metrics on every call.
+ *
+ * @param subsystem The subsystem.
+ * @return The bytes held.
+ */
+uint64_t memory_account_get(memory_subsystem_t subsystem);
+
+/**
+ * @brief Returns the bytes accounted to all subsystems.
+ *
+ * @return The sum of all accounts.
+ */
+uint64_t memory_account_total(void);
+
+/**
+ * @brief Returns the resident set size of the process.
+ *
+ * @return The RSS in bytes, or 0 if it cannot be determined.
+ */
+uint64_t memory_process_rss(void);
+
+/**
+ * @brief Returns the heap statistics of the allocator, which include what open62541 allocates.
+ *
+ * @param in_use Receives the bytes in allocated blocks, mmapped ones included.
+ * @param free_bytes Receives the bytes in free blocks the allocator keeps.
+ * @return true on success, false if the allocator does not report statistics (non-glibc builds).
+ */
+bool memory_heap_stats(uint64_t* in_use, uint64_t* free_bytes);
+
+/**
+ * @brief Returns the number of open file descriptors of the process.
+ *
+ * @return The count, or 0 if it cannot be determined.
+ */
+uint64_t memory_process_fds(void);
+
+/**
+ * @brief Logs one INFO line with the RSS and every account, if the summary interval has passed.
+ *
+ * @param now_ms The current time in milliseconds.
+ * @param interval_sec The summary interval in seconds; 0 disables the summary.
+ */
+void memory_log_summary(int64_t now_ms, int interval_sec);
+
+#endif  // MEMORY_ACCOUNTING_H
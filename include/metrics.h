@@ -0,0 +1,75 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "diagnostics.h"
+#include "histogram.h"
+#include "opcua_server.h"
+
+/*
+ * @brief Pre-aggregated gateway counters and gauges.
+ *
+ * The acquisition loop and the OPC UA server update them with relaxed atomics; the metrics
+ * listener only reads them, so a scrape never takes a lock the hot path could wait on.
+ */
+typedef struct {
+  _Atomic uint64_t    modbus_reads;             // Successful block reads
+  _Atomic uint64_t    modbus_transport_errors;
+  _Atomic uint64_t    modbus_exceptions;        // Exception responses from the device
+  _Atomic uint64_t    modbus_reconnects;
+  _Atomic uint64_t    values_published;
+  _Atomic uint64_t    nan_values;               // Values skipped because the device reported NaN
+  _Atomic uint64_t    opcua_sessions;           // Gauge, sampled from the server statistics
+  _Atomic uint64_t    opcua_sessions_total;
+  _Atomic uint64_t    opcua_secure_channels;    // Gauge
+  _Atomic uint64_t    opcua_monitored_items;    // Gauge
+  _Atomic uint64_t    history_bytes;            // Gauge, approximate size of the stored history
+  _Atomic uint64_t    capture_dropped_packets;  // Wire capture packets lost because the writer fell behind
+  latency_histogram_t poll_lateness;            // Actual minus scheduled block read time
+} gateway_metrics_t;
+
+extern gateway_metrics_t gateway_metrics;
+
+// Counter helpers for the hot path
+#define METRICS_ADD(field, n) atomic_fetch_add_explicit(&gateway_metrics.field, (n), memory_order_relaxed)
+#define METRICS_SUB(field, n) atomic_fetch_sub_explicit(&gateway_metrics.field, (n), memory_order_relaxed)
+#define METRICS_SET(field, v) atomic_store_explicit(&gateway_metrics.field, (v), memory_order_relaxed)
+
+/**
+ * @brief Resets all counters. Call once before the acquisition loop starts.
+ */
+void metrics_init(void);
+
+/**
+ * @brief Samples OPC UA server statistics into the gauges. Must run on the server's thread.
+ *
+ * @param server The OPC UA server instance.
+ */
+void metrics_sample_server(UA_Server* server);
+
+/**
+ * @brief Renders all metrics as OpenMetrics text, as served on /metrics.
+ *
+ * @param len Receives the length of the text.
+ * @return The text (to be freed by the caller), or NULL on allocation failure.
+ */
+char* metrics_render(size_t* len);
+
+/**
+ * @brief Starts the HTTP listener serving OpenMetrics text on /metrics, if enabled.
+ *
+ * @param config A pointer to the application configuration.
+ * @param diag The latency statistics to export as histograms; must outlive the listener.
+ * @return 0 on success or when disabled, -1 if the listener could not be started.
+ */
+int metrics_server_start(const modbus_opcua_config_t* config, const diagnostics_t* diag);
+
+/**
+ * @brief Stops the HTTP listener and waits for its thread to exit.
+ */
+void metrics_server_stop(void);
+
+#endif  // METRICS_H
@@ -13,6 +13,28 @@
  */
 modbus_t* modbus_tcp_connect(const modbus_opcua_config_t* config);
 
+/**
+ * @brief Returns the number of registers occupied by a mapping's data type.
+ *
+ * @param mapping The register mapping.
+ * @return 1 for 16-bit types, 2 for 32-bit types, 4 for U64.
+ */
+int modbus_register_count(const modbus_reg_mapping_t* mapping);
+
+/**
+ * @brief Reads a contiguous range of Modbus registers.
+ *
+ * @param ctx The Modbus context.
+ * @param function_code 3 to read holding registers, 4 to read input registers.
+ * @param address The first register address.
+ * @param num_regs The number of registers to read.
+ * @param dest A buffer of at least num_regs registers to store the read data.
+ * @return 0 on success, -2 if interrupted by a shutdown request, -1 on failure. On failure errno
+ *         is preserved, so Modbus exception responses (errno > MODBUS_ENOBASE) can be told
+ *         apart from transport errors.
+ */
+int read_modbus_registers(modbus_t* ctx, int function_code, int address, int num_regs, uint16_t* dest);
+
 /**
  * @brief Reads data from Modbus registers based on the provided mappings.
  *
@@ -2,6 +2,7 @@
 #define OPCUA_SERVER_H
 
 #include "config.h"
+#include "histogram.h"
 #include "open62541/plugin/accesscontrol_default.h"
 #include "open62541/plugin/log_stdout.h"
 #include "open62541/server.h"
@@ -10,6 +11,26 @@
 // Expose the running flag
 extern UA_Boolean running;
 
+// Client sessions whose request counts are tracked; further sessions are only timed
+#define OPCUA_MAX_TRACKED_SESSIONS 64
+
+/*
+ * @brief OPC UA services whose latency is measured.
+ */
+typedef enum {
+  OPCUA_SERVICE_READ,
+  OPCUA_SERVICE_WRITE,
+  OPCUA_SERVICE_BROWSE,
+  OPCUA_SERVICE_CREATE_MONITORED_ITEMS,
+  OPCUA_SERVICE_PUBLISH,
+  OPCUA_SERVICE_HISTORY_READ,
+  OPCUA_SERVICE_OTHER,  // Server loop time no hook accounts for, e.g. ServerStatus reads, Call or Publish responses
+  OPCUA_SERVICE_COUNT
+} opcua_service_t;
+
+// Latency of every service as experienced inside the server loop, in microseconds
+extern latency_histogram_t opcua_service_latency[OPCUA_SERVICE_COUNT];
+
 /**
  * @brief Configuration for historical data storage.
  */
@@ -67,6 +88,14 @@ UA_StatusCode update_opcua_node_value(UA_Server* server, const modbus_reg_mappin
  */
 UA_StatusCode update_opcua_node_value_typed(UA_Server* server, const modbus_reg_mapping_t* mapping, UA_Variant* value);
 
+/**
+ * @brief Makes value and history updates carry the given source timestamp instead of the current
+ * time, so replayed register traces keep their recorded times.
+ *
+ * @param time The timestamp to use, or 0 to use the clock again.
+ */
+void opcua_override_source_time(UA_DateTime time);
+
 /**
  * @brief Checks if a shutdown has been requested for the OPC UA server.
  *
@@ -82,24 +111,93 @@ int opcua_shutdown_requested(void);
 int opcua_shutdown_signal(void);
 
 /**
- * @brief Adds a history node to the OPC UA server for historical data storage.
+ * @brief Checks whether the gateway itself is currently reading a node (e.g. to verify a write),
+ * so read hooks can tell such reads apart from client requests.
+ *
+ * @return Non-zero during internal reads, zero otherwise.
+ */
+int opcua_internal_read_active(void);
+
+/**
+ * @brief Returns the display name of a service, e.g. "CreateMonitoredItems".
+ *
+ * @param service The service.
+ * @return The name.
+ */
+const char* opcua_service_name(opcua_service_t service);
+
+/**
+ * @brief Runs one iteration of the server loop and times the service requests processed in it.
+ *
+ * Requests are attributed through the hooks calling opcua_service_touch(); time before the first hook
+ * and iterations without any are recorded as OPCUA_SERVICE_OTHER. Hooked requests slower than
+ * 'opcua_slow_request_ms' are logged with their session, and every session's request counts are
+ * logged when it closes.
+ *
+ * @param server The OPC UA server instance.
+ */
+void opcua_server_iterate(UA_Server* server);
+
+/**
+ * @brief Reports that a client request of a service is being processed. Called from the write,
+ * browse, MonitoredItem and history hooks; does nothing outside opcua_server_iterate().
+ *
+ * @param service The service being processed.
+ * @param session_id The session of the request, or NULL if unknown.
+ */
+void opcua_service_touch(opcua_service_t service, const UA_NodeId* session_id);
+
+/**
+ * @brief Reports a read of a node's value from a value or data source callback.
+ *
+ * open62541 runs the same callbacks for Read requests and for sampling MonitoredItems. A read of
+ * a node the session has a value MonitoredItem on is taken as sampling: it is timed as Publish work
+ * and not counted as a request of the session. Any other read is a Read request. A Read request for
+ * a node the same session also monitors is therefore timed as sampling.
+ *
+ * @param session_id The session of the read, or NULL if unknown.
+ * @param node_context The context of the node read, which identifies it for the MonitoredItems.
+ */
+void opcua_read_touch(const UA_NodeId* session_id, const void* node_context);
+
+/**
+ * @brief Allocates the historical data storage for a number of nodes, indexed like the mappings.
+ * Called once; nodes are then enabled with opcua_add_history_node().
+ *
+ * @param numNodes The number of nodes that may be historized.
+ * @return UA_STATUSCODE_GOOD on success.
+ */
+UA_StatusCode opcua_init_history(size_t numNodes);
+
+/**
+ * @brief Enables historical data storage for a node.
  *
  * @param server The OPC UA server instance.
+ * @param index The index of the node's history, below the count given to opcua_init_history().
  * @param nodeId The NodeId of the node to enable history for.
  * @param maxHistoryEntries The maximum number of historical entries to store.
  * @return UA_STATUSCODE_GOOD on success.
  */
-UA_StatusCode opcua_add_history_node(UA_Server* server, UA_NodeId nodeId, size_t maxHistoryEntries);
+UA_StatusCode opcua_add_history_node(UA_Server* server, size_t index, UA_NodeId nodeId, size_t maxHistoryEntries);
 
 /**
  * @brief Updates the historical data for a specific node.
  *
  * @param server The OPC UA server instance.
- * @param nodeId The NodeId of the node to update history for.
+ * @param index The index the node's history was added with.
  * @param value The new value to add to the history.
  * @return UA_STATUSCODE_GOOD on success.
  */
-UA_StatusCode opcua_update_history(UA_Server* server, UA_NodeId nodeId, UA_Variant* value);
+UA_StatusCode opcua_update_history(UA_Server* server, size_t index, UA_Variant* value);
+
+/**
+ * @brief Reports how much history is stored. Safe to call from any thread.
+ *
+ * @param nodes Receives the number of historized nodes.
+ * @param values Receives the number of stored values.
+ * @param capacity Receives the number of values that can be stored.
+ */
+void opcua_history_sizes(size_t* nodes, size_t* values, size_t* capacity);
 
 /**
  * @brief Cleans up historical data resources on server shutdown.
@@ -109,6 +207,11 @@ void opcua_cleanup_history(void);
 
 /**
  * @brief Callback function to read historical data for a node.
+ *
+ * Values are returned oldest first, or newest first when the start time is unset or after the end
+ * time. At most numValuesPerNode values are returned; if more remain, nextContinuationPoint receives
+ * a continuation point to pass back for the next page. Modified values and bounding values are not
+ * supported.
  * 
  * @param server The OPC UA server instance.
  * @param sessionId The session ID of the client requesting the data.
@@ -118,12 +221,15 @@ void opcua_cleanup_history(void);
  * @param range The numeric range for the read.
  * @param timestampsToReturn The type of timestamps to return.
  * @param details The read details specifying time range and other parameters.
+ * @param continuationPoint The continuation point of the previous page, or NULL for the first page.
+ * @param nextContinuationPoint Receives the continuation point of the next page, or NULL.
  * @param result Pointer to store the resulting historical data.
  * @return UA_STATUSCODE_GOOD on success, or an appropriate error code.
  */
 UA_StatusCode readHistoryData(UA_Server* server, const UA_NodeId* sessionId, void* sessionContext, const UA_NodeId* nodeId,
                               UA_Boolean sourceTimeStamp, const UA_NumericRange* range, UA_TimestampsToReturn timestampsToReturn,
-                              const UA_ReadRawModifiedDetails* details, UA_HistoryData* result);
+                              const UA_ReadRawModifiedDetails* details, const UA_ByteString* continuationPoint,
+                              UA_ByteString* nextContinuationPoint, UA_HistoryData* result);
 
 /**
  * @brief Finds the historical data structure for a given node.
@@ -0,0 +1,121 @@
+#ifndef REGISTER_CACHE_H
+#define REGISTER_CACHE_H
+
+#include <stdint.h>
+
+#include "config.h"
+#include "device_caps.h"
+
+// Pause of the acquisition loop after every cycle; due blocks are collected once per cycle
+#define REGISTER_CACHE_CYCLE_IDLE_MS 100
+
+/*
+ * @brief A contiguous span of Modbus registers fetched with a single request.
+ * Mappings whose register ranges overlap (or duplicate each other) share one block,
+ * so each register is read at most once per cycle.
+ */
+typedef struct {
+  int       function_code;     // Modbus read function (3 = holding, 4 = input registers)
+  int       start_address;     // First Modbus register of the block
+  int       num_regs;          // Number of registers covered by the block
+  int       poll_interval_ms;  // Fastest poll interval of all dependent mappings
+  int64_t   next_poll_time;    // Next time (ms) the block is due for a read: the earliest schedule of its mappings
+  int64_t   due_time;          // Scheduled time (ms) of the read collected last, 0 for the first read
+  int64_t   last_read_time;    // Time (ms) of the last successful read, 0 if never read
+  uint16_t* regs;              // Cached register values (points into the cache storage)
+  int       first_mapping;     // Index into block_mappings of the first dependent mapping
+  int       num_mappings;      // Number of dependent mappings
+  bool      coalesced;         // Block combines adjacent (not just overlapping) register ranges
+} register_block_t;
+
+/*
+ * @brief Per-device register cache keyed by Modbus address, i.e. the device's read plan.
+ * Mappings decode from the cached blocks instead of issuing their own reads.
+ */
+typedef struct register_cache_s {
+  register_block_t* blocks;           // Blocks sorted by start address
+  int               num_blocks;
+  int*              block_mappings;   // Mapping indices grouped by block
+  int*              mapping_block;    // Block index for each mapping, -1 if quarantined
+  int*              mapping_offset;   // Register offset of each mapping inside its block
+  int64_t*          next_poll_times;  // Next publish time (ms) for each mapping
+  uint16_t*         storage;          // Register storage shared by all blocks
+  int               num_quarantined;  // Mappings skipped because the device rejects their registers
+} register_cache_t;
+
+/**
+ * @brief Builds the register cache (read plan) for the mappings of a configuration.
+ *
+ * Mappings in ranges the device rejects are quarantined. Adjacent ranges are coalesced
+ * into one read up to caps->max_regs_per_request.
+ *
+ * @param config A pointer to the application configuration.
+ * @param caps The device capabilities, or NULL to only merge overlapping ranges.
+ * @return A pointer to a newly allocated register cache, or NULL on error.
+ */
+register_cache_t* register_cache_create(const modbus_opcua_config_t* config, const device_caps_t* caps);
+
+/**
+ * @brief Rebuilds the read plan after the device capabilities changed.
+ *
+ * Mapping schedules are carried over. On allocation failure the old cache is kept.
+ *
+ * @param cache The current register cache (freed on success).
+ * @param config A pointer to the application configuration.
+ * @param caps The updated device capabilities.
+ * @return The register cache to use from now on.
+ */
+register_cache_t* register_cache_rebuild(register_cache_t* cache, const modbus_opcua_config_t* config, const device_caps_t* caps);
+
+/**
+ * @brief Frees a register cache created by register_cache_create().
+ * @param cache The register cache to free.
+ */
+void register_cache_free(register_cache_t* cache);
+
+/**
+ * @brief Collects the blocks due for a read. A block stays due until register_cache_finish_block()
+ * reschedules it, so blocks that are not read in this cycle are retried in the next one.
+ *
+ * @param cache The register cache.
+ * @param now_ms The current time in milliseconds.
+ * @param due_blocks Output array (at least cache->num_blocks entries) receiving due block indices.
+ * @return The number of due blocks written to due_blocks.
+ */
+int register_cache_collect_due(register_cache_t* cache, int64_t now_ms, int* due_blocks);
+
+/**
+ * @brief Checks whether a mapping on a block that was just read is due and, if so, schedules its next poll.
+ *
+ * @param cache The register cache.
+ * @param config A pointer to the application configuration.
+ * @param mapping_index The index of the mapping in the configuration.
+ * @param now_ms The time (ms) the cycle collected its due blocks.
+ * @param scheduled_ms Receives the time the mapping was due (0 for its first read), if it is due.
+ * @return true if the mapping is due and is to be published.
+ */
+bool register_cache_take_due_mapping(register_cache_t* cache, const modbus_opcua_config_t* config, int mapping_index, int64_t now_ms,
+                                     int64_t* scheduled_ms);
+
+/**
+ * @brief Reschedules a block after a read attempt the device answered. Due mappings that were not
+ * taken (the read was rejected) are retried one poll interval later; the block becomes due again
+ * with the earliest of its mappings.
+ *
+ * @param cache The register cache.
+ * @param config A pointer to the application configuration.
+ * @param block_index The index of the block.
+ * @param now_ms The time (ms) the cycle collected its due blocks.
+ */
+void register_cache_finish_block(register_cache_t* cache, const modbus_opcua_config_t* config, int block_index, int64_t now_ms);
+
+/**
+ * @brief Returns the cached registers of a mapping.
+ *
+ * @param cache The register cache.
+ * @param mapping_index The index of the mapping in the configuration.
+ * @return A pointer to the first cached register of the mapping.
+ */
+const uint16_t* register_cache_mapping_regs(const register_cache_t* cache, int mapping_index);
+
+#endif  // REGISTER_CACHE_H
@@ -0,0 +1,76 @@
+#ifndef REGISTER_TRACE_H
+#define REGISTER_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "config.h"
+
+#define REGISTER_TRACE_MAX_REGS 125  // Largest Modbus read
+
+/*
+ * @brief One recorded register block read.
+ */
+typedef struct {
+  int64_t  time_ms;  // Wall clock time of the read (ms since the epoch)
+  int      function_code;
+  int      address;
+  int      num_regs;
+  uint16_t regs[REGISTER_TRACE_MAX_REGS];
+} register_trace_record_t;
+
+typedef struct register_trace_reader_s register_trace_reader_t;
+
+/**
+ * @brief Starts a new trace in the file 'register_trace_record', if configured.
+ *
+ * A trace is a magic header followed by one record per read: the time since the previous record
+ * and the address as varints, the function code, the register count and the register words.
+ *
+ * @param config A pointer to the application configuration.
+ * @return 0 on success or when recording is disabled, -1 if the file could not be opened.
+ */
+int register_trace_start_recording(const modbus_opcua_config_t* config);
+
+/**
+ * @brief Appends one block read to the trace. Buffered, flushed about once per second; does
+ * nothing when recording is disabled. Must be called from the acquisition loop.
+ *
+ * @param function_code The Modbus read function.
+ * @param address The first register read.
+ * @param num_regs The number of registers read.
+ * @param regs The register values.
+ * @param time_ms Wall clock time of the read in milliseconds.
+ */
+void register_trace_record(int function_code, int address, int num_regs, const uint16_t* regs, int64_t time_ms);
+
+/**
+ * @brief Flushes and closes the recorded trace.
+ */
+void register_trace_stop_recording(void);
+
+/**
+ * @brief Opens a recorded trace for replay.
+ *
+ * @param path The trace file.
+ * @return The reader, or NULL if the file cannot be opened or is not a register trace.
+ */
+register_trace_reader_t* register_trace_open(const char* path);
+
+/**
+ * @brief Reads the next record of a trace.
+ *
+ * @param reader The reader.
+ * @param record Receives the record.
+ * @return 1 if a record was read, 0 at the end of the trace, -1 if the trace is corrupt or truncated.
+ */
+int register_trace_next(register_trace_reader_t* reader, register_trace_record_t* record);
+
+/**
+ * @brief Closes a trace opened with register_trace_open().
+ *
+ * @param reader The reader (may be NULL).
+ */
+void register_trace_close(register_trace_reader_t* reader);
+
+#endif  // REGISTER_TRACE_H
@@ -0,0 +1,85 @@
+#ifndef SCHED_SIM_H
+#define SCHED_SIM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "histogram.h"
+
+/*
+ * @brief Simulated Modbus link and device, and what the simulation measures.
+ */
+typedef struct {
+  int      response_us;           // Device processing plus network round trip of every request
+  int      jitter_us;             // Uniformly distributed extra response time, 0..jitter_us
+  int      bytes_per_sec;         // Link rate applied to request and response frames, 0 for unlimited
+  bool     rtu_framing;           // Modbus RTU frame sizes instead of Modbus TCP ones
+  double   timeout_probability;   // Chance that a request or connection attempt is not answered; costs the Modbus timeout
+  int      cycle_overhead_us;     // OPC UA server iteration and bookkeeping per cycle, besides the idle pause
+  int      max_regs_per_request;  // Coalescing limit of the simulated device, 0 for no coalescing
+  double   sla_tolerance;         // A mapping misses its SLA when published more than poll_interval * (1 + tolerance) apart
+  double   duration_sec;          // Simulated time
+  unsigned seed;                  // Same seed and configuration, same report
+} sched_sim_options_t;
+
+/*
+ * @brief Schedule quality of one mapping.
+ */
+typedef struct {
+  uint64_t publishes;
+  uint64_t sla_misses;
+  int64_t  max_gap_ms;  // Longest time between two publishes
+} sched_sim_mapping_t;
+
+/*
+ * @brief Report of a simulation run.
+ */
+typedef struct {
+  double               simulated_sec;
+  uint64_t             cycles;
+  uint64_t             block_reads;
+  uint64_t             registers_read;
+  uint64_t             timeouts;          // Unanswered requests and failed connection attempts
+  uint64_t             publishes;
+  uint64_t             sla_misses;
+  double               bus_utilisation;   // Share of the simulated time the link had a request outstanding
+  latency_histogram_t  read_lateness;     // Start of each block read behind its schedule, us
+  latency_histogram_t  publish_lateness;  // Publish of each mapping behind its schedule, us
+  sched_sim_mapping_t* mappings;          // One per mapping of the configuration
+  int                  num_mappings;
+} sched_sim_result_t;
+
+/**
+ * @brief Fills options with the defaults: a Modbus TCP device answering in 20 ms with 5 ms jitter,
+ * no rate limit or timeouts, 1 ms per cycle for the OPC UA server, 125 registers per coalesced read,
+ * 50% SLA tolerance and one simulated hour.
+ *
+ * @param options The options to fill.
+ */
+void sched_sim_default_options(sched_sim_options_t* options);
+
+/**
+ * @brief Runs the gateway's acquisition schedule for a configuration against a virtual clock.
+ *
+ * The read plan, the due block selection and the per-mapping scheduling are the gateway's own
+ * (register_cache.c); the Modbus transport is replaced by the link model, and every request, timeout,
+ * reconnect and cycle pause advances the virtual clock instead of taking real time. A timeout drops
+ * the connection; each connection attempt fails with the same probability and is then retried after
+ * the gateway's 5 s pause. Runs are deterministic for the same options.
+ *
+ * @param config The configuration to simulate.
+ * @param options The link model and simulation options.
+ * @param result Receives the report; release it with sched_sim_free_result().
+ * @return 0 on success, -1 on allocation failure.
+ */
+int sched_sim_run(const modbus_opcua_config_t* config, const sched_sim_options_t* options, sched_sim_result_t* result);
+
+/**
+ * @brief Frees the per-mapping part of a report.
+ *
+ * @param result The report of sched_sim_run().
+ */
+void sched_sim_free_result(sched_sim_result_t* result);
+
+#endif  // SCHED_SIM_H
@@ -0,0 +1,89 @@
+#ifndef SMA_SIMULATOR_H
+#define SMA_SIMULATOR_H
+
+#include <stdint.h>
+
+#include "config.h"
+
+/*
+ * @brief Behaviour of the simulated inverters.
+ */
+typedef struct {
+  const char* bind_address;           // Loopback by default
+  int         base_port;              // Inverter i listens on base_port + i
+  int         num_inverters;
+  int         slave_id;               // Unit ID answered, 0 for any
+  int         latency_us;             // Added to every response
+  int         jitter_us;              // Uniformly distributed extra latency, 0..jitter_us
+  int         max_connections;        // Per inverter; further connections are closed at once (SMA devices allow few)
+  double      exception_probability;  // Chance that a valid read is answered with exception_code instead
+  int         exception_code;         // e.g. 0x06 (slave device busy)
+  double      nan_probability;        // Chance per update that a value reads as its SMA NaN sentinel
+  int         update_interval_ms;     // Period of the value dynamics
+  double      day_length_sec;         // Period of the simulated daily production curve
+  unsigned    seed;                   // Same seed, same values
+} sma_sim_options_t;
+
+/*
+ * @brief Counters of a running simulator.
+ */
+typedef struct {
+  uint64_t requests;             // Read requests received
+  uint64_t exceptions;           // Exception responses (injected or for unmapped registers)
+  uint64_t refused_connections;  // Connections closed because of max_connections
+  uint64_t value_changes;        // Register values changed by the dynamics
+} sma_sim_stats_t;
+
+typedef struct sma_sim_s sma_sim_t;
+
+/**
+ * @brief Fills options with the defaults: one inverter on 127.0.0.1:1502, unit ID 3, no latency,
+ * 4 connections, no exceptions or NaNs, 1 s updates and a 10 minute day.
+ *
+ * @param options The options to fill.
+ */
+void sma_sim_default_options(sma_sim_options_t* options);
+
+/**
+ * @brief Starts serving the register map of the configured mappings on one port per inverter.
+ *
+ * Every inverter serves the mapped registers (function codes 3 and 4) plus the serial number and
+ * firmware registers the gateway identifies devices by; other addresses answer with an illegal
+ * data address exception. Values follow their kind: energy and time counters increase, power-like
+ * values follow a daily curve with noise, enums mostly keep their first value, date/time registers
+ * hold the current time. All inverters are served by one background thread.
+ *
+ * @param config The configuration whose mappings define the register map; must outlive the simulator.
+ * @param options The simulation options.
+ * @return The running simulator, or NULL if it could not be started.
+ */
+sma_sim_t* sma_sim_start(const modbus_opcua_config_t* config, const sma_sim_options_t* options);
+
+/**
+ * @brief Stops the simulator and closes all its sockets.
+ *
+ * @param sim The simulator (may be NULL).
+ */
+void sma_sim_stop(sma_sim_t* sim);
+
+/**
+ * @brief Returns the counters of a running simulator. Safe to call from any thread.
+ *
+ * @param sim The simulator.
+ * @param stats Receives the counters.
+ */
+void sma_sim_get_stats(const sma_sim_t* sim, sma_sim_stats_t* stats);
+
+/**
+ * @brief Looks up when a value took a given raw value, so benchmarks can measure how stale the
+ * published values are. The last few changes of every value are kept.
+ *
+ * @param sim The simulator.
+ * @param inverter The index of the inverter.
+ * @param address The first register of the value.
+ * @param raw The raw value (registers combined, high word first).
+ * @return The CLOCK_MONOTONIC time of the change in microseconds, or -1 if raw is not among the recent values.
+ */
+int64_t sma_sim_change_time_us(sma_sim_t* sim, int inverter, int address, uint64_t raw);
+
+#endif  // SMA_SIMULATOR_H
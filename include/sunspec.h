@@ -0,0 +1,30 @@
+#ifndef SUNSPEC_H
+#define SUNSPEC_H
+
+#include <modbus/modbus.h>
+
+#include "config.h"
+
+// SunSpec map layout, see the SunSpec Information Model Specification.
+#define SUNSPEC_MARKER_HI   0x5375  // "Su"
+#define SUNSPEC_MARKER_LO   0x6E53  // "nS"
+#define SUNSPEC_END_MODEL   0xFFFF
+#define SUNSPEC_MAX_REGS    4096    // Upper bound on the size of the walked model chain
+#define SUNSPEC_MODEL_COMMON 1
+
+/**
+ * @brief Discovers the SunSpec models exposed by the device and generates mappings for them.
+ *
+ * The common model is read first to obtain the device serial number. If a discovery cache
+ * for that serial number exists in config->cache_dir, its mappings are used directly;
+ * otherwise the model chain is walked with large block reads and the generated mappings
+ * are written to the cache for the next start.
+ *
+ * @param ctx A connected Modbus context.
+ * @param config A pointer to the application configuration.
+ * @return A newly allocated configuration extended with the SunSpec mappings, or NULL if
+ *         nothing was discovered (the original configuration stays valid in both cases).
+ */
+modbus_opcua_config_t* sunspec_discover(modbus_t* ctx, const modbus_opcua_config_t* config);
+
+#endif  // SUNSPEC_H
@@ -0,0 +1,67 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "config.h"
+
+/*
+ * @brief Kinds of traced spans. Spans of the acquisition loop nest inside the scheduler tick.
+ */
+typedef enum {
+  TRACE_SCHEDULER_TICK,  // One pass of the acquisition loop, without the idle sleep
+  TRACE_BLOCK_READ,      // Modbus request/response of one register block
+  TRACE_DECODE,          // Conversion of cached registers into an OPC UA value
+  TRACE_NODE_UPDATE,     // Write of the value into the OPC UA address space
+  TRACE_OPCUA_ITERATION, // OPC UA network and service processing of one server iteration
+  TRACE_OPCUA_REQUEST,   // One client service request inside a server iteration, labelled with the service
+  TRACE_CAPS_PROBE,      // Background capability revalidation request
+  TRACE_SPAN_COUNT
+} trace_span_kind_t;
+
+/**
+ * @brief Allocates the span ring buffer if tracing is enabled.
+ *
+ * @param config A pointer to the application configuration.
+ * @return 0 on success or when tracing is disabled, -1 on failure.
+ */
+int trace_init(const modbus_opcua_config_t* config);
+
+/**
+ * @brief Exports the remaining spans (if tracing is enabled) and frees the ring buffer.
+ */
+void trace_close(void);
+
+/**
+ * @brief Checks whether spans are recorded.
+ *
+ * @return true if tracing is enabled.
+ */
+bool trace_enabled(void);
+
+/**
+ * @brief Records one completed span. Must only be called from the acquisition thread.
+ *
+ * The oldest spans are overwritten once the ring buffer is full.
+ *
+ * @param kind The kind of span.
+ * @param start_us The monotonic start time in microseconds (see diagnostics_now_us()).
+ * @param end_us The monotonic end time in microseconds.
+ * @param label An optional label shown with the span (e.g. the mapping name), or NULL.
+ *              Must stay valid until the trace is exported.
+ * @param value An optional numeric argument (e.g. the start address), or -1 for none.
+ */
+void trace_span(trace_span_kind_t kind, int64_t start_us, int64_t end_us, const char* label, int value);
+
+/**
+ * @brief Requests an export of the buffered spans at the next trace_poll(). Async-signal-safe.
+ */
+void trace_request_export(void);
+
+/**
+ * @brief Writes the buffered spans as Chrome/Perfetto trace JSON if an export was requested.
+ */
+void trace_poll(void);
+
+#endif  // TRACE_H
@@ -0,0 +1,43 @@
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+#include "config.h"
+
+/*
+ * @brief Loops whose progress is supervised.
+ */
+typedef enum {
+  WATCHDOG_LOOP_ACQUISITION,  // Modbus polling, decoding and publishing
+  WATCHDOG_LOOP_SERVER,       // OPC UA network and service processing
+  WATCHDOG_LOOP_COUNT
+} watchdog_loop_t;
+
+/**
+ * @brief Starts the stall detector and tells systemd the gateway is ready.
+ *
+ * A loop is stalled when it has not reported progress for 'watchdog_sec' seconds (or half the
+ * systemd WatchdogSec= when that is not set). While no loop is stalled, the systemd watchdog is
+ * petted at half its interval; a stall logs the flight state and withholds the pet, so systemd
+ * restarts the gateway. Without a NOTIFY_SOCKET only the stall detector runs.
+ *
+ * @param config A pointer to the application configuration.
+ * @return 0 on success or when supervision is disabled, -1 if the monitor thread could not be started.
+ */
+int watchdog_start(const modbus_opcua_config_t* config);
+
+/**
+ * @brief Tells systemd the gateway is stopping and stops the monitor thread.
+ */
+void watchdog_stop(void);
+
+/**
+ * @brief Reports that a loop made progress and what it is about to do. Cheap enough for every step.
+ *
+ * @param loop The reporting loop.
+ * @param activity A static description of the next step, logged if the loop stalls in it, or NULL
+ *                 when the loop goes idle (e.g. waits for its turn on a shared thread) and cannot stall.
+ * @param detail A number qualifying the activity (e.g. the register address), or -1 for none.
+ */
+void watchdog_progress(watchdog_loop_t loop, const char* activity, int detail);
+
+#endif  // WATCHDOG_H
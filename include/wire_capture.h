@@ -0,0 +1,56 @@
+#ifndef WIRE_CAPTURE_H
+#define WIRE_CAPTURE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "config.h"
+
+/**
+ * @brief Starts the capture writer thread if a capture file is configured.
+ *
+ * Captured Modbus/TCP frames are wrapped in synthetic IPv4/TCP headers (taken from the real
+ * socket addresses) and written as classic pcap, so Wireshark dissects them as Modbus/TCP.
+ *
+ * @param config A pointer to the application configuration.
+ * @return 0 on success or when no capture file is configured, -1 on failure.
+ */
+int wire_capture_start(const modbus_opcua_config_t* config);
+
+/**
+ * @brief Flushes pending frames, closes the capture file and stops the writer thread.
+ */
+void wire_capture_stop(void);
+
+/**
+ * @brief Switches capturing on or off. Async-signal-safe.
+ *
+ * @param enabled true to capture, false to stop capturing.
+ */
+void wire_capture_set_enabled(bool enabled);
+
+/**
+ * @brief Checks whether frames are currently captured. A single relaxed load, cheap enough for every request.
+ *
+ * @return true if capturing.
+ */
+bool wire_capture_enabled(void);
+
+/**
+ * @brief Queues one request/response exchange for writing. Must only be called from one thread.
+ *
+ * Frames are copied into a lock-free single-producer ring; they are dropped (and counted) when
+ * the writer falls behind.
+ *
+ * @param socket_fd The socket the exchange used, for the addresses and ports of the synthetic headers.
+ * @param request The request ADU (MBAP header included).
+ * @param request_len The length of the request ADU.
+ * @param request_us Wall clock time (us) the request was sent.
+ * @param response The response ADU, or NULL if none was received.
+ * @param response_len The length of the response ADU.
+ * @param response_us Wall clock time (us) the response was received.
+ */
+void wire_capture_record(int socket_fd, const uint8_t* request, int request_len, int64_t request_us, const uint8_t* response,
+                         int response_len, int64_t response_us);
+
+#endif  // WIRE_CAPTURE_H
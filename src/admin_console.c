@@ -0,0 +1,524 @@
+#include "admin_console.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "logger.h"
+#include "metrics.h"
+#include "opcua_server.h"
+#include "trace.h"
+#include "wire_capture.h"
+
+#define ADMIN_MAX_LINE    256
+#define ADMIN_IDLE_SEC    300  // Connections without a command for this long are closed
+#define ADMIN_MAX_CLIENTS 4    // Connections served at once; further ones wait in the listen backlog
+#define ADMIN_HANDOFF_SEC 10   // Longest wait for the main loop, which may be blocked on a Modbus timeout
+
+/*
+ * @brief A growing reply buffer.
+ */
+typedef struct {
+  char*  data;
+  size_t len;
+  size_t cap;
+  bool   failed;
+} reply_t;
+
+/*
+ * @brief A connected console client and its partial input line.
+ */
+typedef struct {
+  int    fd;
+  size_t len;
+  time_t last_active;  // Monotonic time (s) of the last input
+  char   line[ADMIN_MAX_LINE];
+} admin_client_t;
+
+static const char* level_names[]       = {"error", "warn", "info", "debug"};
+static const char* probe_state_names[] = {"function codes", "invalid ranges", "max registers", "done"};
+
+static int         listen_fd = -1;
+static pthread_t   console_thread;
+static atomic_bool console_stop;
+static char        socket_path[sizeof(((struct sockaddr_un*) 0)->sun_path)];
+
+// Command handed to the main loop, guarded by handoff_mutex
+static pthread_mutex_t handoff_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  handoff_done  = PTHREAD_COND_INITIALIZER;
+static atomic_bool     handoff_pending;
+static char            handoff_command[ADMIN_MAX_LINE];
+static reply_t*        handoff_reply;
+
+static const register_block_t* sort_blocks = NULL;  // qsort() context of compare_due
+
+static void reply_printf(reply_t* reply, const char* format, ...) {
+  if (reply->failed) {
+    return;
+  }
+  for (;;) {
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(reply->data + reply->len, reply->cap - reply->len, format, args);
+    va_end(args);
+    if (n < 0) {
+      reply->failed = true;
+      return;
+    }
+    if ((size_t) n < reply->cap - reply->len) {
+      reply->len += (size_t) n;
+      return;
+    }
+    size_t cap  = (reply->cap + (size_t) n + 1) * 2;
+    char*  data = realloc(reply->data, cap);
+    if (!data) {
+      reply->failed = true;
+      return;
+    }
+    reply->data = data;
+    reply->cap  = cap;
+  }
+}
+
+static int compare_due(const void* a, const void* b) {
+  int64_t ta = sort_blocks[*(const int*) a].next_poll_time;
+  int64_t tb = sort_blocks[*(const int*) b].next_poll_time;
+  return (ta > tb) - (ta < tb);
+}
+
+// Blocks in the order the scheduler will read them
+static void show_schedule(const admin_view_t* view, reply_t* reply) {
+  const register_cache_t* cache = view->reg_cache;
+  int*                    order = calloc(cache->num_blocks > 0 ? cache->num_blocks : 1, sizeof(int));
+  if (!order) {
+    reply_printf(reply, "error: out of memory\n");
+    return;
+  }
+  for (int b = 0; b < cache->num_blocks; b++) {
+    order[b] = b;
+  }
+  sort_blocks = cache->blocks;
+  qsort(order, cache->num_blocks, sizeof(int), compare_due);
+  sort_blocks = NULL;
+
+  reply_printf(reply, "%d blocks, next read first:\n", cache->num_blocks);
+  for (int k = 0; k < cache->num_blocks; k++) {
+    const register_block_t* block = &cache->blocks[order[k]];
+    int64_t                 due   = block->next_poll_time - view->now_ms;
+    char                    last[32];
+    if (block->last_read_time == 0) {
+      snprintf(last, sizeof(last), "never");
+    } else {
+      snprintf(last, sizeof(last), "%.1f s ago", (double) (view->now_ms - block->last_read_time) / 1000.0);
+    }
+    reply_printf(reply, "  %s %6lld ms  fc%d %5d+%-3d every %d ms, last read %s\n", due <= 0 ? "overdue" : "in     ",
+                 (long long) (due < 0 ? -due : due), block->function_code, block->start_address, block->num_regs, block->poll_interval_ms,
+                 last);
+  }
+  free(order);
+}
+
+// Blocks with the mappings decoded from them
+static void show_plan(const admin_view_t* view, reply_t* reply) {
+  const register_cache_t* cache = view->reg_cache;
+  reply_printf(reply, "%d blocks, %d quarantined mappings:\n", cache->num_blocks, cache->num_quarantined);
+  for (int b = 0; b < cache->num_blocks; b++) {
+    const register_block_t* block = &cache->blocks[b];
+    reply_printf(reply, "  block %d: fc%d registers %d-%d (%d)%s, every %d ms\n", b, block->function_code, block->start_address,
+                 block->start_address + block->num_regs - 1, block->num_regs, block->coalesced ? " coalesced" : "",
+                 block->poll_interval_ms);
+    for (int k = block->first_mapping; k < block->first_mapping + block->num_mappings; k++) {
+      int                         i       = cache->block_mappings[k];
+      const modbus_reg_mapping_t* mapping = &view->config->mappings[i];
+      reply_printf(reply, "    +%-3d %-8s %s (%s), every %d ms\n", cache->mapping_offset[i], mapping->data_type, mapping->name,
+                   mapping->opcua_node_id, mapping->poll_interval_ms);
+    }
+  }
+}
+
+static void show_connection(const admin_view_t* view, reply_t* reply) {
+  const modbus_opcua_config_t* config = view->config;
+  const device_caps_t*         caps   = view->caps;
+  reply_printf(reply, "modbus %s:%d slave %d: %s, %s\n", config->modbus_ip, config->modbus_port, config->modbus_slave_id,
+               view->connected ? "connected" : "disconnected", view->identified ? "identified" : "not identified");
+  reply_printf(reply, "device serial %s, firmware %s, capabilities %s", caps->serial[0] ? caps->serial : "unknown",
+               caps->firmware[0] ? caps->firmware : "unknown", caps->validated ? "validated" : "revalidating");
+  if (!caps->validated) {
+    reply_printf(reply, " (probing %s)", probe_state_names[caps->probe_state]);
+  }
+  reply_printf(reply, "\nmax %d registers per request, fc3 %s, fc4 %s\n", caps->max_regs_per_request, caps->fc3_supported ? "yes" : "no",
+               caps->fc4_supported ? "yes" : "no");
+  reply_printf(reply, "%llu reads, %llu transport errors, %llu exceptions, %llu reconnects\n",
+               (unsigned long long) atomic_load(&gateway_metrics.modbus_reads),
+               (unsigned long long) atomic_load(&gateway_metrics.modbus_transport_errors),
+               (unsigned long long) atomic_load(&gateway_metrics.modbus_exceptions),
+               (unsigned long long) atomic_load(&gateway_metrics.modbus_reconnects));
+}
+
+static void show_quarantine(const admin_view_t* view, reply_t* reply) {
+  const register_cache_t* cache = view->reg_cache;
+  reply_printf(reply, "%d quarantined mappings:\n", cache->num_quarantined);
+  for (int i = 0; i < view->config->num_mappings; i++) {
+    if (cache->mapping_block[i] < 0) {
+      const modbus_reg_mapping_t* mapping = &view->config->mappings[i];
+      reply_printf(reply, "  fc%d %5d %s (%s)\n", mapping->function_code, mapping->modbus_address, mapping->name, mapping->opcua_node_id);
+    }
+  }
+  reply_printf(reply, "%d invalid register ranges:\n", view->caps->num_invalid_ranges);
+  for (int r = 0; r < view->caps->num_invalid_ranges; r++) {
+    const invalid_range_t* range = &view->caps->invalid_ranges[r];
+    reply_printf(reply, "  fc%d %d-%d%s%s\n", range->function_code, range->start, range->end - 1,
+                 range->no_coalesce ? " (read separately)" : "", range->confirmed ? "" : " (unconfirmed)");
+  }
+}
+
+// Makes the block of a mapping due on the next cycle
+static void request_read(const admin_view_t* view, const char* target, reply_t* reply) {
+  const modbus_opcua_config_t* config  = view->config;
+  char*                        end     = NULL;
+  long                         address = strtol(target, &end, 10);
+  bool                         numeric = *target != '\0' && *end == '\0';
+  for (int i = 0; i < config->num_mappings; i++) {
+    const modbus_reg_mapping_t* mapping = &config->mappings[i];
+    if (numeric ? mapping->modbus_address != address : strcmp(mapping->name, target) != 0 && strcmp(mapping->opcua_node_id, target) != 0) {
+      continue;
+    }
+    int b = view->reg_cache->mapping_block[i];
+    if (b < 0) {
+      reply_printf(reply, "error: '%s' is quarantined\n", mapping->name);
+      return;
+    }
+    register_block_t* block             = &view->reg_cache->blocks[b];
+    block->next_poll_time               = 0;
+    view->reg_cache->next_poll_times[i] = 0;  // Published as a first read, so no lateness is recorded
+    reply_printf(reply, "'%s' is read with block fc%d %d+%d on the next cycle%s\n", mapping->name, block->function_code,
+                 block->start_address, block->num_regs, view->connected ? "" : " (once the device is reachable)");
+    return;
+  }
+  reply_printf(reply, "error: no mapping named '%s'\n", target);
+}
+
+// Commands that need the acquisition state; runs on the main thread
+static void execute_state_command(const char* command, const admin_view_t* view, reply_t* reply) {
+  if (strcmp(command, "schedule") == 0) {
+    show_schedule(view, reply);
+  } else if (strcmp(command, "plan") == 0) {
+    show_plan(view, reply);
+  } else if (strcmp(command, "connection") == 0) {
+    show_connection(view, reply);
+  } else if (strcmp(command, "quarantine") == 0) {
+    show_quarantine(view, reply);
+  } else if (strncmp(command, "read ", 5) == 0) {
+    request_read(view, command + 5, reply);
+  }
+}
+
+void admin_console_service(const admin_view_t* view) {
+  if (!atomic_load_explicit(&handoff_pending, memory_order_acquire)) {
+    return;
+  }
+  pthread_mutex_lock(&handoff_mutex);
+  if (atomic_load(&handoff_pending)) {
+    execute_state_command(handoff_command, view, handoff_reply);
+    atomic_store(&handoff_pending, false);
+    pthread_cond_broadcast(&handoff_done);
+  }
+  pthread_mutex_unlock(&handoff_mutex);
+}
+
+// Hands a command to the main loop and waits for its answer
+static void hand_off(const char* command, reply_t* reply) {
+  pthread_mutex_lock(&handoff_mutex);
+  snprintf(handoff_command, sizeof(handoff_command), "%s", command);
+  handoff_reply = reply;
+  atomic_store(&handoff_pending, true);
+
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += ADMIN_HANDOFF_SEC;
+  int rc = 0;
+  while (atomic_load(&handoff_pending) && rc != ETIMEDOUT) {
+    rc = pthread_cond_timedwait(&handoff_done, &handoff_mutex, &deadline);
+  }
+  if (atomic_load(&handoff_pending)) {
+    atomic_store(&handoff_pending, false);  // Withdraw it, the main loop must not write into a reply nobody reads
+    reply_printf(reply, "error: the acquisition loop did not answer within %d s\n", ADMIN_HANDOFF_SEC);
+  }
+  handoff_reply = NULL;
+  pthread_mutex_unlock(&handoff_mutex);
+}
+
+static void set_log_level(const char* arg, reply_t* reply) {
+  char* end   = NULL;
+  long  level = strtol(arg, &end, 10);
+  if (*arg == '\0' || *end != '\0') {
+    level = -1;
+    for (int l = 0; l <= LOG_LEVEL_DEBUG; l++) {
+      level = strcasecmp(arg, level_names[l]) == 0 ? l : level;
+    }
+  }
+  if (level < LOG_LEVEL_ERROR || level > LOG_LEVEL_DEBUG) {
+    reply_printf(reply, "error: log level must be 0-3 or error, warn, info, debug\n");
+    return;
+  }
+  logger_set_level((int) level);
+  log_message(LOG_LEVEL_INFO, "Admin console: log level set to %s.", level_names[level]);
+  reply_printf(reply, "log level %s\n", level_names[level]);
+}
+
+static void show_history(reply_t* reply) {
+  size_t nodes = 0, values = 0, capacity = 0;
+  opcua_history_sizes(&nodes, &values, &capacity);
+  reply_printf(reply, "%zu historized nodes, %zu of %zu values stored, ~%llu bytes\n", nodes, values, capacity,
+               (unsigned long long) atomic_load(&gateway_metrics.history_bytes));
+}
+
+static void show_help(reply_t* reply) {
+  reply_printf(reply,
+               "schedule            blocks in the order they are read next\n"
+               "plan                read plan: blocks and the mappings decoded from them\n"
+               "connection          Modbus connection and device capabilities\n"
+               "quarantine          quarantined mappings and invalid register ranges\n"
+               "read <tag>          read a mapping (name, node id or address) on the next cycle\n"
+               "metrics             metrics snapshot (OpenMetrics text)\n"
+               "history             stored history sizes\n"
+               "loglevel [level]    show or set the log level (0-3 or error, warn, info, debug)\n"
+               "capture on|off      switch the Modbus wire capture\n"
+               "trace               export the buffered trace spans\n"
+               "quit                close the connection\n");
+}
+
+// Executes one command line; returns false when the client asked to close
+static bool execute(char* line, reply_t* reply) {
+  while (*line == ' ' || *line == '\t') {
+    line++;
+  }
+  size_t len = strlen(line);
+  while (len > 0 && (line[len - 1] == ' ' || line[len - 1] == '\t' || line[len - 1] == '\r')) {
+    line[--len] = '\0';
+  }
+
+  if (len == 0) {
+    return true;
+  } else if (strcmp(line, "quit") == 0 || strcmp(line, "exit") == 0) {
+    return false;
+  } else if (strcmp(line, "help") == 0) {
+    show_help(reply);
+  } else if (strcmp(line, "schedule") == 0 || strcmp(line, "plan") == 0 || strcmp(line, "connection") == 0 ||
+             strcmp(line, "quarantine") == 0 || strncmp(line, "read ", 5) == 0) {
+    hand_off(line, reply);
+  } else if (strcmp(line, "metrics") == 0) {
+    size_t text_len = 0;
+    char*  text     = metrics_render(&text_len);
+    if (text) {
+      reply_printf(reply, "%.*s", (int) text_len, text);
+    } else {
+      reply_printf(reply, "error: out of memory\n");
+    }
+    free(text);
+  } else if (strcmp(line, "history") == 0) {
+    show_history(reply);
+  } else if (strcmp(line, "loglevel") == 0) {
+    reply_printf(reply, "log level %s\n", level_names[logger_get_level()]);
+  } else if (strncmp(line, "loglevel ", 9) == 0) {
+    set_log_level(line + 9, reply);
+  } else if (strcmp(line, "capture on") == 0 || strcmp(line, "capture off") == 0) {
+    bool on = strcmp(line, "capture on") == 0;
+    wire_capture_set_enabled(on);
+    if (on && !wire_capture_enabled()) {
+      reply_printf(reply, "error: no capture file configured\n");
+    } else {
+      reply_printf(reply, "capture %s\n", on ? "on" : "off");
+    }
+  } else if (strcmp(line, "trace") == 0) {
+    if (trace_enabled()) {
+      trace_request_export();
+      reply_printf(reply, "trace export requested\n");
+    } else {
+      reply_printf(reply, "error: tracing is not enabled\n");
+    }
+  } else {
+    reply_printf(reply, "error: unknown command '%s', try 'help'\n", line);
+  }
+  return true;
+}
+
+static time_t monotonic_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec;
+}
+
+static void send_all(int fd, const char* data, size_t len) {
+  while (len > 0) {
+    ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return;
+    }
+    data += n;
+    len -= (size_t) n;
+  }
+}
+
+// Reads from a client and answers its complete lines; returns false when the connection is to be closed
+static bool serve_client(admin_client_t* client) {
+  ssize_t n = recv(client->fd, client->line + client->len, sizeof(client->line) - 1 - client->len, 0);
+  if (n <= 0) {
+    return false;
+  }
+  client->len += (size_t) n;
+  client->line[client->len] = '\0';
+
+  bool  open = true;
+  char* newline;
+  while (open && (newline = memchr(client->line, '\n', client->len)) != NULL) {
+    *newline      = '\0';
+    reply_t reply = {NULL, 0, 0, false};
+    open          = execute(client->line, &reply);
+    if (reply.failed) {
+      static const char error[] = "error: out of memory\n";
+      send_all(client->fd, error, sizeof(error) - 1);
+    } else if (reply.len > 0) {
+      send_all(client->fd, reply.data, reply.len);
+    }
+    free(reply.data);
+    client->len -= (size_t) (newline + 1 - client->line);
+    memmove(client->line, newline + 1, client->len);
+  }
+  if (open && client->len == sizeof(client->line) - 1) {
+    static const char error[] = "error: line too long\n";
+    send_all(client->fd, error, sizeof(error) - 1);
+    return false;
+  }
+  return open;
+}
+
+static void* console_main(void* arg) {
+  (void) arg;
+  admin_client_t clients[ADMIN_MAX_CLIENTS];
+  int            num_clients = 0;
+  while (!atomic_load(&console_stop)) {
+    // The listening socket and all clients share one poll, so an idle client does not hold up
+    // the others. Wake up regularly to notice admin_console_stop() and idle clients.
+    struct pollfd pfds[ADMIN_MAX_CLIENTS + 1];
+    for (int i = 0; i < num_clients; i++) {
+      pfds[i] = (struct pollfd) {clients[i].fd, POLLIN, 0};
+    }
+    // With all slots taken, further connections wait in the listen backlog
+    int nfds = num_clients;
+    if (num_clients < ADMIN_MAX_CLIENTS) {
+      pfds[nfds++] = (struct pollfd) {listen_fd, POLLIN, 0};
+    }
+    int ready = poll(pfds, (nfds_t) nfds, 500);
+    if (ready < 0) {
+      continue;
+    }
+
+    time_t now    = monotonic_sec();
+    int    served = num_clients;
+    for (int i = served - 1; i >= 0; i--) {
+      bool open = true;
+      if (pfds[i].revents != 0) {
+        clients[i].last_active = now;
+        open                   = serve_client(&clients[i]);
+      } else if (now - clients[i].last_active >= ADMIN_IDLE_SEC) {
+        open = false;
+      }
+      if (!open) {
+        close(clients[i].fd);
+        clients[i] = clients[--num_clients];
+      }
+    }
+
+    if (nfds > served && (pfds[served].revents & POLLIN)) {
+      int fd = accept(listen_fd, NULL, NULL);
+      if (fd >= 0) {
+        clients[num_clients++] = (admin_client_t) {fd, 0, now, {0}};
+      }
+    }
+  }
+  for (int i = 0; i < num_clients; i++) {
+    close(clients[i].fd);
+  }
+  return NULL;
+}
+
+int admin_console_start(const modbus_opcua_config_t* config) {
+  if (!config->admin_socket || config->admin_socket[0] == '\0') {
+    return 0;
+  }
+  if (strlen(config->admin_socket) >= sizeof(socket_path)) {
+    log_message(LOG_LEVEL_ERROR, "Admin socket path '%s' is too long.", config->admin_socket);
+    return -1;
+  }
+
+  // A socket left behind by a previous run blocks bind(); anything else at the path is not ours to remove
+  struct stat st;
+  if (lstat(config->admin_socket, &st) == 0 && S_ISSOCK(st.st_mode)) {
+    unlink(config->admin_socket);
+  }
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", config->admin_socket);
+
+  listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listen_fd < 0) {
+    log_message(LOG_LEVEL_ERROR, "Failed to create admin socket: %s", strerror(errno));
+    return -1;
+  }
+  if (bind(listen_fd, (struct sockaddr*) &addr, sizeof(addr)) != 0 || chmod(config->admin_socket, 0660) != 0 || listen(listen_fd, 4) != 0) {
+    log_message(LOG_LEVEL_ERROR, "Failed to listen on admin socket '%s': %s", config->admin_socket, strerror(errno));
+    close(listen_fd);
+    listen_fd = -1;
+    return -1;
+  }
+  snprintf(socket_path, sizeof(socket_path), "%s", config->admin_socket);
+
+  atomic_store(&console_stop, false);
+  if (pthread_create(&console_thread, NULL, console_main, NULL) != 0) {
+    log_message(LOG_LEVEL_ERROR, "Failed to start the admin console thread.");
+    close(listen_fd);
+    listen_fd = -1;
+    unlink(socket_path);
+    return -1;
+  }
+
+  log_message(LOG_LEVEL_INFO, "Admin console listening on %s", socket_path);
+  return 0;
+}
+
+void admin_console_stop(void) {
+  if (listen_fd < 0) {
+    return;
+  }
+  atomic_store(&console_stop, true);
+
+  // The main loop has left, so a command waiting for it would only run into the timeout
+  pthread_mutex_lock(&handoff_mutex);
+  if (atomic_load(&handoff_pending)) {
+    reply_printf(handoff_reply, "error: the gateway is shutting down\n");
+    atomic_store(&handoff_pending, false);
+    pthread_cond_broadcast(&handoff_done);
+  }
+  pthread_mutex_unlock(&handoff_mutex);
+  pthread_join(console_thread, NULL);
+  close(listen_fd);
+  listen_fd = -1;
+  unlink(socket_path);
+}
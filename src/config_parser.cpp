@@ -2,116 +2,718 @@
 
 #include <yaml-cpp/yaml.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
 #include <cstring>
+#include <exception>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <iterator>
+#include <optional>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 #include "logger.h"
 
+namespace {
+
+// Intermediate representation of a mapping, filled while walking the YAML tree
+// and laid out into the arena once the final sizes are known.
+struct parsed_enum_value {
+  int         value;
+  std::string name;
+};
+
+struct parsed_mapping {
+  std::optional<std::string>     name;
+  int                            modbus_address   = 0;
+  std::optional<std::string>     opcua_node_id;
+  std::optional<std::string>     data_type;
+  std::optional<std::string>     format;
+  float                          scale            = 1.0f;
+  int                            poll_interval_ms = 0;
+  int                            function_code    = 4;
+  std::vector<parsed_enum_value> enum_values;
+};
+
+struct parsed_config {
+  std::optional<std::string>  modbus_ip;
+  int                         modbus_port        = 0;
+  int                         modbus_slave_id    = 0;
+  int                         modbus_timeout_sec = 0;
+  uint16_t                    opcua_port         = 0;
+  int                         opcua_slow_request_ms    = 100;
+  int                         opcua_history_entries    = 0;
+  std::optional<std::string>  opcua_username;
+  std::optional<std::string>  opcua_password;
+  std::optional<std::string>  log_file;
+  int                         log_level = 0;
+  int                         watchdog_sec             = 0;
+  int                         memory_summary_sec       = 3600;
+  std::optional<std::string>  cache_dir;
+  bool                        sunspec_enabled          = false;
+  int                         sunspec_base_address     = 40000;
+  int                         sunspec_poll_interval_ms = 5000;
+  bool                        metrics_enabled          = false;
+  std::optional<std::string>  metrics_bind_address;
+  int                         metrics_port             = 9464;
+  std::optional<std::string>  admin_socket;
+  bool                        capture_enabled          = false;
+  std::optional<std::string>  capture_file;
+  int                         capture_max_file_mb      = 10;
+  int                         capture_max_files        = 5;
+  bool                        trace_enabled            = false;
+  std::optional<std::string>  trace_file;
+  int                         trace_buffer_events      = 65536;
+  std::optional<std::string>  register_trace_record;
+  std::optional<std::string>  register_trace_replay;
+  double                      register_trace_speed     = 1.0;
+  std::vector<parsed_mapping> mappings;
+};
+
 // Helper to safely get a string value from a YAML node
-static char* get_string(const YAML::Node& node) {
+std::optional<std::string> get_string(const YAML::Node& node) {
   if (!node || !node.IsScalar()) {
-    return nullptr;
+    return std::nullopt;
   }
-  return strdup(node.as<std::string>().c_str());
+  return node.as<std::string>();
 }
 
-extern "C" modbus_opcua_config_t* load_config_from_yaml(const char* filename) {
+// Parses and validates a single mapping entry. Returns false and fills `error` on failure.
+bool parse_mapping(const YAML::Node& mapping_node, parsed_mapping& mapping, std::string& error) {
   try {
-    YAML::Node yaml_config = YAML::LoadFile(filename);
+    mapping.name             = get_string(mapping_node["name"]);
+    mapping.modbus_address   = mapping_node["modbus_address"].as<int>();
+    mapping.opcua_node_id    = get_string(mapping_node["opcua_node_id"]);
+    mapping.data_type        = get_string(mapping_node["data_type"]);
+    mapping.format           = get_string(mapping_node["format"]);
+    mapping.scale            = mapping_node["scale"] ? mapping_node["scale"].as<float>() : 1.0f;
+    mapping.poll_interval_ms = mapping_node["poll_interval_ms"].as<int>();
+    mapping.function_code    = mapping_node["function_code"] ? mapping_node["function_code"].as<int>() : 4;
+
+    // Parse enum_values if present
+    if (mapping_node["enum_values"]) {
+      const auto& enum_node = mapping_node["enum_values"];
+      mapping.enum_values.reserve(enum_node.size());
+      for (auto it = enum_node.begin(); it != enum_node.end(); ++it) {
+        mapping.enum_values.push_back({it->first.as<int>(), it->second.as<std::string>()});
+      }
+    }
+  } catch (const YAML::Exception& e) {
+    error = e.what();
+    return false;
+  }
+
+  if (!mapping.name || !mapping.opcua_node_id || !mapping.data_type) {
+    error = "'name', 'opcua_node_id' and 'data_type' are required";
+    return false;
+  }
+  if (mapping.poll_interval_ms <= 0) {
+    error = "'poll_interval_ms' must be positive";
+    return false;
+  }
+  if (mapping.function_code != 3 && mapping.function_code != 4) {
+    error = "'function_code' must be 3 (holding) or 4 (input registers)";
+    return false;
+  }
+  return true;
+}
+
+// Parses every entry of a `mappings` sequence, collecting one error line per invalid entry.
+void parse_mappings(const YAML::Node& mappings_node, std::vector<parsed_mapping>& mappings, std::vector<std::string>& errors) {
+  if (!mappings_node || !mappings_node.IsSequence()) {
+    return;
+  }
+  mappings.resize(mappings_node.size());
+  for (size_t i = 0; i < mappings.size(); ++i) {
+    std::string error;
+    if (!parse_mapping(mappings_node[i], mappings[i], error)) {
+      errors.push_back("mapping #" + std::to_string(i) + (mappings[i].name ? " '" + *mappings[i].name + "'" : "") + ": " + error);
+    }
+  }
+}
+
+// Result of parsing one mapping file on the loader pool
+struct mapping_file_result {
+  std::string                 path;
+  std::vector<parsed_mapping> mappings;
+  std::vector<std::string>    errors;
+};
+
+// Expands the `mapping_files` entries (files or directories of *.yaml/*.yml files) into a
+// sorted, de-duplicated list of paths, resolved relative to the main configuration file.
+std::vector<std::string> expand_mapping_files(const YAML::Node& files_node, const std::filesystem::path& base_dir) {
+  namespace fs = std::filesystem;
+  std::vector<std::string> paths;
+  if (!files_node || !files_node.IsSequence()) {
+    return paths;
+  }
+  for (const auto& entry : files_node) {
+    fs::path path = entry.as<std::string>();
+    if (path.is_relative()) {
+      path = base_dir / path;
+    }
+    if (fs::is_directory(path)) {
+      std::vector<std::string> dir_paths;
+      for (const auto& dir_entry : fs::directory_iterator(path)) {
+        const auto ext = dir_entry.path().extension();
+        if (dir_entry.is_regular_file() && (ext == ".yaml" || ext == ".yml")) {
+          dir_paths.push_back(dir_entry.path().string());
+        }
+      }
+      std::sort(dir_paths.begin(), dir_paths.end());
+      paths.insert(paths.end(), dir_paths.begin(), dir_paths.end());
+    } else {
+      paths.push_back(path.string());
+    }
+  }
+  return paths;
+}
+
+// Parses the mapping files on a small thread pool. Results keep the order of `paths`,
+// so the merged configuration does not depend on thread scheduling.
+std::vector<mapping_file_result> load_mapping_files(const std::vector<std::string>& paths) {
+  std::vector<mapping_file_result> results(paths.size());
+  std::atomic<size_t>              next_file{0};
+
+  auto worker = [&]() {
+    for (size_t i = next_file++; i < paths.size(); i = next_file++) {
+      mapping_file_result& result = results[i];
+      result.path                 = paths[i];
+      try {
+        YAML::Node file_node = YAML::LoadFile(paths[i]);
+        parse_mappings(file_node["mappings"], result.mappings, result.errors);
+      } catch (const std::exception& e) {
+        // YAML errors and anything else (e.g. std::bad_alloc); an exception leaving a worker thread would terminate the gateway
+        result.errors.push_back(e.what());
+      }
+    }
+  };
+
+  size_t num_workers = std::min<size_t>(paths.size(), std::max(1u, std::thread::hardware_concurrency()));
+  if (num_workers <= 1) {
+    worker();
+    return results;
+  }
+  std::vector<std::thread> pool;
+  pool.reserve(num_workers);
+  for (size_t i = 0; i < num_workers; ++i) {
+    pool.emplace_back(worker);
+  }
+  for (auto& thread : pool) {
+    thread.join();
+  }
+  return results;
+}
 
-    modbus_opcua_config_t* config = (modbus_opcua_config_t*) calloc(1, sizeof(modbus_opcua_config_t));
-    if (!config) {
-      log_message(LOG_LEVEL_ERROR, "Failed to allocate memory for config struct.");
+size_t align_up(size_t offset) {
+  const size_t align = alignof(std::max_align_t);
+  return (offset + align - 1) & ~(align - 1);
+}
+
+/*
+ * Lays the whole configuration out in one allocation:
+ *
+ *   [config struct][mappings[]][enum_values[] of all mappings][interned strings]
+ *
+ * Identical strings (data types, formats, enum labels, ...) are stored once, and
+ * the enum tables of all mappings share one contiguous array. The config struct
+ * sits at the start of the block, so free_config() releases everything with a
+ * single free().
+ */
+class config_arena_builder {
+ public:
+  explicit config_arena_builder(const parsed_config& parsed) : parsed_(parsed) {}
+
+  modbus_opcua_config_t* build() {
+    size_t num_enum_values = 0;
+    intern(parsed_.modbus_ip);
+    intern(parsed_.opcua_username);
+    intern(parsed_.opcua_password);
+    intern(parsed_.log_file);
+    intern(parsed_.cache_dir);
+    intern(parsed_.metrics_bind_address);
+    intern(parsed_.admin_socket);
+    intern(parsed_.capture_file);
+    intern(parsed_.trace_file);
+    intern(parsed_.register_trace_record);
+    intern(parsed_.register_trace_replay);
+    for (const auto& m : parsed_.mappings) {
+      intern(m.name);
+      intern(m.opcua_node_id);
+      intern(m.data_type);
+      intern(m.format);
+      for (const auto& e : m.enum_values) {
+        intern(e.name);
+      }
+      num_enum_values += m.enum_values.size();
+    }
+
+    const size_t mappings_offset = align_up(sizeof(modbus_opcua_config_t));
+    const size_t enums_offset    = align_up(mappings_offset + parsed_.mappings.size() * sizeof(modbus_reg_mapping_t));
+    const size_t strings_offset  = enums_offset + num_enum_values * sizeof(enum_value_mapping_t);
+    const size_t total_size      = strings_offset + string_bytes_;
+
+    char* arena = (char*) calloc(1, total_size);
+    if (!arena) {
       return NULL;
     }
+    strings_ = arena + strings_offset;
+    for (const auto& entry : string_offsets_) {
+      memcpy(strings_ + entry.second, entry.first.c_str(), entry.first.size() + 1);
+    }
+
+    modbus_opcua_config_t* config    = (modbus_opcua_config_t*) arena;
+    config->arena_size               = total_size;
+    config->modbus_ip                = lookup(parsed_.modbus_ip);
+    config->modbus_port              = parsed_.modbus_port;
+    config->modbus_slave_id          = parsed_.modbus_slave_id;
+    config->modbus_timeout_sec       = parsed_.modbus_timeout_sec;
+    config->opcua_port               = parsed_.opcua_port;
+    config->opcua_slow_request_ms    = parsed_.opcua_slow_request_ms;
+    config->opcua_history_entries    = parsed_.opcua_history_entries;
+    config->opcua_username           = lookup(parsed_.opcua_username);
+    config->opcua_password           = lookup(parsed_.opcua_password);
+    config->log_file                 = lookup(parsed_.log_file);
+    config->log_level                = parsed_.log_level;
+    config->watchdog_sec             = parsed_.watchdog_sec;
+    config->memory_summary_sec       = parsed_.memory_summary_sec;
+    config->cache_dir                = lookup(parsed_.cache_dir);
+    config->sunspec_enabled          = parsed_.sunspec_enabled;
+    config->sunspec_base_address     = parsed_.sunspec_base_address;
+    config->sunspec_poll_interval_ms = parsed_.sunspec_poll_interval_ms;
+    config->metrics_enabled          = parsed_.metrics_enabled;
+    config->metrics_bind_address     = lookup(parsed_.metrics_bind_address);
+    config->metrics_port             = parsed_.metrics_port;
+    config->admin_socket             = lookup(parsed_.admin_socket);
+    config->capture_enabled          = parsed_.capture_enabled;
+    config->capture_file             = lookup(parsed_.capture_file);
+    config->capture_max_file_mb      = parsed_.capture_max_file_mb;
+    config->capture_max_files        = parsed_.capture_max_files;
+    config->trace_enabled            = parsed_.trace_enabled;
+    config->trace_file               = lookup(parsed_.trace_file);
+    config->trace_buffer_events      = parsed_.trace_buffer_events;
+    config->register_trace_record    = lookup(parsed_.register_trace_record);
+    config->register_trace_replay    = lookup(parsed_.register_trace_replay);
+    config->register_trace_speed     = parsed_.register_trace_speed;
+
+    if (!parsed_.mappings.empty()) {
+      config->num_mappings = (int) parsed_.mappings.size();
+      config->mappings     = (modbus_reg_mapping_t*) (arena + mappings_offset);
+    }
+
+    enum_value_mapping_t* next_enum = (enum_value_mapping_t*) (arena + enums_offset);
+    for (size_t i = 0; i < parsed_.mappings.size(); ++i) {
+      const parsed_mapping& src = parsed_.mappings[i];
+      modbus_reg_mapping_t& dst = config->mappings[i];
+      dst.name                  = lookup(src.name);
+      dst.modbus_address        = src.modbus_address;
+      dst.opcua_node_id         = lookup(src.opcua_node_id);
+      dst.data_type             = lookup(src.data_type);
+      dst.format                = lookup(src.format);
+      dst.scale                 = src.scale;
+      dst.poll_interval_ms      = src.poll_interval_ms;
+      dst.function_code         = src.function_code;
+
+      if (!src.enum_values.empty()) {
+        dst.num_enum_values = (int) src.enum_values.size();
+        dst.enum_values     = next_enum;
+        for (const auto& e : src.enum_values) {
+          next_enum->value = e.value;
+          next_enum->name  = lookup(e.name);
+          ++next_enum;
+        }
+      }
+    }
+
+    return config;
+  }
+
+ private:
+  void intern(const std::string& s) {
+    if (string_offsets_.emplace(s, string_bytes_).second) {
+      string_bytes_ += s.size() + 1;
+    }
+  }
+
+  void intern(const std::optional<std::string>& s) {
+    if (s) {
+      intern(*s);
+    }
+  }
+
+  char* lookup(const std::string& s) const { return strings_ + string_offsets_.at(s); }
+
+  char* lookup(const std::optional<std::string>& s) const { return s ? lookup(*s) : NULL; }
+
+  const parsed_config&                    parsed_;
+  std::unordered_map<std::string, size_t> string_offsets_;
+  size_t                                  string_bytes_ = 0;
+  char*                                   strings_      = NULL;
+};
+
+// Converts an arena configuration back into the intermediate representation, so it
+// can be re-laid out with extra mappings.
+std::optional<std::string> to_optional(const char* s) {
+  return s ? std::optional<std::string>(s) : std::nullopt;
+}
+
+parsed_mapping from_mapping(const modbus_reg_mapping_t& src) {
+  parsed_mapping mapping;
+  mapping.name             = to_optional(src.name);
+  mapping.modbus_address   = src.modbus_address;
+  mapping.opcua_node_id    = to_optional(src.opcua_node_id);
+  mapping.data_type        = to_optional(src.data_type);
+  mapping.format           = to_optional(src.format);
+  mapping.scale            = src.scale;
+  mapping.poll_interval_ms = src.poll_interval_ms;
+  mapping.function_code    = src.function_code;
+  for (int j = 0; j < src.num_enum_values; j++) {
+    mapping.enum_values.push_back({src.enum_values[j].value, src.enum_values[j].name});
+  }
+  return mapping;
+}
+
+parsed_config from_config(const modbus_opcua_config_t& src) {
+  parsed_config config;
+  config.modbus_ip                = to_optional(src.modbus_ip);
+  config.modbus_port              = src.modbus_port;
+  config.modbus_slave_id          = src.modbus_slave_id;
+  config.modbus_timeout_sec       = src.modbus_timeout_sec;
+  config.opcua_port               = src.opcua_port;
+  config.opcua_slow_request_ms    = src.opcua_slow_request_ms;
+  config.opcua_history_entries    = src.opcua_history_entries;
+  config.opcua_username           = to_optional(src.opcua_username);
+  config.opcua_password           = to_optional(src.opcua_password);
+  config.log_file                 = to_optional(src.log_file);
+  config.log_level                = src.log_level;
+  config.watchdog_sec             = src.watchdog_sec;
+  config.memory_summary_sec       = src.memory_summary_sec;
+  config.cache_dir                = to_optional(src.cache_dir);
+  config.sunspec_enabled          = src.sunspec_enabled;
+  config.sunspec_base_address     = src.sunspec_base_address;
+  config.sunspec_poll_interval_ms = src.sunspec_poll_interval_ms;
+  config.metrics_enabled          = src.metrics_enabled;
+  config.metrics_bind_address     = to_optional(src.metrics_bind_address);
+  config.metrics_port             = src.metrics_port;
+  config.admin_socket             = to_optional(src.admin_socket);
+  config.capture_enabled          = src.capture_enabled;
+  config.capture_file             = to_optional(src.capture_file);
+  config.capture_max_file_mb      = src.capture_max_file_mb;
+  config.capture_max_files        = src.capture_max_files;
+  config.trace_enabled            = src.trace_enabled;
+  config.trace_file               = to_optional(src.trace_file);
+  config.trace_buffer_events      = src.trace_buffer_events;
+  config.register_trace_record    = to_optional(src.register_trace_record);
+  config.register_trace_replay    = to_optional(src.register_trace_replay);
+  config.register_trace_speed     = src.register_trace_speed;
+  for (int i = 0; i < src.num_mappings; i++) {
+    config.mappings.push_back(from_mapping(src.mappings[i]));
+  }
+  return config;
+}
+
+// Writes an emitted document to a temporary file first and renames it into place, so a
+// crash never leaves a truncated cache file behind.
+int write_yaml_file(const char* filename, const YAML::Emitter& out) {
+  const std::string tmp_name = std::string(filename) + ".tmp";
+  std::ofstream     file(tmp_name, std::ios::trunc);
+  file << out.c_str() << "\n";
+  file.close();
+  if (!file || std::rename(tmp_name.c_str(), filename) != 0) {
+    log_message(LOG_LEVEL_ERROR, "Failed to write YAML file '%s'.", filename);
+    std::remove(tmp_name.c_str());
+    return -1;
+  }
+  return 0;
+}
+
+}  // namespace
+
+extern "C" modbus_opcua_config_t* load_config_from_yaml(const char* filename) {
+  parsed_config parsed;
+  try {
+    YAML::Node yaml_config = YAML::LoadFile(filename);
 
     // Parse Modbus settings
-    const auto& modbus_node    = yaml_config["modbus"];
-    config->modbus_ip          = get_string(modbus_node["ip"]);
-    config->modbus_port        = modbus_node["port"].as<int>();
-    config->modbus_slave_id    = modbus_node["slave_id"].as<int>();
-    config->modbus_timeout_sec = modbus_node["timeout_sec"].as<int>();
+    const auto& modbus_node   = yaml_config["modbus"];
+    parsed.modbus_ip          = get_string(modbus_node["ip"]);
+    parsed.modbus_port        = modbus_node["port"].as<int>();
+    parsed.modbus_slave_id    = modbus_node["slave_id"].as<int>();
+    parsed.modbus_timeout_sec = modbus_node["timeout_sec"].as<int>();
 
     // Parse OPC UA settings
-    config->opcua_port = yaml_config["opcua"]["port"].as<int>();
+    parsed.opcua_port = yaml_config["opcua"]["port"].as<int>();
+    if (yaml_config["opcua"]["slow_request_ms"]) {
+      parsed.opcua_slow_request_ms = yaml_config["opcua"]["slow_request_ms"].as<int>();
+    }
+    if (yaml_config["opcua"]["history_entries"]) {
+      parsed.opcua_history_entries = yaml_config["opcua"]["history_entries"].as<int>();
+    }
 
     // Parse Security settings
     const auto& security_node = yaml_config["security"];
-    config->opcua_username    = get_string(security_node["username"]);
-    config->opcua_password    = get_string(security_node["password"]);
+    parsed.opcua_username     = get_string(security_node["username"]);
+    parsed.opcua_password     = get_string(security_node["password"]);
 
     // Parse Logging settings
     const auto& logging_node = yaml_config["logging"];
-    config->log_file         = get_string(logging_node["file"]);
-    config->log_level        = logging_node["level"].as<int>();
+    parsed.log_file          = get_string(logging_node["file"]);
+    parsed.log_level         = logging_node["level"].as<int>();
+
+    // Parse the stall threshold of the watchdog
+    if (yaml_config["watchdog_sec"]) {
+      parsed.watchdog_sec = yaml_config["watchdog_sec"].as<int>();
+    }
+    if (yaml_config["memory_summary_sec"]) {
+      parsed.memory_summary_sec = yaml_config["memory_summary_sec"].as<int>();
+    }
+
+    // Parse cache and SunSpec discovery settings
+    parsed.cache_dir = get_string(yaml_config["cache_dir"]);
+    if (const auto& sunspec_node = yaml_config["sunspec"]) {
+      parsed.sunspec_enabled = sunspec_node["enabled"] && sunspec_node["enabled"].as<bool>();
+      if (sunspec_node["base_address"]) {
+        parsed.sunspec_base_address = sunspec_node["base_address"].as<int>();
+      }
+      if (sunspec_node["poll_interval_ms"]) {
+        parsed.sunspec_poll_interval_ms = sunspec_node["poll_interval_ms"].as<int>();
+      }
+    }
+
+    // Parse the optional Prometheus/OpenMetrics listener
+    if (const auto& metrics_node = yaml_config["metrics"]) {
+      parsed.metrics_enabled      = metrics_node["enabled"] && metrics_node["enabled"].as<bool>();
+      parsed.metrics_bind_address = get_string(metrics_node["bind_address"]);
+      if (metrics_node["port"]) {
+        parsed.metrics_port = metrics_node["port"].as<int>();
+      }
+    }
+
+    // Parse the optional admin console
+    if (const auto& admin_node = yaml_config["admin"]) {
+      parsed.admin_socket = get_string(admin_node["socket"]);
+    }
+
+    // Parse the optional Modbus wire capture
+    if (const auto& capture_node = yaml_config["capture"]) {
+      parsed.capture_enabled = capture_node["enabled"] && capture_node["enabled"].as<bool>();
+      parsed.capture_file    = get_string(capture_node["file"]);
+      if (capture_node["max_file_mb"]) {
+        parsed.capture_max_file_mb = capture_node["max_file_mb"].as<int>();
+      }
+      if (capture_node["max_files"]) {
+        parsed.capture_max_files = capture_node["max_files"].as<int>();
+      }
+    }
+
+    // Parse the optional span tracing
+    if (const auto& trace_node = yaml_config["trace"]) {
+      parsed.trace_enabled = trace_node["enabled"] && trace_node["enabled"].as<bool>();
+      parsed.trace_file    = get_string(trace_node["file"]);
+      if (trace_node["buffer_events"]) {
+        parsed.trace_buffer_events = trace_node["buffer_events"].as<int>();
+      }
+    }
+
+    // Parse the optional register trace recording and replay
+    if (const auto& register_trace_node = yaml_config["register_trace"]) {
+      parsed.register_trace_record = get_string(register_trace_node["record_file"]);
+      parsed.register_trace_replay = get_string(register_trace_node["replay_file"]);
+      if (register_trace_node["replay_speed"]) {
+        parsed.register_trace_speed = register_trace_node["replay_speed"].as<double>();
+      }
+    }
 
     // Parse Mappings
-    const auto& mappings_node = yaml_config["mappings"];
-    if (mappings_node && mappings_node.IsSequence()) {
-      config->num_mappings = mappings_node.size();
-      config->mappings     = (modbus_reg_mapping_t*) calloc(config->num_mappings, sizeof(modbus_reg_mapping_t));
-
-      for (size_t i = 0; i < config->num_mappings; ++i) {
-        const auto& mapping_node             = mappings_node[i];
-        config->mappings[i].name             = get_string(mapping_node["name"]);
-        config->mappings[i].modbus_address   = mapping_node["modbus_address"].as<int>();
-        config->mappings[i].opcua_node_id    = get_string(mapping_node["opcua_node_id"]);
-        config->mappings[i].data_type        = get_string(mapping_node["data_type"]);
-        config->mappings[i].format           = get_string(mapping_node["format"]);
-        config->mappings[i].scale            = mapping_node["scale"] ? mapping_node["scale"].as<float>() : 1.0f;
-        config->mappings[i].poll_interval_ms = mapping_node["poll_interval_ms"].as<int>();
-
-        // Parse enum_values if present
-        if (mapping_node["enum_values"]) {
-          const auto& enum_node               = mapping_node["enum_values"];
-          config->mappings[i].num_enum_values = enum_node.size();
-          config->mappings[i].enum_values     = (enum_value_mapping_t*) calloc(config->mappings[i].num_enum_values, sizeof(enum_value_mapping_t));
-
-          int j = 0;
-          for (auto it = enum_node.begin(); it != enum_node.end(); ++it, ++j) {
-            config->mappings[i].enum_values[j].value = it->first.as<int>();
-            config->mappings[i].enum_values[j].name  = strdup(it->second.as<std::string>().c_str());
-          }
-        }
+    std::vector<std::string> errors;
+    parse_mappings(yaml_config["mappings"], parsed.mappings, errors);
+    for (const auto& error : errors) {
+      log_message(LOG_LEVEL_ERROR, "%s: %s", filename, error.c_str());
+    }
+    bool                     valid = errors.empty();
+    std::vector<std::string> mapping_sources(parsed.mappings.size(), filename);
+
+    // Parse additional mapping files in parallel and append them in listed order
+    const auto paths = expand_mapping_files(yaml_config["mapping_files"], std::filesystem::path(filename).parent_path());
+    for (auto& result : load_mapping_files(paths)) {
+      for (const auto& error : result.errors) {
+        log_message(LOG_LEVEL_ERROR, "%s: %s", result.path.c_str(), error.c_str());
       }
+      valid = valid && result.errors.empty();
+      mapping_sources.insert(mapping_sources.end(), result.mappings.size(), result.path);
+      std::move(result.mappings.begin(), result.mappings.end(), std::back_inserter(parsed.mappings));
+    }
+    if (!paths.empty()) {
+      log_message(LOG_LEVEL_INFO, "Loaded %zu mapping file(s) referenced by '%s'.", paths.size(), filename);
     }
 
-    return config;
+    // Node IDs must be unique across all files
+    if (valid) {
+      std::unordered_map<std::string, size_t> node_ids;
+      for (size_t i = 0; i < parsed.mappings.size(); ++i) {
+        auto inserted = node_ids.emplace(*parsed.mappings[i].opcua_node_id, i);
+        if (!inserted.second) {
+          log_message(LOG_LEVEL_ERROR, "%s: duplicate opcua_node_id '%s' (first defined in %s).", mapping_sources[i].c_str(),
+                      parsed.mappings[i].opcua_node_id->c_str(), mapping_sources[inserted.first->second].c_str());
+          valid = false;
+        }
+      }
+    }
+    if (!valid) {
+      return NULL;
+    }
 
   } catch (const YAML::Exception& e) {
     log_message(LOG_LEVEL_ERROR, "Failed to parse YAML file '%s': %s", filename, e.what());
     return NULL;
+  } catch (const std::filesystem::filesystem_error& e) {
+    log_message(LOG_LEVEL_ERROR, "Failed to resolve mapping files of '%s': %s", filename, e.what());
+    return NULL;
+  }
+
+  modbus_opcua_config_t* config = config_arena_builder(parsed).build();
+  if (!config) {
+    log_message(LOG_LEVEL_ERROR, "Failed to allocate memory for config struct.");
+    return NULL;
   }
+  return config;
 }
 
 extern "C" void free_config(modbus_opcua_config_t* config) {
-  if (!config) {
-    return;
+  // The struct heads the arena that holds every mapping, enum table and string.
+  free(config);
+}
+
+extern "C" modbus_opcua_config_t* load_mappings_from_yaml(const char* filename) {
+  parsed_config            parsed;
+  std::vector<std::string> errors;
+  try {
+    parse_mappings(YAML::LoadFile(filename)["mappings"], parsed.mappings, errors);
+  } catch (const YAML::Exception& e) {
+    log_message(LOG_LEVEL_ERROR, "Failed to parse YAML file '%s': %s", filename, e.what());
+    return NULL;
+  }
+  for (const auto& error : errors) {
+    log_message(LOG_LEVEL_ERROR, "%s: %s", filename, error.c_str());
+  }
+  if (!errors.empty()) {
+    return NULL;
+  }
+  return config_arena_builder(parsed).build();
+}
+
+extern "C" int save_mappings_to_yaml(const char* filename, const modbus_reg_mapping_t* mappings, int num_mappings) {
+  YAML::Emitter out;
+  out << YAML::BeginMap << YAML::Key << "mappings" << YAML::Value << YAML::BeginSeq;
+  for (int i = 0; i < num_mappings; i++) {
+    const modbus_reg_mapping_t& m = mappings[i];
+    out << YAML::BeginMap;
+    out << YAML::Key << "name" << YAML::Value << YAML::DoubleQuoted << m.name;
+    out << YAML::Key << "modbus_address" << YAML::Value << m.modbus_address;
+    out << YAML::Key << "function_code" << YAML::Value << m.function_code;
+    out << YAML::Key << "opcua_node_id" << YAML::Value << YAML::DoubleQuoted << m.opcua_node_id;
+    out << YAML::Key << "data_type" << YAML::Value << YAML::DoubleQuoted << m.data_type;
+    if (m.format) {
+      out << YAML::Key << "format" << YAML::Value << YAML::DoubleQuoted << m.format;
+    }
+    out << YAML::Key << "poll_interval_ms" << YAML::Value << m.poll_interval_ms;
+    if (m.num_enum_values > 0) {
+      out << YAML::Key << "enum_values" << YAML::Value << YAML::BeginMap;
+      for (int j = 0; j < m.num_enum_values; j++) {
+        out << YAML::Key << m.enum_values[j].value << YAML::Value << YAML::DoubleQuoted << m.enum_values[j].name;
+      }
+      out << YAML::EndMap;
+    }
+    out << YAML::EndMap;
   }
+  out << YAML::EndSeq << YAML::EndMap;
 
-  free(config->modbus_ip);
-  free(config->opcua_username);
-  free(config->opcua_password);
-  free(config->log_file);
+  return write_yaml_file(filename, out);
+}
 
-  if (config->mappings) {
-    for (int i = 0; i < config->num_mappings; i++) {
-      free(config->mappings[i].name);
-      free(config->mappings[i].opcua_node_id);
-      free(config->mappings[i].data_type);
-      free(config->mappings[i].format);
+extern "C" modbus_opcua_config_t* config_append_mappings(const modbus_opcua_config_t* config, const modbus_reg_mapping_t* mappings,
+                                                         int num_mappings) {
+  parsed_config parsed = from_config(*config);
 
-      if (config->mappings[i].enum_values) {
-        for (int j = 0; j < config->mappings[i].num_enum_values; j++) {
-          free(config->mappings[i].enum_values[j].name);
-        }
-        free(config->mappings[i].enum_values);
+  std::unordered_map<std::string, bool> node_ids;
+  for (const auto& mapping : parsed.mappings) {
+    node_ids.emplace(*mapping.opcua_node_id, true);
+  }
+  for (int i = 0; i < num_mappings; i++) {
+    if (!node_ids.emplace(mappings[i].opcua_node_id, true).second) {
+      log_message(LOG_LEVEL_WARN, "Skipping mapping '%s': opcua_node_id '%s' is already in use.", mappings[i].name, mappings[i].opcua_node_id);
+      continue;
+    }
+    parsed.mappings.push_back(from_mapping(mappings[i]));
+  }
+
+  modbus_opcua_config_t* merged = config_arena_builder(parsed).build();
+  if (!merged) {
+    log_message(LOG_LEVEL_ERROR, "Failed to allocate memory for config struct.");
+  }
+  return merged;
+}
+
+extern "C" int load_device_caps_from_yaml(const char* filename, device_caps_t* caps) {
+  try {
+    YAML::Node node = YAML::LoadFile(filename);
+    caps->max_regs_per_request   = node["max_regs_per_request"].as<int>();
+    caps->fc3_supported          = node["fc3_supported"].as<bool>();
+    caps->fc4_supported          = node["fc4_supported"].as<bool>();
+    caps->max_pipelined_requests = node["max_pipelined_requests"] ? node["max_pipelined_requests"].as<int>() : 1;
+    caps->num_invalid_ranges     = 0;
+    for (const auto& range : node["invalid_ranges"]) {
+      if (caps->num_invalid_ranges >= DEVICE_CAPS_MAX_INVALID_RANGES) {
+        break;
       }
+      invalid_range_t& dst = caps->invalid_ranges[caps->num_invalid_ranges++];
+      dst.function_code    = range["function_code"].as<int>();
+      dst.start            = range["start"].as<int>();
+      dst.end              = range["end"].as<int>();
+      dst.no_coalesce      = range["no_coalesce"] && range["no_coalesce"].as<bool>();
+      dst.confirmed        = true;
+      dst.learned_at       = 0;
+    }
+  } catch (const YAML::Exception& e) {
+    // A missing file is the normal "not cached yet" case
+    if (std::filesystem::exists(filename)) {
+      log_message(LOG_LEVEL_WARN, "Ignoring invalid capability cache '%s': %s", filename, e.what());
     }
-    free(config->mappings);
+    return -1;
   }
-  free(config);
-}
\ No newline at end of file
+  return 0;
+}
+
+extern "C" int save_device_caps_to_yaml(const char* filename, const device_caps_t* caps) {
+  YAML::Emitter out;
+  out << YAML::BeginMap;
+  out << YAML::Key << "serial" << YAML::Value << YAML::DoubleQuoted << caps->serial;
+  out << YAML::Key << "firmware" << YAML::Value << YAML::DoubleQuoted << caps->firmware;
+  out << YAML::Key << "max_regs_per_request" << YAML::Value << caps->max_regs_per_request;
+  out << YAML::Key << "fc3_supported" << YAML::Value << caps->fc3_supported;
+  out << YAML::Key << "fc4_supported" << YAML::Value << caps->fc4_supported;
+  out << YAML::Key << "max_pipelined_requests" << YAML::Value << caps->max_pipelined_requests;
+  out << YAML::Key << "invalid_ranges" << YAML::Value << YAML::BeginSeq;
+  for (int r = 0; r < caps->num_invalid_ranges; r++) {
+    const invalid_range_t& range = caps->invalid_ranges[r];
+    if (!range.confirmed) {
+      continue;
+    }
+    out << YAML::Flow << YAML::BeginMap;
+    out << YAML::Key << "function_code" << YAML::Value << range.function_code;
+    out << YAML::Key << "start" << YAML::Value << range.start;
+    out << YAML::Key << "end" << YAML::Value << range.end;
+    if (range.no_coalesce) {
+      out << YAML::Key << "no_coalesce" << YAML::Value << true;
+    }
+    out << YAML::EndMap;
+  }
+  out << YAML::EndSeq << YAML::EndMap;
+  return write_yaml_file(filename, out);
+}
@@ -0,0 +1,89 @@
+#include "cpu_accounting.h"
+
+#include <stddef.h>
+#include <time.h>
+
+#define MAX_STAGE_DEPTH 8
+
+/*
+ * @brief A stage currently being timed on this thread.
+ */
+typedef struct {
+  pipeline_stage_t stage;
+  uint64_t         wall_start;
+  uint64_t         cpu_start;
+  uint64_t         child_wall;  // Time of nested stages, subtracted to keep the accounts exclusive
+  uint64_t         child_cpu;
+} stage_frame_t;
+
+stage_accounts_t cpu_accounts_global;
+
+static const char* stage_names[PIPELINE_STAGE_COUNT] = {
+    "ModbusIO", "Decode", "NodeUpdate", "History", "Logging", "OpcUaService",
+};
+
+static _Thread_local stage_frame_t     frames[MAX_STAGE_DEPTH];
+static _Thread_local int               depth  = 0;
+static _Thread_local stage_accounts_t* device = NULL;
+
+static uint64_t clock_ns(clockid_t clock) {
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+const char* cpu_accounting_stage_name(pipeline_stage_t stage) {
+  return stage_names[stage];
+}
+
+void cpu_accounting_bind_device(stage_accounts_t* accounts) {
+  device = accounts;
+}
+
+void cpu_accounting_enter(pipeline_stage_t stage) {
+  if (depth < MAX_STAGE_DEPTH) {
+    stage_frame_t* frame = &frames[depth];
+    frame->stage         = stage;
+    frame->wall_start    = clock_ns(CLOCK_MONOTONIC);
+    frame->cpu_start     = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+    frame->child_wall    = 0;
+    frame->child_cpu     = 0;
+  }
+  depth++;  // Deeper stages are not timed but keep the pairing intact
+}
+
+static void add_time(stage_time_t* account, uint64_t wall_ns, uint64_t cpu_ns) {
+  atomic_fetch_add_explicit(&account->calls, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&account->wall_ns, wall_ns, memory_order_relaxed);
+  atomic_fetch_add_explicit(&account->cpu_ns, cpu_ns, memory_order_relaxed);
+}
+
+void cpu_accounting_leave(pipeline_stage_t stage) {
+  if (depth == 0) {
+    return;
+  }
+  depth--;
+  if (depth >= MAX_STAGE_DEPTH || frames[depth].stage != stage) {
+    return;
+  }
+
+  const stage_frame_t* frame   = &frames[depth];
+  uint64_t             wall_ns = clock_ns(CLOCK_MONOTONIC) - frame->wall_start;
+  uint64_t             cpu_ns  = clock_ns(CLOCK_THREAD_CPUTIME_ID) - frame->cpu_start;
+  if (depth > 0) {
+    frames[depth - 1].child_wall += wall_ns;
+    frames[depth - 1].child_cpu += cpu_ns;
+  }
+
+  // Clocks of different resolution can make the nested time exceed the total by a tick
+  uint64_t self_wall = wall_ns > frame->child_wall ? wall_ns - frame->child_wall : 0;
+  uint64_t self_cpu  = cpu_ns > frame->child_cpu ? cpu_ns - frame->child_cpu : 0;
+  add_time(&cpu_accounts_global.stage[stage], self_wall, self_cpu);
+  if (device) {
+    add_time(&device->stage[stage], self_wall, self_cpu);
+  }
+}
+
+uint64_t cpu_accounting_process_cpu_ns(void) {
+  return clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+}
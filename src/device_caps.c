@@ -0,0 +1,334 @@
+#include "device_caps.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "config_parser.h"
+#include "logger.h"
+#include "modbus_client.h"
+#include "register_cache.h"
+
+void device_caps_init(device_caps_t* caps) {
+  memset(caps, 0, sizeof(*caps));
+  caps->fc3_supported          = true;
+  caps->fc4_supported          = true;
+  caps->max_pipelined_requests = 1;
+}
+
+static void caps_file_name(const modbus_opcua_config_t* config, const char* serial, const char* firmware, char* out, size_t out_size) {
+  snprintf(out, out_size, "%s/caps_%s_%s.yaml", config->cache_dir, serial, firmware);
+}
+
+// Finds the most recently written cache entry of a serial number, whatever its firmware.
+static int find_latest_caps_file(const modbus_opcua_config_t* config, const char* serial, char* out, size_t out_size) {
+  DIR* dir = opendir(config->cache_dir);
+  if (!dir) {
+    return -1;
+  }
+  char prefix[64];
+  snprintf(prefix, sizeof(prefix), "caps_%s_", serial);
+
+  time_t         newest = 0;
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != NULL) {
+    if (strncmp(entry->d_name, prefix, strlen(prefix)) != 0) {
+      continue;
+    }
+    char        path[512];
+    struct stat st;
+    snprintf(path, sizeof(path), "%s/%s", config->cache_dir, entry->d_name);
+    if (stat(path, &st) == 0 && st.st_mtime >= newest) {
+      newest = st.st_mtime;
+      snprintf(out, out_size, "%s", path);
+    }
+  }
+  closedir(dir);
+  return newest > 0 ? 0 : -1;
+}
+
+static void caps_start_probe(device_caps_t* caps) {
+  caps->validated   = false;
+  caps->probe_state = CAPS_PROBE_FUNCTION_CODES;
+  caps->probe_index = 0;
+  caps->probe_lo    = 0;
+  caps->probe_hi    = 0;
+}
+
+int device_caps_identify(device_caps_t* caps, modbus_t* ctx, const modbus_opcua_config_t* config) {
+  char     serial[32]   = "";
+  char     firmware[32] = "";
+  uint16_t regs[4];
+
+  // Serial number (U32) and firmware version (U32, FW format) are adjacent on SMA devices
+  if (read_modbus_registers(ctx, 4, SMA_REG_SERIAL_NUMBER, 4, regs) == 0) {
+    uint32_t sn = ((uint32_t) regs[0] << 16) | regs[1];
+    uint32_t fw = ((uint32_t) regs[2] << 16) | regs[3];
+    snprintf(serial, sizeof(serial), "%u", sn);
+    snprintf(firmware, sizeof(firmware), "%u.%u.%u.%u", (fw >> 24) & 0xFF, (fw >> 16) & 0xFF, (fw >> 8) & 0xFF, fw & 0xFF);
+  }
+
+  if (strcmp(serial, caps->serial) == 0 && strcmp(firmware, caps->firmware) == 0 && serial[0] != '\0') {
+    return 0;  // Same device as before the reconnect
+  }
+
+  device_caps_init(caps);
+  snprintf(caps->serial, sizeof(caps->serial), "%s", serial);
+  snprintf(caps->firmware, sizeof(caps->firmware), "%s", firmware);
+  caps_start_probe(caps);
+
+  if (serial[0] == '\0') {
+    log_message(LOG_LEVEL_WARN, "Could not identify Modbus device, probing capabilities without persistence.");
+    return 1;
+  }
+  if (!config->cache_dir) {
+    log_message(LOG_LEVEL_INFO, "Device %s (firmware %s): no cache_dir configured, probing capabilities.", serial, firmware);
+    return 1;
+  }
+
+  char path[512];
+  caps_file_name(config, serial, firmware, path, sizeof(path));
+  if (load_device_caps_from_yaml(path, caps) == 0) {
+    caps->validated   = true;
+    caps->probe_state = CAPS_PROBE_DONE;
+    log_message(LOG_LEVEL_INFO, "Device %s (firmware %s): using cached capabilities (max %d registers/request, %d invalid ranges).", serial,
+                firmware, caps->max_regs_per_request, caps->num_invalid_ranges);
+  } else if (find_latest_caps_file(config, serial, path, sizeof(path)) == 0 && load_device_caps_from_yaml(path, caps) == 0) {
+    // Keep the new firmware version, the loaded limits are only a starting point
+    snprintf(caps->firmware, sizeof(caps->firmware), "%s", firmware);
+    log_message(LOG_LEVEL_INFO, "Device %s: firmware changed to %s, starting from %s and revalidating in the background.", serial, firmware,
+                path);
+  } else {
+    log_message(LOG_LEVEL_INFO, "Device %s (firmware %s): no cached capabilities, probing in the background.", serial, firmware);
+  }
+  return 1;
+}
+
+static int add_invalid_range(device_caps_t* caps, int function_code, int start, int end, bool no_coalesce) {
+  for (int r = 0; r < caps->num_invalid_ranges; r++) {
+    const invalid_range_t* range = &caps->invalid_ranges[r];
+    if (range->function_code == function_code && range->start == start && range->end == end) {
+      return 0;
+    }
+  }
+  if (caps->num_invalid_ranges >= DEVICE_CAPS_MAX_INVALID_RANGES) {
+    return 0;
+  }
+  invalid_range_t* range = &caps->invalid_ranges[caps->num_invalid_ranges++];
+  range->function_code   = function_code;
+  range->start           = start;
+  range->end             = end;
+  range->no_coalesce     = no_coalesce;
+  range->confirmed       = false;
+  range->learned_at      = time(NULL);
+  if (no_coalesce) {
+    log_message(LOG_LEVEL_WARN, "Coalesced read of registers %d-%d (FC%d) rejected, reading its parts separately.", start, end - 1,
+                function_code);
+  } else {
+    log_message(LOG_LEVEL_WARN, "Registers %d-%d (FC%d) rejected by the device, quarantining dependent mappings.", start, end - 1,
+                function_code);
+  }
+  return 1;
+}
+
+int device_caps_report_exception(device_caps_t* caps, int function_code, int address, int num_regs, bool coalesced, int error) {
+  if (error == EMBXILFUN) {
+    bool* supported = function_code == 3 ? &caps->fc3_supported : &caps->fc4_supported;
+    if (*supported) {
+      *supported = false;
+      log_message(LOG_LEVEL_WARN, "Device rejects function code %d, quarantining dependent mappings.", function_code);
+      return 1;
+    }
+    return 0;
+  }
+  if (error != EMBXILADD && error != EMBXILVAL) {
+    return 0;  // Busy/failure exceptions say nothing about the register map
+  }
+  // A failed coalesced read only tells that one of its parts is invalid; the separate
+  // reads of the next cycle find out which one
+  return add_invalid_range(caps, function_code, address, address + num_regs, coalesced);
+}
+
+bool device_caps_may_coalesce(const device_caps_t* caps, int function_code, int start, int end) {
+  if (end - start > caps->max_regs_per_request) {
+    return false;
+  }
+  for (int r = 0; r < caps->num_invalid_ranges; r++) {
+    const invalid_range_t* range = &caps->invalid_ranges[r];
+    if (range->no_coalesce && range->function_code == function_code && start < range->end && end > range->start) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool device_caps_is_invalid(const device_caps_t* caps, int function_code, int start, int end) {
+  if ((function_code == 3 && !caps->fc3_supported) || (function_code == 4 && !caps->fc4_supported)) {
+    return true;
+  }
+  for (int r = 0; r < caps->num_invalid_ranges; r++) {
+    const invalid_range_t* range = &caps->invalid_ranges[r];
+    if (!range->no_coalesce && range->function_code == function_code && start < range->end && end > range->start) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Finds the longest run of adjacent blocks (same function code) to probe the block size limit on.
+static int longest_adjacent_run(const register_cache_t* cache, int* run_address, int* run_function_code) {
+  int best = 0;
+  for (int b = 0; b < cache->num_blocks;) {
+    const register_block_t* first = &cache->blocks[b];
+    int                     end   = first->start_address + first->num_regs;
+    int                     next  = b + 1;
+    while (next < cache->num_blocks && cache->blocks[next].function_code == first->function_code && cache->blocks[next].start_address == end) {
+      end += cache->blocks[next].num_regs;
+      next++;
+    }
+    if (end - first->start_address > best) {
+      best               = end - first->start_address;
+      *run_address       = first->start_address;
+      *run_function_code = first->function_code;
+    }
+    b = next;
+  }
+  return best > MODBUS_MAX_READ_REGISTERS ? MODBUS_MAX_READ_REGISTERS : best;
+}
+
+void device_caps_save(const device_caps_t* caps, const modbus_opcua_config_t* config) {
+  if (caps->serial[0] != '\0' && config->cache_dir) {
+    char path[512];
+    caps_file_name(config, caps->serial, caps->firmware, path, sizeof(path));
+    save_device_caps_to_yaml(path, caps);
+  }
+}
+
+static void caps_finish_probe(device_caps_t* caps, const modbus_opcua_config_t* config) {
+  caps->validated   = true;
+  caps->probe_state = CAPS_PROBE_DONE;
+  log_message(LOG_LEVEL_INFO, "Device %s capabilities validated: max %d registers/request, FC3 %s, FC4 %s, %d invalid ranges.",
+              caps->serial[0] ? caps->serial : "(unknown)", caps->max_regs_per_request, caps->fc3_supported ? "yes" : "no",
+              caps->fc4_supported ? "yes" : "no", caps->num_invalid_ranges);
+  device_caps_save(caps, config);
+}
+
+// Issues a probe read: 1 if accepted, 0 if rejected with an illegal function, address or value
+// exception, -1 if it is to be retried later. Busy and gateway exceptions say nothing about the
+// request, and transport errors are left to the acquisition loop to handle.
+static int probe_read(modbus_t* ctx, int function_code, int address, int num_regs, uint16_t* regs) {
+  if (read_modbus_registers(ctx, function_code, address, num_regs, regs) == 0) {
+    return 1;
+  }
+  return errno == EMBXILFUN || errno == EMBXILADD || errno == EMBXILVAL ? 0 : -1;
+}
+
+// Re-reads an unconfirmed invalid range once it is old enough, so a single transient
+// exception does not quarantine mappings for good
+static int confirm_learned_range(device_caps_t* caps, modbus_t* ctx, const modbus_opcua_config_t* config, uint16_t* regs) {
+  time_t now = time(NULL);
+  for (int r = 0; r < caps->num_invalid_ranges; r++) {
+    invalid_range_t range = caps->invalid_ranges[r];
+    if (range.confirmed || now - range.learned_at < DEVICE_CAPS_CONFIRM_DELAY_SEC) {
+      continue;
+    }
+    int count = range.end - range.start;
+    int rc    = count <= MODBUS_MAX_READ_REGISTERS ? probe_read(ctx, range.function_code, range.start, count, regs) : 0;
+    if (rc < 0) {
+      return 0;
+    }
+    if (rc == 1) {
+      log_message(LOG_LEVEL_INFO, "Registers %d-%d (FC%d) read fine on recheck, the earlier exception was transient.", range.start,
+                  range.end - 1, range.function_code);
+      caps->invalid_ranges[r] = caps->invalid_ranges[--caps->num_invalid_ranges];
+      return 1;
+    }
+    caps->invalid_ranges[r].confirmed = true;
+    device_caps_save(caps, config);
+    return 0;
+  }
+  return 0;
+}
+
+int device_caps_probe_step(device_caps_t* caps, modbus_t* ctx, const register_cache_t* cache, const modbus_opcua_config_t* config) {
+  uint16_t regs[MODBUS_MAX_READ_REGISTERS];
+
+  switch (caps->probe_state) {
+  case CAPS_PROBE_FUNCTION_CODES: {
+    // One single-register read per function code used by the read plan
+    int function_code = caps->probe_index == 0 ? 4 : 3;
+    for (int b = 0; b < cache->num_blocks; b++) {
+      if (cache->blocks[b].function_code == function_code) {
+        int rc = probe_read(ctx, function_code, cache->blocks[b].start_address, 1, regs);
+        if (rc < 0) {
+          return 0;
+        }
+        if (rc == 0 && errno == EMBXILFUN) {
+          device_caps_report_exception(caps, function_code, cache->blocks[b].start_address, 1, false, EMBXILFUN);
+        }
+        break;
+      }
+    }
+    if (++caps->probe_index >= 2) {
+      caps->probe_state = CAPS_PROBE_INVALID_RANGES;
+      caps->probe_index = 0;
+    }
+    return (function_code == 3 && !caps->fc3_supported) || (function_code == 4 && !caps->fc4_supported);
+  }
+
+  case CAPS_PROBE_INVALID_RANGES: {
+    // Ranges learned on an older firmware may be readable again
+    if (caps->probe_index >= caps->num_invalid_ranges) {
+      caps->probe_state = CAPS_PROBE_MAX_REGS;
+      return 0;
+    }
+    invalid_range_t range = caps->invalid_ranges[caps->probe_index];
+    int             count = range.end - range.start;
+    int             rc    = count <= MODBUS_MAX_READ_REGISTERS ? probe_read(ctx, range.function_code, range.start, count, regs) : 0;
+    if (rc < 0) {
+      return 0;
+    }
+    if (rc == 1) {
+      log_message(LOG_LEVEL_INFO, "Registers %d-%d (FC%d) are readable again in one request.", range.start, range.end - 1,
+                  range.function_code);
+      caps->invalid_ranges[caps->probe_index] = caps->invalid_ranges[--caps->num_invalid_ranges];
+      return 1;
+    }
+    caps->invalid_ranges[caps->probe_index++].confirmed = true;
+    return 0;
+  }
+
+  case CAPS_PROBE_MAX_REGS: {
+    // Binary search over [known good, longest adjacent run] at the start of that run
+    int address = 0, function_code = 4;
+    int run     = longest_adjacent_run(cache, &address, &function_code);
+    if (caps->probe_hi == 0) {
+      caps->probe_lo = caps->max_regs_per_request < run ? caps->max_regs_per_request : run;
+      caps->probe_hi = run;
+    }
+    if (caps->probe_lo >= caps->probe_hi) {
+      int changed                = caps->max_regs_per_request != caps->probe_lo;
+      caps->max_regs_per_request = caps->probe_lo;
+      caps_finish_probe(caps, config);
+      return changed;
+    }
+    int size = (caps->probe_lo + caps->probe_hi + 1) / 2;
+    int rc   = probe_read(ctx, function_code, address, size, regs);
+    if (rc == 1) {
+      caps->probe_lo = size;
+    } else if (rc == 0) {
+      caps->probe_hi = size - 1;
+    }
+    return 0;
+  }
+
+  case CAPS_PROBE_DONE:
+    return confirm_learned_range(caps, ctx, config, regs);
+
+  default:
+    return 0;
+  }
+}
@@ -0,0 +1,372 @@
+#include "diagnostics.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "logger.h"
+#include "memory_accounting.h"
+
+#define MEMORY_PROCESS_RSS -1  // sample_memory() argument selecting the RSS
+
+// Statistics exposed for every stage, in browse order
+static const struct {
+  const char* name;
+  double      percentile;
+} stat_points[] = {
+    {"Count", -1.0},
+    {"P50", 50.0},
+    {"P90", 90.0},
+    {"P99", 99.0},
+    {"Max", 100.0},
+};
+#define NUM_STAT_POINTS ((int) (sizeof(stat_points) / sizeof(stat_points[0])))
+
+// Variables exposed for every pipeline stage time account
+#define NUM_TIME_POINTS 3
+
+// Nodes added to the address space, for its memory estimate
+static int nodes_added = 0;
+
+static const char* stage_names[LATENCY_STAGE_COUNT] = {
+    "ModbusRoundTrip",
+    "Decode",
+    "AddressSpaceUpdate",
+    "PollLateness",
+    "PublishAge",
+};
+
+int64_t diagnostics_now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void stats_init(latency_stats_t* stats) {
+  for (int s = 0; s < LATENCY_STAGE_COUNT; s++) {
+    histogram_init(&stats->stage[s]);
+  }
+  atomic_init(&stats->missed_intervals, 0);
+}
+
+diagnostics_t* diagnostics_create(const modbus_opcua_config_t* config) {
+  diagnostics_t* diag = calloc(1, sizeof(diagnostics_t));
+  if (!diag) {
+    return NULL;
+  }
+  diag->num_mappings = config->num_mappings;
+  diag->mappings     = calloc(config->num_mappings > 0 ? config->num_mappings : 1, sizeof(latency_stats_t));
+  diag->num_values   = (config->num_mappings + 1) * (LATENCY_STAGE_COUNT * NUM_STAT_POINTS + 1)  // Latency stats
+                     + 2 * PIPELINE_STAGE_COUNT * NUM_TIME_POINTS + 1                         // Device and gateway stage times
+                     + MEMORY_SUBSYSTEM_COUNT + 1                                             // Memory accounts and RSS
+                     + OPCUA_SERVICE_COUNT * NUM_STAT_POINTS;                                 // OPC UA service latency
+  diag->values       = calloc(diag->num_values, sizeof(diag_value_t));
+  diag->tags         = calloc(config->num_mappings > 0 ? config->num_mappings : 1, sizeof(diag_tag_t));
+  if (!diag->mappings || !diag->values || !diag->tags) {
+    diagnostics_free(diag);
+    return NULL;
+  }
+
+  stats_init(&diag->device);
+  for (int i = 0; i < diag->num_mappings; i++) {
+    stats_init(&diag->mappings[i]);
+    diag->tags[i].diag          = diag;
+    diag->tags[i].mapping_index = i;
+  }
+  memory_account_set(MEMORY_DIAGNOSTICS, sizeof(diagnostics_t) + (size_t) diag->num_values * sizeof(diag_value_t) +
+                                             (size_t) (diag->num_mappings > 0 ? diag->num_mappings : 1) *
+                                                 (sizeof(latency_stats_t) + sizeof(diag_tag_t)));
+  return diag;
+}
+
+void diagnostics_free(diagnostics_t* diag) {
+  if (!diag) {
+    return;
+  }
+  free(diag->mappings);
+  free(diag->values);
+  free(diag->tags);
+  free(diag);
+  memory_account_set(MEMORY_DIAGNOSTICS, 0);
+}
+
+void diagnostics_record_device(diagnostics_t* diag, latency_stage_t stage, int64_t micros) {
+  histogram_record(&diag->device.stage[stage], micros);
+}
+
+void diagnostics_record_mapping(diagnostics_t* diag, int mapping_index, latency_stage_t stage, int64_t micros) {
+  histogram_record(&diag->mappings[mapping_index].stage[stage], micros);
+}
+
+void diagnostics_record_schedule(diagnostics_t* diag, int mapping_index, int64_t scheduled_ms, int64_t actual_ms, int interval_ms) {
+  if (scheduled_ms == 0) {
+    return;  // First read, there was no schedule to be late for
+  }
+  int64_t lateness_ms = actual_ms - scheduled_ms;
+  diagnostics_record_device(diag, LATENCY_POLL_LATENESS, lateness_ms * 1000);
+  diagnostics_record_mapping(diag, mapping_index, LATENCY_POLL_LATENESS, lateness_ms * 1000);
+
+  // Every full interval the read came late by is a value the schedule promised but never delivered
+  if (interval_ms > 0 && lateness_ms >= interval_ms) {
+    uint64_t missed = (uint64_t) (lateness_ms / interval_ms);
+    atomic_fetch_add_explicit(&diag->device.missed_intervals, missed, memory_order_relaxed);
+    atomic_fetch_add_explicit(&diag->mappings[mapping_index].missed_intervals, missed, memory_order_relaxed);
+  }
+}
+
+// Value callback of the mapping nodes: measures how old the value handed to a client is
+static void on_tag_read(UA_Server* server, const UA_NodeId* sessionId, void* sessionContext, const UA_NodeId* nodeId, void* nodeContext,
+                        const UA_NumericRange* range, const UA_DataValue* value) {
+  opcua_read_touch(sessionId, nodeContext);
+  const diag_tag_t* tag = (const diag_tag_t*) nodeContext;
+  if (!tag || !value || !value->hasSourceTimestamp || opcua_internal_read_active()) {
+    return;
+  }
+  int64_t age_us = (int64_t) ((UA_DateTime_now() - value->sourceTimestamp) / (UA_DATETIME_MSEC / 1000));
+  diagnostics_record_device(tag->diag, LATENCY_PUBLISH_AGE, age_us);
+  diagnostics_record_mapping(tag->diag, tag->mapping_index, LATENCY_PUBLISH_AGE, age_us);
+}
+
+// Value callback of the mapping nodes for client writes
+static void on_tag_write(UA_Server* server, const UA_NodeId* sessionId, void* sessionContext, const UA_NodeId* nodeId, void* nodeContext,
+                         const UA_NumericRange* range, const UA_DataValue* data) {
+  opcua_service_touch(OPCUA_SERVICE_WRITE, sessionId);
+}
+
+// Data source read callback: percentiles are only computed when a client asks for them
+static UA_StatusCode read_diag_value(UA_Server* server, const UA_NodeId* sessionId, void* sessionContext, const UA_NodeId* nodeId,
+                                     void* nodeContext, UA_Boolean includeSourceTimeStamp, const UA_NumericRange* range,
+                                     UA_DataValue* value) {
+  opcua_read_touch(sessionId, nodeContext);
+  const diag_value_t* dv = (const diag_value_t*) nodeContext;
+  UA_StatusCode       rc;
+  if (!dv->hist) {
+    uint64_t raw = dv->sample ? dv->sample(dv->sample_arg) : atomic_load_explicit(dv->counter, memory_order_relaxed);
+    if (dv->scale > 0.0) {
+      UA_Double scaled = (UA_Double) raw * dv->scale;
+      rc               = UA_Variant_setScalarCopy(&value->value, &scaled, &UA_TYPES[UA_TYPES_DOUBLE]);
+    } else {
+      UA_UInt64 count = raw;
+      rc              = UA_Variant_setScalarCopy(&value->value, &count, &UA_TYPES[UA_TYPES_UINT64]);
+    }
+  } else if (dv->percentile < 0.0) {
+    UA_UInt64 count = histogram_count(dv->hist);
+    rc              = UA_Variant_setScalarCopy(&value->value, &count, &UA_TYPES[UA_TYPES_UINT64]);
+  } else {
+    uint64_t  micros = dv->percentile >= 100.0 ? histogram_max(dv->hist) : histogram_percentile(dv->hist, dv->percentile);
+    UA_Double millis = (UA_Double) micros / 1000.0;
+    rc               = UA_Variant_setScalarCopy(&value->value, &millis, &UA_TYPES[UA_TYPES_DOUBLE]);
+  }
+  if (rc != UA_STATUSCODE_GOOD) {
+    return rc;
+  }
+  value->hasValue = true;
+  if (includeSourceTimeStamp) {
+    value->hasSourceTimestamp = true;
+    value->sourceTimestamp    = UA_DateTime_now();
+  }
+  return UA_STATUSCODE_GOOD;
+}
+
+static UA_StatusCode add_folder(UA_Server* server, const char* node_id, UA_NodeId parent, const char* name) {
+  UA_ObjectAttributes attr = UA_ObjectAttributes_default;
+  attr.displayName         = UA_LOCALIZEDTEXT("en-US", (char*) name);
+  UA_StatusCode rc = UA_Server_addObjectNode(server, UA_NODEID_STRING(1, (char*) node_id), parent, UA_NODEID_NUMERIC(0, UA_NS0ID_ORGANIZES),
+                                             UA_QUALIFIEDNAME(1, (char*) name), UA_NODEID_NUMERIC(0, UA_NS0ID_FOLDERTYPE), attr, NULL, NULL);
+  nodes_added += rc == UA_STATUSCODE_GOOD;
+  return rc;
+}
+
+static UA_StatusCode add_object(UA_Server* server, const char* node_id, const char* parent_id, const char* name) {
+  UA_ObjectAttributes attr = UA_ObjectAttributes_default;
+  attr.displayName         = UA_LOCALIZEDTEXT("en-US", (char*) name);
+  UA_StatusCode rc = UA_Server_addObjectNode(server, UA_NODEID_STRING(1, (char*) node_id), UA_NODEID_STRING(1, (char*) parent_id),
+                                             UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT), UA_QUALIFIEDNAME(1, (char*) name),
+                                             UA_NODEID_NUMERIC(0, UA_NS0ID_BASEOBJECTTYPE), attr, NULL, NULL);
+  nodes_added += rc == UA_STATUSCODE_GOOD;
+  return rc;
+}
+
+// Adds a read-only data source variable <parent_id>.<name> exposing dv
+static UA_StatusCode add_value_node(UA_Server* server, const char* parent_id, const char* name, diag_value_t* dv) {
+  char value_id[700];
+  snprintf(value_id, sizeof(value_id), "%s.%s", parent_id, name);
+  bool is_double = dv->hist ? dv->percentile >= 0.0 : dv->scale > 0.0;
+
+  UA_DataSource         source = {.read = read_diag_value, .write = NULL};
+  UA_VariableAttributes attr   = UA_VariableAttributes_default;
+  attr.displayName             = UA_LOCALIZEDTEXT("en-US", (char*) name);
+  attr.accessLevel             = UA_ACCESSLEVELMASK_READ;
+  attr.dataType                = is_double ? UA_TYPES[UA_TYPES_DOUBLE].typeId : UA_TYPES[UA_TYPES_UINT64].typeId;
+  UA_StatusCode rc = UA_Server_addDataSourceVariableNode(server, UA_NODEID_STRING(1, value_id), UA_NODEID_STRING(1, (char*) parent_id),
+                                                         UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT), UA_QUALIFIEDNAME(1, (char*) name),
+                                                         UA_NODEID_NUMERIC(0, UA_NS0ID_BASEDATAVARIABLETYPE), attr, source, dv, NULL);
+  nodes_added += rc == UA_STATUSCODE_GOOD;
+  return rc;
+}
+
+// Adds one object per stage below prefix, each with the stat_points variables
+static UA_StatusCode add_stats_nodes(UA_Server* server, diagnostics_t* diag, const latency_stats_t* stats, const char* prefix,
+                                     int* next_value) {
+  for (int s = 0; s < LATENCY_STAGE_COUNT; s++) {
+    char stage_id[512];
+    snprintf(stage_id, sizeof(stage_id), "%s.%s", prefix, stage_names[s]);
+    UA_StatusCode rc = add_object(server, stage_id, prefix, stage_names[s]);
+
+    for (int p = 0; p < NUM_STAT_POINTS && rc == UA_STATUSCODE_GOOD; p++) {
+      diag_value_t* dv = &diag->values[(*next_value)++];
+      dv->hist         = &stats->stage[s];
+      dv->percentile   = stat_points[p].percentile;
+      rc               = add_value_node(server, stage_id, stat_points[p].name, dv);
+    }
+    if (rc != UA_STATUSCODE_GOOD) {
+      return rc;
+    }
+  }
+
+  diag_value_t* dv = &diag->values[(*next_value)++];
+  dv->counter      = &stats->missed_intervals;
+  return add_value_node(server, prefix, "MissedIntervals", dv);
+}
+
+static uint64_t sample_process_cpu(int arg) {
+  (void) arg;
+  return cpu_accounting_process_cpu_ns();
+}
+
+// Bytes of a memory subsystem, or the RSS for MEMORY_PROCESS_RSS
+static uint64_t sample_memory(int subsystem) {
+  return subsystem == MEMORY_PROCESS_RSS ? memory_process_rss() : memory_account_get((memory_subsystem_t) subsystem);
+}
+
+// Adds Diagnostics/Gateway/Memory with the bytes of every subsystem next to the process RSS
+static UA_StatusCode add_memory_nodes(UA_Server* server, diagnostics_t* diag, int* next_value) {
+  UA_StatusCode rc = add_object(server, "Diagnostics.Gateway.Memory", "Diagnostics.Gateway", "Memory");
+  for (int s = -1; s < MEMORY_SUBSYSTEM_COUNT && rc == UA_STATUSCODE_GOOD; s++) {
+    diag_value_t* dv = &diag->values[(*next_value)++];
+    dv->sample       = sample_memory;
+    dv->sample_arg   = s < 0 ? MEMORY_PROCESS_RSS : s;
+    rc               = add_value_node(server, "Diagnostics.Gateway.Memory",
+                                      s < 0 ? "ProcessRss" : memory_subsystem_name((memory_subsystem_t) s), dv);
+  }
+  return rc;
+}
+
+// Adds Diagnostics/Gateway/Services with the latency statistics of every timed OPC UA service
+static UA_StatusCode add_service_nodes(UA_Server* server, diagnostics_t* diag, int* next_value) {
+  UA_StatusCode rc = add_object(server, "Diagnostics.Gateway.Services", "Diagnostics.Gateway", "Services");
+  for (int s = 0; s < OPCUA_SERVICE_COUNT && rc == UA_STATUSCODE_GOOD; s++) {
+    const char* name = opcua_service_name((opcua_service_t) s);
+    char        service_id[128];
+    snprintf(service_id, sizeof(service_id), "Diagnostics.Gateway.Services.%s", name);
+    rc = add_object(server, service_id, "Diagnostics.Gateway.Services", name);
+
+    for (int p = 0; p < NUM_STAT_POINTS && rc == UA_STATUSCODE_GOOD; p++) {
+      diag_value_t* dv = &diag->values[(*next_value)++];
+      dv->hist         = &opcua_service_latency[s];
+      dv->percentile   = stat_points[p].percentile;
+      rc               = add_value_node(server, service_id, stat_points[p].name, dv);
+    }
+  }
+  return rc;
+}
+
+// Adds a StageTime object below prefix with Calls, WallSeconds and CpuSeconds for every pipeline stage
+static UA_StatusCode add_time_nodes(UA_Server* server, diagnostics_t* diag, const stage_accounts_t* accounts, const char* prefix,
+                                    int* next_value) {
+  char time_id[512];
+  snprintf(time_id, sizeof(time_id), "%s.StageTime", prefix);
+  UA_StatusCode rc = add_object(server, time_id, prefix, "StageTime");
+
+  for (int s = 0; s < PIPELINE_STAGE_COUNT && rc == UA_STATUSCODE_GOOD; s++) {
+    const stage_time_t* account = &accounts->stage[s];
+    const char*         name    = cpu_accounting_stage_name((pipeline_stage_t) s);
+    char                stage_id[600];
+    snprintf(stage_id, sizeof(stage_id), "%s.%s", time_id, name);
+    rc = add_object(server, stage_id, time_id, name);
+
+    diag_value_t* calls = &diag->values[(*next_value)++];
+    diag_value_t* wall  = &diag->values[(*next_value)++];
+    diag_value_t* cpu   = &diag->values[(*next_value)++];
+    calls->counter      = &account->calls;
+    wall->counter       = &account->wall_ns;
+    wall->scale         = 1e-9;
+    cpu->counter        = &account->cpu_ns;
+    cpu->scale          = 1e-9;
+    if (rc == UA_STATUSCODE_GOOD) {
+      rc = add_value_node(server, stage_id, "Calls", calls);
+    }
+    if (rc == UA_STATUSCODE_GOOD) {
+      rc = add_value_node(server, stage_id, "WallSeconds", wall);
+    }
+    if (rc == UA_STATUSCODE_GOOD) {
+      rc = add_value_node(server, stage_id, "CpuSeconds", cpu);
+    }
+  }
+  return rc;
+}
+
+UA_StatusCode diagnostics_add_nodes(UA_Server* server, diagnostics_t* diag, const modbus_opcua_config_t* config) {
+  int  next_value = 0;
+  char device_name[128];
+  snprintf(device_name, sizeof(device_name), "Device %s:%d", config->modbus_ip, config->modbus_port);
+
+  UA_StatusCode rc = add_folder(server, "Diagnostics", UA_NODEID_NUMERIC(0, UA_NS0ID_OBJECTSFOLDER), "Diagnostics");
+  if (rc == UA_STATUSCODE_GOOD) {
+    rc = add_folder(server, "Diagnostics.Device", UA_NODEID_STRING(1, "Diagnostics"), device_name);
+  }
+  if (rc == UA_STATUSCODE_GOOD) {
+    rc = add_stats_nodes(server, diag, &diag->device, "Diagnostics.Device", &next_value);
+  }
+  if (rc == UA_STATUSCODE_GOOD) {
+    rc = add_time_nodes(server, diag, &diag->device_time, "Diagnostics.Device", &next_value);
+  }
+
+  // Gateway-wide totals: stage times of all threads and the CPU time of the whole process
+  if (rc == UA_STATUSCODE_GOOD) {
+    rc = add_folder(server, "Diagnostics.Gateway", UA_NODEID_STRING(1, "Diagnostics"), "Gateway");
+  }
+  if (rc == UA_STATUSCODE_GOOD) {
+    rc = add_time_nodes(server, diag, &cpu_accounts_global, "Diagnostics.Gateway", &next_value);
+  }
+  if (rc == UA_STATUSCODE_GOOD) {
+    diag_value_t* dv = &diag->values[next_value++];
+    dv->sample       = sample_process_cpu;
+    dv->scale        = 1e-9;
+    rc               = add_value_node(server, "Diagnostics.Gateway", "ProcessCpuSeconds", dv);
+  }
+  if (rc == UA_STATUSCODE_GOOD) {
+    rc = add_memory_nodes(server, diag, &next_value);
+  }
+  if (rc == UA_STATUSCODE_GOOD) {
+    rc = add_service_nodes(server, diag, &next_value);
+  }
+  if (rc == UA_STATUSCODE_GOOD) {
+    rc = add_folder(server, "Diagnostics.Mappings", UA_NODEID_STRING(1, "Diagnostics"), "Mappings");
+  }
+
+  for (int i = 0; i < diag->num_mappings && rc == UA_STATUSCODE_GOOD; i++) {
+    const modbus_reg_mapping_t* mapping = &config->mappings[i];
+    char                        prefix[300];
+    snprintf(prefix, sizeof(prefix), "Diagnostics.%s", mapping->opcua_node_id);
+    rc = add_folder(server, prefix, UA_NODEID_STRING(1, "Diagnostics.Mappings"), mapping->name);
+    if (rc == UA_STATUSCODE_GOOD) {
+      rc = add_stats_nodes(server, diag, &diag->mappings[i], prefix, &next_value);
+    }
+
+    // Hook client reads of the value node itself to measure the age of what they get, and writes to time them
+    UA_NodeId        node_id  = UA_NODEID_STRING(1, mapping->opcua_node_id);
+    UA_ValueCallback callback = {.onRead = on_tag_read, .onWrite = on_tag_write};
+    if (rc == UA_STATUSCODE_GOOD && UA_Server_setNodeContext(server, node_id, &diag->tags[i]) == UA_STATUSCODE_GOOD) {
+      UA_Server_setVariableNode_valueCallback(server, node_id, callback);
+    }
+  }
+
+  if (rc != UA_STATUSCODE_GOOD) {
+    log_message(LOG_LEVEL_ERROR, "Failed to add diagnostics nodes: 0x%08x", rc);
+    return rc;
+  }
+  memory_account_add(MEMORY_ADDRESS_SPACE, (int64_t) nodes_added * MEMORY_NODE_ESTIMATE_BYTES);
+  log_message(LOG_LEVEL_INFO, "Diagnostics exposed for the device and %d mappings (%d variables).", diag->num_mappings, next_value);
+  return UA_STATUSCODE_GOOD;
+}
@@ -0,0 +1,389 @@
+#include "fault_proxy.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "logger.h"
+
+#define PROXY_MAX_CONNECTIONS 64
+#define PROXY_QUEUE_CHUNKS    16    // Per direction; the source is not read while its queue is full
+#define PROXY_CHUNK_BYTES     1024
+#define PROXY_POLL_MS         10    // Longest poll() wait, bounds the reaction to fault changes and fault_proxy_stop()
+#define PROXY_SLOW_BURST      16.0  // Bytes a slow reader may send at once after idling
+
+#define PROXY_CLIENT 0  // The gateway side
+#define PROXY_TARGET 1  // The device side
+
+/*
+ * @brief Data read in one recv() call, forwarded once due.
+ */
+typedef struct {
+  int64_t  due_us;
+  uint16_t length;
+  uint16_t offset;  // Bytes already sent
+  uint8_t  data[PROXY_CHUNK_BYTES];
+} proxy_chunk_t;
+
+/*
+ * @brief Data read from one side of a connection, waiting to be written to the other side.
+ */
+typedef struct {
+  proxy_chunk_t chunks[PROXY_QUEUE_CHUNKS];
+  int           head;
+  int           count;
+  int64_t       last_due_us;  // Jitter never reorders chunks
+  double        credit;       // Bytes a slow reader may send now
+  int64_t       credit_us;
+} proxy_queue_t;
+
+/*
+ * @brief A proxied connection. queue[d] holds data read from fd[d], to be written to fd[1 - d].
+ */
+typedef struct {
+  int           fd[2];
+  proxy_queue_t queue[2];
+} proxy_connection_t;
+
+struct fault_proxy_s {
+  int                  listen_fd;
+  struct sockaddr_in   target;
+  proxy_connection_t*  connections[PROXY_MAX_CONNECTIONS];
+  int                  num_connections;
+  struct pollfd        pfds[1 + 2 * PROXY_MAX_CONNECTIONS];
+  uint64_t             rng;
+  pthread_t            thread;
+  pthread_mutex_t      lock;  // Guards faults
+  fault_proxy_faults_t faults;
+  atomic_bool          stop;
+  atomic_bool          reset_requested;
+  _Atomic uint64_t     accepted;
+  _Atomic uint64_t     refused;
+  _Atomic uint64_t     resets;
+  _Atomic uint64_t     bytes_forwarded;
+  _Atomic uint64_t     bytes_dropped;
+  atomic_int           active_connections;
+};
+
+static int64_t monotonic_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// xorshift64*, only used for the jitter
+static uint64_t next_random(fault_proxy_t* proxy) {
+  proxy->rng ^= proxy->rng >> 12;
+  proxy->rng ^= proxy->rng << 25;
+  proxy->rng ^= proxy->rng >> 27;
+  return proxy->rng * 0x2545F4914F6CDD1Dull;
+}
+
+static void load_faults(fault_proxy_t* proxy, fault_proxy_faults_t* faults) {
+  pthread_mutex_lock(&proxy->lock);
+  *faults = proxy->faults;
+  pthread_mutex_unlock(&proxy->lock);
+}
+
+// Closing with a zero linger time sends RST instead of FIN
+static void reset_socket(int fd) {
+  struct linger linger = {1, 0};
+  setsockopt(fd, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+  close(fd);
+}
+
+static void close_connection(fault_proxy_t* proxy, int index, bool reset) {
+  proxy_connection_t* conn = proxy->connections[index];
+  for (int d = 0; d < 2; d++) {
+    if (conn->fd[d] >= 0) {
+      if (reset) {
+        reset_socket(conn->fd[d]);
+      } else {
+        close(conn->fd[d]);
+      }
+    }
+  }
+  free(conn);
+  proxy->connections[index] = proxy->connections[--proxy->num_connections];
+  atomic_fetch_sub_explicit(&proxy->active_connections, 1, memory_order_relaxed);
+}
+
+static void accept_connection(fault_proxy_t* proxy, const fault_proxy_faults_t* faults) {
+  int fd = accept(proxy->listen_fd, NULL, NULL);
+  if (fd < 0) {
+    return;
+  }
+  atomic_fetch_add_explicit(&proxy->accepted, 1, memory_order_relaxed);
+  if (faults->refuse || proxy->num_connections >= PROXY_MAX_CONNECTIONS) {
+    atomic_fetch_add_explicit(&proxy->refused, 1, memory_order_relaxed);
+    reset_socket(fd);
+    return;
+  }
+
+  // The target is local, so a blocking connect is quick; an unreachable target looks like a refusal
+  int target_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (target_fd < 0 || connect(target_fd, (struct sockaddr*) &proxy->target, sizeof(proxy->target)) != 0) {
+    atomic_fetch_add_explicit(&proxy->refused, 1, memory_order_relaxed);
+    if (target_fd >= 0) {
+      close(target_fd);
+    }
+    reset_socket(fd);
+    return;
+  }
+  proxy_connection_t* conn = calloc(1, sizeof(proxy_connection_t));
+  if (!conn) {
+    close(target_fd);
+    reset_socket(fd);
+    return;
+  }
+  conn->fd[PROXY_CLIENT] = fd;
+  conn->fd[PROXY_TARGET] = target_fd;
+  int64_t now_us         = monotonic_us();
+  for (int d = 0; d < 2; d++) {
+    int nodelay = 1;
+    setsockopt(conn->fd[d], IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    fcntl(conn->fd[d], F_SETFL, fcntl(conn->fd[d], F_GETFL) | O_NONBLOCK);
+    conn->queue[d].credit_us = now_us;
+  }
+  proxy->connections[proxy->num_connections++] = conn;
+  atomic_fetch_add_explicit(&proxy->active_connections, 1, memory_order_relaxed);
+}
+
+// Reads from side d; returns false when the side closed or failed
+static bool read_side(fault_proxy_t* proxy, proxy_connection_t* conn, int d, const fault_proxy_faults_t* faults, int64_t now_us) {
+  proxy_queue_t* queue = &conn->queue[d];
+  proxy_chunk_t* chunk = &queue->chunks[(queue->head + queue->count) % PROXY_QUEUE_CHUNKS];
+  ssize_t        n     = recv(conn->fd[d], chunk->data, sizeof(chunk->data), 0);
+  if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+    return true;
+  }
+  if (n <= 0) {
+    return false;
+  }
+  if (faults->half_open) {
+    atomic_fetch_add_explicit(&proxy->bytes_dropped, (uint64_t) n, memory_order_relaxed);
+    return true;
+  }
+
+  int64_t due_us = now_us + faults->latency_us;
+  if (faults->jitter_us > 0) {
+    due_us += (int64_t) (next_random(proxy) % (uint64_t) (faults->jitter_us + 1));
+  }
+  chunk->due_us      = due_us > queue->last_due_us ? due_us : queue->last_due_us;
+  chunk->length      = (uint16_t) n;
+  chunk->offset      = 0;
+  queue->last_due_us = chunk->due_us;
+  queue->count++;
+  return true;
+}
+
+// Writes the due data read from side d to the other side; returns the time until more is due
+// (us), -1 if nothing is queued, or -2 if the other side failed
+static int64_t flush_side(fault_proxy_t* proxy, proxy_connection_t* conn, int d, const fault_proxy_faults_t* faults, int64_t now_us) {
+  proxy_queue_t* queue = &conn->queue[d];
+  if (faults->half_open) {
+    for (; queue->count > 0; queue->count--, queue->head = (queue->head + 1) % PROXY_QUEUE_CHUNKS) {
+      proxy_chunk_t* chunk = &queue->chunks[queue->head];
+      atomic_fetch_add_explicit(&proxy->bytes_dropped, (uint64_t) (chunk->length - chunk->offset), memory_order_relaxed);
+    }
+    return -1;
+  }
+  if (faults->stall || conn->fd[1 - d] < 0) {
+    return queue->count > 0 ? PROXY_POLL_MS * 1000 : -1;
+  }
+
+  // Slow reads only throttle what the device sends towards the gateway
+  int rate = d == PROXY_TARGET ? faults->slow_read_bytes_per_sec : 0;
+  if (rate > 0) {
+    queue->credit += (double) (now_us - queue->credit_us) * rate / 1e6;
+    queue->credit  = queue->credit > PROXY_SLOW_BURST ? PROXY_SLOW_BURST : queue->credit;
+  }
+  queue->credit_us = now_us;
+
+  while (queue->count > 0) {
+    proxy_chunk_t* chunk = &queue->chunks[queue->head];
+    if (chunk->due_us > now_us) {
+      return chunk->due_us - now_us;
+    }
+    size_t length = (size_t) (chunk->length - chunk->offset);
+    if (rate > 0) {
+      if (queue->credit < 1.0) {
+        return (int64_t) ((1.0 - queue->credit) * 1e6 / rate) + 1;
+      }
+      length = length < (size_t) queue->credit ? length : (size_t) queue->credit;
+    }
+    ssize_t n = send(conn->fd[1 - d], chunk->data + chunk->offset, length, MSG_NOSIGNAL);
+    if (n < 0) {
+      return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 1000 : -2;
+    }
+    atomic_fetch_add_explicit(&proxy->bytes_forwarded, (uint64_t) n, memory_order_relaxed);
+    chunk->offset  = (uint16_t) (chunk->offset + n);
+    queue->credit -= rate > 0 ? (double) n : 0.0;
+    if (chunk->offset == chunk->length) {
+      queue->head = (queue->head + 1) % PROXY_QUEUE_CHUNKS;
+      queue->count--;
+    }
+  }
+  return -1;
+}
+
+static void* proxy_main(void* arg) {
+  fault_proxy_t* proxy = (fault_proxy_t*) arg;
+
+  while (!atomic_load(&proxy->stop)) {
+    fault_proxy_faults_t faults;
+    load_faults(proxy, &faults);
+
+    if (atomic_exchange(&proxy->reset_requested, false)) {
+      atomic_fetch_add_explicit(&proxy->resets, (uint64_t) proxy->num_connections, memory_order_relaxed);
+      while (proxy->num_connections > 0) {
+        close_connection(proxy, proxy->num_connections - 1, true);
+      }
+    }
+
+    int64_t now_us  = monotonic_us();
+    int64_t wait_us = PROXY_POLL_MS * 1000;
+    for (int c = proxy->num_connections - 1; c >= 0; c--) {
+      proxy_connection_t* conn = proxy->connections[c];
+      // A side that closed while half open takes the connection down once the fault is cleared
+      bool failed = !faults.half_open && (conn->fd[PROXY_CLIENT] < 0 || conn->fd[PROXY_TARGET] < 0);
+      for (int d = 0; d < 2 && !failed; d++) {
+        int64_t next_us = flush_side(proxy, conn, d, &faults, now_us);
+        failed          = next_us == -2;
+        wait_us         = next_us >= 0 && next_us < wait_us ? next_us : wait_us;
+      }
+      if (failed) {
+        close_connection(proxy, c, false);
+      }
+    }
+
+    // The listener first, then both sides of every connection; a side with a full queue is not read
+    proxy->pfds[0] = (struct pollfd) {proxy->listen_fd, POLLIN, 0};
+    for (int c = 0; c < proxy->num_connections; c++) {
+      proxy_connection_t* conn = proxy->connections[c];
+      for (int d = 0; d < 2; d++) {
+        bool readable              = conn->fd[d] >= 0 && (faults.half_open || conn->queue[d].count < PROXY_QUEUE_CHUNKS);
+        proxy->pfds[1 + 2 * c + d] = (struct pollfd) {readable ? conn->fd[d] : -1, POLLIN, 0};
+      }
+    }
+    int timeout_ms = (int) ((wait_us + 999) / 1000);
+    if (poll(proxy->pfds, (nfds_t) (1 + 2 * proxy->num_connections), timeout_ms) <= 0) {
+      continue;
+    }
+
+    // Data that arrived after a fault change is handled with the new faults. Connections are
+    // handled before accepting, so indices into pfds stay valid.
+    load_faults(proxy, &faults);
+    now_us = monotonic_us();
+    for (int c = proxy->num_connections - 1; c >= 0; c--) {
+      proxy_connection_t* conn   = proxy->connections[c];
+      bool                closed = false;
+      for (int d = 0; d < 2 && !closed; d++) {
+        if (!proxy->pfds[1 + 2 * c + d].revents || read_side(proxy, conn, d, &faults, now_us)) {
+          continue;
+        }
+        if (faults.half_open) {
+          close(conn->fd[d]);  // The other peer never learns about it
+          conn->fd[d] = -1;
+        } else {
+          closed = true;
+        }
+      }
+      if (closed) {
+        close_connection(proxy, c, false);
+      }
+    }
+    if (proxy->pfds[0].revents & POLLIN) {
+      accept_connection(proxy, &faults);
+    }
+  }
+  return NULL;
+}
+
+fault_proxy_t* fault_proxy_start(int listen_port, const char* target_address, int target_port) {
+  fault_proxy_t* proxy = calloc(1, sizeof(fault_proxy_t));
+  if (!proxy) {
+    return NULL;
+  }
+  proxy->target.sin_family = AF_INET;
+  proxy->target.sin_port   = htons((uint16_t) target_port);
+  if (inet_pton(AF_INET, target_address, &proxy->target.sin_addr) != 1) {
+    log_message(LOG_LEVEL_ERROR, "Fault proxy: invalid target address '%s'.", target_address);
+    free(proxy);
+    return NULL;
+  }
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family      = AF_INET;
+  addr.sin_port        = htons((uint16_t) listen_port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  proxy->listen_fd     = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  int reuse            = 1;
+  if (proxy->listen_fd < 0 || setsockopt(proxy->listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0 ||
+      bind(proxy->listen_fd, (struct sockaddr*) &addr, sizeof(addr)) != 0 || listen(proxy->listen_fd, 16) != 0) {
+    log_message(LOG_LEVEL_ERROR, "Fault proxy: failed to listen on 127.0.0.1:%d: %s", listen_port, strerror(errno));
+    if (proxy->listen_fd >= 0) {
+      close(proxy->listen_fd);
+    }
+    free(proxy);
+    return NULL;
+  }
+
+  proxy->rng = 0x9E3779B97F4A7C15ull ^ (uint64_t) listen_port;
+  pthread_mutex_init(&proxy->lock, NULL);
+  atomic_store(&proxy->stop, false);
+  if (pthread_create(&proxy->thread, NULL, proxy_main, proxy) != 0) {
+    log_message(LOG_LEVEL_ERROR, "Fault proxy: failed to start the proxy thread.");
+    close(proxy->listen_fd);
+    pthread_mutex_destroy(&proxy->lock);
+    free(proxy);
+    return NULL;
+  }
+  log_message(LOG_LEVEL_INFO, "Fault proxy: 127.0.0.1:%d -> %s:%d.", listen_port, target_address, target_port);
+  return proxy;
+}
+
+void fault_proxy_stop(fault_proxy_t* proxy) {
+  if (!proxy) {
+    return;
+  }
+  atomic_store(&proxy->stop, true);
+  pthread_join(proxy->thread, NULL);
+  while (proxy->num_connections > 0) {
+    close_connection(proxy, proxy->num_connections - 1, false);
+  }
+  close(proxy->listen_fd);
+  pthread_mutex_destroy(&proxy->lock);
+  free(proxy);
+}
+
+void fault_proxy_set_faults(fault_proxy_t* proxy, const fault_proxy_faults_t* faults) {
+  pthread_mutex_lock(&proxy->lock);
+  proxy->faults = *faults;
+  pthread_mutex_unlock(&proxy->lock);
+}
+
+void fault_proxy_reset_connections(fault_proxy_t* proxy) {
+  atomic_store(&proxy->reset_requested, true);
+}
+
+void fault_proxy_get_stats(fault_proxy_t* proxy, fault_proxy_stats_t* stats) {
+  stats->accepted           = atomic_load_explicit(&proxy->accepted, memory_order_relaxed);
+  stats->refused            = atomic_load_explicit(&proxy->refused, memory_order_relaxed);
+  stats->resets             = atomic_load_explicit(&proxy->resets, memory_order_relaxed);
+  stats->bytes_forwarded    = atomic_load_explicit(&proxy->bytes_forwarded, memory_order_relaxed);
+  stats->bytes_dropped      = atomic_load_explicit(&proxy->bytes_dropped, memory_order_relaxed);
+  stats->active_connections = atomic_load_explicit(&proxy->active_connections, memory_order_relaxed);
+}
@@ -0,0 +1,110 @@
+#include "histogram.h"
+
+// Maps a value to its bucket: exact below HISTOGRAM_SUB_BUCKETS, then HISTOGRAM_SUB_BUCKETS
+// linear buckets per power of two.
+static int bucket_index(uint64_t value) {
+  if (value < HISTOGRAM_SUB_BUCKETS) {
+    return (int) value;
+  }
+  if (value >> (HISTOGRAM_MAX_MAGNITUDE + 1)) {
+    return HISTOGRAM_NUM_BUCKETS - 1;
+  }
+  int magnitude = HISTOGRAM_SUB_BUCKET_BITS;
+  while (value >> (magnitude + 1)) {
+    magnitude++;
+  }
+  int shift = magnitude - HISTOGRAM_SUB_BUCKET_BITS;
+  int sub   = (int) (value >> shift) - HISTOGRAM_SUB_BUCKETS;
+  return HISTOGRAM_SUB_BUCKETS * (shift + 1) + sub;
+}
+
+// Highest value that falls into a bucket.
+static uint64_t bucket_upper_value(int index) {
+  if (index < HISTOGRAM_SUB_BUCKETS) {
+    return (uint64_t) index;
+  }
+  int      shift = index / HISTOGRAM_SUB_BUCKETS - 1;
+  uint64_t lower = (uint64_t) (HISTOGRAM_SUB_BUCKETS + index % HISTOGRAM_SUB_BUCKETS) << shift;
+  return lower + ((uint64_t) 1 << shift) - 1;
+}
+
+void histogram_init(latency_histogram_t* hist) {
+  for (int b = 0; b < HISTOGRAM_NUM_BUCKETS; b++) {
+    atomic_init(&hist->buckets[b], 0);
+  }
+  atomic_init(&hist->count, 0);
+  atomic_init(&hist->sum_us, 0);
+  atomic_init(&hist->max_us, 0);
+}
+
+void histogram_record(latency_histogram_t* hist, int64_t value_us) {
+  uint64_t value = value_us > 0 ? (uint64_t) value_us : 0;
+  atomic_fetch_add_explicit(&hist->buckets[bucket_index(value)], 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&hist->count, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&hist->sum_us, value, memory_order_relaxed);
+
+  uint64_t max = atomic_load_explicit(&hist->max_us, memory_order_relaxed);
+  while (value > max && !atomic_compare_exchange_weak_explicit(&hist->max_us, &max, value, memory_order_relaxed, memory_order_relaxed)) {
+  }
+}
+
+uint64_t histogram_percentile(const latency_histogram_t* hist, double percentile) {
+  // Work on the bucket counts only, so a concurrent writer cannot make the target unreachable
+  uint64_t total = 0;
+  for (int b = 0; b < HISTOGRAM_NUM_BUCKETS; b++) {
+    total += atomic_load_explicit(&hist->buckets[b], memory_order_relaxed);
+  }
+  if (total == 0) {
+    return 0;
+  }
+
+  if (percentile < 0.0) {
+    percentile = 0.0;
+  } else if (percentile > 100.0) {
+    percentile = 100.0;
+  }
+  double   rank   = percentile / 100.0 * (double) total;
+  uint64_t target = (uint64_t) rank;
+  if (target < rank || target == 0) {
+    target++;
+  }
+
+  uint64_t seen = 0;
+  for (int b = 0; b < HISTOGRAM_NUM_BUCKETS; b++) {
+    seen += atomic_load_explicit(&hist->buckets[b], memory_order_relaxed);
+    if (seen >= target) {
+      uint64_t value = bucket_upper_value(b);
+      uint64_t max   = histogram_max(hist);
+      return value < max ? value : max;
+    }
+  }
+  return histogram_max(hist);
+}
+
+uint64_t histogram_count(const latency_histogram_t* hist) {
+  return atomic_load_explicit(&hist->count, memory_order_relaxed);
+}
+
+uint64_t histogram_max(const latency_histogram_t* hist) {
+  return atomic_load_explicit(&hist->max_us, memory_order_relaxed);
+}
+
+uint64_t histogram_sum(const latency_histogram_t* hist) {
+  return atomic_load_explicit(&hist->sum_us, memory_order_relaxed);
+}
+
+uint64_t histogram_count_at_or_below(const latency_histogram_t* hist, uint64_t value_us) {
+  uint64_t count = 0;
+  for (int b = 0; b < HISTOGRAM_NUM_BUCKETS && bucket_upper_value(b) <= value_us; b++) {
+    count += atomic_load_explicit(&hist->buckets[b], memory_order_relaxed);
+  }
+  return count;
+}
+
+double histogram_mean(const latency_histogram_t* hist) {
+  uint64_t count = histogram_count(hist);
+  if (count == 0) {
+    return 0.0;
+  }
+  return (double) histogram_sum(hist) / (double) count;
+}
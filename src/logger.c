@@ -1,12 +1,18 @@
 #include "logger.h"
 
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
 
+#include "cpu_accounting.h"
+#include "memory_accounting.h"
+
 static FILE*       log_file          = NULL;
-static int         current_log_level = LOG_LEVEL_ERROR;
+static _Atomic int current_log_level = LOG_LEVEL_ERROR;  // Changed at runtime by the admin console
 static const char* level_strings[]   = {"ERROR", "WARN", "INFO", "DEBUG"};
+static _Atomic uint64_t dropped_messages = 0;
 
 int logger_init(const char* filename, int level) {
   if (filename) {
@@ -19,32 +25,52 @@ int logger_init(const char* filename, int level) {
     log_file = stdout;
   }
   current_log_level = level;
+  memory_account_add(MEMORY_LOG_BUFFERS, BUFSIZ);  // stdio stream buffer
   log_message(LOG_LEVEL_INFO, "Logger initialized.");
   return 0;
 }
 
 void log_message(log_level_t level, const char* format, ...) {
-  if (level > current_log_level) {
+  if ((int) level > atomic_load_explicit(&current_log_level, memory_order_relaxed)) {
     return;
   }
+  cpu_accounting_enter(PIPELINE_LOGGING);
 
   // Get current time
   time_t now = time(NULL);
   char   time_buf[20];
   strftime(time_buf, sizeof(time_buf), "%Y-%m-%d %H:%M:%S", localtime(&now));
 
+  // Messages logged before logger_init() (e.g. configuration errors) go to stderr
+  FILE* out = log_file ? log_file : stderr;
+
   // Print log prefix
-  fprintf(log_file, "%s [%s] - ", time_buf, level_strings[level]);
+  bool written = fprintf(out, "%s [%s] - ", time_buf, level_strings[level]) >= 0;
 
   // Print user message
   va_list args;
   va_start(args, format);
-  vfprintf(log_file, format, args);
+  written = vfprintf(out, format, args) >= 0 && written;
   va_end(args);
 
   // Newline and flush
-  fprintf(log_file, "\n");
-  fflush(log_file);
+  written = fprintf(out, "\n") >= 0 && written;
+  if (fflush(out) != 0 || !written) {
+    atomic_fetch_add_explicit(&dropped_messages, 1, memory_order_relaxed);
+  }
+  cpu_accounting_leave(PIPELINE_LOGGING);
+}
+
+void logger_set_level(int level) {
+  atomic_store_explicit(&current_log_level, level, memory_order_relaxed);
+}
+
+int logger_get_level(void) {
+  return atomic_load_explicit(&current_log_level, memory_order_relaxed);
+}
+
+uint64_t logger_dropped_messages(void) {
+  return atomic_load_explicit(&dropped_messages, memory_order_relaxed);
 }
 
 void logger_close() {
@@ -6,122 +6,204 @@ int64_t get_time_ms() {
   return (int64_t) tv.tv_sec * 1000 + tv.tv_usec / 1000;
 }
 
-bool process_modbus_value_formatted(const uint16_t *regs, const modbus_reg_mapping_t *mapping, UA_Variant *out_variant) {
-  UA_Variant_init(out_variant);
-  
-  // Combine registers according to data type and check for NaN
-  uint64_t raw_value = 0;
-  bool is_nan = false;
-  
-  if (strcmp(mapping->data_type, "U16") == 0) {
-    raw_value = regs[0];
-    is_nan = (regs[0] == SMA_NAN_U16);
-  } else if (strcmp(mapping->data_type, "S16") == 0) {
-    raw_value = regs[0];
-    is_nan = (regs[0] == SMA_NAN_S16);
-  } else if (strcmp(mapping->data_type, "U32") == 0) {
-    raw_value = ((uint32_t) regs[0] << 16) | regs[1];
-    is_nan = (raw_value == SMA_NAN_U32);
-  } else if (strcmp(mapping->data_type, "S32") == 0) {
-    raw_value = ((uint32_t) regs[0] << 16) | regs[1];
-    is_nan = (raw_value == SMA_NAN_S32);
-  } else if (strcmp(mapping->data_type, "U64") == 0) {
-    raw_value = ((uint64_t) regs[0] << 48) | ((uint64_t) regs[1] << 32) | ((uint64_t) regs[2] << 16) | regs[3];
-    is_nan = (raw_value == SMA_NAN_U64);
+/**
+ * @brief Decodes a mapping from its cached registers and publishes it to the OPC UA server.
+ * @param server The OPC UA server instance.
+ * @param diagnostics The latency statistics to record the decode and update times in.
+ * @param config The application configuration.
+ * @param index The index of the mapping to publish.
+ * @param regs The cached registers of the mapping.
+ */
+static void publish_mapping(UA_Server *server, diagnostics_t *diagnostics, const modbus_opcua_config_t *config, int index,
+                            const uint16_t *regs) {
+  const modbus_reg_mapping_t *mapping = &config->mappings[index];
+  UA_Variant                  ua_value;
+
+  cpu_accounting_enter(PIPELINE_DECODE);
+  int64_t decode_start = diagnostics_now_us();
+  bool    decoded      = process_modbus_value_formatted(regs, mapping, &ua_value);
+  int64_t decode_end   = diagnostics_now_us();
+  cpu_accounting_leave(PIPELINE_DECODE);
+  int64_t decode_us    = decode_end - decode_start;
+  trace_span(TRACE_DECODE, decode_start, decode_end, mapping->name, mapping->modbus_address);
+  diagnostics_record_device(diagnostics, LATENCY_DECODE, decode_us);
+  diagnostics_record_mapping(diagnostics, index, LATENCY_DECODE, decode_us);
+  if (!decoded) {
+    METRICS_ADD(nan_values, 1);
+    log_message(LOG_LEVEL_WARN, "Received NaN for '%s' (Modbus Addr: %d). Skipping update.", mapping->name, mapping->modbus_address);
+    return;
+  }
+
+  // Log the value based on its type
+  if (ua_value.type == &UA_TYPES[UA_TYPES_FLOAT]) {
+    float val = *(UA_Float*)ua_value.data;
+    log_message(LOG_LEVEL_DEBUG, "Read '%s': %f (Poll Rate: %dms)", mapping->name, val, mapping->poll_interval_ms);
+  } else if (ua_value.type == &UA_TYPES[UA_TYPES_INT32]) {
+    int32_t val = *(UA_Int32*)ua_value.data;
+    
+    // For ENUM format, try to find the corresponding string
+    if (mapping->format && strcmp(mapping->format, "ENUM") == 0) {
+      const char* enum_string = "Unknown";
+      for (int j = 0; j < mapping->num_enum_values; j++) {
+        if (mapping->enum_values[j].value == val) {
+          enum_string = mapping->enum_values[j].name;
+          break;
+        }
+      }
+      log_message(LOG_LEVEL_DEBUG, "Read '%s': %d (%s) (Poll Rate: %dms)", 
+                 mapping->name, val, enum_string, mapping->poll_interval_ms);
+    } else {
+      log_message(LOG_LEVEL_DEBUG, "Read '%s': %d (Poll Rate: %dms)", 
+                 mapping->name, val, mapping->poll_interval_ms);
+    }
+  } else if (ua_value.type == &UA_TYPES[UA_TYPES_STRING]) {
+    UA_String *str = (UA_String*)ua_value.data;
+    log_message(LOG_LEVEL_DEBUG, "Read '%s': %.*s (Poll Rate: %dms)", mapping->name, (int)str->length, str->data, mapping->poll_interval_ms);
   } else {
-    log_message(LOG_LEVEL_WARN, "Unsupported data type for '%s': %s", mapping->name, mapping->data_type);
-    return false;
+    log_message(LOG_LEVEL_DEBUG, "Read '%s': (complex type) (Poll Rate: %dms)", mapping->name, mapping->poll_interval_ms);
   }
   
-  if (is_nan) {
-    return false;
+  cpu_accounting_enter(PIPELINE_NODE_UPDATE);
+  int64_t update_start = diagnostics_now_us();
+  update_opcua_node_value_typed(server, mapping, &ua_value);
+  int64_t update_end = diagnostics_now_us();
+  cpu_accounting_leave(PIPELINE_NODE_UPDATE);
+  int64_t update_us  = update_end - update_start;
+  trace_span(TRACE_NODE_UPDATE, update_start, update_end, mapping->name, mapping->modbus_address);
+  diagnostics_record_device(diagnostics, LATENCY_NODE_UPDATE, update_us);
+  diagnostics_record_mapping(diagnostics, index, LATENCY_NODE_UPDATE, update_us);
+  if (config->opcua_history_entries > 0) {
+    opcua_update_history(server, (size_t) index, &ua_value);
   }
-  
-  // Process according to format
-  if (!mapping->format) {
-    log_message(LOG_LEVEL_WARN, "No format specified for '%s', cannot process value.", mapping->name);
-    return false;
+  METRICS_ADD(values_published, 1);
+  UA_Variant_clear(&ua_value);
+}
+
+// Between replayed records the gateway keeps serving clients and the console like the acquisition loop does
+static void replay_service(UA_Server *server, const admin_view_t *admin_view) {
+  watchdog_progress(WATCHDOG_LOOP_SERVER, "housekeeping", -1);
+  admin_console_service(admin_view);
+  watchdog_progress(WATCHDOG_LOOP_SERVER, "processing OPC UA requests", -1);
+  cpu_accounting_enter(PIPELINE_OPCUA_SERVICE);
+  opcua_server_iterate(server);
+  cpu_accounting_leave(PIPELINE_OPCUA_SERVICE);
+  watchdog_progress(WATCHDOG_LOOP_SERVER, "housekeeping", -1);
+  metrics_sample_server(server);
+  watchdog_progress(WATCHDOG_LOOP_SERVER, NULL, -1);
+}
+
+/**
+ * @brief Feeds a recorded register trace through the decode, publish and history pipeline instead of
+ * reading the device. Every record refreshes the cached blocks it overlaps, then each mapping it fully
+ * covers is published (and historized, if enabled) when due by trace time, with the recorded time as
+ * source timestamp.
+ * @param server The OPC UA server instance.
+ * @param diagnostics The latency statistics to record the decode and update times in.
+ * @param config The application configuration.
+ * @param reg_cache The register cache the records are copied into.
+ * @param device_caps The device capabilities shown by the admin console.
+ */
+static void replay_trace(UA_Server *server, diagnostics_t *diagnostics, const modbus_opcua_config_t *config, register_cache_t *reg_cache,
+                         const device_caps_t *device_caps) {
+  register_trace_reader_t *reader = register_trace_open(config->register_trace_replay);
+  if (!reader) {
+    return;
   }
-  
-  // Format-specific processing
-  if (strncmp(mapping->format, "FIX", 3) == 0) {
-    // FIXn format
-    int decimal_places = 0;
-    if (strlen(mapping->format) > 3) {
-      decimal_places = atoi(mapping->format + 3);
-    }
-    float scale = 1.0f;
-    for (int i = 0; i < decimal_places; i++) {
-      scale *= 0.1f;
-    }
-    
-    float *float_val = UA_Float_new();
-    if (strcmp(mapping->data_type, "S16") == 0 || strcmp(mapping->data_type, "S32") == 0) {
-      *float_val = (float)((int64_t)raw_value) * scale;
-    } else {
-      *float_val = (float)raw_value * scale;
+  double speed = config->register_trace_speed;
+  if (speed > 0) {
+    log_message(LOG_LEVEL_INFO, "Replaying register trace '%s' at %.2fx real time.", config->register_trace_replay, speed);
+  } else {
+    log_message(LOG_LEVEL_INFO, "Replaying register trace '%s' as fast as possible.", config->register_trace_replay);
+  }
+
+  // Mappings are scheduled by trace time, so every one is due on the first record covering it
+  for (int i = 0; i < config->num_mappings; i++) {
+    reg_cache->next_poll_times[i] = 0;
+  }
+
+  register_trace_record_t record;
+  admin_view_t            admin_view    = {config, reg_cache, device_caps, false, false, 0};
+  int64_t                 start_us      = diagnostics_now_us();
+  int64_t                 first_ms      = -1;
+  long                    num_records   = 0;
+  long                    num_published = 0;
+  int                     rc            = 0;
+  while (!opcua_shutdown_requested() && (rc = register_trace_next(reader, &record)) == 1) {
+    if (first_ms < 0) {
+      first_ms = record.time_ms;
     }
-    UA_Variant_setScalar(out_variant, float_val, &UA_TYPES[UA_TYPES_FLOAT]);
-    
-  } else if (strcmp(mapping->format, "ENUM") == 0) {
-    // ENUM format
-    UA_Int32 *int_val = UA_Int32_new();
-    *int_val = (UA_Int32)raw_value;
-    UA_Variant_setScalar(out_variant, int_val, &UA_TYPES[UA_TYPES_INT32]);
-    
-  } else if (strcmp(mapping->format, "FW") == 0) {
-    // Firmware version format
-    uint32_t fw_val = (uint32_t)raw_value;
-    uint8_t major = (fw_val >> 24) & 0xFF;
-    uint8_t minor = (fw_val >> 16) & 0xFF;
-    uint8_t build = (fw_val >> 8) & 0xFF;
-    uint8_t release = fw_val & 0xFF;
-    
-    char release_char = 'R';
-    switch (release) {
-      case 3: release_char = 'B'; break;
-      case 4: release_char = 'R'; break;
-      default: release_char = '?'; break;
+    admin_view.now_ms = record.time_ms;
+
+    // At recorded pace, wait for the record's time; as fast as possible, still serve clients regularly
+    if (speed > 0) {
+      int64_t target_us = start_us + (int64_t) ((double) (record.time_ms - first_ms) * 1000.0 / speed);
+      int64_t wait_us;
+      while (!opcua_shutdown_requested() && (wait_us = target_us - diagnostics_now_us()) > 0) {
+        replay_service(server, &admin_view);
+        usleep((useconds_t) (wait_us < 100 * 1000 ? wait_us : 100 * 1000));
+      }
+    } else if (num_records % 256 == 0) {
+      replay_service(server, &admin_view);
     }
-    
-    char fw_string[32];
-    snprintf(fw_string, sizeof(fw_string), "%d.%d.%d.%c", major, minor, build, release_char);
-    
-    UA_String *string_val = UA_String_new();
-    *string_val = UA_STRING_ALLOC(fw_string);
-    UA_Variant_setScalar(out_variant, string_val, &UA_TYPES[UA_TYPES_STRING]);
-    
-  } else if (strcmp(mapping->format, "DT") == 0 || strcmp(mapping->format, "TM") == 0) {
-    // DateTime format
-    uint32_t unix_timestamp = (uint32_t)raw_value;
-    UA_DateTime *datetime_val = UA_DateTime_new();
-    *datetime_val = (unix_timestamp + 11644473600ULL) * 10000000ULL;
-    UA_Variant_setScalar(out_variant, datetime_val, &UA_TYPES[UA_TYPES_DATETIME]);
-    
-  } else if (strcmp(mapping->format, "Duration") == 0) {
-    // Duration format (seconds to milliseconds)
-    float *float_val = UA_Float_new();
-    *float_val = (float)raw_value * 1000.0f;
-    UA_Variant_setScalar(out_variant, float_val, &UA_TYPES[UA_TYPES_FLOAT]);
-    
-  } else if (strcmp(mapping->format, "TEMP") == 0) {
-    // Temperature format (tenths of degrees to degrees)
-    float *float_val = UA_Float_new();
-    if (strcmp(mapping->data_type, "S32") == 0) {
-      *float_val = (float)((int32_t)raw_value) * 0.1f;
-    } else {
-      *float_val = (float)raw_value * 0.1f;
+    num_records++;
+
+    watchdog_progress(WATCHDOG_LOOP_ACQUISITION, "replaying register block", record.address);
+    opcua_override_source_time(UA_DATETIME_UNIX_EPOCH + record.time_ms * UA_DATETIME_MSEC);
+    int record_end = record.address + record.num_regs;
+    for (int b = 0; b < reg_cache->num_blocks; b++) {
+      register_block_t *block     = &reg_cache->blocks[b];
+      int               block_end = block->start_address + block->num_regs;
+      if (block->function_code != record.function_code || block->start_address >= record_end || block_end <= record.address) {
+        continue;
+      }
+      int from = block->start_address > record.address ? block->start_address : record.address;
+      int to   = block_end < record_end ? block_end : record_end;
+      memcpy(&block->regs[from - block->start_address], &record.regs[from - record.address], (size_t) (to - from) * sizeof(uint16_t));
+      block->last_read_time = record.time_ms;
+
+      for (int k = block->first_mapping; k < block->first_mapping + block->num_mappings; k++) {
+        int                         i       = reg_cache->block_mappings[k];
+        const modbus_reg_mapping_t *mapping = &config->mappings[i];
+        if (record.time_ms < reg_cache->next_poll_times[i] || mapping->modbus_address < record.address ||
+            mapping->modbus_address + modbus_register_count(mapping) > record_end) {
+          continue;
+        }
+        reg_cache->next_poll_times[i] = record.time_ms + mapping->poll_interval_ms;
+        publish_mapping(server, diagnostics, config, i, register_cache_mapping_regs(reg_cache, i));
+        num_published++;
+      }
     }
-    UA_Variant_setScalar(out_variant, float_val, &UA_TYPES[UA_TYPES_FLOAT]);
-    
-  } else {
-    log_message(LOG_LEVEL_WARN, "Unknown format '%s' for '%s', using raw value", mapping->format, mapping->name);
-    float *float_val = UA_Float_new();
-    *float_val = (float)raw_value;
-    UA_Variant_setScalar(out_variant, float_val, &UA_TYPES[UA_TYPES_FLOAT]);
+    opcua_override_source_time(0);
   }
-  
-  return true;
+  watchdog_progress(WATCHDOG_LOOP_ACQUISITION, NULL, -1);
+
+  double elapsed_s = (double) (diagnostics_now_us() - start_us) / 1e6;
+  double traced_s  = first_ms < 0 ? 0 : (double) (record.time_ms - first_ms) / 1e3;
+  if (rc < 0) {
+    log_message(LOG_LEVEL_WARN, "Register trace '%s' is truncated or corrupt after %ld records.", config->register_trace_replay, num_records);
+  }
+  log_message(LOG_LEVEL_INFO, "Replay finished: %ld records, %ld values in %.3f s (%.1fx real time).", num_records, num_published, elapsed_s,
+              elapsed_s > 0 ? traced_s / elapsed_s : 0.0);
+  register_trace_close(reader);
+
+  // The replayed values stay readable until shutdown
+  while (!opcua_shutdown_requested()) {
+    admin_view.now_ms = get_time_ms();
+    replay_service(server, &admin_view);
+    usleep(REGISTER_CACHE_CYCLE_IDLE_MS * 1000);
+  }
+}
+
+// SIGUSR1 toggles the Modbus wire capture at runtime
+static void toggle_capture_handler(int sig) {
+  (void) sig;
+  wire_capture_set_enabled(!wire_capture_enabled());
+}
+
+// SIGUSR2 exports the buffered trace spans
+static void export_trace_handler(int sig) {
+  (void) sig;
+  trace_request_export();
 }
 
 int main(int argc, char *argv[]) {
@@ -144,26 +226,98 @@ int main(int argc, char *argv[]) {
 
   log_message(LOG_LEVEL_INFO, "Configuration loaded successfully from %s.", argv[1]);
 
-  modbus_t  *modbus_ctx   = NULL;
+  // Wire capture starts first so SunSpec discovery traffic can be captured too
+  if (wire_capture_start(config) == 0) {
+    signal(SIGUSR1, toggle_capture_handler);
+  }
+
+  modbus_t *modbus_ctx = NULL;
+  bool      replaying  = config->register_trace_replay && config->register_trace_replay[0] != '\0';
+
+  // SunSpec discovery runs before the address space is built so its mappings get nodes too
+  if (config->sunspec_enabled && replaying) {
+    log_message(LOG_LEVEL_WARN, "SunSpec discovery skipped: replaying a register trace.");
+  } else if (config->sunspec_enabled) {
+    modbus_ctx = modbus_tcp_connect(config);
+    if (modbus_ctx) {
+      modbus_opcua_config_t *discovered = sunspec_discover(modbus_ctx, config);
+      if (discovered) {
+        free_config(config);
+        config = discovered;
+      }
+    } else {
+      log_message(LOG_LEVEL_WARN, "SunSpec discovery skipped: Modbus device not reachable at startup.");
+    }
+  }
+
+  memory_account_set(MEMORY_CONFIG, config->arena_size);
+
   UA_Server *opcua_server = opcua_server_init(config);
   add_opcua_nodes(opcua_server, config);
 
+  // Latency statistics are exposed under Objects/Diagnostics
+  diagnostics_t *diagnostics = diagnostics_create(config);
+  if (!diagnostics) {
+    log_message(LOG_LEVEL_ERROR, "Failed to allocate memory for the diagnostics.");
+    if (modbus_ctx) {
+      modbus_close(modbus_ctx);
+      modbus_free(modbus_ctx);
+    }
+    free_config(config);
+    UA_Server_delete(opcua_server);
+    wire_capture_stop();
+    logger_close();
+    return EXIT_FAILURE;
+  }
+  diagnostics_add_nodes(opcua_server, diagnostics, config);
+  cpu_accounting_bind_device(&diagnostics->device_time);
+  metrics_init();
+
+  // Tracing is optional, the gateway runs without it
+  trace_init(config);
+  signal(SIGUSR2, export_trace_handler);
+
   UA_StatusCode retval = UA_Server_run_startup(opcua_server);
   if (retval != UA_STATUSCODE_GOOD) {
     log_message(LOG_LEVEL_ERROR, "OPC UA server startup failed with status code %s.", UA_StatusCode_name(retval));
+    if (modbus_ctx) {
+      modbus_close(modbus_ctx);
+      modbus_free(modbus_ctx);
+    }
     free_config(config);
     UA_Server_delete(opcua_server);
+    diagnostics_free(diagnostics);
+    trace_close();
+    wire_capture_stop();
     logger_close();
     return EXIT_FAILURE;
   }
   log_message(LOG_LEVEL_INFO, "OPC UA Server is running on port %d.", config->opcua_port);
 
-  // Array to track the next poll time for each mapping
-  int64_t *next_poll_times = calloc(config->num_mappings, sizeof(int64_t));
-  if (!next_poll_times) {
-    log_message(LOG_LEVEL_ERROR, "Failed to allocate memory for poll timers.");
+  // A broken metrics listener must not take the gateway down
+  metrics_server_start(config, diagnostics);
+
+  // The admin console is a debugging aid, the gateway runs without it
+  admin_console_start(config);
+
+  // Tell systemd we are up and start supervising the loops
+  watchdog_start(config);
+
+  // Device capabilities start from conservative defaults until the device is identified
+  device_caps_t device_caps;
+  device_caps_init(&device_caps);
+  bool device_identified = false;
+  bool was_connected     = modbus_ctx != NULL;
+
+  // Register cache shared by all mappings, plus scratch space for the due block list
+  register_cache_t *reg_cache  = register_cache_create(config, &device_caps);
+  int              *due_blocks = calloc(config->num_mappings > 0 ? config->num_mappings : 1, sizeof(int));
+  if (!reg_cache || !due_blocks) {
+    log_message(LOG_LEVEL_ERROR, "Failed to allocate memory for the register cache.");
 
     // Perform graceful shutdown/cleanup.
+    register_cache_free(reg_cache);
+    free(due_blocks);
     if (modbus_ctx) {
       modbus_close(modbus_ctx);
       modbus_free(modbus_ctx);
@@ -171,92 +325,156 @@ int main(int argc, char *argv[]) {
     }
 
     // Stop and delete OPC UA server
+    watchdog_stop();
+    admin_console_stop();
+    metrics_server_stop();
     UA_Server_run_shutdown(opcua_server);
     UA_Server_delete(opcua_server);
+    diagnostics_free(diagnostics);
 
     // Free config and close logger
+    trace_close();
     free_config(config);
+    wire_capture_stop();
     logger_close();
 
     return EXIT_FAILURE;
   }
 
-  while (!opcua_shutdown_requested()) {
+  // Recording is optional, the gateway runs without it
+  register_trace_start_recording(config);
+
+  // A replayed trace stands in for the device, the acquisition loop below is skipped
+  if (replaying) {
+    replay_trace(opcua_server, diagnostics, config, reg_cache, &device_caps);
+  }
+
+  while (!replaying && !opcua_shutdown_requested()) {
+    int64_t tick_start = diagnostics_now_us();
+
+    // Console commands that inspect the read plan are answered between two cycles, also while reconnecting
+    admin_view_t admin_view = {config, reg_cache, &device_caps, modbus_ctx != NULL, device_identified, get_time_ms()};
+    watchdog_progress(WATCHDOG_LOOP_ACQUISITION, "housekeeping", -1);
+    admin_console_service(&admin_view);
     if (!modbus_ctx) {
+      watchdog_progress(WATCHDOG_LOOP_ACQUISITION, "connecting to the Modbus device", -1);
       modbus_ctx = modbus_tcp_connect(config);
       if (!modbus_ctx) {
         if (opcua_shutdown_requested())
           break;
+        watchdog_progress(WATCHDOG_LOOP_ACQUISITION, NULL, -1);  // Waiting to retry is not a stall
         sleep(5);
         continue;
       }
+      if (was_connected) {
+        METRICS_ADD(modbus_reconnects, 1);
+      }
+      was_connected = true;
+    }
+
+    // Load known-good limits for this device (serial number and firmware) right after connecting
+    if (!device_identified) {
+      watchdog_progress(WATCHDOG_LOOP_ACQUISITION, "identifying the device", -1);
+      if (device_caps_identify(&device_caps, modbus_ctx, config)) {
+        reg_cache = register_cache_rebuild(reg_cache, config, &device_caps);
+      }
+      device_identified = true;
     }
 
+    watchdog_progress(WATCHDOG_LOOP_ACQUISITION, "scheduling", -1);
+    bool    caps_changed    = false;
     int64_t current_time_ms = get_time_ms();
+    int     num_due         = register_cache_collect_due(reg_cache, current_time_ms, due_blocks);
 
-    for (int i = 0; i < config->num_mappings; i++) {
+    for (int d = 0; d < num_due; d++) {
       if (opcua_shutdown_requested())
         break;
 
-      if (current_time_ms < next_poll_times[i]) {
-        continue;
+      // Each block is read once, then every due mapping on it decodes from the cache
+      register_block_t *block = &reg_cache->blocks[due_blocks[d]];
+      watchdog_progress(WATCHDOG_LOOP_ACQUISITION, "reading register block", block->start_address);
+      if (block->due_time != 0) {
+        histogram_record(&gateway_metrics.poll_lateness, (get_time_ms() - block->due_time) * 1000);
       }
-
-      next_poll_times[i] = current_time_ms + config->mappings[i].poll_interval_ms;
-
-      uint16_t regs[4];
-      int      read_rc = read_modbus_data(modbus_ctx, &config->mappings[i], regs);
-      if (read_rc == 0) {
-        UA_Variant ua_value;
-        if (process_modbus_value_formatted(regs, &config->mappings[i], &ua_value)) {
-          // Log the value based on its type
-          if (ua_value.type == &UA_TYPES[UA_TYPES_FLOAT]) {
-            float val = *(UA_Float*)ua_value.data;
-            log_message(LOG_LEVEL_DEBUG, "Read '%s': %f (Poll Rate: %dms)", config->mappings[i].name, val, config->mappings[i].poll_interval_ms);
-          } else if (ua_value.type == &UA_TYPES[UA_TYPES_INT32]) {
-            int32_t val = *(UA_Int32*)ua_value.data;
-            
-            // For ENUM format, try to find the corresponding string
-            if (config->mappings[i].format && strcmp(config->mappings[i].format, "ENUM") == 0) {
-              const char* enum_string = "Unknown";
-              for (int j = 0; j < config->mappings[i].num_enum_values; j++) {
-                if (config->mappings[i].enum_values[j].value == val) {
-                  enum_string = config->mappings[i].enum_values[j].name;
-                  break;
-                }
-              }
-              log_message(LOG_LEVEL_DEBUG, "Read '%s': %d (%s) (Poll Rate: %dms)", 
-                         config->mappings[i].name, val, enum_string, config->mappings[i].poll_interval_ms);
-            } else {
-              log_message(LOG_LEVEL_DEBUG, "Read '%s': %d (Poll Rate: %dms)", 
-                         config->mappings[i].name, val, config->mappings[i].poll_interval_ms);
-            }
-          } else if (ua_value.type == &UA_TYPES[UA_TYPES_STRING]) {
-            UA_String *str = (UA_String*)ua_value.data;
-            log_message(LOG_LEVEL_DEBUG, "Read '%s': %.*s (Poll Rate: %dms)", config->mappings[i].name, (int)str->length, str->data, config->mappings[i].poll_interval_ms);
-          } else {
-            log_message(LOG_LEVEL_DEBUG, "Read '%s': (complex type) (Poll Rate: %dms)", config->mappings[i].name, config->mappings[i].poll_interval_ms);
-          }
-          
-          update_opcua_node_value_typed(opcua_server, &config->mappings[i], &ua_value);
-          UA_Variant_clear(&ua_value);
-        } else {
-          log_message(LOG_LEVEL_WARN, "Received NaN for '%s' (Modbus Addr: %d). Skipping update.", config->mappings[i].name,
-                      config->mappings[i].modbus_address);
-        }
-      } else if (read_rc == -2) {
+      cpu_accounting_enter(PIPELINE_MODBUS_IO);
+      int64_t read_start = diagnostics_now_us();
+      int     read_rc    = read_modbus_registers(modbus_ctx, block->function_code, block->start_address, block->num_regs, block->regs);
+      int64_t read_end   = diagnostics_now_us();
+      cpu_accounting_leave(PIPELINE_MODBUS_IO);
+      int64_t rtt_us     = read_end - read_start;
+      trace_span(TRACE_BLOCK_READ, read_start, read_end, NULL, block->start_address);
+      if (read_rc == -2) {
         break;
-      } else {
+      } else if (read_rc != 0 && errno > MODBUS_ENOBASE) {
+        // The device answered with an exception, so the connection is fine: learn from it instead
+        METRICS_ADD(modbus_exceptions, 1);
+        caps_changed |= device_caps_report_exception(&device_caps, block->function_code, block->start_address, block->num_regs,
+                                                     block->coalesced, errno);
+        register_cache_finish_block(reg_cache, config, due_blocks[d], current_time_ms);
+        continue;
+      } else if (read_rc != 0) {
+        METRICS_ADD(modbus_transport_errors, 1);
         modbus_close(modbus_ctx);
         modbus_free(modbus_ctx);
-        modbus_ctx = NULL;
+        modbus_ctx        = NULL;
+        device_identified = false;
         log_message(LOG_LEVEL_ERROR, "Modbus read failed, will attempt to reconnect.");
         break;
       }
+      block->last_read_time = current_time_ms;
+      int64_t read_time_ms  = get_time_ms();
+      register_trace_record(block->function_code, block->start_address, block->num_regs, block->regs, read_time_ms);
+      diagnostics_record_device(diagnostics, LATENCY_MODBUS_RTT, rtt_us);
+      METRICS_ADD(modbus_reads, 1);
+
+      for (int k = block->first_mapping; k < block->first_mapping + block->num_mappings; k++) {
+        int     i = reg_cache->block_mappings[k];
+        int64_t scheduled_ms;
+        if (!register_cache_take_due_mapping(reg_cache, config, i, current_time_ms, &scheduled_ms)) {
+          continue;
+        }
+        diagnostics_record_schedule(diagnostics, i, scheduled_ms, read_time_ms, config->mappings[i].poll_interval_ms);
+        diagnostics_record_mapping(diagnostics, i, LATENCY_MODBUS_RTT, rtt_us);
+        watchdog_progress(WATCHDOG_LOOP_ACQUISITION, "publishing register", config->mappings[i].modbus_address);
+        publish_mapping(opcua_server, diagnostics, config, i, register_cache_mapping_regs(reg_cache, i));
+      }
+      register_cache_finish_block(reg_cache, config, due_blocks[d], current_time_ms);
+    }
+
+    // Background capability revalidation, one probe request per iteration
+    if (modbus_ctx && !opcua_shutdown_requested()) {
+      watchdog_progress(WATCHDOG_LOOP_ACQUISITION, "probing device capabilities", -1);
+      int64_t probe_start = diagnostics_now_us();
+      cpu_accounting_enter(PIPELINE_MODBUS_IO);
+      caps_changed |= device_caps_probe_step(&device_caps, modbus_ctx, reg_cache, config);
+      cpu_accounting_leave(PIPELINE_MODBUS_IO);
+      trace_span(TRACE_CAPS_PROBE, probe_start, diagnostics_now_us(), NULL, -1);
+    }
+    if (caps_changed) {
+      if (device_caps.validated) {
+        device_caps_save(&device_caps, config);  // Only confirmed ranges are kept across restarts
+      }
+      reg_cache = register_cache_rebuild(reg_cache, config, &device_caps);
     }
 
-    UA_Server_run_iterate(opcua_server, false);
-    usleep(100 * 1000);
+    // Both loops share this thread, so each is idle while the other one runs
+    watchdog_progress(WATCHDOG_LOOP_ACQUISITION, NULL, -1);
+    watchdog_progress(WATCHDOG_LOOP_SERVER, "processing OPC UA requests", -1);
+    cpu_accounting_enter(PIPELINE_OPCUA_SERVICE);
+    int64_t service_start = diagnostics_now_us();
+    opcua_server_iterate(opcua_server);
+    int64_t service_end = diagnostics_now_us();
+    cpu_accounting_leave(PIPELINE_OPCUA_SERVICE);
+    watchdog_progress(WATCHDOG_LOOP_SERVER, NULL, -1);
+    // Sampling, summaries and trace exports can block on I/O, so only the pause counts as idle
+    watchdog_progress(WATCHDOG_LOOP_ACQUISITION, "housekeeping", -1);
+    trace_span(TRACE_OPCUA_ITERATION, service_start, service_end, NULL, -1);
+    metrics_sample_server(opcua_server);
+    memory_log_summary(get_time_ms(), config->memory_summary_sec);
+    trace_span(TRACE_SCHEDULER_TICK, tick_start, service_end, NULL, num_due);
+    trace_poll();
+    watchdog_progress(WATCHDOG_LOOP_ACQUISITION, NULL, -1);
+    usleep(REGISTER_CACHE_CYCLE_IDLE_MS * 1000);
   }
 
   // Log the fact that shutdown was requested
@@ -266,18 +484,27 @@ int main(int argc, char *argv[]) {
   } else {
     log_message(LOG_LEVEL_INFO, "Shutdown requested, stopping.");
   }
+  watchdog_stop();
+  admin_console_stop();
 
-  free(next_poll_times);
+  free(due_blocks);
+  register_cache_free(reg_cache);
+  register_trace_stop_recording();
 
   if (modbus_ctx) {
     modbus_close(modbus_ctx);
     modbus_free(modbus_ctx);
   }
 
+  metrics_server_stop();
   UA_Server_run_shutdown(opcua_server);
   UA_Server_delete(opcua_server);
+  opcua_cleanup_history();
+  diagnostics_free(diagnostics);
+  trace_close();  // Span labels point into the configuration
   free_config(config);
 
+  wire_capture_stop();
   log_message(LOG_LEVEL_INFO, "Application terminated cleanly.");
   logger_close();
   
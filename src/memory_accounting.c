@@ -0,0 +1,128 @@
+#include "memory_accounting.h"
+
+#include <dirent.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <unistd.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include "logger.h"
+#include "metrics.h"
+
+static const char* subsystem_names[MEMORY_SUBSYSTEM_COUNT] = {
+    "Config", "RegisterCache", "AddressSpace", "History", "LogBuffers", "Diagnostics", "OpcUaSessions",
+};
+
+static _Atomic uint64_t accounts[MEMORY_SUBSYSTEM_COUNT];
+static int64_t          last_summary_ms = 0;
+
+const char* memory_subsystem_name(memory_subsystem_t subsystem) {
+  return subsystem_names[subsystem];
+}
+
+void memory_account_set(memory_subsystem_t subsystem, uint64_t bytes) {
+  atomic_store_explicit(&accounts[subsystem], bytes, memory_order_relaxed);
+}
+
+void memory_account_add(memory_subsystem_t subsystem, int64_t delta) {
+  atomic_fetch_add_explicit(&accounts[subsystem], (uint64_t) delta, memory_order_relaxed);
+}
+
+uint64_t memory_account_get(memory_subsystem_t subsystem) {
+  switch (subsystem) {
+    case MEMORY_HISTORY:
+      return atomic_load_explicit(&gateway_metrics.history_bytes, memory_order_relaxed);
+    case MEMORY_OPCUA_SESSIONS:
+      return atomic_load_explicit(&gateway_metrics.opcua_secure_channels, memory_order_relaxed) * MEMORY_CHANNEL_ESTIMATE_BYTES +
+             atomic_load_explicit(&gateway_metrics.opcua_sessions, memory_order_relaxed) * MEMORY_SESSION_ESTIMATE_BYTES +
+             atomic_load_explicit(&gateway_metrics.opcua_monitored_items, memory_order_relaxed) * MEMORY_MONITORED_ITEM_ESTIMATE_BYTES;
+    default:
+      return atomic_load_explicit(&accounts[subsystem], memory_order_relaxed);
+  }
+}
+
+uint64_t memory_account_total(void) {
+  uint64_t total = 0;
+  for (int s = 0; s < MEMORY_SUBSYSTEM_COUNT; s++) {
+    total += memory_account_get((memory_subsystem_t) s);
+  }
+  return total;
+}
+
+uint64_t memory_process_rss(void) {
+  FILE* statm = fopen("/proc/self/statm", "r");
+  if (!statm) {
+    return 0;
+  }
+  unsigned long long size = 0, resident = 0;
+  int                fields = fscanf(statm, "%llu %llu", &size, &resident);
+  fclose(statm);
+  return fields == 2 ? (uint64_t) resident * (uint64_t) sysconf(_SC_PAGESIZE) : 0;
+}
+
+bool memory_heap_stats(uint64_t* in_use, uint64_t* free_bytes) {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+  struct mallinfo2 info = mallinfo2();
+  *in_use               = (uint64_t) info.uordblks + (uint64_t) info.hblkhd;
+  *free_bytes           = (uint64_t) info.fordblks;
+  return true;
+#else
+  *in_use     = 0;
+  *free_bytes = 0;
+  return false;
+#endif
+}
+
+uint64_t memory_process_fds(void) {
+  DIR* dir = opendir("/proc/self/fd");
+  if (!dir) {
+    return 0;
+  }
+  uint64_t count = 0;
+  for (struct dirent* entry = readdir(dir); entry; entry = readdir(dir)) {
+    count += entry->d_name[0] != '.';
+  }
+  closedir(dir);
+  return count > 0 ? count - 1 : 0;  // Without the descriptor of the listing itself
+}
+
+// Formats a byte count with a binary unit, e.g. "12.3 MiB"
+static const char* format_bytes(char* buf, size_t size, uint64_t bytes) {
+  static const char* units[] = {"B", "KiB", "MiB", "GiB"};
+  double             value   = (double) bytes;
+  int                unit    = 0;
+  while (value >= 1024.0 && unit < 3) {
+    value /= 1024.0;
+    unit++;
+  }
+  if (unit == 0) {
+    snprintf(buf, size, "%llu B", (unsigned long long) bytes);
+  } else {
+    snprintf(buf, size, "%.1f %s", value, units[unit]);
+  }
+  return buf;
+}
+
+void memory_log_summary(int64_t now_ms, int interval_sec) {
+  if (interval_sec <= 0 || (last_summary_ms != 0 && now_ms - last_summary_ms < (int64_t) interval_sec * 1000)) {
+    return;
+  }
+  last_summary_ms = now_ms;
+
+  char   line[512];
+  char   value[32];
+  size_t len = 0;
+  for (int s = 0; s < MEMORY_SUBSYSTEM_COUNT && len < sizeof(line); s++) {
+    len += (size_t) snprintf(line + len, sizeof(line) - len, "%s%s %s", s ? ", " : "", subsystem_names[s],
+                             format_bytes(value, sizeof(value), memory_account_get((memory_subsystem_t) s)));
+  }
+
+  // Whatever the accounts do not explain is libraries, stacks, allocator overhead - or a leak if it keeps growing
+  uint64_t rss       = memory_process_rss();
+  uint64_t accounted = memory_account_total();
+  char     rss_text[32], unaccounted_text[32];
+  log_message(LOG_LEVEL_INFO, "Memory: RSS %s, unaccounted %s (%s)", format_bytes(rss_text, sizeof(rss_text), rss),
+              format_bytes(unaccounted_text, sizeof(unaccounted_text), rss > accounted ? rss - accounted : 0), line);
+}
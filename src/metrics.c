@@ -0,0 +1,345 @@
+#include "metrics.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "logger.h"
+#include "memory_accounting.h"
+
+#define METRICS_MAX_REQUEST 4096
+
+gateway_metrics_t gateway_metrics;
+
+static int                  listen_fd = -1;
+static pthread_t            listener_thread;
+static atomic_bool          listener_stop;
+static const diagnostics_t* listener_diag = NULL;
+
+// Bucket bounds (seconds) of the exported histograms, from 100 us to 30 s
+static const double histogram_bounds[] = {0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05,
+                                          0.1,    0.25,    0.5,    1.0,   2.5,    5.0,   10.0, 30.0};
+#define NUM_HISTOGRAM_BOUNDS ((int) (sizeof(histogram_bounds) / sizeof(histogram_bounds[0])))
+
+void metrics_init(void) {
+  atomic_init(&gateway_metrics.modbus_reads, 0);
+  atomic_init(&gateway_metrics.modbus_transport_errors, 0);
+  atomic_init(&gateway_metrics.modbus_exceptions, 0);
+  atomic_init(&gateway_metrics.modbus_reconnects, 0);
+  atomic_init(&gateway_metrics.values_published, 0);
+  atomic_init(&gateway_metrics.nan_values, 0);
+  atomic_init(&gateway_metrics.opcua_sessions, 0);
+  atomic_init(&gateway_metrics.opcua_sessions_total, 0);
+  atomic_init(&gateway_metrics.opcua_secure_channels, 0);
+  atomic_init(&gateway_metrics.opcua_monitored_items, 0);
+  atomic_init(&gateway_metrics.history_bytes, 0);
+  atomic_init(&gateway_metrics.capture_dropped_packets, 0);
+  histogram_init(&gateway_metrics.poll_lateness);
+}
+
+void metrics_sample_server(UA_Server* server) {
+  UA_ServerStatistics stats = UA_Server_getStatistics(server);
+  METRICS_SET(opcua_sessions, stats.ss.currentSessionCount);
+  METRICS_SET(opcua_sessions_total, stats.ss.cumulatedSessionCount);
+  METRICS_SET(opcua_secure_channels, stats.scs.currentChannelCount);
+}
+
+/*
+ * @brief Growable text buffer the exposition is rendered into.
+ */
+typedef struct {
+  char*  data;
+  size_t len;
+  size_t cap;
+  bool   failed;
+} text_buffer_t;
+
+static void buffer_printf(text_buffer_t* buf, const char* format, ...) {
+  if (buf->failed) {
+    return;
+  }
+  for (;;) {
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(buf->data + buf->len, buf->cap - buf->len, format, args);
+    va_end(args);
+    if (n < 0) {
+      buf->failed = true;
+      return;
+    }
+    if ((size_t) n < buf->cap - buf->len) {
+      buf->len += (size_t) n;
+      return;
+    }
+    size_t cap  = (buf->cap + (size_t) n + 1) * 2;
+    char*  data = realloc(buf->data, cap);
+    if (!data) {
+      buf->failed = true;
+      return;
+    }
+    buf->data = data;
+    buf->cap  = cap;
+  }
+}
+
+static uint64_t load(const _Atomic uint64_t* value) {
+  return atomic_load_explicit(value, memory_order_relaxed);
+}
+
+static void render_counter(text_buffer_t* buf, const char* name, const char* help, uint64_t value) {
+  buffer_printf(buf, "# TYPE %s counter\n# HELP %s %s\n%s_total %llu\n", name, name, help, name, (unsigned long long) value);
+}
+
+static void render_gauge(text_buffer_t* buf, const char* name, const char* help, uint64_t value) {
+  buffer_printf(buf, "# TYPE %s gauge\n# HELP %s %s\n%s %llu\n", name, name, help, name, (unsigned long long) value);
+}
+
+static void render_histogram(text_buffer_t* buf, const char* name, const char* help, const latency_histogram_t* hist) {
+  buffer_printf(buf, "# TYPE %s histogram\n# UNIT %s seconds\n# HELP %s %s\n", name, name, name, help);
+  for (int b = 0; b < NUM_HISTOGRAM_BOUNDS; b++) {
+    uint64_t count = histogram_count_at_or_below(hist, (uint64_t) (histogram_bounds[b] * 1e6));
+    buffer_printf(buf, "%s_bucket{le=\"%g\"} %llu\n", name, histogram_bounds[b], (unsigned long long) count);
+  }
+  // +Inf is taken from the buckets too, so it can never be lower than a finite bucket
+  uint64_t total = histogram_count_at_or_below(hist, UINT64_MAX);
+  buffer_printf(buf, "%s_bucket{le=\"+Inf\"} %llu\n%s_count %llu\n%s_sum %.6f\n", name, (unsigned long long) total, name,
+                (unsigned long long) total, name, (double) histogram_sum(hist) / 1e6);
+}
+
+// One counter family with a sample per pipeline stage, in seconds
+static void render_stage_times(text_buffer_t* buf, const char* name, const char* help, bool cpu) {
+  buffer_printf(buf, "# TYPE %s counter\n# UNIT %s seconds\n# HELP %s %s\n", name, name, name, help);
+  for (int s = 0; s < PIPELINE_STAGE_COUNT; s++) {
+    const stage_time_t* account = &cpu_accounts_global.stage[s];
+    uint64_t            ns      = load(cpu ? &account->cpu_ns : &account->wall_ns);
+    buffer_printf(buf, "%s_total{stage=\"%s\"} %.6f\n", name, cpu_accounting_stage_name((pipeline_stage_t) s), (double) ns / 1e9);
+  }
+}
+
+// One histogram family with a sample set per OPC UA service
+static void render_service_latency(text_buffer_t* buf) {
+  static const char name[] = "modbus_gateway_opcua_service_seconds";
+  buffer_printf(buf, "# TYPE %s histogram\n# UNIT %s seconds\n# HELP %s OPC UA service request processing time.\n", name, name, name);
+  for (int s = 0; s < OPCUA_SERVICE_COUNT; s++) {
+    const latency_histogram_t* hist    = &opcua_service_latency[s];
+    const char*                service = opcua_service_name((opcua_service_t) s);
+    for (int b = 0; b < NUM_HISTOGRAM_BOUNDS; b++) {
+      uint64_t count = histogram_count_at_or_below(hist, (uint64_t) (histogram_bounds[b] * 1e6));
+      buffer_printf(buf, "%s_bucket{service=\"%s\",le=\"%g\"} %llu\n", name, service, histogram_bounds[b], (unsigned long long) count);
+    }
+    uint64_t total = histogram_count_at_or_below(hist, UINT64_MAX);
+    buffer_printf(buf, "%s_bucket{service=\"%s\",le=\"+Inf\"} %llu\n%s_count{service=\"%s\"} %llu\n%s_sum{service=\"%s\"} %.6f\n", name,
+                  service, (unsigned long long) total, name, service, (unsigned long long) total, name, service,
+                  (double) histogram_sum(hist) / 1e6);
+  }
+}
+
+static void render_metrics(text_buffer_t* buf) {
+  render_counter(buf, "modbus_gateway_modbus_reads", "Successful Modbus block reads.", load(&gateway_metrics.modbus_reads));
+  render_counter(buf, "modbus_gateway_modbus_transport_errors", "Modbus reads failed on the transport.",
+                 load(&gateway_metrics.modbus_transport_errors));
+  render_counter(buf, "modbus_gateway_modbus_exceptions", "Modbus reads answered with an exception.",
+                 load(&gateway_metrics.modbus_exceptions));
+  render_counter(buf, "modbus_gateway_modbus_reconnects", "Modbus reconnects after a lost connection.",
+                 load(&gateway_metrics.modbus_reconnects));
+  render_counter(buf, "modbus_gateway_values_published", "Values written to the OPC UA address space.",
+                 load(&gateway_metrics.values_published));
+  render_counter(buf, "modbus_gateway_nan_values", "Values skipped because the device reported NaN.", load(&gateway_metrics.nan_values));
+  render_gauge(buf, "modbus_gateway_opcua_sessions", "Active OPC UA sessions.", load(&gateway_metrics.opcua_sessions));
+  render_counter(buf, "modbus_gateway_opcua_sessions_created", "OPC UA sessions created.", load(&gateway_metrics.opcua_sessions_total));
+  render_gauge(buf, "modbus_gateway_opcua_secure_channels", "Open OPC UA secure channels.", load(&gateway_metrics.opcua_secure_channels));
+  render_gauge(buf, "modbus_gateway_opcua_monitored_items", "Active OPC UA MonitoredItems.", load(&gateway_metrics.opcua_monitored_items));
+  render_gauge(buf, "modbus_gateway_history_bytes", "Approximate memory held by stored history.", load(&gateway_metrics.history_bytes));
+  render_counter(buf, "modbus_gateway_log_dropped_messages", "Log messages that could not be written.", logger_dropped_messages());
+  render_counter(buf, "modbus_gateway_capture_dropped_packets", "Wire capture packets dropped because the writer fell behind.",
+                 load(&gateway_metrics.capture_dropped_packets));
+
+  render_stage_times(buf, "modbus_gateway_stage_cpu_seconds", "Thread CPU time spent per pipeline stage.", true);
+  render_stage_times(buf, "modbus_gateway_stage_wall_seconds", "Wall time spent per pipeline stage.", false);
+  buffer_printf(buf, "# TYPE modbus_gateway_memory_bytes gauge\n# UNIT modbus_gateway_memory_bytes bytes\n");
+  buffer_printf(buf, "# HELP modbus_gateway_memory_bytes Memory held per subsystem (partly estimated).\n");
+  for (int s = 0; s < MEMORY_SUBSYSTEM_COUNT; s++) {
+    buffer_printf(buf, "modbus_gateway_memory_bytes{subsystem=\"%s\"} %llu\n", memory_subsystem_name((memory_subsystem_t) s),
+                  (unsigned long long) memory_account_get((memory_subsystem_t) s));
+  }
+  buffer_printf(buf, "# TYPE process_resident_memory_bytes gauge\n# UNIT process_resident_memory_bytes bytes\n");
+  buffer_printf(buf, "# HELP process_resident_memory_bytes Resident set size.\nprocess_resident_memory_bytes %llu\n",
+                (unsigned long long) memory_process_rss());
+  uint64_t heap_in_use, heap_free;
+  if (memory_heap_stats(&heap_in_use, &heap_free)) {
+    buffer_printf(buf, "# TYPE process_heap_bytes gauge\n# UNIT process_heap_bytes bytes\n");
+    buffer_printf(buf, "# HELP process_heap_bytes Heap held by the allocator, in allocated and in free blocks.\n");
+    buffer_printf(buf, "process_heap_bytes{state=\"in_use\"} %llu\nprocess_heap_bytes{state=\"free\"} %llu\n",
+                  (unsigned long long) heap_in_use, (unsigned long long) heap_free);
+  }
+  render_gauge(buf, "process_open_fds", "Open file descriptors.", memory_process_fds());
+  buffer_printf(buf, "# TYPE process_cpu_seconds counter\n# UNIT process_cpu_seconds seconds\n");
+  buffer_printf(buf, "# HELP process_cpu_seconds CPU time of all threads.\nprocess_cpu_seconds_total %.6f\n",
+                (double) cpu_accounting_process_cpu_ns() / 1e9);
+
+  render_service_latency(buf);
+  render_histogram(buf, "modbus_gateway_poll_lateness_seconds", "Delay of block reads behind their schedule.", &gateway_metrics.poll_lateness);
+  if (listener_diag) {
+    render_histogram(buf, "modbus_gateway_modbus_rtt_seconds", "Modbus block read round trip time.",
+                     &listener_diag->device.stage[LATENCY_MODBUS_RTT]);
+    render_histogram(buf, "modbus_gateway_decode_seconds", "Register decode time per value.", &listener_diag->device.stage[LATENCY_DECODE]);
+    render_histogram(buf, "modbus_gateway_node_update_seconds", "OPC UA address space write time per value.",
+                     &listener_diag->device.stage[LATENCY_NODE_UPDATE]);
+    render_histogram(buf, "modbus_gateway_publish_age_seconds", "Age of values served to OPC UA clients.",
+                     &listener_diag->device.stage[LATENCY_PUBLISH_AGE]);
+    render_counter(buf, "modbus_gateway_missed_poll_intervals", "Poll intervals that passed without a read.",
+                   load(&listener_diag->device.missed_intervals));
+  }
+  buffer_printf(buf, "# EOF\n");
+}
+
+char* metrics_render(size_t* len) {
+  text_buffer_t buf = {NULL, 0, 0, false};
+  render_metrics(&buf);
+  if (buf.failed) {
+    free(buf.data);
+    return NULL;
+  }
+  *len = buf.len;
+  return buf.data;
+}
+
+static void send_all(int fd, const char* data, size_t len) {
+  while (len > 0) {
+    ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return;
+    }
+    data += n;
+    len -= (size_t) n;
+  }
+}
+
+static void send_response(int fd, const char* status, const char* content_type, const char* body, size_t body_len) {
+  char header[256];
+  int  n = snprintf(header, sizeof(header), "HTTP/1.1 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n", status,
+                    content_type, body_len);
+  send_all(fd, header, (size_t) n);
+  send_all(fd, body, body_len);
+}
+
+static void serve_client(int fd) {
+  struct timeval timeout = {2, 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+  // Only the request line matters; read until the end of the headers
+  char   request[METRICS_MAX_REQUEST];
+  size_t len = 0;
+  while (len < sizeof(request) - 1) {
+    ssize_t n = recv(fd, request + len, sizeof(request) - 1 - len, 0);
+    if (n <= 0) {
+      break;
+    }
+    len += (size_t) n;
+    request[len] = '\0';
+    if (strstr(request, "\r\n\r\n")) {
+      break;
+    }
+  }
+  request[len] = '\0';
+
+  if (strncmp(request, "GET /metrics ", 13) != 0 && strncmp(request, "GET /metrics?", 13) != 0) {
+    static const char not_found[] = "Not found\n";
+    send_response(fd, "404 Not Found", "text/plain", not_found, sizeof(not_found) - 1);
+    return;
+  }
+
+  size_t text_len = 0;
+  char*  text     = metrics_render(&text_len);
+  if (!text) {
+    static const char error[] = "Out of memory\n";
+    send_response(fd, "500 Internal Server Error", "text/plain", error, sizeof(error) - 1);
+  } else {
+    send_response(fd, "200 OK", "application/openmetrics-text; version=1.0.0; charset=utf-8", text, text_len);
+  }
+  free(text);
+}
+
+static void* listener_main(void* arg) {
+  (void) arg;
+  while (!atomic_load(&listener_stop)) {
+    // Wake up regularly to notice metrics_server_stop()
+    struct pollfd pfd = {listen_fd, POLLIN, 0};
+    if (poll(&pfd, 1, 500) <= 0) {
+      continue;
+    }
+    int client = accept(listen_fd, NULL, NULL);
+    if (client < 0) {
+      continue;
+    }
+    serve_client(client);
+    close(client);
+  }
+  return NULL;
+}
+
+int metrics_server_start(const modbus_opcua_config_t* config, const diagnostics_t* diag) {
+  if (!config->metrics_enabled) {
+    return 0;
+  }
+  const char* bind_address = config->metrics_bind_address ? config->metrics_bind_address : "0.0.0.0";
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port   = htons((uint16_t) config->metrics_port);
+  if (inet_pton(AF_INET, bind_address, &addr.sin_addr) != 1) {
+    log_message(LOG_LEVEL_ERROR, "Invalid metrics bind address '%s'.", bind_address);
+    return -1;
+  }
+
+  listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (listen_fd < 0) {
+    log_message(LOG_LEVEL_ERROR, "Failed to create metrics socket: %s", strerror(errno));
+    return -1;
+  }
+  int reuse = 1;
+  setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  if (bind(listen_fd, (struct sockaddr*) &addr, sizeof(addr)) != 0 || listen(listen_fd, 8) != 0) {
+    log_message(LOG_LEVEL_ERROR, "Failed to listen for metrics on %s:%d: %s", bind_address, config->metrics_port, strerror(errno));
+    close(listen_fd);
+    listen_fd = -1;
+    return -1;
+  }
+
+  listener_diag = diag;
+  atomic_store(&listener_stop, false);
+  if (pthread_create(&listener_thread, NULL, listener_main, NULL) != 0) {
+    log_message(LOG_LEVEL_ERROR, "Failed to start the metrics listener thread.");
+    close(listen_fd);
+    listen_fd = -1;
+    return -1;
+  }
+
+  log_message(LOG_LEVEL_INFO, "Serving OpenMetrics on http://%s:%d/metrics", bind_address, config->metrics_port);
+  return 0;
+}
+
+void metrics_server_stop(void) {
+  if (listen_fd < 0) {
+    return;
+  }
+  atomic_store(&listener_stop, true);
+  pthread_join(listener_thread, NULL);
+  close(listen_fd);
+  listen_fd     = -1;
+  listener_diag = NULL;
+}
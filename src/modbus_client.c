@@ -8,6 +8,7 @@
 
 #include "logger.h"
 #include "opcua_server.h"
+#include "wire_capture.h"
 
 modbus_t* modbus_tcp_connect(const modbus_opcua_config_t* config) {
   modbus_t* ctx = modbus_new_tcp(config->modbus_ip, config->modbus_port);
@@ -38,27 +39,86 @@ modbus_t* modbus_tcp_connect(const modbus_opcua_config_t* config) {
   return ctx;
 }
 
-int read_modbus_data(modbus_t* ctx, const modbus_reg_mapping_t* mapping, uint16_t* dest) {
-  int num_regs = 1;  // Default to reading one register
+int modbus_register_count(const modbus_reg_mapping_t* mapping) {
   if (strcmp(mapping->data_type, "S32") == 0 || strcmp(mapping->data_type, "U32") == 0) {
-    num_regs = 2;
+    return 2;
   } else if (strcmp(mapping->data_type, "U64") == 0) {
-    num_regs = 4;
+    return 4;
+  }
+  return 1;  // Default to reading one register
+}
+
+static int64_t wall_time_us(void) {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (int64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+// Performs the read through libmodbus' raw request API so the exact ADUs can be captured.
+// Validates the response like modbus_read_registers() does and sets errno the same way.
+static int read_registers_captured(modbus_t* ctx, int function_code, int address, int num_regs, uint16_t* dest) {
+  uint8_t pdu[6] = {(uint8_t) modbus_get_slave(ctx), (uint8_t) (function_code == 3 ? 0x03 : 0x04), (uint8_t) (address >> 8),
+                    (uint8_t) address, (uint8_t) (num_regs >> 8), (uint8_t) num_regs};
+  uint8_t response[MODBUS_TCP_MAX_ADU_LENGTH];
+
+  int64_t request_us = wall_time_us();
+  if (modbus_send_raw_request(ctx, pdu, sizeof(pdu)) == -1) {
+    return -1;
   }
+  int     length      = modbus_receive_confirmation(ctx, response);
+  int     saved_errno = errno;
+  int64_t response_us = wall_time_us();
+
+  // Raw requests go out with transaction id 0, so the request ADU can be rebuilt byte for byte
+  uint8_t request[12] = {0, 0, 0, 0, 0, 6};
+  memcpy(request + 6, pdu, sizeof(pdu));
+  wire_capture_record(modbus_get_socket(ctx), request, sizeof(request), request_us, length > 0 ? response : NULL, length, response_us);
 
+  if (length == -1) {
+    errno = saved_errno;
+    return -1;
+  }
+  if (length >= 9 && (response[7] & 0x80)) {
+    errno = MODBUS_ENOBASE + response[8];
+    return -1;
+  }
+  if (length != 9 + 2 * num_regs || response[7] != pdu[1] || response[8] != 2 * num_regs) {
+    modbus_flush(ctx);
+    errno = EMBBADDATA;
+    return -1;
+  }
+  for (int i = 0; i < num_regs; i++) {
+    dest[i] = (uint16_t) ((response[9 + 2 * i] << 8) | response[10 + 2 * i]);
+  }
+  return num_regs;
+}
+
+int read_modbus_registers(modbus_t* ctx, int function_code, int address, int num_regs, uint16_t* dest) {
   // Convert manual address to libmodbus 0-based address and determine function
-  int libmodbus_address = mapping->modbus_address;
+  int libmodbus_address = address;
   int rc = -1;
-  rc = modbus_read_input_registers(ctx, libmodbus_address, num_regs, dest);
+  if (wire_capture_enabled()) {
+    rc = read_registers_captured(ctx, function_code, libmodbus_address, num_regs, dest);
+  } else if (function_code == 3) {
+    rc = modbus_read_registers(ctx, libmodbus_address, num_regs, dest);
+  } else {
+    rc = modbus_read_input_registers(ctx, libmodbus_address, num_regs, dest);
+  }
 
   if (rc == -1) {
-    if (errno == EINTR && opcua_shutdown_requested()) {
+    int saved_errno = errno;
+    if (saved_errno == EINTR && opcua_shutdown_requested()) {
       return -2;
     }
 
-    log_message(LOG_LEVEL_ERROR, "Failed to read Modbus register %d (libmodbus addr %d): %s", 
-                mapping->modbus_address, libmodbus_address, modbus_strerror(errno));
+    log_message(LOG_LEVEL_ERROR, "Failed to read %d Modbus register(s) at %d (libmodbus addr %d): %s", 
+                num_regs, address, libmodbus_address, modbus_strerror(saved_errno));
+    errno = saved_errno;  // Callers tell Modbus exceptions (errno > MODBUS_ENOBASE) from transport errors
     return -1;
   }
   return 0;
 }
+
+int read_modbus_data(modbus_t* ctx, const modbus_reg_mapping_t* mapping, uint16_t* dest) {
+  return read_modbus_registers(ctx, mapping->function_code, mapping->modbus_address, modbus_register_count(mapping), dest);
+}
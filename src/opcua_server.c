@@ -1,13 +1,74 @@
 #include "opcua_server.h"
 
 #include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <pthread.h>
+#include <time.h>
+#include "cpu_accounting.h"
 #include "logger.h"
+#include "memory_accounting.h"
+#include "metrics.h"
+#include "trace.h"
 
 static volatile sig_atomic_t shutdown_requested  = 0;
 static volatile sig_atomic_t shutdown_signal_num = 0;
+static bool                  internal_read       = false;
+static UA_DateTime           source_time         = 0;  // Overrides the clock for value timestamps when set
+
+// Server loop time no hook accounts for is recorded as Other from this long; shorter gaps are loop overhead
+#define UNATTRIBUTED_MIN_US 100
+
+/*
+ * @brief A node a session has value MonitoredItems on, keyed by the node's context.
+ */
+typedef struct {
+  const void* node_context;
+  uint32_t    items;
+} monitored_node_t;
+
+/*
+ * @brief Requests of one client session, keyed by its session NodeId.
+ */
+typedef struct {
+  UA_NodeId         session_id;  // Null for a free slot
+  char              user[64];
+  uint64_t          requests[OPCUA_SERVICE_COUNT];
+  uint64_t          slowest_us;
+  monitored_node_t* monitored;   // Sorted by node context; reads of these nodes are sampling, not Read requests
+  size_t            num_monitored;
+  size_t            monitored_capacity;
+} session_stats_t;
+
+/*
+ * @brief The service request currently being timed inside opcua_server_iterate().
+ *
+ * open62541 processes requests one after another inside UA_Server_run_iterate(); a request is
+ * timed from the end of the previous one to the first hook of the next one with a different
+ * service or session, the last one until the iteration returns. Time before the first hook is
+ * recorded as Other.
+ */
+static struct {
+  bool      active;
+  int       service;   // -1 until the first hook fires
+  bool      sampling;  // MonitoredItem sampling, timed as Publish work but not counted as a request
+  UA_NodeId session_id;
+  int64_t   start_us;
+} window = {false, -1, false, {0}, 0};
+
+static const char* service_names[OPCUA_SERVICE_COUNT] = {
+    "Read", "Write", "Browse", "CreateMonitoredItems", "Publish", "HistoryRead", "Other",
+};
+
+latency_histogram_t opcua_service_latency[OPCUA_SERVICE_COUNT];
+
+static session_stats_t sessions[OPCUA_MAX_TRACKED_SESSIONS];
+static int64_t         slow_request_us  = 0;
+static int64_t         last_slow_log_us = 0;
+static uint64_t        slow_suppressed  = 0;
+static UA_AccessControl original_access;  // Callbacks of the access control plugin the hooks chain to
 
 static HistoryData *historyNodes = NULL;
 static size_t historyNodeCount = 0;
@@ -26,6 +87,10 @@ int opcua_shutdown_signal(void) {
   return shutdown_signal_num;
 }
 
+int opcua_internal_read_active(void) {
+  return internal_read;
+}
+
 // Struct to hold user credentials for the callback
 static struct {
   UA_String username;
@@ -42,6 +107,289 @@ usernamePasswordLogin(UA_Server *server, const UA_NodeId *sessionId, void *sessi
   return UA_STATUSCODE_BADIDENTITYTOKENINVALID;
 }
 
+static int64_t monotonic_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+const char* opcua_service_name(opcua_service_t service) {
+  return service_names[service];
+}
+
+// Returns the statistics slot of a session, claiming a free one if create is set, or NULL
+static session_stats_t* find_session(const UA_NodeId* session_id, bool create) {
+  if (!session_id || UA_NodeId_isNull(session_id)) {
+    return NULL;
+  }
+  session_stats_t* free_slot = NULL;
+  for (int i = 0; i < OPCUA_MAX_TRACKED_SESSIONS; i++) {
+    if (UA_NodeId_isNull(&sessions[i].session_id)) {
+      free_slot = free_slot ? free_slot : &sessions[i];
+    } else if (UA_NodeId_equal(&sessions[i].session_id, session_id)) {
+      return &sessions[i];
+    }
+  }
+  if (!create || !free_slot) {
+    return NULL;
+  }
+  memset(free_slot, 0, sizeof(*free_slot));
+  UA_NodeId_copy(session_id, &free_slot->session_id);
+  snprintf(free_slot->user, sizeof(free_slot->user), "anonymous");
+  return free_slot;
+}
+
+// Formats a session for the log as "<NodeId> (user <name>)"
+static const char* describe_session(char* buf, size_t size, const UA_NodeId* session_id, const session_stats_t* stats) {
+  UA_String id = {0, NULL};
+  if (!session_id || UA_NodeId_isNull(session_id) || UA_NodeId_print(session_id, &id) != UA_STATUSCODE_GOOD) {
+    snprintf(buf, size, "none");
+  } else {
+    snprintf(buf, size, "%.*s (user %s)", (int) id.length, (const char*) id.data, stats ? stats->user : "unknown");
+  }
+  UA_String_clear(&id);
+  return buf;
+}
+
+// Closes the timed request: records its latency, counts it for its session and logs it if it was slow
+static void finish_request(opcua_service_t service, const UA_NodeId* session_id, int64_t duration_us) {
+  histogram_record(&opcua_service_latency[service], duration_us);
+  session_stats_t* stats = find_session(session_id, true);
+  if (stats) {
+    stats->requests[service]++;
+    stats->slowest_us = duration_us > (int64_t) stats->slowest_us ? (uint64_t) duration_us : stats->slowest_us;
+  }
+  if (slow_request_us <= 0 || duration_us < slow_request_us) {
+    return;
+  }
+
+  // One line per second at most, so a misbehaving client cannot flood the log
+  int64_t now_us = monotonic_us();
+  if (last_slow_log_us != 0 && now_us - last_slow_log_us < 1000000) {
+    slow_suppressed++;
+    return;
+  }
+  uint64_t total = 0;
+  for (int s = 0; stats && s < OPCUA_SERVICE_COUNT; s++) {
+    total += stats->requests[s];
+  }
+  char session_text[160];
+  describe_session(session_text, sizeof(session_text), session_id, stats);
+  log_message(LOG_LEVEL_WARN, "Slow OPC UA %s request: %.1f ms, session %s, %llu requests so far (%llu slow requests not logged).",
+              service_names[service], (double) duration_us / 1000.0, session_text, (unsigned long long) total,
+              (unsigned long long) slow_suppressed);
+  last_slow_log_us = now_us;
+  slow_suppressed  = 0;
+}
+
+// Ends the timed request at now_us; the next one starts there
+static void close_window(int64_t now_us) {
+  if (window.service >= 0) {
+    if (window.sampling) {
+      // Inferred, so it belongs to no session and is never logged as a slow request
+      histogram_record(&opcua_service_latency[OPCUA_SERVICE_PUBLISH], now_us - window.start_us);
+    } else {
+      finish_request((opcua_service_t) window.service, &window.session_id, now_us - window.start_us);
+    }
+    trace_span(TRACE_OPCUA_REQUEST, window.start_us, now_us, service_names[window.service], -1);
+  } else if (now_us - window.start_us >= UNATTRIBUTED_MIN_US) {
+    // Work before the first hook, or a whole iteration without one: requests no hook sees
+    histogram_record(&opcua_service_latency[OPCUA_SERVICE_OTHER], now_us - window.start_us);
+    trace_span(TRACE_OPCUA_REQUEST, window.start_us, now_us, service_names[OPCUA_SERVICE_OTHER], -1);
+  }
+  window.start_us = now_us;
+  UA_NodeId_clear(&window.session_id);
+  window.service  = -1;
+  window.sampling = false;
+}
+
+void opcua_service_touch(opcua_service_t service, const UA_NodeId* session_id) {
+  if (!window.active || (window.service == (int) service && session_id && UA_NodeId_equal(&window.session_id, session_id))) {
+    return;  // Outside the server loop (the gateway's own accesses) or still the same request
+  }
+  close_window(monotonic_us());
+  if (session_id) {
+    UA_NodeId_copy(session_id, &window.session_id);
+  }
+  window.service = (int) service;
+}
+
+// Returns the position of a node context in the session's sorted MonitoredItem list, or where it belongs
+static size_t monitored_position(const session_stats_t* stats, const void* node_context) {
+  size_t lo = 0, hi = stats->num_monitored;
+  while (lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    if ((uintptr_t) stats->monitored[mid].node_context < (uintptr_t) node_context) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+static bool is_monitored(const session_stats_t* stats, const void* node_context) {
+  size_t pos = monitored_position(stats, node_context);
+  return pos < stats->num_monitored && stats->monitored[pos].node_context == node_context;
+}
+
+// Counts a value MonitoredItem of a session on a node in or out
+static void track_monitored(session_stats_t* stats, const void* node_context, bool removed) {
+  size_t pos = monitored_position(stats, node_context);
+  if (pos < stats->num_monitored && stats->monitored[pos].node_context == node_context) {
+    if (!removed) {
+      stats->monitored[pos].items++;
+    } else if (--stats->monitored[pos].items == 0) {
+      memmove(&stats->monitored[pos], &stats->monitored[pos + 1], (stats->num_monitored - pos - 1) * sizeof(monitored_node_t));
+      stats->num_monitored--;
+    }
+    return;
+  }
+  if (removed) {
+    return;
+  }
+  if (stats->num_monitored == stats->monitored_capacity) {
+    size_t            capacity = stats->monitored_capacity ? 2 * stats->monitored_capacity : 16;
+    monitored_node_t* grown    = realloc(stats->monitored, capacity * sizeof(monitored_node_t));
+    if (!grown) {
+      return;  // The node's samples are then counted as Read requests
+    }
+    stats->monitored          = grown;
+    stats->monitored_capacity = capacity;
+  }
+  memmove(&stats->monitored[pos + 1], &stats->monitored[pos], (stats->num_monitored - pos) * sizeof(monitored_node_t));
+  stats->monitored[pos].node_context = node_context;
+  stats->monitored[pos].items        = 1;
+  stats->num_monitored++;
+}
+
+void opcua_read_touch(const UA_NodeId* session_id, const void* node_context) {
+  if (!window.active) {
+    return;
+  }
+  session_stats_t* stats = node_context ? find_session(session_id, false) : NULL;
+  if (stats && is_monitored(stats, node_context)) {
+    if (!window.sampling) {
+      close_window(monotonic_us());
+      window.service  = OPCUA_SERVICE_PUBLISH;
+      window.sampling = true;
+    }
+    return;
+  }
+  opcua_service_touch(OPCUA_SERVICE_READ, session_id);
+}
+
+void opcua_server_iterate(UA_Server *server) {
+  window.active   = true;
+  window.service  = -1;
+  window.sampling = false;
+  window.start_us = monotonic_us();
+  UA_Server_run_iterate(server, false);
+  window.active = false;
+
+  close_window(monotonic_us());
+}
+
+// Remembers the user name of a session for the slow request log
+static UA_StatusCode activate_session_hook(UA_Server *server, UA_AccessControl *ac, const UA_EndpointDescription *endpointDescription,
+                                           const UA_ByteString *secureChannelRemoteCertificate, const UA_NodeId *sessionId,
+                                           const UA_ExtensionObject *userIdentityToken, void **sessionContext) {
+  UA_StatusCode rc = original_access.activateSession(server, ac, endpointDescription, secureChannelRemoteCertificate, sessionId,
+                                                     userIdentityToken, sessionContext);
+  session_stats_t* stats = rc == UA_STATUSCODE_GOOD ? find_session(sessionId, true) : NULL;
+  if (stats && userIdentityToken && userIdentityToken->content.decoded.type == &UA_TYPES[UA_TYPES_USERNAMEIDENTITYTOKEN]) {
+    const UA_UserNameIdentityToken *token = (const UA_UserNameIdentityToken *) userIdentityToken->content.decoded.data;
+    snprintf(stats->user, sizeof(stats->user), "%.*s", (int) token->userName.length, (const char *) token->userName.data);
+  }
+  return rc;
+}
+
+// Logs what a session asked for over its lifetime and frees its slot
+static void close_session_hook(UA_Server *server, UA_AccessControl *ac, const UA_NodeId *sessionId, void *sessionContext) {
+  if (window.active && window.service >= 0 && UA_NodeId_equal(&window.session_id, sessionId)) {
+    close_window(monotonic_us());  // Count the session's last request before its slot goes away
+  }
+  session_stats_t* stats = find_session(sessionId, false);
+  if (stats) {
+    char   counts[256];
+    size_t len = 0;
+    for (int s = 0; s < OPCUA_SERVICE_OTHER && len < sizeof(counts); s++) {
+      len += (size_t) snprintf(counts + len, sizeof(counts) - len, "%s%s %llu", s ? ", " : "", service_names[s],
+                               (unsigned long long) stats->requests[s]);
+    }
+    char session_text[160];
+    log_message(LOG_LEVEL_INFO, "OPC UA session %s closed: %s requests, slowest %.1f ms.",
+                describe_session(session_text, sizeof(session_text), sessionId, stats), counts, (double) stats->slowest_us / 1000.0);
+    UA_NodeId_clear(&stats->session_id);
+    free(stats->monitored);
+    stats->monitored          = NULL;
+    stats->num_monitored      = 0;
+    stats->monitored_capacity = 0;
+  }
+  original_access.closeSession(server, ac, sessionId, sessionContext);
+}
+
+static UA_Boolean allow_browse_hook(UA_Server *server, UA_AccessControl *ac, const UA_NodeId *sessionId, void *sessionContext,
+                                    const UA_NodeId *nodeId, void *nodeContext) {
+  opcua_service_touch(OPCUA_SERVICE_BROWSE, sessionId);
+  return original_access.allowBrowseNode(server, ac, sessionId, sessionContext, nodeId, nodeContext);
+}
+
+// Chains the service hooks in front of the configured access control plugin
+static void hook_access_control(UA_ServerConfig *ua_config) {
+  original_access = ua_config->accessControl;
+  if (original_access.activateSession) {
+    ua_config->accessControl.activateSession = activate_session_hook;
+  }
+  if (original_access.closeSession) {
+    ua_config->accessControl.closeSession = close_session_hook;
+  }
+  if (original_access.allowBrowseNode) {
+    ua_config->accessControl.allowBrowseNode = allow_browse_hook;
+  }
+}
+
+#ifdef UA_ENABLE_SUBSCRIPTIONS
+// Keeps the MonitoredItem gauge of the metrics endpoint current, times CreateMonitoredItems and
+// remembers which nodes each session samples, so sampling is not taken for Read requests
+static void monitored_item_registered(UA_Server *server, const UA_NodeId *sessionId, void *sessionContext, const UA_NodeId *nodeId,
+                                      void *nodeContext, UA_UInt32 attributeId, UA_Boolean removed) {
+  if (removed) {
+    METRICS_SUB(opcua_monitored_items, 1);
+  } else {
+    METRICS_ADD(opcua_monitored_items, 1);
+    opcua_service_touch(OPCUA_SERVICE_CREATE_MONITORED_ITEMS, sessionId);
+  }
+  session_stats_t* stats = attributeId == UA_ATTRIBUTEID_VALUE && nodeContext ? find_session(sessionId, !removed) : NULL;
+  if (stats) {
+    track_monitored(stats, nodeContext, removed);
+  }
+}
+#endif
+
+#ifdef UA_ENABLE_HISTORIZING
+/*
+ * @brief HistoryRead (raw) handler of the server's history database. Answers every node from the
+ * history kept by opcua_update_history(), a page of numValuesPerNode values at a time.
+ */
+static void history_read_raw(UA_Server *server, void *hdbContext, const UA_NodeId *sessionId, void *sessionContext,
+                             const UA_RequestHeader *requestHeader, const UA_ReadRawModifiedDetails *historyReadDetails,
+                             UA_TimestampsToReturn timestampsToReturn, UA_Boolean releaseContinuationPoints,
+                             size_t nodesToReadSize, const UA_HistoryReadValueId *nodesToRead,
+                             UA_HistoryReadResponse *response, UA_HistoryData *const *const historyData) {
+  for (size_t i = 0; i < nodesToReadSize; i++) {
+    // Continuation points carry no server state, so releasing them only means returning no data
+    if (releaseContinuationPoints) {
+      response->results[i].statusCode = UA_STATUSCODE_GOOD;
+      continue;
+    }
+    response->results[i].statusCode =
+        readHistoryData(server, sessionId, sessionContext, &nodesToRead[i].nodeId, true, NULL, timestampsToReturn, historyReadDetails,
+                        &nodesToRead[i].continuationPoint, &response->results[i].continuationPoint, historyData[i]);
+  }
+}
+#endif
+
 UA_Server *opcua_server_init(const modbus_opcua_config_t *config) {
   signal(SIGINT, stop_handler);
   signal(SIGTERM, stop_handler);
@@ -49,6 +397,15 @@ UA_Server *opcua_server_init(const modbus_opcua_config_t *config) {
   UA_Server       *server    = UA_Server_new();
   UA_ServerConfig *ua_config = UA_Server_getConfig(server);
   UA_ServerConfig_setMinimal(ua_config, config->opcua_port, NULL);
+#ifdef UA_ENABLE_SUBSCRIPTIONS
+  ua_config->monitoredItemRegisterCallback = monitored_item_registered;
+#endif
+#ifdef UA_ENABLE_HISTORIZING
+  // Without a history database open62541 rejects every HistoryRead before it reaches our store
+  if (config->opcua_history_entries > 0) {
+    ua_config->historyDatabase.readRaw = history_read_raw;
+  }
+#endif
 
   // Setup user authentication if username and password are provided
   if (config->opcua_username && config->opcua_username[0] != '\0' && config->opcua_password) {
@@ -67,15 +424,31 @@ UA_Server *opcua_server_init(const modbus_opcua_config_t *config) {
     log_message(LOG_LEVEL_WARN, "OPC UA security is disabled. No username/password configured.");
   }
 
+  for (int s = 0; s < OPCUA_SERVICE_COUNT; s++) {
+    histogram_init(&opcua_service_latency[s]);
+  }
+  slow_request_us = (int64_t) config->opcua_slow_request_ms * 1000;
+  hook_access_control(ua_config);
+
   return server;
 }
 
 void add_opcua_nodes(UA_Server *server, const modbus_opcua_config_t *config) {
+  // History is indexed like the mappings, so publishing a value finds its buffer directly
+  bool history = config->opcua_history_entries > 0;
+  if (history && opcua_init_history((size_t) config->num_mappings) != UA_STATUSCODE_GOOD) {
+    log_message(LOG_LEVEL_ERROR, "Failed to allocate the history of %d mappings, history is disabled.", config->num_mappings);
+    history = false;
+  }
   for (int i = 0; i < config->num_mappings; i++) {
     modbus_reg_mapping_t* mapping = &config->mappings[i];
     UA_VariableAttributes attr    = UA_VariableAttributes_default;
     attr.displayName              = UA_LOCALIZEDTEXT("en-US", mapping->name);
     attr.accessLevel              = UA_ACCESSLEVELMASK_READ | UA_ACCESSLEVELMASK_WRITE;
+    if (config->opcua_history_entries > 0) {
+      attr.accessLevel |= UA_ACCESSLEVELMASK_HISTORYREAD;
+      attr.historizing  = true;
+    }
 
     UA_NodeId node_id = UA_NODEID_STRING(1, mapping->opcua_node_id);
 
@@ -277,6 +650,14 @@ void add_opcua_nodes(UA_Server *server, const modbus_opcua_config_t *config) {
       UA_Server_addVariableNode(server, node_id, UA_NODEID_NUMERIC(0, UA_NS0ID_OBJECTSFOLDER), UA_NODEID_NUMERIC(0, UA_NS0ID_ORGANIZES),
                                 UA_QUALIFIEDNAME(1, mapping->name), UA_NODEID_NUMERIC(0, UA_NS0ID_BASEDATAVARIABLETYPE), attr, NULL, NULL);
     }
+
+    // The variable, plus the DataType and its two properties for enumerations
+    bool is_enum = mapping->format && strcmp(mapping->format, "ENUM") == 0 && mapping->enum_values && mapping->num_enum_values > 0;
+    memory_account_add(MEMORY_ADDRESS_SPACE, (is_enum ? 4 : 1) * MEMORY_NODE_ESTIMATE_BYTES);
+
+    if (history && opcua_add_history_node(server, (size_t) i, node_id, (size_t) config->opcua_history_entries) != UA_STATUSCODE_GOOD) {
+      log_message(LOG_LEVEL_WARN, "Failed to enable history for '%s'.", mapping->name);
+    }
   }
 }
 
@@ -289,7 +670,7 @@ UA_StatusCode update_opcua_node_value_typed(UA_Server *server, const modbus_reg_
   dv.hasValue = true;
   dv.value = *value;
   dv.hasSourceTimestamp = true;
-  dv.sourceTimestamp = UA_DateTime_now();
+  dv.sourceTimestamp = source_time ? source_time : UA_DateTime_now();
   dv.hasServerTimestamp = true;
   dv.serverTimestamp = dv.sourceTimestamp;
   dv.status = UA_STATUSCODE_GOOD;
@@ -304,7 +685,9 @@ UA_StatusCode update_opcua_node_value_typed(UA_Server *server, const modbus_reg_
   // Read back to verify
   UA_Variant read_back;
   UA_Variant_init(&read_back);
-  rc = UA_Server_readValue(server, node_id, &read_back);
+  internal_read = true;
+  rc            = UA_Server_readValue(server, node_id, &read_back);
+  internal_read = false;
   if (rc != UA_STATUSCODE_GOOD) {
     log_message(LOG_LEVEL_WARN, "UA_Server_readValue failed for '%s' after write: 0x%08x", mapping->name, rc);
   } else {
@@ -326,6 +709,10 @@ UA_StatusCode update_opcua_node_value_typed(UA_Server *server, const modbus_reg_
   return UA_STATUSCODE_GOOD;
 }
 
+void opcua_override_source_time(UA_DateTime time) {
+  source_time = time;
+}
+
 UA_StatusCode update_opcua_node_value(UA_Server *server, const modbus_reg_mapping_t *mapping, float value) {
   UA_NodeId  node_id = UA_NODEID_STRING(1, (char *) mapping->opcua_node_id);
   UA_Variant ua_value;
@@ -335,9 +722,10 @@ UA_StatusCode update_opcua_node_value(UA_Server *server, const modbus_reg_mappin
 }
 
 HistoryData* findHistoryData(const UA_NodeId *nodeId) {
+    // Only HistoryRead looks nodes up by id; publishing goes by mapping index
     pthread_mutex_lock(&historyMutex);
     for(size_t i = 0; i < historyNodeCount; i++) {
-        if(UA_NodeId_equal(&historyNodes[i].nodeId, nodeId)) {
+        if(historyNodes[i].values && UA_NodeId_equal(&historyNodes[i].nodeId, nodeId)) {
             pthread_mutex_unlock(&historyMutex);
             return &historyNodes[i];
         }
@@ -346,6 +734,13 @@ HistoryData* findHistoryData(const UA_NodeId *nodeId) {
     return NULL;
 }
 
+/* A continuation point holds the source timestamp of the last value returned and how many values
+ * with that timestamp were returned so far, so it stays valid while the ring buffer moves on. */
+typedef struct {
+    UA_DateTime lastTime;
+    UA_UInt64   sameTime;
+} HistoryContinuation;
+
 UA_StatusCode
 readHistoryData(UA_Server *server, const UA_NodeId *sessionId,
                 void *sessionContext, const UA_NodeId *nodeId,
@@ -353,84 +748,178 @@ readHistoryData(UA_Server *server, const UA_NodeId *sessionId,
                 const UA_NumericRange *range,
                 UA_TimestampsToReturn timestampsToReturn,
                 const UA_ReadRawModifiedDetails *details,
+                const UA_ByteString *continuationPoint,
+                UA_ByteString *nextContinuationPoint,
                 UA_HistoryData *result) {
-    
+    opcua_service_touch(OPCUA_SERVICE_HISTORY_READ, sessionId);
+
+    /* Modified values and bounding values are not stored; without an end time (or a start time)
+     * the number of values bounds the read, as the specification requires */
+    if(details->isReadModified || details->returnBounds)
+        return UA_STATUSCODE_BADHISTORYOPERATIONUNSUPPORTED;
+    if((details->startTime == 0 || details->endTime == 0) &&
+       (details->numValuesPerNode == 0 || details->startTime == details->endTime))
+        return UA_STATUSCODE_BADHISTORYOPERATIONUNSUPPORTED;
+
+    HistoryContinuation resume = {0, 0};
+    bool resuming = continuationPoint && continuationPoint->length > 0;
+    if(resuming) {
+        if(continuationPoint->length != sizeof(resume))
+            return UA_STATUSCODE_BADCONTINUATIONPOINTINVALID;
+        memcpy(&resume, continuationPoint->data, sizeof(resume));
+    }
+
     HistoryData *hd = findHistoryData(nodeId);
     if(!hd)
         return UA_STATUSCODE_BADNODEIDUNKNOWN;
 
-    pthread_mutex_lock(&hd->mutex);
-    
-    // Filter data based on time range
-    size_t count = 0;
-    for(size_t i = 0; i < hd->currentSize; i++) {
-        UA_DateTime ts = hd->values[i].sourceTimestamp;
-        if(ts >= details->startTime && ts <= details->endTime) {
-            count++;
-        }
+    /* Without a start time, or with the start after the end, values are returned newest first */
+    bool reverse = details->startTime == 0 || (details->endTime != 0 && details->startTime > details->endTime);
+    UA_DateTime low, high;
+    if(!reverse) {
+        low  = details->startTime;
+        high = details->endTime != 0 ? details->endTime : INT64_MAX;
+    } else {
+        low  = details->startTime == 0 ? INT64_MIN : details->endTime;
+        high = details->startTime == 0 ? details->endTime : details->startTime;
     }
+    size_t limit = details->numValuesPerNode > 0 ? details->numValuesPerNode : SIZE_MAX;
 
-    if(count == 0) {
+    pthread_mutex_lock(&hd->mutex);
+
+    /* Once the ring buffer is full, the oldest value is the one overwritten next */
+    size_t first = hd->currentSize == hd->maxSize ? hd->currentIndex : 0;
+    size_t capacity = hd->currentSize < limit ? hd->currentSize : limit;
+    UA_DataValue *values = capacity > 0 ?
+        (UA_DataValue*)UA_Array_new(capacity, &UA_TYPES[UA_TYPES_DATAVALUE]) : NULL;
+    if(capacity > 0 && !values) {
         pthread_mutex_unlock(&hd->mutex);
-        return UA_STATUSCODE_GOOD;
+        return UA_STATUSCODE_BADOUTOFMEMORY;
     }
 
-    result->dataValuesSize = count;
-    result->dataValues = (UA_DataValue*)UA_Array_new(count, &UA_TYPES[UA_TYPES_DATAVALUE]);
-    
-    size_t idx = 0;
-    for(size_t i = 0; i < hd->currentSize && idx < count; i++) {
-        UA_DateTime ts = hd->values[i].sourceTimestamp;
-        if(ts >= details->startTime && ts <= details->endTime) {
-            UA_DataValue_copy(&hd->values[i], &result->dataValues[idx]);
-            idx++;
+    size_t count = 0;
+    bool more = false;
+    UA_UInt64 skipped = 0;
+    for(size_t j = 0; j < hd->currentSize; j++) {
+        size_t k = reverse ? hd->currentSize - 1 - j : j;
+        const UA_DataValue *dv = &hd->values[(first + k) % hd->maxSize];
+        UA_DateTime ts = dv->sourceTimestamp;
+        if(ts < low || ts > high)
+            continue;
+        if(resuming) {
+            if(reverse ? ts > resume.lastTime : ts < resume.lastTime)
+                continue;
+            if(ts == resume.lastTime && skipped < resume.sameTime) {
+                skipped++;
+                continue;
+            }
+        }
+        if(count == limit) {
+            more = true;
+            break;
         }
+        UA_DataValue_copy(dv, &values[count++]);
+    }
+
+    if(more) {
+        /* Count the returned values sharing the last timestamp, including earlier pages */
+        HistoryContinuation next = {values[count - 1].sourceTimestamp, 0};
+        for(size_t j = count; j > 0 && values[j - 1].sourceTimestamp == next.lastTime; j--)
+            next.sameTime++;
+        if(resuming && next.lastTime == resume.lastTime)
+            next.sameTime += resume.sameTime;
+        if(nextContinuationPoint &&
+           UA_ByteString_allocBuffer(nextContinuationPoint, sizeof(next)) == UA_STATUSCODE_GOOD)
+            memcpy(nextContinuationPoint->data, &next, sizeof(next));
     }
 
     pthread_mutex_unlock(&hd->mutex);
+
+    if(count == 0) {
+        UA_Array_delete(values, capacity, &UA_TYPES[UA_TYPES_DATAVALUE]);
+        return UA_STATUSCODE_GOOD;
+    }
+    result->dataValuesSize = count;
+    result->dataValues = values;
     return UA_STATUSCODE_GOOD;
 }
 
-UA_StatusCode opcua_add_history_node(UA_Server *server, UA_NodeId nodeId, 
-                                      size_t maxHistoryEntries) {
+UA_StatusCode opcua_init_history(size_t numNodes) {
     pthread_mutex_lock(&historyMutex);
-    
-    /* Allocate or expand history nodes array */
-    HistoryData *temp = realloc(historyNodes, (historyNodeCount + 1) * sizeof(HistoryData));
-    if(!temp) {
+    if(historyNodes) {
+        pthread_mutex_unlock(&historyMutex);
+        return UA_STATUSCODE_BADINVALIDSTATE;
+    }
+    /* Allocated once: the entries hold mutexes, which must not move */
+    historyNodes = calloc(numNodes > 0 ? numNodes : 1, sizeof(HistoryData));
+    if(!historyNodes) {
         pthread_mutex_unlock(&historyMutex);
         return UA_STATUSCODE_BADOUTOFMEMORY;
     }
-    historyNodes = temp;
-    
-    HistoryData *hd = &historyNodes[historyNodeCount];
-    UA_NodeId_copy(&nodeId, &hd->nodeId);
+    for(size_t i = 0; i < numNodes; i++)
+        pthread_mutex_init(&historyNodes[i].mutex, NULL);
+    historyNodeCount = numNodes;
+    pthread_mutex_unlock(&historyMutex);
+    return UA_STATUSCODE_GOOD;
+}
+
+UA_StatusCode opcua_add_history_node(UA_Server *server, size_t index, UA_NodeId nodeId,
+                                      size_t maxHistoryEntries) {
+    if(index >= historyNodeCount || maxHistoryEntries == 0)
+        return UA_STATUSCODE_BADINVALIDARGUMENT;
+
+    HistoryData *hd = &historyNodes[index];
+    pthread_mutex_lock(&hd->mutex);
+    if(hd->values) {
+        pthread_mutex_unlock(&hd->mutex);
+        return UA_STATUSCODE_BADNODEIDEXISTS;
+    }
     hd->values = (UA_DataValue*)UA_Array_new(maxHistoryEntries, &UA_TYPES[UA_TYPES_DATAVALUE]);
+    if(!hd->values) {
+        pthread_mutex_unlock(&hd->mutex);
+        return UA_STATUSCODE_BADOUTOFMEMORY;
+    }
+    UA_NodeId_copy(&nodeId, &hd->nodeId);
     hd->maxSize = maxHistoryEntries;
     hd->currentSize = 0;
     hd->currentIndex = 0;
-    pthread_mutex_init(&hd->mutex, NULL);
-    
-    historyNodeCount++;
-    pthread_mutex_unlock(&historyMutex);
-    
-    /* Enable historizing on the node */
-    UA_HistorizingNodeIdSettings setting;
-    setting.historizingBackend = UA_HistoryDataBackend_Memory(maxHistoryEntries, 100);
-    setting.maxHistoryDataResponseSize = 100;
-    setting.historizingUpdateStrategy = UA_HISTORIZINGUPDATESTRATEGY_VALUESET;
-    
-    UA_Server_setHistorizingSetting(server, nodeId, setting);
-    
+    pthread_mutex_unlock(&hd->mutex);
+
     return UA_STATUSCODE_GOOD;
 }
 
-UA_StatusCode opcua_update_history(UA_Server *server, UA_NodeId nodeId, 
-                                    UA_Variant *value) {
-    HistoryData *hd = findHistoryData(&nodeId);
-    if(!hd)
+void opcua_history_sizes(size_t *nodes, size_t *values, size_t *capacity) {
+  pthread_mutex_lock(&historyMutex);
+  *nodes    = 0;
+  *values   = 0;
+  *capacity = 0;
+  for (size_t i = 0; i < historyNodeCount; i++) {
+    pthread_mutex_lock(&historyNodes[i].mutex);
+    *nodes += historyNodes[i].values ? 1 : 0;
+    *values += historyNodes[i].currentSize;
+    *capacity += historyNodes[i].maxSize;
+    pthread_mutex_unlock(&historyNodes[i].mutex);
+  }
+  pthread_mutex_unlock(&historyMutex);
+}
+
+// Approximate memory held by one stored history value
+static size_t history_value_bytes(const UA_DataValue *dv) {
+    size_t bytes = sizeof(UA_DataValue);
+    if(dv->value.type) {
+        bytes += dv->value.type->memSize;
+        if(dv->value.type == &UA_TYPES[UA_TYPES_STRING])
+            bytes += ((const UA_String*)dv->value.data)->length;
+    }
+    return bytes;
+}
+
+UA_StatusCode opcua_update_history(UA_Server *server, size_t index, UA_Variant *value) {
+    if(index >= historyNodeCount || !historyNodes[index].values)
         return UA_STATUSCODE_BADNODEIDUNKNOWN;
+    HistoryData *hd = &historyNodes[index];
     
+    cpu_accounting_enter(PIPELINE_HISTORY);
     pthread_mutex_lock(&hd->mutex);
     
     // Create new data value with timestamp
@@ -438,23 +927,26 @@ UA_StatusCode opcua_update_history(UA_Server *server, UA_NodeId nodeId,
     UA_DataValue_init(&dv);
     UA_Variant_copy(value, &dv.value);
     dv.hasValue = true;
-    dv.sourceTimestamp = UA_DateTime_now();
+    dv.sourceTimestamp = source_time ? source_time : UA_DateTime_now();
     dv.hasSourceTimestamp = true;
     dv.hasServerTimestamp = true;
-    dv.serverTimestamp = UA_DateTime_now();
+    dv.serverTimestamp = dv.sourceTimestamp;
     
     // Store in circular buffer
     size_t idx = hd->currentIndex;
     if(hd->currentSize < hd->maxSize) {
         hd->currentSize++;
     } else {
+        METRICS_SUB(history_bytes, history_value_bytes(&hd->values[idx]));
         UA_DataValue_clear(&hd->values[idx]);
     }
     
     hd->values[idx] = dv;
+    METRICS_ADD(history_bytes, history_value_bytes(&dv));
     hd->currentIndex = (hd->currentIndex + 1) % hd->maxSize;
     
     pthread_mutex_unlock(&hd->mutex);
+    cpu_accounting_leave(PIPELINE_HISTORY);
     
     return UA_STATUSCODE_GOOD;
 }
@@ -464,13 +956,15 @@ void opcua_cleanup_history(void) {
     for(size_t i = 0; i < historyNodeCount; i++) {
         pthread_mutex_lock(&historyNodes[i].mutex);
         UA_NodeId_clear(&historyNodes[i].nodeId);
-        UA_Array_delete(historyNodes[i].values, historyNodes[i].currentSize, 
-                       &UA_TYPES[UA_TYPES_DATAVALUE]);
+        if(historyNodes[i].values)
+            UA_Array_delete(historyNodes[i].values, historyNodes[i].maxSize,
+                            &UA_TYPES[UA_TYPES_DATAVALUE]);
         pthread_mutex_unlock(&historyNodes[i].mutex);
         pthread_mutex_destroy(&historyNodes[i].mutex);
     }
     free(historyNodes);
     historyNodes = NULL;
     historyNodeCount = 0;
+    METRICS_SET(history_bytes, 0);
     pthread_mutex_unlock(&historyMutex);
 }
\ No newline at end of file
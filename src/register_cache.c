@@ -0,0 +1,189 @@
+#include "register_cache.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logger.h"
+#include "memory_accounting.h"
+#include "modbus_client.h"
+
+static const modbus_reg_mapping_t* sort_mappings = NULL;
+
+static int compare_mapping_address(const void* a, const void* b) {
+  // Holding and input registers are separate address spaces
+  int lhs_fc = sort_mappings[*(const int*) a].function_code;
+  int rhs_fc = sort_mappings[*(const int*) b].function_code;
+  if (lhs_fc != rhs_fc) {
+    return lhs_fc < rhs_fc ? -1 : 1;
+  }
+
+  int lhs = sort_mappings[*(const int*) a].modbus_address;
+  int rhs = sort_mappings[*(const int*) b].modbus_address;
+  if (lhs != rhs) {
+    return lhs < rhs ? -1 : 1;
+  }
+  // Keep configuration order for mappings on the same address
+  return *(const int*) a - *(const int*) b;
+}
+
+register_cache_t* register_cache_create(const modbus_opcua_config_t* config, const device_caps_t* caps) {
+  register_cache_t* cache = calloc(1, sizeof(register_cache_t));
+  if (!cache) {
+    return NULL;
+  }
+
+  int n                  = config->num_mappings;
+  cache->blocks          = calloc(n > 0 ? n : 1, sizeof(register_block_t));
+  cache->block_mappings  = calloc(n > 0 ? n : 1, sizeof(int));
+  cache->mapping_block   = calloc(n > 0 ? n : 1, sizeof(int));
+  cache->mapping_offset  = calloc(n > 0 ? n : 1, sizeof(int));
+  cache->next_poll_times = calloc(n > 0 ? n : 1, sizeof(int64_t));
+  if (!cache->blocks || !cache->block_mappings || !cache->mapping_block || !cache->mapping_offset || !cache->next_poll_times) {
+    register_cache_free(cache);
+    return NULL;
+  }
+
+  // Quarantine mappings the device is known to reject, order the rest by address
+  // so overlapping and adjacent ranges end up next to each other
+  int num_active = 0;
+  for (int i = 0; i < n; i++) {
+    const modbus_reg_mapping_t* mapping = &config->mappings[i];
+    if (caps && device_caps_is_invalid(caps, mapping->function_code, mapping->modbus_address,
+                                       mapping->modbus_address + modbus_register_count(mapping))) {
+      cache->mapping_block[i] = -1;
+      cache->num_quarantined++;
+      continue;
+    }
+    cache->block_mappings[num_active++] = i;
+  }
+  sort_mappings = config->mappings;
+  qsort(cache->block_mappings, num_active, sizeof(int), compare_mapping_address);
+  sort_mappings = NULL;
+
+  // Merge overlapping and duplicate register ranges into blocks. Adjacent ranges with the
+  // same poll interval are coalesced as well, up to the device's validated request size.
+  int total_regs = 0;
+  for (int k = 0; k < num_active; k++) {
+    int                         i       = cache->block_mappings[k];
+    const modbus_reg_mapping_t* mapping = &config->mappings[i];
+    int                         start   = mapping->modbus_address;
+    int                         end     = start + modbus_register_count(mapping);
+
+    register_block_t* block     = cache->num_blocks > 0 ? &cache->blocks[cache->num_blocks - 1] : NULL;
+    int               block_end = block ? block->start_address + block->num_regs : 0;
+    bool              overlaps  = block && start < block_end && end - block->start_address <= MODBUS_MAX_READ_REGISTERS;
+    bool              adjacent  = block && caps && start == block_end && mapping->poll_interval_ms == block->poll_interval_ms &&
+                                  device_caps_may_coalesce(caps, mapping->function_code, block->start_address, end);
+    if (block && block->function_code == mapping->function_code && (overlaps || adjacent)) {
+      if (end > block_end) {
+        total_regs += end - block_end;
+        block->num_regs = end - block->start_address;
+      }
+      if (mapping->poll_interval_ms < block->poll_interval_ms) {
+        block->poll_interval_ms = mapping->poll_interval_ms;
+      }
+      block->coalesced = block->coalesced || adjacent;
+      block->num_mappings++;
+    } else {
+      block                   = &cache->blocks[cache->num_blocks++];
+      block->function_code    = mapping->function_code;
+      block->start_address    = start;
+      block->num_regs         = end - start;
+      block->poll_interval_ms = mapping->poll_interval_ms;
+      block->first_mapping    = k;
+      block->num_mappings     = 1;
+      total_regs += block->num_regs;
+    }
+    cache->mapping_block[i]  = cache->num_blocks - 1;
+    cache->mapping_offset[i] = start - block->start_address;
+  }
+
+  cache->storage = calloc(total_regs > 0 ? total_regs : 1, sizeof(uint16_t));
+  if (!cache->storage) {
+    register_cache_free(cache);
+    return NULL;
+  }
+  uint16_t* next = cache->storage;
+  for (int b = 0; b < cache->num_blocks; b++) {
+    cache->blocks[b].regs = next;
+    next += cache->blocks[b].num_regs;
+  }
+
+  size_t per_mapping = sizeof(register_block_t) + 3 * sizeof(int) + sizeof(int64_t);
+  memory_account_set(MEMORY_REGISTER_CACHE, sizeof(register_cache_t) + (size_t) (n > 0 ? n : 1) * per_mapping +
+                                                (size_t) (total_regs > 0 ? total_regs : 1) * sizeof(uint16_t));
+
+  log_message(LOG_LEVEL_INFO, "Register cache: %d mappings served by %d block reads (%d registers), %d quarantined.", num_active,
+              cache->num_blocks, total_regs, cache->num_quarantined);
+  return cache;
+}
+
+register_cache_t* register_cache_rebuild(register_cache_t* cache, const modbus_opcua_config_t* config, const device_caps_t* caps) {
+  register_cache_t* rebuilt = register_cache_create(config, caps);
+  if (!rebuilt) {
+    log_message(LOG_LEVEL_ERROR, "Failed to rebuild the register cache, keeping the current read plan.");
+    return cache;
+  }
+  // Mappings keep their schedule; the new blocks are read on the next cycle
+  memcpy(rebuilt->next_poll_times, cache->next_poll_times, (config->num_mappings > 0 ? config->num_mappings : 1) * sizeof(int64_t));
+  register_cache_free(cache);
+  return rebuilt;
+}
+
+void register_cache_free(register_cache_t* cache) {
+  if (!cache) {
+    return;
+  }
+  free(cache->blocks);
+  free(cache->block_mappings);
+  free(cache->mapping_block);
+  free(cache->mapping_offset);
+  free(cache->next_poll_times);
+  free(cache->storage);
+  free(cache);
+}
+
+int register_cache_collect_due(register_cache_t* cache, int64_t now_ms, int* due_blocks) {
+  int count = 0;
+  for (int b = 0; b < cache->num_blocks; b++) {
+    register_block_t* block = &cache->blocks[b];
+    if (now_ms < block->next_poll_time) {
+      continue;
+    }
+    // The block is rescheduled once it was read, so a block the cycle never got to stays due
+    block->due_time     = block->next_poll_time;
+    due_blocks[count++] = b;
+  }
+  return count;
+}
+
+bool register_cache_take_due_mapping(register_cache_t* cache, const modbus_opcua_config_t* config, int mapping_index, int64_t now_ms,
+                                     int64_t* scheduled_ms) {
+  if (now_ms < cache->next_poll_times[mapping_index]) {
+    return false;
+  }
+  *scheduled_ms                         = cache->next_poll_times[mapping_index];
+  cache->next_poll_times[mapping_index] = now_ms + config->mappings[mapping_index].poll_interval_ms;
+  return true;
+}
+
+void register_cache_finish_block(register_cache_t* cache, const modbus_opcua_config_t* config, int block_index, int64_t now_ms) {
+  register_block_t* block = &cache->blocks[block_index];
+  int64_t           next  = INT64_MAX;
+  for (int k = block->first_mapping; k < block->first_mapping + block->num_mappings; k++) {
+    int i = cache->block_mappings[k];
+    // Mappings still due were not published because the device rejected the read; retry them one interval later
+    if (now_ms >= cache->next_poll_times[i]) {
+      cache->next_poll_times[i] = now_ms + config->mappings[i].poll_interval_ms;
+    }
+    if (cache->next_poll_times[i] < next) {
+      next = cache->next_poll_times[i];
+    }
+  }
+  block->next_poll_time = next;
+}
+
+const uint16_t* register_cache_mapping_regs(const register_cache_t* cache, int mapping_index) {
+  return cache->blocks[cache->mapping_block[mapping_index]].regs + cache->mapping_offset[mapping_index];
+}
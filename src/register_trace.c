@@ -0,0 +1,191 @@
+#include "register_trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "logger.h"
+
+#define TRACE_MAGIC         "SMARTRC1"
+#define TRACE_MAGIC_LENGTH  8
+#define TRACE_HEADER_LENGTH (TRACE_MAGIC_LENGTH + 8)  // Magic + start time (int64 little endian)
+#define TRACE_MAX_RECORD    (10 + 1 + 5 + 1 + 2 * REGISTER_TRACE_MAX_REGS)
+#define TRACE_FLUSH_MS      1000
+#define TRACE_BUFFER_BYTES  (64 * 1024)
+
+/*
+ * @brief State of an open trace being replayed.
+ */
+struct register_trace_reader_s {
+  FILE*   file;
+  int64_t time_ms;  // Time of the previous record, the start time before the first one
+};
+
+// Recording state, only touched by the acquisition loop
+static FILE*   record_file    = NULL;
+static char*   record_buffer  = NULL;
+static int64_t record_time_ms = 0;  // Time of the previous record, deltas are relative to it
+static int64_t last_flush_ms  = 0;
+static bool    write_failed   = false;
+
+static int put_varint(uint8_t* p, uint64_t v) {
+  int length = 0;
+  while (v >= 0x80) {
+    p[length++] = (uint8_t) (v | 0x80);
+    v >>= 7;
+  }
+  p[length++] = (uint8_t) v;
+  return length;
+}
+
+static bool get_varint(FILE* file, uint64_t* v) {
+  *v = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    int c = fgetc(file);
+    if (c == EOF) {
+      return false;
+    }
+    *v |= (uint64_t) (c & 0x7F) << shift;
+    if (!(c & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+int register_trace_start_recording(const modbus_opcua_config_t* config) {
+  if (!config->register_trace_record || config->register_trace_record[0] == '\0') {
+    return 0;
+  }
+
+  // Appending to an existing trace would mix two header timelines, so each run starts a new file
+  record_file = fopen(config->register_trace_record, "wb");
+  if (!record_file) {
+    log_message(LOG_LEVEL_ERROR, "Failed to open register trace '%s' for writing.", config->register_trace_record);
+    return -1;
+  }
+  record_buffer = malloc(TRACE_BUFFER_BYTES);
+  if (record_buffer) {
+    setvbuf(record_file, record_buffer, _IOFBF, TRACE_BUFFER_BYTES);
+  }
+
+  // The header time is only the base for the first delta; reads are never older than startup
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  record_time_ms = (int64_t) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+  last_flush_ms  = record_time_ms;
+  write_failed   = false;
+
+  uint8_t header[TRACE_HEADER_LENGTH];
+  memcpy(header, TRACE_MAGIC, TRACE_MAGIC_LENGTH);
+  for (int i = 0; i < 8; i++) {
+    header[TRACE_MAGIC_LENGTH + i] = (uint8_t) ((uint64_t) record_time_ms >> (8 * i));
+  }
+  fwrite(header, 1, sizeof(header), record_file);
+
+  log_message(LOG_LEVEL_INFO, "Recording register reads to '%s'.", config->register_trace_record);
+  return 0;
+}
+
+void register_trace_record(int function_code, int address, int num_regs, const uint16_t* regs, int64_t time_ms) {
+  if (!record_file || num_regs <= 0 || num_regs > REGISTER_TRACE_MAX_REGS) {
+    return;
+  }
+
+  // Wall clock steps backwards are recorded as simultaneous reads so deltas stay unsigned
+  int64_t delta_ms = time_ms > record_time_ms ? time_ms - record_time_ms : 0;
+  record_time_ms += delta_ms;
+
+  uint8_t record[TRACE_MAX_RECORD];
+  int     length = put_varint(record, (uint64_t) delta_ms);
+  record[length++] = (uint8_t) function_code;
+  length += put_varint(record + length, (uint64_t) address);
+  record[length++] = (uint8_t) num_regs;
+  for (int r = 0; r < num_regs; r++) {
+    record[length++] = (uint8_t) (regs[r] >> 8);
+    record[length++] = (uint8_t) regs[r];
+  }
+
+  bool ok = fwrite(record, 1, (size_t) length, record_file) == (size_t) length;
+  if (ok && record_time_ms - last_flush_ms >= TRACE_FLUSH_MS) {
+    ok            = fflush(record_file) == 0;
+    last_flush_ms = record_time_ms;
+  }
+  if (!ok && !write_failed) {
+    log_message(LOG_LEVEL_ERROR, "Failed to write the register trace, the trace is incomplete.");
+    write_failed = true;
+  }
+}
+
+void register_trace_stop_recording(void) {
+  if (record_file) {
+    fclose(record_file);
+    record_file = NULL;
+  }
+  free(record_buffer);
+  record_buffer = NULL;
+}
+
+register_trace_reader_t* register_trace_open(const char* path) {
+  FILE* file = fopen(path, "rb");
+  if (!file) {
+    log_message(LOG_LEVEL_ERROR, "Failed to open register trace '%s'.", path);
+    return NULL;
+  }
+
+  uint8_t header[TRACE_HEADER_LENGTH];
+  if (fread(header, 1, sizeof(header), file) != sizeof(header) || memcmp(header, TRACE_MAGIC, TRACE_MAGIC_LENGTH) != 0) {
+    log_message(LOG_LEVEL_ERROR, "'%s' is not a register trace.", path);
+    fclose(file);
+    return NULL;
+  }
+
+  register_trace_reader_t* reader = calloc(1, sizeof(register_trace_reader_t));
+  if (!reader) {
+    log_message(LOG_LEVEL_ERROR, "Failed to allocate memory for the register trace reader.");
+    fclose(file);
+    return NULL;
+  }
+  reader->file = file;
+  for (int i = 0; i < 8; i++) {
+    reader->time_ms |= (int64_t) ((uint64_t) header[TRACE_MAGIC_LENGTH + i] << (8 * i));
+  }
+  return reader;
+}
+
+int register_trace_next(register_trace_reader_t* reader, register_trace_record_t* record) {
+  int c = fgetc(reader->file);
+  if (c == EOF) {
+    return 0;
+  }
+  ungetc(c, reader->file);
+
+  uint64_t delta_ms, address;
+  int      function_code, num_regs;
+  if (!get_varint(reader->file, &delta_ms) || (function_code = fgetc(reader->file)) == EOF || !get_varint(reader->file, &address) ||
+      (num_regs = fgetc(reader->file)) == EOF || num_regs == 0 || num_regs > REGISTER_TRACE_MAX_REGS || address > 0xFFFF) {
+    return -1;
+  }
+
+  uint8_t words[2 * REGISTER_TRACE_MAX_REGS];
+  if (fread(words, 2, (size_t) num_regs, reader->file) != (size_t) num_regs) {
+    return -1;
+  }
+  reader->time_ms      += (int64_t) delta_ms;
+  record->time_ms       = reader->time_ms;
+  record->function_code = function_code;
+  record->address       = (int) address;
+  record->num_regs      = num_regs;
+  for (int r = 0; r < num_regs; r++) {
+    record->regs[r] = (uint16_t) ((words[2 * r] << 8) | words[2 * r + 1]);
+  }
+  return 1;
+}
+
+void register_trace_close(register_trace_reader_t* reader) {
+  if (reader) {
+    fclose(reader->file);
+    free(reader);
+  }
+}
@@ -0,0 +1,193 @@
+#include "sched_sim.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "device_caps.h"
+#include "logger.h"
+#include "register_cache.h"
+
+// Frame sizes of a read request and of its response without the register data
+#define TCP_REQUEST_BYTES  12  // MBAP header, function code, address, count
+#define TCP_RESPONSE_BYTES 9   // MBAP header, function code, byte count
+#define RTU_REQUEST_BYTES  8   // Unit ID, function code, address, count, CRC
+#define RTU_RESPONSE_BYTES 5   // Unit ID, function code, byte count, CRC
+
+// Requests of a reconnect: the connection itself and reading the identification registers
+#define RECONNECT_REQUESTS 3
+// Pause of the gateway after a failed connection attempt (main.c)
+#define RECONNECT_RETRY_SEC 5
+
+/*
+ * @brief Virtual clock and link state of a run.
+ */
+typedef struct {
+  const sched_sim_options_t* options;
+  int64_t                    now_us;   // Virtual clock
+  int64_t                    busy_us;  // Time the link had a request outstanding
+  uint64_t                   random;   // xorshift64 state
+} sim_state_t;
+
+void sched_sim_default_options(sched_sim_options_t* options) {
+  memset(options, 0, sizeof(*options));
+  options->response_us          = 20000;
+  options->jitter_us            = 5000;
+  options->cycle_overhead_us    = 1000;
+  options->max_regs_per_request = 125;
+  options->sla_tolerance        = 0.5;
+  options->duration_sec         = 3600.0;
+  options->seed                 = 1;
+}
+
+static uint64_t next_random(sim_state_t* sim) {
+  sim->random ^= sim->random << 13;
+  sim->random ^= sim->random >> 7;
+  sim->random ^= sim->random << 17;
+  return sim->random;
+}
+
+static double random_unit(sim_state_t* sim) {
+  return (double) (next_random(sim) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Time a frame occupies the link at its rate
+static int64_t frame_us(const sched_sim_options_t* options, int bytes) {
+  return options->bytes_per_sec > 0 ? (int64_t) bytes * 1000000 / options->bytes_per_sec : 0;
+}
+
+// Advances the clock by one read request; returns false if it timed out
+static bool simulate_request(sim_state_t* sim, int num_regs, int timeout_sec) {
+  const sched_sim_options_t* options  = sim->options;
+  int                        request  = options->rtu_framing ? RTU_REQUEST_BYTES : TCP_REQUEST_BYTES;
+  int                        response = (options->rtu_framing ? RTU_RESPONSE_BYTES : TCP_RESPONSE_BYTES) + 2 * num_regs;
+  if (options->timeout_probability > 0.0 && random_unit(sim) < options->timeout_probability) {
+    int64_t cost  = frame_us(options, request) + (int64_t) timeout_sec * 1000000;
+    sim->now_us  += cost;
+    sim->busy_us += cost;
+    return false;
+  }
+  int64_t jitter = options->jitter_us > 0 ? (int64_t) (next_random(sim) % (uint64_t) (options->jitter_us + 1)) : 0;
+  int64_t cost   = frame_us(options, request) + options->response_us + jitter + frame_us(options, response);
+  sim->now_us   += cost;
+  sim->busy_us  += cost;
+  return true;
+}
+
+int sched_sim_run(const modbus_opcua_config_t* config, const sched_sim_options_t* options, sched_sim_result_t* result) {
+  memset(result, 0, sizeof(*result));
+  histogram_init(&result->read_lateness);
+  histogram_init(&result->publish_lateness);
+
+  // The simulated device has validated limits, so the gateway neither identifies nor probes it
+  device_caps_t caps;
+  device_caps_init(&caps);
+  caps.max_regs_per_request = options->max_regs_per_request;
+  caps.validated            = true;
+  caps.probe_state          = CAPS_PROBE_DONE;
+
+  int               n            = config->num_mappings;
+  register_cache_t* cache        = register_cache_create(config, &caps);
+  int*              due_blocks   = calloc(n > 0 ? n : 1, sizeof(int));
+  int64_t*          last_publish = calloc(n > 0 ? n : 1, sizeof(int64_t));
+  result->mappings               = calloc(n > 0 ? n : 1, sizeof(sched_sim_mapping_t));
+  result->num_mappings           = n;
+  if (!cache || !due_blocks || !last_publish || !result->mappings) {
+    log_message(LOG_LEVEL_ERROR, "Failed to allocate memory for the scheduler simulation.");
+    register_cache_free(cache);
+    free(due_blocks);
+    free(last_publish);
+    sched_sim_free_result(result);
+    return -1;
+  }
+
+  // The virtual clock starts at an arbitrary non-zero time; 0 means "never" in the schedule
+  sim_state_t sim       = {options, 1000000000LL, 0, options->seed ? options->seed : 1};
+  int64_t     start     = sim.now_us;
+  int64_t     end       = start + (int64_t) (options->duration_sec * 1e6);
+  bool        connected = true;
+  while (sim.now_us < end) {
+    result->cycles++;
+    if (!connected) {
+      // libmodbus bounds the connection attempt by the response timeout; a failed one is retried after a pause
+      if (!simulate_request(&sim, 2, config->modbus_timeout_sec)) {
+        result->timeouts++;
+        sim.now_us += RECONNECT_RETRY_SEC * 1000000LL;
+        continue;
+      }
+      for (int r = 1; r < RECONNECT_REQUESTS; r++) {
+        simulate_request(&sim, 2, 0);
+      }
+      connected = true;
+    }
+
+    // The same steps as the gateway's acquisition loop, on virtual time
+    int64_t current_time_ms = sim.now_us / 1000;
+    int     num_due         = register_cache_collect_due(cache, current_time_ms, due_blocks);
+    for (int d = 0; d < num_due; d++) {
+      register_block_t* block = &cache->blocks[due_blocks[d]];
+      if (block->due_time != 0) {
+        histogram_record(&result->read_lateness, sim.now_us - block->due_time * 1000);
+      }
+      result->block_reads++;
+      if (!simulate_request(&sim, block->num_regs, config->modbus_timeout_sec)) {
+        result->timeouts++;
+        connected = false;
+        break;
+      }
+      result->registers_read += (uint64_t) block->num_regs;
+      block->last_read_time   = current_time_ms;
+      int64_t read_time_ms    = sim.now_us / 1000;
+
+      for (int k = block->first_mapping; k < block->first_mapping + block->num_mappings; k++) {
+        int     i = cache->block_mappings[k];
+        int64_t scheduled_ms;
+        if (!register_cache_take_due_mapping(cache, config, i, current_time_ms, &scheduled_ms)) {
+          continue;
+        }
+        sched_sim_mapping_t* mapping = &result->mappings[i];
+        if (scheduled_ms != 0) {
+          histogram_record(&result->publish_lateness, (read_time_ms - scheduled_ms) * 1000);
+        }
+        if (last_publish[i] != 0) {
+          int64_t gap_ms      = read_time_ms - last_publish[i];
+          mapping->max_gap_ms = gap_ms > mapping->max_gap_ms ? gap_ms : mapping->max_gap_ms;
+          if (gap_ms > config->mappings[i].poll_interval_ms * (1.0 + options->sla_tolerance)) {
+            mapping->sla_misses++;
+            result->sla_misses++;
+          }
+        }
+        last_publish[i] = read_time_ms;
+        mapping->publishes++;
+        result->publishes++;
+      }
+      register_cache_finish_block(cache, config, due_blocks[d], current_time_ms);
+    }
+
+    sim.now_us += options->cycle_overhead_us + REGISTER_CACHE_CYCLE_IDLE_MS * 1000LL;
+  }
+
+  // A mapping that is overdue at the end, or was never published, misses its SLA as well
+  for (int i = 0; i < n; i++) {
+    sched_sim_mapping_t* mapping = &result->mappings[i];
+    int64_t              gap_ms  = sim.now_us / 1000 - (last_publish[i] != 0 ? last_publish[i] : start / 1000);
+    if (cache->mapping_block[i] < 0 || gap_ms <= config->mappings[i].poll_interval_ms * (1.0 + options->sla_tolerance)) {
+      continue;
+    }
+    mapping->max_gap_ms = gap_ms > mapping->max_gap_ms ? gap_ms : mapping->max_gap_ms;
+    mapping->sla_misses++;
+    result->sla_misses++;
+  }
+
+  result->simulated_sec   = (double) (sim.now_us - start) / 1e6;
+  result->bus_utilisation = result->simulated_sec > 0.0 ? (double) sim.busy_us / 1e6 / result->simulated_sec : 0.0;
+  register_cache_free(cache);
+  free(due_blocks);
+  free(last_publish);
+  return 0;
+}
+
+void sched_sim_free_result(sched_sim_result_t* result) {
+  free(result->mappings);
+  result->mappings     = NULL;
+  result->num_mappings = 0;
+}
@@ -0,0 +1,127 @@
+#include "sma_format.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logger.h"
+
+bool process_modbus_value_formatted(const uint16_t *regs, const modbus_reg_mapping_t *mapping, UA_Variant *out_variant) {
+  UA_Variant_init(out_variant);
+  
+  // Combine registers according to data type and check for NaN
+  uint64_t raw_value = 0;
+  bool is_nan = false;
+  
+  if (strcmp(mapping->data_type, "U16") == 0) {
+    raw_value = regs[0];
+    is_nan = (regs[0] == SMA_NAN_U16);
+  } else if (strcmp(mapping->data_type, "S16") == 0) {
+    raw_value = regs[0];
+    is_nan = (regs[0] == SMA_NAN_S16);
+  } else if (strcmp(mapping->data_type, "U32") == 0) {
+    raw_value = ((uint32_t) regs[0] << 16) | regs[1];
+    is_nan = (raw_value == SMA_NAN_U32);
+  } else if (strcmp(mapping->data_type, "S32") == 0) {
+    raw_value = ((uint32_t) regs[0] << 16) | regs[1];
+    is_nan = (raw_value == SMA_NAN_S32);
+  } else if (strcmp(mapping->data_type, "U64") == 0) {
+    raw_value = ((uint64_t) regs[0] << 48) | ((uint64_t) regs[1] << 32) | ((uint64_t) regs[2] << 16) | regs[3];
+    is_nan = (raw_value == SMA_NAN_U64);
+  } else {
+    log_message(LOG_LEVEL_WARN, "Unsupported data type for '%s': %s", mapping->name, mapping->data_type);
+    return false;
+  }
+  
+  if (is_nan) {
+    return false;
+  }
+  
+  // Process according to format
+  if (!mapping->format) {
+    log_message(LOG_LEVEL_WARN, "No format specified for '%s', cannot process value.", mapping->name);
+    return false;
+  }
+  
+  // Format-specific processing
+  if (strncmp(mapping->format, "FIX", 3) == 0) {
+    // FIXn format
+    int decimal_places = 0;
+    if (strlen(mapping->format) > 3) {
+      decimal_places = atoi(mapping->format + 3);
+    }
+    float scale = 1.0f;
+    for (int i = 0; i < decimal_places; i++) {
+      scale *= 0.1f;
+    }
+    
+    float *float_val = UA_Float_new();
+    if (strcmp(mapping->data_type, "S16") == 0) {
+      *float_val = (float)((int16_t)raw_value) * scale;
+    } else if (strcmp(mapping->data_type, "S32") == 0) {
+      *float_val = (float)((int32_t)raw_value) * scale;
+    } else {
+      *float_val = (float)raw_value * scale;
+    }
+    UA_Variant_setScalar(out_variant, float_val, &UA_TYPES[UA_TYPES_FLOAT]);
+    
+  } else if (strcmp(mapping->format, "ENUM") == 0) {
+    // ENUM format
+    UA_Int32 *int_val = UA_Int32_new();
+    *int_val = (UA_Int32)raw_value;
+    UA_Variant_setScalar(out_variant, int_val, &UA_TYPES[UA_TYPES_INT32]);
+    
+  } else if (strcmp(mapping->format, "FW") == 0) {
+    // Firmware version format
+    uint32_t fw_val = (uint32_t)raw_value;
+    uint8_t major = (fw_val >> 24) & 0xFF;
+    uint8_t minor = (fw_val >> 16) & 0xFF;
+    uint8_t build = (fw_val >> 8) & 0xFF;
+    uint8_t release = fw_val & 0xFF;
+    
+    char release_char = 'R';
+    switch (release) {
+      case 3: release_char = 'B'; break;
+      case 4: release_char = 'R'; break;
+      default: release_char = '?'; break;
+    }
+    
+    char fw_string[32];
+    snprintf(fw_string, sizeof(fw_string), "%d.%d.%d.%c", major, minor, build, release_char);
+    
+    UA_String *string_val = UA_String_new();
+    *string_val = UA_STRING_ALLOC(fw_string);
+    UA_Variant_setScalar(out_variant, string_val, &UA_TYPES[UA_TYPES_STRING]);
+    
+  } else if (strcmp(mapping->format, "DT") == 0 || strcmp(mapping->format, "TM") == 0) {
+    // DateTime format
+    uint32_t unix_timestamp = (uint32_t)raw_value;
+    UA_DateTime *datetime_val = UA_DateTime_new();
+    *datetime_val = (unix_timestamp + 11644473600ULL) * 10000000ULL;
+    UA_Variant_setScalar(out_variant, datetime_val, &UA_TYPES[UA_TYPES_DATETIME]);
+    
+  } else if (strcmp(mapping->format, "Duration") == 0) {
+    // Duration format (seconds to milliseconds)
+    float *float_val = UA_Float_new();
+    *float_val = (float)raw_value * 1000.0f;
+    UA_Variant_setScalar(out_variant, float_val, &UA_TYPES[UA_TYPES_FLOAT]);
+    
+  } else if (strcmp(mapping->format, "TEMP") == 0) {
+    // Temperature format (tenths of degrees to degrees)
+    float *float_val = UA_Float_new();
+    if (strcmp(mapping->data_type, "S32") == 0) {
+      *float_val = (float)((int32_t)raw_value) * 0.1f;
+    } else {
+      *float_val = (float)raw_value * 0.1f;
+    }
+    UA_Variant_setScalar(out_variant, float_val, &UA_TYPES[UA_TYPES_FLOAT]);
+    
+  } else {
+    log_message(LOG_LEVEL_WARN, "Unknown format '%s' for '%s', using raw value", mapping->format, mapping->name);
+    float *float_val = UA_Float_new();
+    *float_val = (float)raw_value;
+    UA_Variant_setScalar(out_variant, float_val, &UA_TYPES[UA_TYPES_FLOAT]);
+  }
+  
+  return true;
+}
@@ -0,0 +1,637 @@
+#include "sma_simulator.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "device_caps.h"
+#include "logger.h"
+#include "modbus_client.h"
+
+#define SIM_MAX_ADU          260  // Modbus TCP maximum
+#define SIM_MAX_READ_REGS    125
+#define SIM_ADDRESS_SPACE    65536
+#define SIM_FIRMWARE_VERSION 0x03010204u  // 3.1.2.R
+#define SIM_SERIAL_BASE      1900000000u
+#define SIM_POLL_MS          100          // Longest poll() wait, bounds the reaction to sma_sim_stop()
+#define SIM_CHANGE_HISTORY   4            // Recent changes kept per value for sma_sim_change_time_us()
+
+#define MODBUS_EXCEPTION_ILLEGAL_FUNCTION_CODE 0x01
+#define MODBUS_EXCEPTION_ILLEGAL_ADDRESS       0x02
+#define MODBUS_EXCEPTION_ILLEGAL_VALUE         0x03
+#define MODBUS_EXCEPTION_GATEWAY_TARGET        0x0B
+
+/*
+ * @brief How a simulated value evolves.
+ */
+typedef enum {
+  POINT_ANALOG,    // Follows the daily curve with noise (power, current, voltage, temperature)
+  POINT_COUNTER,   // Increases monotonically (energy yield, operating time)
+  POINT_ENUM,      // Mostly keeps its first enum value
+  POINT_FIRMWARE,  // Constant firmware version
+  POINT_SERIAL,    // Constant, unique per inverter
+  POINT_DATETIME   // Current Unix time
+} point_kind_t;
+
+/*
+ * @brief One simulated value occupying 1, 2 or 4 consecutive registers.
+ */
+typedef struct {
+  const modbus_reg_mapping_t* mapping;  // NULL for the built-in identification registers
+  int                         slot;     // First register in the inverters' register storage
+  int                         num_regs;
+  point_kind_t                kind;
+  double                      nominal;  // Peak raw value (analog) or raw increment per second (counter)
+  double                      floor;    // Share of the nominal value kept at night (analog)
+  uint64_t                    max_raw;  // Largest raw value that is not the NaN sentinel
+  uint64_t                    nan_raw;  // SMA NaN sentinel of the data type
+} sim_point_t;
+
+/*
+ * @brief A past value of a point and when it was stored.
+ */
+typedef struct {
+  uint64_t raw;
+  int64_t  time_us;
+} sim_change_t;
+
+/*
+ * @brief State of one simulated inverter.
+ */
+typedef struct {
+  int           listen_fd;
+  int           num_connections;
+  uint16_t*     regs;         // Register values, indexed by slot
+  double*       counters;     // Counter state, indexed by point
+  sim_change_t* changes;      // SIM_CHANGE_HISTORY recent changes per point, oldest overwritten first
+  uint8_t*      change_next;  // Next entry of changes to overwrite, indexed by point
+  double        phase;        // Offset into the day, so inverters do not change in lockstep
+} sim_inverter_t;
+
+/*
+ * @brief A client connection. Requests are answered in order, one at a time.
+ */
+typedef struct {
+  int     fd;
+  int     inverter;
+  uint8_t request[SIM_MAX_ADU];
+  size_t  request_len;
+  uint8_t response[SIM_MAX_ADU];
+  size_t  response_len;
+  int64_t response_due_us;  // 0 while no response is pending
+} sim_connection_t;
+
+struct sma_sim_s {
+  sma_sim_options_t            options;
+  const modbus_opcua_config_t* config;
+  sim_point_t*                 points;
+  int                          num_points;
+  int32_t*                     slot_of;  // Slot of every register address, -1 if not served
+  int32_t*                     point_of;  // Point of every slot
+  int                          num_slots;
+  sim_inverter_t*              inverters;
+  sim_connection_t*            connections;
+  int                          num_connections;
+  int                          max_connections;
+  struct pollfd*               pfds;
+  uint64_t                     rng;
+  int64_t                      start_us;
+  int64_t                      next_update_us;
+  pthread_t                    thread;
+  pthread_mutex_t              lock;  // Guards the register values against sma_sim_change_time_us()
+  atomic_bool                  stop;
+  _Atomic uint64_t             requests;
+  _Atomic uint64_t             exceptions;
+  _Atomic uint64_t             refused_connections;
+  _Atomic uint64_t             value_changes;
+};
+
+static int64_t monotonic_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// xorshift64*: cheap and reproducible for a given seed
+static uint64_t next_random(sma_sim_t* sim) {
+  sim->rng ^= sim->rng >> 12;
+  sim->rng ^= sim->rng << 25;
+  sim->rng ^= sim->rng >> 27;
+  return sim->rng * 0x2545F4914F6CDD1Dull;
+}
+
+// Uniform in [0, 1)
+static double random_unit(sma_sim_t* sim) {
+  return (double) (next_random(sim) >> 11) / (double) (1ull << 53);
+}
+
+void sma_sim_default_options(sma_sim_options_t* options) {
+  memset(options, 0, sizeof(*options));
+  options->bind_address       = "127.0.0.1";
+  options->base_port          = 1502;
+  options->num_inverters      = 1;
+  options->slave_id           = 3;
+  options->max_connections    = 4;
+  options->exception_code     = 0x06;
+  options->update_interval_ms = 1000;
+  options->day_length_sec     = 600.0;
+  options->seed               = 1;
+}
+
+static bool name_contains(const modbus_reg_mapping_t* mapping, const char* const* words) {
+  for (; *words; words++) {
+    if (strstr(mapping->name, *words)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Chooses the dynamics of a mapping from its format, data type and name
+static void classify_point(sma_sim_t* sim, sim_point_t* point) {
+  static const char* const counter_words[] = {"Total", "Yield", "Energy", "Counter", "Time", "Cnt", NULL};
+  static const char* const power_words[]   = {"Pow", "Watt", "Current", "Amp", NULL};
+  const modbus_reg_mapping_t* mapping      = point->mapping;
+  const char*                 format       = mapping->format ? mapping->format : "";
+
+  if (strcmp(format, "ENUM") == 0 && mapping->num_enum_values > 0) {
+    point->kind = POINT_ENUM;
+  } else if (strcmp(format, "FW") == 0) {
+    point->kind = POINT_FIRMWARE;
+  } else if (strcmp(format, "DT") == 0 || strcmp(format, "TM") == 0) {
+    point->kind = POINT_DATETIME;
+  } else if (strcmp(mapping->data_type, "U64") == 0 || strcmp(format, "Duration") == 0 || name_contains(mapping, counter_words)) {
+    point->kind    = POINT_COUNTER;
+    point->nominal = 0.5 + 1.5 * random_unit(sim);
+  } else {
+    // Power-like values drop to zero at night, voltages and temperatures only dip
+    point->kind    = POINT_ANALOG;
+    point->nominal = 500.0 + 4500.0 * random_unit(sim);
+    point->floor   = name_contains(mapping, power_words) ? 0.0 : 0.8;
+    if (strcmp(format, "TEMP") == 0) {
+      point->nominal = 300.0 + 150.0 * random_unit(sim);  // 30 to 45 degrees Celsius
+    }
+  }
+}
+
+// Registers a value of num_regs registers at address; returns false if they are already served
+static bool add_point(sma_sim_t* sim, const modbus_reg_mapping_t* mapping, int address, const char* data_type) {
+  int num_regs = strcmp(data_type, "U64") == 0 ? 4 : strncmp(data_type + 1, "32", 2) == 0 ? 2 : 1;
+  if (address < 0 || address + num_regs > SIM_ADDRESS_SPACE) {
+    return false;
+  }
+  for (int r = 0; r < num_regs; r++) {
+    if (sim->slot_of[address + r] >= 0) {
+      return false;  // Overlapping mappings: the first one defines the registers
+    }
+  }
+
+  sim_point_t* point = &sim->points[sim->num_points++];
+  point->mapping     = mapping;
+  point->slot        = sim->num_slots;
+  point->num_regs    = num_regs;
+  bool is_signed     = data_type[0] == 'S';
+  int  bits          = num_regs * 16;
+  point->nan_raw     = is_signed ? 1ull << (bits - 1) : bits == 64 ? UINT64_MAX : (1ull << bits) - 1;
+  point->max_raw     = is_signed ? (1ull << (bits - 1)) - 1 : point->nan_raw - 1;
+  for (int r = 0; r < num_regs; r++) {
+    sim->point_of[sim->num_slots] = sim->num_points - 1;
+    sim->slot_of[address + r]     = sim->num_slots++;
+  }
+  return true;
+}
+
+static void store_raw(sma_sim_t* sim, sim_inverter_t* inverter, int p, uint64_t raw, int64_t now_us) {
+  const sim_point_t* point = &sim->points[p];
+  bool changed = false;
+  for (int r = 0; r < point->num_regs; r++) {
+    uint16_t word = (uint16_t) (raw >> (16 * (point->num_regs - 1 - r)));  // SMA: high word first
+    changed |= inverter->regs[point->slot + r] != word;
+    inverter->regs[point->slot + r] = word;
+  }
+  if (changed) {
+    atomic_fetch_add_explicit(&sim->value_changes, 1, memory_order_relaxed);
+    sim_change_t* change     = &inverter->changes[p * SIM_CHANGE_HISTORY + inverter->change_next[p]];
+    change->raw              = raw;
+    change->time_us          = now_us;
+    inverter->change_next[p] = (uint8_t) ((inverter->change_next[p] + 1) % SIM_CHANGE_HISTORY);
+  }
+}
+
+// Advances every value of every inverter to the current time
+static void update_values(sma_sim_t* sim, int64_t now_us) {
+  double elapsed_sec = (double) (now_us - sim->start_us) / 1e6;
+  double step_sec    = sim->options.update_interval_ms / 1000.0;
+  for (int i = 0; i < sim->options.num_inverters; i++) {
+    sim_inverter_t* inverter = &sim->inverters[i];
+    double          day      = fmod(elapsed_sec / sim->options.day_length_sec + inverter->phase, 1.0);
+    double          sun      = fmax(0.0, sin(2.0 * M_PI * day));
+
+    for (int p = 0; p < sim->num_points; p++) {
+      const sim_point_t* point = &sim->points[p];
+      double             value = 0.0;
+      switch (point->kind) {
+        case POINT_ANALOG:
+          value = point->nominal * (point->floor + (1.0 - point->floor) * sun) * (0.98 + 0.04 * random_unit(sim));
+          break;
+        case POINT_COUNTER:
+          inverter->counters[p] += point->nominal * step_sec * (0.5 + sun);
+          value = inverter->counters[p];
+          break;
+        case POINT_ENUM: {
+          const modbus_reg_mapping_t* mapping = point->mapping;
+          int                         pick    = random_unit(sim) < 0.01 ? (int) (next_random(sim) % mapping->num_enum_values) : 0;
+          value                               = mapping->enum_values[pick].value;
+          break;
+        }
+        case POINT_FIRMWARE:
+          value = SIM_FIRMWARE_VERSION;
+          break;
+        case POINT_SERIAL:
+          value = SIM_SERIAL_BASE + (unsigned) i;
+          break;
+        case POINT_DATETIME:
+          value = (double) time(NULL);
+          break;
+      }
+
+      // Identification must stay readable, everything else may report NaN like a real device at times
+      bool nan = point->kind != POINT_SERIAL && point->kind != POINT_FIRMWARE && random_unit(sim) < sim->options.nan_probability;
+      if (nan) {
+        store_raw(sim, inverter, p, point->nan_raw, now_us);
+      } else {
+        uint64_t raw = value <= 0.0 ? 0 : value >= (double) point->max_raw ? point->max_raw : (uint64_t) value;
+        store_raw(sim, inverter, p, raw, now_us);
+      }
+    }
+  }
+}
+
+static void put_u16(uint8_t* p, uint16_t v) {
+  p[0] = (uint8_t) (v >> 8);
+  p[1] = (uint8_t) v;
+}
+
+static uint16_t get_u16(const uint8_t* p) {
+  return (uint16_t) ((p[0] << 8) | p[1]);
+}
+
+static size_t build_exception(uint8_t* response, const uint8_t* request, uint8_t code) {
+  memcpy(response, request, 4);  // Transaction and protocol identifier
+  put_u16(response + 4, 3);
+  response[6] = request[6];
+  response[7] = request[7] | 0x80;
+  response[8] = code;
+  return 9;
+}
+
+// Answers one complete request frame into conn->response
+static void handle_request(sma_sim_t* sim, sim_connection_t* conn, const uint8_t* request, size_t len) {
+  atomic_fetch_add_explicit(&sim->requests, 1, memory_order_relaxed);
+  uint8_t  unit     = request[6];
+  uint8_t  function = request[7];
+  uint8_t  code     = 0;
+  uint16_t address  = len >= 12 ? get_u16(request + 8) : 0;
+  uint16_t count    = len >= 12 ? get_u16(request + 10) : 0;
+
+  if (sim->options.slave_id != 0 && unit != sim->options.slave_id) {
+    code = MODBUS_EXCEPTION_GATEWAY_TARGET;
+  } else if (function != 3 && function != 4) {
+    code = MODBUS_EXCEPTION_ILLEGAL_FUNCTION_CODE;
+  } else if (len < 12 || count == 0 || count > SIM_MAX_READ_REGS) {
+    code = MODBUS_EXCEPTION_ILLEGAL_VALUE;
+  } else if ((int) address + count > SIM_ADDRESS_SPACE) {
+    code = MODBUS_EXCEPTION_ILLEGAL_ADDRESS;
+  } else {
+    for (int r = 0; r < count && code == 0; r++) {
+      code = sim->slot_of[address + r] < 0 ? MODBUS_EXCEPTION_ILLEGAL_ADDRESS : 0;
+    }
+    if (code == 0 && sim->options.exception_probability > 0.0 && random_unit(sim) < sim->options.exception_probability) {
+      code = (uint8_t) sim->options.exception_code;
+    }
+  }
+
+  if (code != 0) {
+    atomic_fetch_add_explicit(&sim->exceptions, 1, memory_order_relaxed);
+    conn->response_len = build_exception(conn->response, request, code);
+  } else {
+    const sim_inverter_t* inverter = &sim->inverters[conn->inverter];
+    memcpy(conn->response, request, 4);
+    put_u16(conn->response + 4, (uint16_t) (3 + 2 * count));
+    conn->response[6] = unit;
+    conn->response[7] = function;
+    conn->response[8] = (uint8_t) (2 * count);
+    for (int r = 0; r < count; r++) {
+      put_u16(conn->response + 9 + 2 * r, inverter->regs[sim->slot_of[address + r]]);
+    }
+    conn->response_len = 9 + 2 * (size_t) count;
+  }
+
+  int64_t delay_us = sim->options.latency_us;
+  if (sim->options.jitter_us > 0) {
+    delay_us += (int64_t) (next_random(sim) % (uint64_t) (sim->options.jitter_us + 1));
+  }
+  conn->response_due_us = monotonic_us() + (delay_us > 0 ? delay_us : 0);
+  if (conn->response_due_us == 0) {
+    conn->response_due_us = 1;
+  }
+}
+
+// Parses the next buffered frame; returns false if the stream is not Modbus TCP
+static bool process_buffered(sma_sim_t* sim, sim_connection_t* conn) {
+  if (conn->response_due_us != 0 || conn->request_len < 7) {
+    return true;
+  }
+  size_t frame_len = 6 + (size_t) get_u16(conn->request + 4);
+  if (get_u16(conn->request + 2) != 0 || frame_len < 8 || frame_len > SIM_MAX_ADU) {
+    return false;
+  }
+  if (conn->request_len < frame_len) {
+    return true;
+  }
+  handle_request(sim, conn, conn->request, frame_len);
+  conn->request_len -= frame_len;
+  memmove(conn->request, conn->request + frame_len, conn->request_len);
+  return true;
+}
+
+static void close_connection(sma_sim_t* sim, int index) {
+  sim_connection_t* conn = &sim->connections[index];
+  close(conn->fd);
+  sim->inverters[conn->inverter].num_connections--;
+  sim->connections[index] = sim->connections[--sim->num_connections];
+}
+
+static void accept_connection(sma_sim_t* sim, int inverter_index) {
+  sim_inverter_t* inverter = &sim->inverters[inverter_index];
+  int             fd       = accept(inverter->listen_fd, NULL, NULL);
+  if (fd < 0) {
+    return;
+  }
+  if (inverter->num_connections >= sim->options.max_connections || sim->num_connections >= sim->max_connections) {
+    atomic_fetch_add_explicit(&sim->refused_connections, 1, memory_order_relaxed);
+    close(fd);
+    return;
+  }
+  int nodelay = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+  sim_connection_t* conn = &sim->connections[sim->num_connections++];
+  memset(conn, 0, sizeof(*conn));
+  conn->fd       = fd;
+  conn->inverter = inverter_index;
+  inverter->num_connections++;
+}
+
+// Sends due responses; returns the time until the next one (us), or -1 if none is pending
+static int64_t send_due_responses(sma_sim_t* sim, int64_t now_us) {
+  int64_t next = -1;
+  for (int c = 0; c < sim->num_connections; c++) {
+    sim_connection_t* conn = &sim->connections[c];
+    if (conn->response_due_us == 0) {
+      continue;
+    }
+    if (conn->response_due_us > now_us) {
+      next = next < 0 || conn->response_due_us - now_us < next ? conn->response_due_us - now_us : next;
+      continue;
+    }
+    ssize_t n             = send(conn->fd, conn->response, conn->response_len, MSG_NOSIGNAL);
+    conn->response_due_us = 0;
+    if (n != (ssize_t) conn->response_len || !process_buffered(sim, conn)) {
+      close_connection(sim, c--);  // A client that does not read a few bytes is gone
+    } else if (conn->response_due_us != 0) {
+      next = 0;  // A pipelined request was answered right away
+    }
+  }
+  return next;
+}
+
+static void* sim_main(void* arg) {
+  sma_sim_t* sim         = (sma_sim_t*) arg;
+  int        num_listen  = sim->options.num_inverters;
+  int64_t    interval_us = (int64_t) sim->options.update_interval_ms * 1000;
+
+  while (!atomic_load(&sim->stop)) {
+    int64_t now_us = monotonic_us();
+    if (now_us >= sim->next_update_us) {
+      pthread_mutex_lock(&sim->lock);
+      update_values(sim, now_us);
+      pthread_mutex_unlock(&sim->lock);
+      sim->next_update_us = now_us + interval_us;
+    }
+    int64_t wait_us = send_due_responses(sim, now_us);
+    int64_t until   = sim->next_update_us - now_us;
+    wait_us         = wait_us < 0 || until < wait_us ? until : wait_us;
+    int timeout_ms  = wait_us > SIM_POLL_MS * 1000 ? SIM_POLL_MS : (int) ((wait_us + 999) / 1000);
+
+    // Listeners first, then the connections; a connection waiting for its response is not read
+    for (int i = 0; i < num_listen; i++) {
+      sim->pfds[i] = (struct pollfd) {sim->inverters[i].listen_fd, POLLIN, 0};
+    }
+    for (int c = 0; c < sim->num_connections; c++) {
+      sim->pfds[num_listen + c] = (struct pollfd) {sim->connections[c].fd, sim->connections[c].response_due_us ? 0 : POLLIN, 0};
+    }
+    int num_fds = num_listen + sim->num_connections;
+    if (poll(sim->pfds, (nfds_t) num_fds, timeout_ms) <= 0) {
+      continue;
+    }
+
+    // Connections are handled before accepting, so indices into pfds stay valid
+    for (int c = sim->num_connections - 1; c >= 0; c--) {
+      short revents = sim->pfds[num_listen + c].revents;
+      if (!revents) {
+        continue;
+      }
+      sim_connection_t* conn = &sim->connections[c];
+      ssize_t           n    = recv(conn->fd, conn->request + conn->request_len, sizeof(conn->request) - conn->request_len, 0);
+      if (n <= 0) {
+        close_connection(sim, c);
+        continue;
+      }
+      conn->request_len += (size_t) n;
+      if (!process_buffered(sim, conn)) {
+        close_connection(sim, c);
+      }
+    }
+    for (int i = 0; i < num_listen; i++) {
+      if (sim->pfds[i].revents & POLLIN) {
+        accept_connection(sim, i);
+      }
+    }
+  }
+  return NULL;
+}
+
+static int open_listener(const char* bind_address, int port) {
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port   = htons((uint16_t) port);
+  if (inet_pton(AF_INET, bind_address, &addr.sin_addr) != 1) {
+    log_message(LOG_LEVEL_ERROR, "Simulator: invalid bind address '%s'.", bind_address);
+    return -1;
+  }
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  int reuse = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0 || listen(fd, 16) != 0) {
+    log_message(LOG_LEVEL_ERROR, "Simulator: failed to listen on %s:%d: %s", bind_address, port, strerror(errno));
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static void free_sim(sma_sim_t* sim) {
+  if (sim->inverters) {
+    for (int i = 0; i < sim->options.num_inverters; i++) {
+      if (sim->inverters[i].listen_fd >= 0) {
+        close(sim->inverters[i].listen_fd);
+      }
+      free(sim->inverters[i].regs);
+      free(sim->inverters[i].counters);
+      free(sim->inverters[i].changes);
+      free(sim->inverters[i].change_next);
+    }
+  }
+  for (int c = 0; c < sim->num_connections; c++) {
+    close(sim->connections[c].fd);
+  }
+  free(sim->inverters);
+  free(sim->connections);
+  free(sim->pfds);
+  free(sim->points);
+  free(sim->slot_of);
+  free(sim->point_of);
+  pthread_mutex_destroy(&sim->lock);
+  free(sim);
+}
+
+sma_sim_t* sma_sim_start(const modbus_opcua_config_t* config, const sma_sim_options_t* options) {
+  if (options->num_inverters <= 0 || options->update_interval_ms <= 0 || options->day_length_sec <= 0.0) {
+    log_message(LOG_LEVEL_ERROR, "Simulator: invalid options.");
+    return NULL;
+  }
+  sma_sim_t* sim = calloc(1, sizeof(sma_sim_t));
+  if (!sim) {
+    return NULL;
+  }
+  sim->options         = *options;
+  sim->config          = config;
+  sim->rng             = 0x9E3779B97F4A7C15ull ^ options->seed;
+  sim->max_connections = options->num_inverters * (options->max_connections > 0 ? options->max_connections : 1);
+  sim->points          = calloc((size_t) config->num_mappings + 2, sizeof(sim_point_t));
+  sim->slot_of         = malloc(SIM_ADDRESS_SPACE * sizeof(int32_t));
+  sim->point_of        = calloc((size_t) (config->num_mappings + 2) * 4, sizeof(int32_t));
+  sim->inverters       = calloc((size_t) options->num_inverters, sizeof(sim_inverter_t));
+  sim->connections     = calloc((size_t) sim->max_connections, sizeof(sim_connection_t));
+  sim->pfds            = calloc((size_t) (options->num_inverters + sim->max_connections), sizeof(struct pollfd));
+  pthread_mutex_init(&sim->lock, NULL);
+
+  // No listener is open yet; free_sim() must not close descriptor 0 on an early failure
+  for (int i = 0; sim->inverters && i < options->num_inverters; i++) {
+    sim->inverters[i].listen_fd = -1;
+  }
+  if (!sim->points || !sim->slot_of || !sim->point_of || !sim->inverters || !sim->connections || !sim->pfds) {
+    free_sim(sim);
+    return NULL;
+  }
+  memset(sim->slot_of, 0xFF, SIM_ADDRESS_SPACE * sizeof(int32_t));
+
+  // The identification registers come first so the gateway can always tell the inverters apart
+  add_point(sim, NULL, SMA_REG_SERIAL_NUMBER, "U32");
+  sim->points[sim->num_points - 1].kind = POINT_SERIAL;
+  add_point(sim, NULL, SMA_REG_FIRMWARE, "U32");
+  sim->points[sim->num_points - 1].kind = POINT_FIRMWARE;
+  for (int m = 0; m < config->num_mappings; m++) {
+    if (add_point(sim, &config->mappings[m], config->mappings[m].modbus_address, config->mappings[m].data_type)) {
+      classify_point(sim, &sim->points[sim->num_points - 1]);
+    }
+  }
+
+  for (int i = 0; i < options->num_inverters; i++) {
+    sim_inverter_t* inverter = &sim->inverters[i];
+    inverter->regs           = calloc((size_t) (sim->num_slots > 0 ? sim->num_slots : 1), sizeof(uint16_t));
+    inverter->counters       = calloc((size_t) sim->num_points, sizeof(double));
+    inverter->changes        = calloc((size_t) sim->num_points * SIM_CHANGE_HISTORY, sizeof(sim_change_t));
+    inverter->change_next    = calloc((size_t) sim->num_points, sizeof(uint8_t));
+    inverter->phase          = random_unit(sim) * 0.05;
+    if (!inverter->regs || !inverter->counters || !inverter->changes || !inverter->change_next) {
+      free_sim(sim);
+      return NULL;
+    }
+    for (int p = 0; p < sim->num_points; p++) {
+      inverter->counters[p] = 1e6 * (1.0 + 9.0 * random_unit(sim));
+      for (int h = 0; h < SIM_CHANGE_HISTORY; h++) {
+        inverter->changes[p * SIM_CHANGE_HISTORY + h].time_us = -1;
+      }
+    }
+    inverter->listen_fd = open_listener(options->bind_address, options->base_port + i);
+    if (inverter->listen_fd < 0) {
+      free_sim(sim);
+      return NULL;
+    }
+  }
+
+  sim->start_us       = monotonic_us();
+  sim->next_update_us = sim->start_us;
+  atomic_store(&sim->stop, false);
+  if (pthread_create(&sim->thread, NULL, sim_main, sim) != 0) {
+    log_message(LOG_LEVEL_ERROR, "Simulator: failed to start the server thread.");
+    free_sim(sim);
+    return NULL;
+  }
+  log_message(LOG_LEVEL_INFO, "Simulator: %d inverters on %s:%d-%d, %d values (%d registers) each.", options->num_inverters,
+              options->bind_address, options->base_port, options->base_port + options->num_inverters - 1, sim->num_points, sim->num_slots);
+  return sim;
+}
+
+void sma_sim_stop(sma_sim_t* sim) {
+  if (!sim) {
+    return;
+  }
+  atomic_store(&sim->stop, true);
+  pthread_join(sim->thread, NULL);
+  free_sim(sim);
+}
+
+void sma_sim_get_stats(const sma_sim_t* sim, sma_sim_stats_t* stats) {
+  stats->requests            = atomic_load_explicit(&sim->requests, memory_order_relaxed);
+  stats->exceptions          = atomic_load_explicit(&sim->exceptions, memory_order_relaxed);
+  stats->refused_connections = atomic_load_explicit(&sim->refused_connections, memory_order_relaxed);
+  stats->value_changes       = atomic_load_explicit(&sim->value_changes, memory_order_relaxed);
+}
+
+int64_t sma_sim_change_time_us(sma_sim_t* sim, int inverter, int address, uint64_t raw) {
+  if (inverter < 0 || inverter >= sim->options.num_inverters || address < 0 || address >= SIM_ADDRESS_SPACE || sim->slot_of[address] < 0) {
+    return -1;
+  }
+  int                   p       = sim->point_of[sim->slot_of[address]];
+  const sim_inverter_t* state   = &sim->inverters[inverter];
+  int64_t               time_us = -1;
+  pthread_mutex_lock(&sim->lock);
+  // Newest first: a value that recurs was last produced by its latest change
+  for (int h = 1; h <= SIM_CHANGE_HISTORY && time_us < 0; h++) {
+    const sim_change_t* change = &state->changes[p * SIM_CHANGE_HISTORY + (state->change_next[p] + SIM_CHANGE_HISTORY - h) % SIM_CHANGE_HISTORY];
+    if (change->time_us >= 0 && change->raw == raw) {
+      time_us = change->time_us;
+    }
+  }
+  pthread_mutex_unlock(&sim->lock);
+  return time_us;
+}
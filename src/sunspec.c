@@ -0,0 +1,286 @@
+#include "sunspec.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "config_parser.h"
+#include "logger.h"
+#include "modbus_client.h"
+
+// SunSpec sunssf value for "scale factor not implemented"
+#define SUNSPEC_SF_NAN 0x8000
+
+/*
+ * @brief A point of a SunSpec model that is exposed as a mapping.
+ */
+typedef struct {
+  const char* name;       // SunSpec point name
+  int         offset;     // Register offset inside the model body
+  const char* data_type;  // Gateway data type ("U16", "S16", "U32")
+  int         sf_offset;  // Register offset of the point's scale factor, -1 if it has none
+  const char* format;     // Format for points without a scale factor
+} sunspec_point_t;
+
+/*
+ * @brief The points exposed for a SunSpec model id.
+ */
+typedef struct {
+  int                    model_id;
+  const sunspec_point_t* points;
+  int                    num_points;
+} sunspec_model_t;
+
+// Inverter models 101 (single phase), 102 (split phase) and 103 (three phase)
+// share the integer + scale factor layout.
+static const sunspec_point_t inverter_points[] = {
+    {"A", 0, "U16", 4, NULL},        {"AphA", 1, "U16", 4, NULL},     {"AphB", 2, "U16", 4, NULL},     {"AphC", 3, "U16", 4, NULL},
+    {"PPVphAB", 5, "U16", 11, NULL}, {"PPVphBC", 6, "U16", 11, NULL}, {"PPVphCA", 7, "U16", 11, NULL}, {"PhVphA", 8, "U16", 11, NULL},
+    {"PhVphB", 9, "U16", 11, NULL},  {"PhVphC", 10, "U16", 11, NULL}, {"W", 12, "S16", 13, NULL},      {"Hz", 14, "U16", 15, NULL},
+    {"VA", 16, "S16", 17, NULL},     {"VAr", 18, "S16", 19, NULL},    {"PF", 20, "S16", 21, NULL},     {"WH", 22, "U32", 24, NULL},
+    {"DCA", 25, "U16", 26, NULL},    {"DCV", 27, "U16", 28, NULL},    {"DCW", 29, "S16", 30, NULL},    {"TmpCab", 31, "S16", 35, NULL},
+    {"TmpSnk", 32, "S16", 35, NULL}, {"TmpTrns", 33, "S16", 35, NULL}, {"TmpOt", 34, "S16", 35, NULL},  {"St", 36, "U16", -1, "ENUM"},
+    {"StVnd", 37, "U16", -1, "RAW"},
+};
+
+static enum_value_mapping_t inverter_state_enum[] = {
+    {1, "Off"}, {2, "Sleeping"}, {3, "Starting"}, {4, "MPPT"}, {5, "Throttled"}, {6, "Shutting down"}, {7, "Fault"}, {8, "Standby"},
+};
+
+static const sunspec_model_t known_models[] = {
+    {101, inverter_points, sizeof(inverter_points) / sizeof(inverter_points[0])},
+    {102, inverter_points, sizeof(inverter_points) / sizeof(inverter_points[0])},
+    {103, inverter_points, sizeof(inverter_points) / sizeof(inverter_points[0])},
+};
+
+/*
+ * @brief The SunSpec register map as far as it has been fetched from the device.
+ */
+typedef struct {
+  modbus_t* ctx;
+  int       base_address;
+  int       loaded;  // Number of registers fetched so far
+  uint16_t  regs[SUNSPEC_MAX_REGS];
+} sunspec_map_t;
+
+/*
+ * @brief A generated mapping together with the storage for its strings.
+ */
+typedef struct {
+  modbus_reg_mapping_t mapping;
+  char                 name[64];
+  char                 node_id[96];
+  char                 format[8];
+} sunspec_generated_t;
+
+// Makes sure the first `count` registers of the map are loaded, using maximum size block reads.
+// Reads past the end of the device's map may be rejected, so a failed full block is retried
+// with just the registers that are actually needed.
+static int sunspec_load(sunspec_map_t* map, int count) {
+  if (count > SUNSPEC_MAX_REGS) {
+    log_message(LOG_LEVEL_WARN, "SunSpec map exceeds %d registers, stopping discovery.", SUNSPEC_MAX_REGS);
+    return -1;
+  }
+  while (map->loaded < count) {
+    int chunk = SUNSPEC_MAX_REGS - map->loaded;
+    if (chunk > MODBUS_MAX_READ_REGISTERS) {
+      chunk = MODBUS_MAX_READ_REGISTERS;
+    }
+    int address = map->base_address + map->loaded;
+    if (read_modbus_registers(map->ctx, 3, address, chunk, &map->regs[map->loaded]) != 0) {
+      int needed = count - map->loaded;
+      if (needed >= chunk || read_modbus_registers(map->ctx, 3, address, needed, &map->regs[map->loaded]) != 0) {
+        return -1;
+      }
+      chunk = needed;
+    }
+    map->loaded += chunk;
+  }
+  return 0;
+}
+
+// Copies a SunSpec string point into `out`, keeping only characters safe for a file name.
+static void sunspec_read_string(const uint16_t* regs, int num_regs, char* out, size_t out_size) {
+  size_t len = 0;
+  for (int i = 0; i < num_regs && len + 1 < out_size; i++) {
+    char chars[2] = {(char) (regs[i] >> 8), (char) (regs[i] & 0xFF)};
+    for (int c = 0; c < 2 && len + 1 < out_size; c++) {
+      if (chars[c] == '\0') {
+        i = num_regs;
+        break;
+      }
+      if (isalnum((unsigned char) chars[c]) || chars[c] == '-' || chars[c] == '_') {
+        out[len++] = chars[c];
+      }
+    }
+  }
+  out[len] = '\0';
+}
+
+static const sunspec_model_t* find_model(int model_id) {
+  for (size_t i = 0; i < sizeof(known_models) / sizeof(known_models[0]); i++) {
+    if (known_models[i].model_id == model_id) {
+      return &known_models[i];
+    }
+  }
+  return NULL;
+}
+
+// Walks the model chain and generates mappings for the points of all known models.
+static int sunspec_generate(sunspec_map_t* map, const modbus_opcua_config_t* config, sunspec_generated_t** out) {
+  sunspec_generated_t* generated = NULL;
+  int                  count     = 0;
+  int                  capacity  = 0;
+  int                  instances[1024] = {0};
+
+  int offset = 2;  // Skip the "SunS" marker
+  while (sunspec_load(map, offset + 2) == 0) {
+    int model_id = map->regs[offset];
+    int length   = map->regs[offset + 1];
+    if (model_id == SUNSPEC_END_MODEL) {
+      break;
+    }
+    if (sunspec_load(map, offset + 2 + length) != 0) {
+      break;
+    }
+
+    const uint16_t*        body     = &map->regs[offset + 2];
+    int                    instance = model_id < 1024 ? instances[model_id]++ : 0;
+    const sunspec_model_t* model    = find_model(model_id);
+    log_message(LOG_LEVEL_INFO, "SunSpec model %d (length %d) at register %d%s", model_id, length, map->base_address + offset,
+                model ? "" : ", no point definitions, skipped");
+
+    for (int p = 0; model && p < model->num_points; p++) {
+      const sunspec_point_t* point = &model->points[p];
+      if (point->offset >= length || point->sf_offset >= length) {
+        continue;
+      }
+
+      char format[8];
+      if (point->sf_offset >= 0) {
+        int16_t sf = (int16_t) body[point->sf_offset];
+        if (body[point->sf_offset] == SUNSPEC_SF_NAN || sf > 0 || sf < -9) {
+          log_message(LOG_LEVEL_DEBUG, "SunSpec point %d.%s has an unusable scale factor, skipped", model_id, point->name);
+          continue;
+        }
+        snprintf(format, sizeof(format), "FIX%d", -sf);
+      } else {
+        snprintf(format, sizeof(format), "%s", point->format);
+      }
+
+      if (count == capacity) {
+        capacity                  = capacity ? capacity * 2 : 32;
+        sunspec_generated_t* temp = realloc(generated, capacity * sizeof(sunspec_generated_t));
+        if (!temp) {
+          free(generated);
+          return -1;
+        }
+        generated = temp;
+      }
+
+      sunspec_generated_t* g = &generated[count++];
+      memset(g, 0, sizeof(*g));
+      if (instance > 0) {
+        snprintf(g->name, sizeof(g->name), "SunSpec %d#%d %s", model_id, instance + 1, point->name);
+      } else {
+        snprintf(g->name, sizeof(g->name), "SunSpec %d %s", model_id, point->name);
+      }
+      snprintf(g->node_id, sizeof(g->node_id), "sunspec.%d.%d.%s", model_id, instance, point->name);
+      snprintf(g->format, sizeof(g->format), "%s", format);
+      g->mapping.modbus_address   = map->base_address + offset + 2 + point->offset;
+      g->mapping.function_code    = 3;
+      g->mapping.data_type        = (char*) point->data_type;
+      g->mapping.scale            = 1.0f;
+      g->mapping.poll_interval_ms = config->sunspec_poll_interval_ms;
+      if (strcmp(format, "ENUM") == 0) {
+        g->mapping.enum_values     = inverter_state_enum;
+        g->mapping.num_enum_values = sizeof(inverter_state_enum) / sizeof(inverter_state_enum[0]);
+      }
+    }
+    offset += 2 + length;
+  }
+
+  // Entries may have moved while growing the array, so wire up the string pointers last
+  for (int i = 0; i < count; i++) {
+    generated[i].mapping.name          = generated[i].name;
+    generated[i].mapping.opcua_node_id = generated[i].node_id;
+    generated[i].mapping.format        = generated[i].format;
+  }
+  *out = generated;
+  return count;
+}
+
+modbus_opcua_config_t* sunspec_discover(modbus_t* ctx, const modbus_opcua_config_t* config) {
+  sunspec_map_t* map = calloc(1, sizeof(sunspec_map_t));
+  if (!map) {
+    return NULL;
+  }
+  map->ctx          = ctx;
+  map->base_address = config->sunspec_base_address;
+
+  // One block read covers the marker and the common model with the serial number
+  if (sunspec_load(map, MODBUS_MAX_READ_REGISTERS) != 0 && sunspec_load(map, 4) != 0) {
+    log_message(LOG_LEVEL_WARN, "SunSpec discovery failed: cannot read register %d.", map->base_address);
+    free(map);
+    return NULL;
+  }
+  if (map->regs[0] != SUNSPEC_MARKER_HI || map->regs[1] != SUNSPEC_MARKER_LO) {
+    log_message(LOG_LEVEL_WARN, "No SunSpec map found at register %d.", map->base_address);
+    free(map);
+    return NULL;
+  }
+
+  // Serial number: common model point SN, 16 registers at body offset 48
+  char serial[40] = "";
+  if (map->regs[2] == SUNSPEC_MODEL_COMMON && map->regs[3] >= 64 && sunspec_load(map, 4 + 64) == 0) {
+    sunspec_read_string(&map->regs[4 + 48], 16, serial, sizeof(serial));
+  }
+
+  char cache_file[512] = "";
+  if (config->cache_dir && serial[0] != '\0') {
+    snprintf(cache_file, sizeof(cache_file), "%s/sunspec_%s.yaml", config->cache_dir, serial);
+  }
+
+  modbus_opcua_config_t* result = NULL;
+  struct stat            st;
+  if (cache_file[0] != '\0' && stat(cache_file, &st) == 0) {
+    modbus_opcua_config_t* cached = load_mappings_from_yaml(cache_file);
+    if (cached) {
+      for (int i = 0; i < cached->num_mappings; i++) {
+        cached->mappings[i].poll_interval_ms = config->sunspec_poll_interval_ms;
+      }
+      log_message(LOG_LEVEL_INFO, "Using cached SunSpec discovery for serial %s (%d mappings) from %s.", serial, cached->num_mappings, cache_file);
+      result = config_append_mappings(config, cached->mappings, cached->num_mappings);
+      free_config(cached);
+      free(map);
+      return result;
+    }
+    log_message(LOG_LEVEL_WARN, "Ignoring unreadable SunSpec cache %s, rediscovering.", cache_file);
+  }
+
+  sunspec_generated_t* generated = NULL;
+  int                  count     = sunspec_generate(map, config, &generated);
+  free(map);
+  if (count <= 0) {
+    log_message(LOG_LEVEL_WARN, "SunSpec discovery found no supported models.");
+    free(generated);
+    return NULL;
+  }
+
+  modbus_reg_mapping_t* mappings = calloc(count, sizeof(modbus_reg_mapping_t));
+  if (mappings) {
+    for (int i = 0; i < count; i++) {
+      mappings[i] = generated[i].mapping;
+    }
+    log_message(LOG_LEVEL_INFO, "SunSpec discovery generated %d mappings for serial %s.", count, serial[0] ? serial : "(unknown)");
+    if (cache_file[0] != '\0' && save_mappings_to_yaml(cache_file, mappings, count) == 0) {
+      log_message(LOG_LEVEL_INFO, "SunSpec discovery cached in %s.", cache_file);
+    }
+    result = config_append_mappings(config, mappings, count);
+    free(mappings);
+  }
+  free(generated);
+  return result;
+}
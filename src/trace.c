@@ -0,0 +1,164 @@
+#include "trace.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logger.h"
+#include "memory_accounting.h"
+
+/*
+ * @brief One recorded span.
+ */
+typedef struct {
+  int64_t           start_us;
+  int32_t           duration_us;
+  int32_t           value;  // -1 when unused
+  trace_span_kind_t kind;
+  const char*       label;  // Points into the configuration, may be NULL
+} trace_event_t;
+
+// Names and categories as shown in the trace viewer
+static const struct {
+  const char* name;
+  const char* category;
+} span_names[TRACE_SPAN_COUNT] = {
+    {"SchedulerTick", "scheduler"},
+    {"BlockRead", "modbus"},
+    {"Decode", "decode"},
+    {"AddressSpaceUpdate", "opcua"},
+    {"ServerIteration", "opcua"},
+    {"ServiceCall", "opcua"},
+    {"CapabilityProbe", "modbus"},
+};
+
+// Only the acquisition thread records and exports, so the ring needs no locking
+static trace_event_t*        events           = NULL;
+static int                   capacity         = 0;
+static uint64_t              recorded         = 0;  // Total spans recorded, the ring holds the last 'capacity'
+static char                  trace_path[1024];
+static volatile sig_atomic_t export_requested = 0;
+
+bool trace_enabled(void) {
+  return events != NULL;
+}
+
+int trace_init(const modbus_opcua_config_t* config) {
+  if (!config->trace_enabled) {
+    return 0;
+  }
+  if (!config->trace_file) {
+    log_message(LOG_LEVEL_WARN, "Tracing enabled but no trace file configured.");
+    return 0;
+  }
+  capacity = config->trace_buffer_events > 0 ? config->trace_buffer_events : 1;
+  events   = calloc(capacity, sizeof(trace_event_t));
+  if (!events) {
+    log_message(LOG_LEVEL_ERROR, "Failed to allocate memory for %d trace events.", capacity);
+    return -1;
+  }
+  snprintf(trace_path, sizeof(trace_path), "%s", config->trace_file);
+  recorded = 0;
+  memory_account_add(MEMORY_LOG_BUFFERS, (int64_t) (capacity * sizeof(trace_event_t)));
+  log_message(LOG_LEVEL_INFO, "Tracing the last %d spans, exported to '%s' on SIGUSR2 and at shutdown.", capacity, trace_path);
+  return 0;
+}
+
+void trace_span(trace_span_kind_t kind, int64_t start_us, int64_t end_us, const char* label, int value) {
+  if (!events) {
+    return;
+  }
+  trace_event_t* event = &events[recorded % (uint64_t) capacity];
+  event->start_us      = start_us;
+  event->duration_us   = (int32_t) (end_us > start_us ? end_us - start_us : 0);
+  event->value         = value;
+  event->kind          = kind;
+  event->label         = label;
+  recorded++;
+}
+
+void trace_request_export(void) {
+  export_requested = 1;
+}
+
+// Writes a JSON string literal, escaping what mapping names could contain
+static void write_json_string(FILE* file, const char* text) {
+  fputc('"', file);
+  for (const char* c = text; *c; c++) {
+    if (*c == '"' || *c == '\\') {
+      fprintf(file, "\\%c", *c);
+    } else if ((unsigned char) *c < 0x20) {
+      fprintf(file, "\\u%04x", (unsigned char) *c);
+    } else {
+      fputc(*c, file);
+    }
+  }
+  fputc('"', file);
+}
+
+// Writes the ring oldest first in the Chrome trace event format; "X" events nest by time on one thread
+static int export_trace(void) {
+  char temp_path[1100];
+  snprintf(temp_path, sizeof(temp_path), "%s.tmp", trace_path);
+  FILE* file = fopen(temp_path, "w");
+  if (!file) {
+    log_message(LOG_LEVEL_ERROR, "Failed to open trace file '%s'.", temp_path);
+    return -1;
+  }
+
+  fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"modbus_gateway\"}},\n");
+  fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"acquisition\"}}");
+
+  uint64_t count = recorded < (uint64_t) capacity ? recorded : (uint64_t) capacity;
+  for (uint64_t n = recorded - count; n < recorded; n++) {
+    const trace_event_t* event = &events[n % (uint64_t) capacity];
+    fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%lld,\"dur\":%d", span_names[event->kind].name,
+            span_names[event->kind].category, (long long) event->start_us, (int) event->duration_us);
+    if (event->label || event->value >= 0) {
+      fprintf(file, ",\"args\":{");
+      if (event->label) {
+        fprintf(file, "\"label\":");
+        write_json_string(file, event->label);
+      }
+      if (event->value >= 0) {
+        fprintf(file, "%s\"value\":%d", event->label ? "," : "", (int) event->value);
+      }
+      fputc('}', file);
+    }
+    fputc('}', file);
+  }
+  fprintf(file, "\n]}\n");
+
+  if (fclose(file) != 0 || rename(temp_path, trace_path) != 0) {
+    log_message(LOG_LEVEL_ERROR, "Failed to write trace file '%s'.", trace_path);
+    remove(temp_path);
+    return -1;
+  }
+  log_message(LOG_LEVEL_INFO, "Exported %llu trace spans to '%s'.", (unsigned long long) count, trace_path);
+  return 0;
+}
+
+void trace_poll(void) {
+  if (!export_requested) {
+    return;
+  }
+  export_requested = 0;
+  if (!events) {
+    log_message(LOG_LEVEL_WARN, "Trace export requested but tracing is not enabled.");
+    return;
+  }
+  export_trace();
+}
+
+void trace_close(void) {
+  if (!events) {
+    return;
+  }
+  export_trace();
+  free(events);
+  memory_account_add(MEMORY_LOG_BUFFERS, -(int64_t) (capacity * sizeof(trace_event_t)));
+  events   = NULL;
+  capacity = 0;
+}
@@ -0,0 +1,197 @@
+#include "watchdog.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cpu_accounting.h"
+#include "logger.h"
+#include "metrics.h"
+
+#define WATCHDOG_CHECK_MS 250
+
+/*
+ * @brief Last reported progress of one loop, written by the loop and read by the monitor.
+ */
+typedef struct {
+  _Atomic int64_t      progress_ms;  // Monotonic time of the last report, 0 before the first
+  _Atomic(const char*) activity;     // NULL while the loop is idle and cannot stall
+  _Atomic int          detail;
+} loop_state_t;
+
+static const char* loop_names[WATCHDOG_LOOP_COUNT] = {"acquisition", "server"};
+
+static loop_state_t loops[WATCHDOG_LOOP_COUNT];
+static atomic_bool  monitor_stop;
+static bool         monitor_running = false;
+static pthread_t    monitor_thread;
+static int64_t      stall_threshold_ms = 0;
+static int64_t      pet_interval_ms    = 0;  // 0 when systemd does not supervise us
+
+static int64_t monotonic_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Minimal sd_notify(): one datagram to $NOTIFY_SOCKET, so the gateway does not depend on libsystemd
+static void notify_systemd(const char* state) {
+  const char* path = getenv("NOTIFY_SOCKET");
+  if (!path || (path[0] != '/' && path[0] != '@') || strlen(path) >= sizeof(((struct sockaddr_un*) 0)->sun_path)) {
+    return;
+  }
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  memcpy(addr.sun_path, path, strlen(path));
+  if (path[0] == '@') {
+    addr.sun_path[0] = '\0';  // Abstract namespace socket
+  }
+
+  int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return;
+  }
+  socklen_t len = (socklen_t) (offsetof(struct sockaddr_un, sun_path) + strlen(path));
+  if (sendto(fd, state, strlen(state), MSG_NOSIGNAL, (struct sockaddr*) &addr, len) < 0) {
+    log_message(LOG_LEVEL_WARN, "Failed to notify systemd (%s).", state);
+  }
+  close(fd);
+}
+
+void watchdog_progress(watchdog_loop_t loop, const char* activity, int detail) {
+  loop_state_t* state = &loops[loop];
+  atomic_store_explicit(&state->activity, activity, memory_order_relaxed);
+  atomic_store_explicit(&state->detail, detail, memory_order_relaxed);
+  atomic_store_explicit(&state->progress_ms, monotonic_ms(), memory_order_release);
+}
+
+// Logs what every loop was doing when the stall was detected, and whether the process is spinning or blocked
+static void log_flight_state(int64_t now_ms, uint64_t cpu_ns_since_check, int64_t check_ms) {
+  log_message(LOG_LEVEL_ERROR, "Watchdog: gateway stalled, withholding the watchdog notification. Flight state:");
+  for (int l = 0; l < WATCHDOG_LOOP_COUNT; l++) {
+    int64_t     progress = atomic_load_explicit(&loops[l].progress_ms, memory_order_acquire);
+    const char* activity = atomic_load_explicit(&loops[l].activity, memory_order_relaxed);
+    int         detail   = atomic_load_explicit(&loops[l].detail, memory_order_relaxed);
+    char        detail_text[32] = "";
+    if (detail >= 0) {
+      snprintf(detail_text, sizeof(detail_text), " (%d)", detail);
+    }
+    log_message(LOG_LEVEL_ERROR, "  %s loop: %s%s, last progress %.1f s ago", loop_names[l], activity ? activity : "idle", detail_text,
+                progress ? (double) (now_ms - progress) / 1000.0 : 0.0);
+  }
+
+  // Near 100% CPU means a busy loop, near 0% a blocking call
+  double cpu_percent = check_ms > 0 ? (double) cpu_ns_since_check / 1e4 / (double) check_ms : 0.0;
+  log_message(LOG_LEVEL_ERROR, "  process CPU %.0f%% over the last %lld ms (%s)", cpu_percent, (long long) check_ms,
+              cpu_percent > 50.0 ? "spinning" : "blocked");
+  log_message(LOG_LEVEL_ERROR, "  %llu Modbus reads, %llu transport errors, %llu reconnects, %llu OPC UA sessions",
+              (unsigned long long) atomic_load(&gateway_metrics.modbus_reads),
+              (unsigned long long) atomic_load(&gateway_metrics.modbus_transport_errors),
+              (unsigned long long) atomic_load(&gateway_metrics.modbus_reconnects),
+              (unsigned long long) atomic_load(&gateway_metrics.opcua_sessions));
+}
+
+// Returns the loop that made no progress for the longest time beyond the threshold, or -1
+static int find_stalled_loop(int64_t now_ms) {
+  int     stalled = -1;
+  int64_t longest = stall_threshold_ms;
+  for (int l = 0; l < WATCHDOG_LOOP_COUNT; l++) {
+    int64_t progress = atomic_load_explicit(&loops[l].progress_ms, memory_order_acquire);
+    bool    busy     = atomic_load_explicit(&loops[l].activity, memory_order_relaxed) != NULL;
+    if (busy && progress != 0 && now_ms - progress > longest) {
+      longest = now_ms - progress;
+      stalled = l;
+    }
+  }
+  return stalled;
+}
+
+static void* monitor_main(void* arg) {
+  (void) arg;
+  struct timespec interval    = {0, WATCHDOG_CHECK_MS * 1000000L};
+  int64_t         last_pet_ms = 0;
+  int64_t         stall_since = 0;
+  int64_t         last_check  = monotonic_ms();
+  uint64_t        last_cpu_ns = cpu_accounting_process_cpu_ns();
+
+  while (!atomic_load(&monitor_stop)) {
+    nanosleep(&interval, NULL);
+    int64_t  now_ms = monotonic_ms();
+    uint64_t cpu_ns = cpu_accounting_process_cpu_ns();
+    int      loop   = find_stalled_loop(now_ms);
+
+    if (loop >= 0 && stall_since == 0) {
+      stall_since = now_ms;
+      log_flight_state(now_ms, cpu_ns - last_cpu_ns, now_ms - last_check);
+      char status[160];
+      snprintf(status, sizeof(status), "STATUS=Stalled: %s loop made no progress for %.1f s", loop_names[loop],
+               (double) stall_threshold_ms / 1000.0);
+      notify_systemd(status);
+    } else if (loop < 0 && stall_since != 0) {
+      log_message(LOG_LEVEL_WARN, "Watchdog: gateway recovered after a %.1f s stall.", (double) (now_ms - stall_since) / 1000.0);
+      stall_since = 0;
+      notify_systemd("STATUS=Running");
+    }
+
+    // A stalled gateway is not petted; systemd restarts it once WatchdogSec= runs out
+    if (pet_interval_ms > 0 && loop < 0 && now_ms - last_pet_ms >= pet_interval_ms) {
+      notify_systemd("WATCHDOG=1");
+      last_pet_ms = now_ms;
+    }
+    last_check  = now_ms;
+    last_cpu_ns = cpu_ns;
+  }
+  return NULL;
+}
+
+int watchdog_start(const modbus_opcua_config_t* config) {
+  // systemd passes WatchdogSec= as WATCHDOG_USEC, for our PID only if WATCHDOG_PID is set
+  const char* usec_env = getenv("WATCHDOG_USEC");
+  const char* pid_env  = getenv("WATCHDOG_PID");
+  if (usec_env && (!pid_env || atol(pid_env) == (long) getpid())) {
+    pet_interval_ms = atoll(usec_env) / 2000;
+  }
+  stall_threshold_ms = config->watchdog_sec > 0 ? (int64_t) config->watchdog_sec * 1000 : pet_interval_ms;
+
+  notify_systemd("READY=1\nSTATUS=Running");
+  if (stall_threshold_ms <= 0) {
+    return 0;
+  }
+  if (pet_interval_ms > 0 && stall_threshold_ms >= pet_interval_ms * 2) {
+    log_message(LOG_LEVEL_WARN, "Watchdog: watchdog_sec (%d s) is not below systemd's WatchdogSec=, stalls may go unlogged.",
+                config->watchdog_sec);
+  }
+  if (config->modbus_timeout_sec > 0 && stall_threshold_ms <= (int64_t) config->modbus_timeout_sec * 1000) {
+    log_message(LOG_LEVEL_WARN, "Watchdog: stall threshold (%lld ms) does not exceed the Modbus timeout, slow reads look like stalls.",
+                (long long) stall_threshold_ms);
+  }
+
+  atomic_store(&monitor_stop, false);
+  if (pthread_create(&monitor_thread, NULL, monitor_main, NULL) != 0) {
+    log_message(LOG_LEVEL_ERROR, "Failed to start the watchdog thread.");
+    return -1;
+  }
+  monitor_running = true;
+  log_message(LOG_LEVEL_INFO, "Watchdog: stall threshold %lld ms, %s.", (long long) stall_threshold_ms,
+              pet_interval_ms > 0 ? "notifying systemd" : "systemd watchdog not enabled");
+  return 0;
+}
+
+void watchdog_stop(void) {
+  notify_systemd("STOPPING=1");
+  if (!monitor_running) {
+    return;
+  }
+  atomic_store(&monitor_stop, true);
+  pthread_join(monitor_thread, NULL);
+  monitor_running = false;
+}
@@ -0,0 +1,290 @@
+#include "wire_capture.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+
+#include "logger.h"
+#include "memory_accounting.h"
+#include "metrics.h"
+
+#define CAPTURE_RING_SIZE     1024  // Packets buffered between the acquisition loop and the writer
+#define CAPTURE_HEADER_LENGTH 40    // Synthetic IPv4 (20) + TCP (20) header
+#define CAPTURE_MAX_PACKET    (CAPTURE_HEADER_LENGTH + 260)
+#define CAPTURE_BATCH_BYTES   (64 * 1024)
+#define CAPTURE_FLUSH_MS      100
+#define PCAP_LINKTYPE_RAW     101  // Packets start with the IPv4 header
+
+/*
+ * @brief One captured packet, ready to be written after its pcap record header.
+ */
+typedef struct {
+  int64_t  timestamp_us;
+  uint16_t length;
+  uint8_t  data[CAPTURE_MAX_PACKET];
+} capture_packet_t;
+
+/*
+ * @brief Addresses and TCP sequence numbers of the captured connection.
+ */
+typedef struct {
+  struct sockaddr_in local;
+  struct sockaddr_in remote;
+  uint32_t           client_seq;
+  uint32_t           server_seq;
+  uint16_t           ip_id;
+} capture_connection_t;
+
+// Single-producer/single-consumer ring: the acquisition loop only advances head, the writer only tail
+static capture_packet_t ring[CAPTURE_RING_SIZE];
+static _Atomic uint32_t ring_head;
+static _Atomic uint32_t ring_tail;
+
+static atomic_bool          capture_on;
+static atomic_bool          writer_stop;
+static bool                 writer_running = false;
+static pthread_t            writer_thread;
+static capture_connection_t connection;
+
+// Writer thread state. Settings are copied, the configuration may be replaced after startup.
+static char    capture_path[1024];
+static long    capture_max_bytes;
+static int     capture_max_files;
+static FILE*   capture_file = NULL;
+static long    file_bytes   = 0;
+static uint8_t batch[CAPTURE_BATCH_BYTES];
+
+void wire_capture_set_enabled(bool enabled) {
+  atomic_store_explicit(&capture_on, enabled && writer_running, memory_order_relaxed);
+}
+
+bool wire_capture_enabled(void) {
+  return atomic_load_explicit(&capture_on, memory_order_relaxed);
+}
+
+static void put_u16(uint8_t* p, uint16_t v) {
+  p[0] = (uint8_t) (v >> 8);
+  p[1] = (uint8_t) v;
+}
+
+static void put_u32(uint8_t* p, uint32_t v) {
+  put_u16(p, (uint16_t) (v >> 16));
+  put_u16(p + 2, (uint16_t) v);
+}
+
+static uint16_t ip_checksum(const uint8_t* header, int length) {
+  uint32_t sum = 0;
+  for (int i = 0; i < length; i += 2) {
+    sum += ((uint32_t) header[i] << 8) | header[i + 1];
+  }
+  while (sum >> 16) {
+    sum = (sum & 0xFFFF) + (sum >> 16);
+  }
+  return (uint16_t) ~sum;
+}
+
+// Refreshes the connection endpoints; a new local port means a new TCP stream
+static bool update_connection(int socket_fd) {
+  struct sockaddr_in local, remote;
+  socklen_t          local_len = sizeof(local), remote_len = sizeof(remote);
+  if (getsockname(socket_fd, (struct sockaddr*) &local, &local_len) != 0 || getpeername(socket_fd, (struct sockaddr*) &remote, &remote_len) != 0 ||
+      local.sin_family != AF_INET) {
+    return false;
+  }
+  if (local.sin_port != connection.local.sin_port || remote.sin_port != connection.remote.sin_port ||
+      local.sin_addr.s_addr != connection.local.sin_addr.s_addr) {
+    connection.local      = local;
+    connection.remote     = remote;
+    connection.client_seq = 1;
+    connection.server_seq = 1;
+  }
+  return true;
+}
+
+static void push_packet(bool from_device, const uint8_t* payload, int length, int64_t timestamp_us) {
+  uint32_t head = atomic_load_explicit(&ring_head, memory_order_relaxed);
+  uint32_t tail = atomic_load_explicit(&ring_tail, memory_order_acquire);
+  if (head - tail >= CAPTURE_RING_SIZE || length > CAPTURE_MAX_PACKET - CAPTURE_HEADER_LENGTH) {
+    METRICS_ADD(capture_dropped_packets, 1);
+    return;
+  }
+
+  const struct sockaddr_in* src = from_device ? &connection.remote : &connection.local;
+  const struct sockaddr_in* dst = from_device ? &connection.local : &connection.remote;
+  uint32_t*                 seq = from_device ? &connection.server_seq : &connection.client_seq;
+  uint32_t                  ack = from_device ? connection.client_seq : connection.server_seq;
+
+  capture_packet_t* packet = &ring[head % CAPTURE_RING_SIZE];
+  uint8_t*          ip     = packet->data;
+  uint8_t*          tcp    = ip + 20;
+  memset(ip, 0, CAPTURE_HEADER_LENGTH);
+
+  ip[0] = 0x45;  // IPv4, 20 byte header
+  put_u16(ip + 2, (uint16_t) (CAPTURE_HEADER_LENGTH + length));
+  put_u16(ip + 4, connection.ip_id++);
+  put_u16(ip + 6, 0x4000);  // Don't fragment
+  ip[8] = 64;
+  ip[9] = IPPROTO_TCP;
+  memcpy(ip + 12, &src->sin_addr.s_addr, 4);
+  memcpy(ip + 16, &dst->sin_addr.s_addr, 4);
+  put_u16(ip + 10, ip_checksum(ip, 20));
+
+  memcpy(tcp, &src->sin_port, 2);
+  memcpy(tcp + 2, &dst->sin_port, 2);
+  put_u32(tcp + 4, *seq);
+  put_u32(tcp + 8, ack);
+  tcp[12] = 5 << 4;  // 20 byte header
+  tcp[13] = 0x18;    // PSH, ACK
+  put_u16(tcp + 14, 65535);
+
+  memcpy(packet->data + CAPTURE_HEADER_LENGTH, payload, (size_t) length);
+  packet->length       = (uint16_t) (CAPTURE_HEADER_LENGTH + length);
+  packet->timestamp_us = timestamp_us;
+  *seq += (uint32_t) length;
+
+  atomic_store_explicit(&ring_head, head + 1, memory_order_release);
+}
+
+void wire_capture_record(int socket_fd, const uint8_t* request, int request_len, int64_t request_us, const uint8_t* response,
+                         int response_len, int64_t response_us) {
+  if (!writer_running || !update_connection(socket_fd)) {
+    return;
+  }
+  push_packet(false, request, request_len, request_us);
+  if (response && response_len > 0) {
+    push_packet(true, response, response_len, response_us);
+  }
+}
+
+// Shifts <file> to <file>.1, <file>.1 to <file>.2, ... dropping the oldest
+static void rotate_files(void) {
+  char from[1100], to[1100];
+  for (int k = capture_max_files - 1; k >= 1; k--) {
+    snprintf(from, sizeof(from), "%s.%d", capture_path, k);
+    snprintf(to, sizeof(to), "%s.%d", capture_path, k + 1);
+    rename(from, to);
+  }
+  snprintf(to, sizeof(to), "%s.1", capture_path);
+  rename(capture_path, to);
+}
+
+static int open_capture_file(void) {
+  rotate_files();  // Never overwrite an earlier capture
+  capture_file = fopen(capture_path, "wb");
+  if (!capture_file) {
+    log_message(LOG_LEVEL_ERROR, "Failed to open capture file '%s'.", capture_path);
+    return -1;
+  }
+
+  uint8_t header[24];
+  memset(header, 0, sizeof(header));
+  uint32_t magic = 0xA1B2C3D4, snaplen = 65535, linktype = PCAP_LINKTYPE_RAW;
+  uint16_t major = 2, minor = 4;
+  memcpy(header, &magic, 4);  // Written in host byte order, as readers expect
+  memcpy(header + 4, &major, 2);
+  memcpy(header + 6, &minor, 2);
+  memcpy(header + 16, &snaplen, 4);
+  memcpy(header + 20, &linktype, 4);
+  fwrite(header, 1, sizeof(header), capture_file);
+  file_bytes = sizeof(header);
+  log_message(LOG_LEVEL_INFO, "Capturing Modbus traffic to '%s'.", capture_path);
+  return 0;
+}
+
+static void close_capture_file(void) {
+  if (capture_file) {
+    fclose(capture_file);
+    capture_file = NULL;
+    log_message(LOG_LEVEL_INFO, "Modbus capture file '%s' closed.", capture_path);
+  }
+}
+
+// Writes all queued packets with one fwrite per batch
+static void drain_ring(void) {
+  uint32_t tail = atomic_load_explicit(&ring_tail, memory_order_relaxed);
+  uint32_t head = atomic_load_explicit(&ring_head, memory_order_acquire);
+  if (head == tail) {
+    if (!wire_capture_enabled()) {
+      close_capture_file();
+    }
+    return;
+  }
+  if (!capture_file && open_capture_file() != 0) {
+    atomic_store_explicit(&ring_tail, head, memory_order_release);  // Nowhere to write, drop them
+    return;
+  }
+
+  size_t used = 0;
+  while (tail != head) {
+    const capture_packet_t* packet = &ring[tail % CAPTURE_RING_SIZE];
+    if (used + 16 + packet->length > sizeof(batch)) {
+      fwrite(batch, 1, used, capture_file);
+      file_bytes += (long) used;
+      used = 0;
+    }
+    uint32_t record[4] = {(uint32_t) (packet->timestamp_us / 1000000), (uint32_t) (packet->timestamp_us % 1000000), packet->length,
+                          packet->length};
+    memcpy(batch + used, record, sizeof(record));
+    memcpy(batch + used + sizeof(record), packet->data, packet->length);
+    used += sizeof(record) + packet->length;
+    atomic_store_explicit(&ring_tail, ++tail, memory_order_release);
+  }
+  fwrite(batch, 1, used, capture_file);
+  file_bytes += (long) used;
+  fflush(capture_file);
+
+  if (file_bytes >= capture_max_bytes) {
+    close_capture_file();
+  }
+}
+
+static void* writer_main(void* arg) {
+  (void) arg;
+  struct timespec interval = {0, CAPTURE_FLUSH_MS * 1000000L};
+  while (!atomic_load(&writer_stop)) {
+    drain_ring();
+    nanosleep(&interval, NULL);
+  }
+  drain_ring();
+  close_capture_file();
+  return NULL;
+}
+
+int wire_capture_start(const modbus_opcua_config_t* config) {
+  if (!config->capture_file) {
+    if (config->capture_enabled) {
+      log_message(LOG_LEVEL_WARN, "Modbus capture enabled but no capture file configured.");
+    }
+    return 0;
+  }
+  snprintf(capture_path, sizeof(capture_path), "%s", config->capture_file);
+  capture_max_bytes = (long) (config->capture_max_file_mb > 0 ? config->capture_max_file_mb : 1) * 1024 * 1024;
+  capture_max_files = config->capture_max_files > 0 ? config->capture_max_files : 1;
+  atomic_store(&writer_stop, false);
+  if (pthread_create(&writer_thread, NULL, writer_main, NULL) != 0) {
+    log_message(LOG_LEVEL_ERROR, "Failed to start the capture writer thread.");
+    return -1;
+  }
+  writer_running = true;
+  memory_account_add(MEMORY_LOG_BUFFERS, (int64_t) (sizeof(ring) + sizeof(batch)));
+  wire_capture_set_enabled(config->capture_enabled);
+  log_message(LOG_LEVEL_INFO, "Modbus capture to '%s' available (currently %s, toggle with SIGUSR1).", config->capture_file,
+              config->capture_enabled ? "on" : "off");
+  return 0;
+}
+
+void wire_capture_stop(void) {
+  if (!writer_running) {
+    return;
+  }
+  wire_capture_set_enabled(false);
+  atomic_store(&writer_stop, true);
+  pthread_join(writer_thread, NULL);
+  writer_running = false;
+  memory_account_add(MEMORY_LOG_BUFFERS, -(int64_t) (sizeof(ring) + sizeof(batch)));
+}
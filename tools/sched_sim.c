@@ -0,0 +1,141 @@
+#include "sched_sim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config_parser.h"
+#include "logger.h"
+
+static void usage(const char* program) {
+  fprintf(stderr,
+          "Usage: %s [options] <path_to_config.yaml>\n"
+          "  -d <sec>    simulated time (default 3600)\n"
+          "  -l <us>     device response time per request (default 20000)\n"
+          "  -j <us>     additional uniform jitter (default 5000)\n"
+          "  -b <B/s>    link rate, 0 for unlimited (default 0)\n"
+          "  -R          Modbus RTU frame sizes (default Modbus TCP)\n"
+          "  -e <p>      probability that a request times out (default 0)\n"
+          "  -c <us>     OPC UA server and bookkeeping time per cycle (default 1000)\n"
+          "  -m <regs>   largest coalesced read of the device, 0 for no coalescing (default 125)\n"
+          "  -t <ratio>  SLA tolerance: a publish gap over poll interval * (1 + ratio) is a miss (default 0.5)\n"
+          "  -w <count>  mappings listed with the most SLA misses (default 10)\n"
+          "  -s <seed>   random seed (default 1)\n"
+          "  -o <path>   JSON report file\n",
+          program);
+}
+
+int main(int argc, char* argv[]) {
+  sched_sim_options_t options;
+  sched_sim_default_options(&options);
+  int         worst  = 10;
+  const char* output = NULL;
+  int         opt;
+  while ((opt = getopt(argc, argv, "d:l:j:b:Re:c:m:t:w:s:o:h")) != -1) {
+    switch (opt) {
+      case 'd': options.duration_sec = atof(optarg); break;
+      case 'l': options.response_us = atoi(optarg); break;
+      case 'j': options.jitter_us = atoi(optarg); break;
+      case 'b': options.bytes_per_sec = atoi(optarg); break;
+      case 'R': options.rtu_framing = true; break;
+      case 'e': options.timeout_probability = atof(optarg); break;
+      case 'c': options.cycle_overhead_us = atoi(optarg); break;
+      case 'm': options.max_regs_per_request = atoi(optarg); break;
+      case 't': options.sla_tolerance = atof(optarg); break;
+      case 'w': worst = atoi(optarg); break;
+      case 's': options.seed = (unsigned) strtoul(optarg, NULL, 10); break;
+      case 'o': output = optarg; break;
+      default: usage(argv[0]); return EXIT_FAILURE;
+    }
+  }
+  if (optind >= argc || options.duration_sec <= 0.0 || options.response_us < 0 || options.jitter_us < 0 || options.bytes_per_sec < 0 ||
+      options.cycle_overhead_us < 0 || options.max_regs_per_request < 0) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  // Keep the parser's and the read plan's INFO lines out of the report
+  logger_init(NULL, LOG_LEVEL_WARN);
+  modbus_opcua_config_t* config = load_config_from_yaml(argv[optind]);
+  if (!config) {
+    logger_close();
+    return EXIT_FAILURE;
+  }
+
+  struct timespec    wall_start, wall_end;
+  sched_sim_result_t result;
+  clock_gettime(CLOCK_MONOTONIC, &wall_start);
+  if (sched_sim_run(config, &options, &result) != 0) {
+    free_config(config);
+    logger_close();
+    return EXIT_FAILURE;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &wall_end);
+  double wall_sec = (double) (wall_end.tv_sec - wall_start.tv_sec) + (double) (wall_end.tv_nsec - wall_start.tv_nsec) / 1e9;
+
+  printf("Simulated %.0f s of polling %d mappings in %.2f s (seed %u)\n", result.simulated_sec, config->num_mappings, wall_sec, options.seed);
+  printf("  cycles            %llu\n", (unsigned long long) result.cycles);
+  printf("  block reads       %llu (%.1f/s, %llu registers), %llu timed out\n", (unsigned long long) result.block_reads,
+         result.block_reads / result.simulated_sec, (unsigned long long) result.registers_read, (unsigned long long) result.timeouts);
+  printf("  bus utilisation   %.1f%%\n", 100.0 * result.bus_utilisation);
+  printf("  read lateness     p50 %.1f ms, p99 %.1f ms, max %.1f ms\n", histogram_percentile(&result.read_lateness, 50.0) / 1000.0,
+         histogram_percentile(&result.read_lateness, 99.0) / 1000.0, histogram_max(&result.read_lateness) / 1000.0);
+  printf("  publish lateness  p50 %.1f ms, p99 %.1f ms, max %.1f ms\n", histogram_percentile(&result.publish_lateness, 50.0) / 1000.0,
+         histogram_percentile(&result.publish_lateness, 99.0) / 1000.0, histogram_max(&result.publish_lateness) / 1000.0);
+  printf("  SLA misses        %llu of %llu publishes (%.3f%%, tolerance %.0f%%)\n", (unsigned long long) result.sla_misses,
+         (unsigned long long) result.publishes, result.publishes ? 100.0 * result.sla_misses / result.publishes : 0.0,
+         100.0 * options.sla_tolerance);
+
+  // Mappings with the most misses; selection by repeated scans keeps the per-mapping order stable
+  bool* listed = calloc(result.num_mappings > 0 ? result.num_mappings : 1, sizeof(bool));
+  for (int w = 0; listed && w < worst; w++) {
+    int pick = -1;
+    for (int i = 0; i < result.num_mappings; i++) {
+      if (!listed[i] && result.mappings[i].sla_misses > 0 && (pick < 0 || result.mappings[i].sla_misses > result.mappings[pick].sla_misses)) {
+        pick = i;
+      }
+    }
+    if (pick < 0) {
+      break;
+    }
+    listed[pick] = true;
+    printf("  %-40s %6llu misses, poll %d ms, longest gap %lld ms\n", config->mappings[pick].name,
+           (unsigned long long) result.mappings[pick].sla_misses, config->mappings[pick].poll_interval_ms,
+           (long long) result.mappings[pick].max_gap_ms);
+  }
+  free(listed);
+
+  if (output) {
+    FILE* out = fopen(output, "w");
+    if (!out) {
+      fprintf(stderr, "sched_sim: cannot write %s\n", output);
+    } else {
+      fprintf(out, "{\n  \"benchmark\": \"sched_sim\",\n");
+      fprintf(out,
+              "  \"parameters\": {\"mappings\": %d, \"duration_sec\": %.0f, \"response_us\": %d, \"jitter_us\": %d, \"bytes_per_sec\": %d, "
+              "\"rtu_framing\": %s, \"timeout_probability\": %g, \"cycle_overhead_us\": %d, \"max_regs_per_request\": %d, "
+              "\"sla_tolerance\": %g, \"seed\": %u},\n",
+              config->num_mappings, options.duration_sec, options.response_us, options.jitter_us, options.bytes_per_sec,
+              options.rtu_framing ? "true" : "false", options.timeout_probability, options.cycle_overhead_us, options.max_regs_per_request,
+              options.sla_tolerance, options.seed);
+      fprintf(out, "  \"cycles\": %llu,\n  \"block_reads\": %llu,\n  \"timeouts\": %llu,\n  \"bus_utilisation\": %.4f,\n",
+              (unsigned long long) result.cycles, (unsigned long long) result.block_reads, (unsigned long long) result.timeouts,
+              result.bus_utilisation);
+      fprintf(out, "  \"read_lateness_ms\": {\"p50\": %.3f, \"p99\": %.3f, \"max\": %.3f},\n",
+              histogram_percentile(&result.read_lateness, 50.0) / 1000.0, histogram_percentile(&result.read_lateness, 99.0) / 1000.0,
+              histogram_max(&result.read_lateness) / 1000.0);
+      fprintf(out, "  \"publish_lateness_ms\": {\"p50\": %.3f, \"p99\": %.3f, \"max\": %.3f},\n",
+              histogram_percentile(&result.publish_lateness, 50.0) / 1000.0, histogram_percentile(&result.publish_lateness, 99.0) / 1000.0,
+              histogram_max(&result.publish_lateness) / 1000.0);
+      fprintf(out, "  \"publishes\": %llu,\n  \"sla_misses\": %llu\n}\n", (unsigned long long) result.publishes,
+              (unsigned long long) result.sla_misses);
+      fclose(out);
+    }
+  }
+
+  sched_sim_free_result(&result);
+  free_config(config);
+  logger_close();
+  return EXIT_SUCCESS;
+}
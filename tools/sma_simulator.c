@@ -0,0 +1,96 @@
+#include "sma_simulator.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "config_parser.h"
+#include "logger.h"
+
+static void usage(const char* program) {
+  fprintf(stderr,
+          "Usage: %s [options] <path_to_config.yaml>\n"
+          "  -n <count>    number of inverters (default 1)\n"
+          "  -p <port>     port of the first inverter, the others follow (default 1502)\n"
+          "  -b <address>  bind address (default 127.0.0.1)\n"
+          "  -u <id>       unit ID answered, 0 for any (default: modbus.slave_id of the config)\n"
+          "  -l <us>       response latency in microseconds\n"
+          "  -j <us>       additional uniform jitter in microseconds\n"
+          "  -c <count>    connections per inverter (default 4)\n"
+          "  -e <p>        probability of an injected exception per read\n"
+          "  -x <code>     code of injected exceptions (default 6, slave device busy)\n"
+          "  -N <p>        probability per update that a value reads as NaN\n"
+          "  -i <ms>       update interval of the values (default 1000)\n"
+          "  -d <sec>      length of a simulated day (default 600)\n"
+          "  -s <seed>     random seed\n",
+          program);
+}
+
+int main(int argc, char* argv[]) {
+  sma_sim_options_t options;
+  sma_sim_default_options(&options);
+  int slave_id = -1;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:p:b:u:l:j:c:e:x:N:i:d:s:h")) != -1) {
+    switch (opt) {
+      case 'n': options.num_inverters = atoi(optarg); break;
+      case 'p': options.base_port = atoi(optarg); break;
+      case 'b': options.bind_address = optarg; break;
+      case 'u': slave_id = atoi(optarg); break;
+      case 'l': options.latency_us = atoi(optarg); break;
+      case 'j': options.jitter_us = atoi(optarg); break;
+      case 'c': options.max_connections = atoi(optarg); break;
+      case 'e': options.exception_probability = atof(optarg); break;
+      case 'x': options.exception_code = (int) strtol(optarg, NULL, 0); break;
+      case 'N': options.nan_probability = atof(optarg); break;
+      case 'i': options.update_interval_ms = atoi(optarg); break;
+      case 'd': options.day_length_sec = atof(optarg); break;
+      case 's': options.seed = (unsigned) strtoul(optarg, NULL, 0); break;
+      default: usage(argv[0]); return EXIT_FAILURE;
+    }
+  }
+  if (optind != argc - 1) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  modbus_opcua_config_t* config = load_config_from_yaml(argv[optind]);
+  if (!config) {
+    return EXIT_FAILURE;
+  }
+  // Log to stdout only; the gateway's log file belongs to the gateway
+  if (logger_init(NULL, config->log_level) != 0) {
+    free_config(config);
+    return EXIT_FAILURE;
+  }
+  options.slave_id = slave_id >= 0 ? slave_id : config->modbus_slave_id;
+
+  // Blocked before the server thread starts, so only the sigwait() below receives them
+  sigset_t stop_signals;
+  sigemptyset(&stop_signals);
+  sigaddset(&stop_signals, SIGINT);
+  sigaddset(&stop_signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &stop_signals, NULL);
+
+  sma_sim_t* sim = sma_sim_start(config, &options);
+  if (!sim) {
+    logger_close();
+    free_config(config);
+    return EXIT_FAILURE;
+  }
+
+  int sig = 0;
+  sigwait(&stop_signals, &sig);
+
+  sma_sim_stats_t stats;
+  sma_sim_get_stats(sim, &stats);
+  log_message(LOG_LEVEL_INFO, "Simulator: %llu requests, %llu exceptions, %llu refused connections, %llu value changes.",
+              (unsigned long long) stats.requests, (unsigned long long) stats.exceptions, (unsigned long long) stats.refused_connections,
+              (unsigned long long) stats.value_changes);
+  sma_sim_stop(sim);
+  logger_close();
+  free_config(config);
+  return EXIT_SUCCESS;
+}